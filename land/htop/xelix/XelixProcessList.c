@@ -12,6 +12,7 @@ in the source distribution for its full text.
 #include <stdlib.h>
 #include <string.h>
 #include <pwd.h>
+#include <sys/time.h>
 
 ProcessList* ProcessList_new(UsersTable* usersTable, Hashtable* pidWhiteList, uid_t userId) {
    ProcessList* this = xCalloc(1, sizeof(ProcessList));
@@ -38,6 +39,17 @@ void ProcessList_goThroughEntries(ProcessList* super, bool pauseProcessUpdate) {
     super->totalTasks = 0;
     super->runningTasks = 0;
 
+    // Time since the last scan in hundredths of a second, for CPU percentages
+    static struct timeval lastScan;
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    long long elapsed = 0;
+    if(lastScan.tv_sec) {
+        elapsed = (now.tv_sec - lastScan.tv_sec) * 100
+            + (now.tv_usec - lastScan.tv_usec) / 10000;
+    }
+    lastScan = now;
+
     // Drop first line
     char* data = malloc(1024);
     fgets(data, 1024, fp);
@@ -57,8 +69,15 @@ void ProcessList_goThroughEntries(ProcessList* super, bool pauseProcessUpdate) {
         int mem;
         char _tty[30];
         char* tty = _tty;
-
-        if(fscanf(fp, "%d %d %d %d %c \"%500[^\"]\" %d %s\n", &pid, &uid, &gid, &ppid, &cstate, name, &mem, tty) != 8) {
+        int nice;
+        unsigned int runtime;
+        unsigned int utime;
+        unsigned int stime;
+        unsigned int faults;
+
+        if(fscanf(fp, "%d %d %d %d %c \"%500[^\"]\" %d %s %d %u %u %u %*u %*u %u %*llu %*llu\n",
+            &pid, &uid, &gid, &ppid, &cstate, name, &mem, tty, &nice, &runtime, &utime,
+            &stime, &faults) != 13) {
             continue;
         }
 
@@ -73,7 +92,16 @@ void ProcessList_goThroughEntries(ProcessList* super, bool pauseProcessUpdate) {
             proc->state = 'S';
         }
 
-        proc->time = proc->time + 10;
+        // htop expects hundredths of a second, utime and stime are in ms
+        unsigned long long time = (utime + stime) / 10;
+        if(preExisting && elapsed > 0 && time >= proc->time) {
+            proc->percent_cpu = (float)(time - proc->time) * 100 / elapsed;
+        } else {
+            proc->percent_cpu = 0.0;
+        }
+
+        proc->time = time;
+        proc->minflt = faults;
         proc->pid  = pid;
         proc->ppid = ppid;
         proc->tgid = pid;
@@ -90,7 +118,6 @@ void ProcessList_goThroughEntries(ProcessList* super, bool pauseProcessUpdate) {
         proc->flags = 0;
         proc->processor = 0;
 
-        proc->percent_cpu = 42.23;
         proc->percent_mem = 20.0;
 
         struct passwd* pwd = getpwuid(uid);
@@ -101,8 +128,8 @@ void ProcessList_goThroughEntries(ProcessList* super, bool pauseProcessUpdate) {
             itoa(uid, proc->user, 100);
         }
 
-        proc->priority = 1;
-        proc->nice = 1;
+        proc->priority = 20 + nice;
+        proc->nice = nice;
         proc->nlwp = 1;
         strncpy(proc->starttime_show, "Jun 01 ", sizeof(proc->starttime_show));
         proc->starttime_ctime = 1433116800; // Jun 01, 2015
@@ -33,11 +33,24 @@ extern void __libc_fini_array();
 struct _xelix_execdata* _xelix_execdata;
 const char* _progname;
 FILE* _xelix_serial = NULL;
+int _xelix_threaded = 0;
+
+/* newlib is built with __DYNAMIC_REENT__ so that every thread gets its own
+ * errno and reentrancy data. This is defined here instead of pthread.c so it
+ * always takes precedence over the default version in libc/reent.
+ */
+struct _reent* __getreent(void) {
+	if(!_xelix_threaded) {
+		return _impure_ptr;
+	}
+	return _xelix_tcb()->reent;
+}
 
 void __attribute__((fastcall, noreturn)) _start(void) {
+	// Needs to be set first since syscalls check it
+	_xelix_execdata = (struct _xelix_execdata*)0x5000;
 	__libc_init_array();
 
-	_xelix_execdata = (struct _xelix_execdata*)0x5000;
 	environ = _xelix_execdata->env;
 
 	atexit(__libc_fini_array);
@@ -0,0 +1,571 @@
+/* Copyright © 2023 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* POSIX threads. Threads are created using the clone syscall and share the
+ * address space, file descriptors and signal handlers of the process. All
+ * waiting is done using the futex syscall, so uncontended locks never enter
+ * the kernel.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <reent.h>
+#include <sys/lock.h>
+#include <sys/xelix.h>
+
+// Keep in sync with kernel (tasks/futex.h)
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
+
+#define DEFAULT_STACK_SIZE 0x40000
+#define MIN_STACK_SIZE 0x1000
+#define KEYS_MAX 64
+#define DESTRUCTOR_ITERATIONS 4
+
+struct __pthread {
+	// Has to match struct _xelix_tcb
+	struct __pthread* self;
+	struct _reent* reent;
+	pid_t tid;
+
+	// Cleared and woken up by the kernel once the thread has exited
+	volatile int alive;
+	bool detached;
+	bool exited;
+	void* (*start)(void*);
+	void* arg;
+	void* result;
+	void* specific[KEYS_MAX];
+	struct __pthread* next_dead;
+	struct _reent reent_data;
+
+	// The thread stack follows
+};
+
+// Defined in libc/stdio/findfp.c
+extern void __sinit(struct _reent* s);
+
+/* The main thread only gets a TCB once the first thread is created. Until then
+ * %gs isn't set up, so _xelix_threaded needs to be checked first.
+ */
+static struct __pthread main_thread;
+static volatile int num_threads = 0;
+
+// Detached threads that have exited, but whose stack might still be in use
+static struct __pthread* dead_threads = NULL;
+static struct __xelix_lock threads_lock = __XELIX_LOCK_INITIALIZER;
+
+static void (*key_destructors[KEYS_MAX])(void*);
+static bool key_used[KEYS_MAX];
+
+/* Returns the tid in the parent and jumps to the function on top of the new
+ * stack in the thread. Can't be a C function since the new thread starts out
+ * without a valid stack frame.
+ */
+int __xelix_clone(void* stack, void* tls, volatile int* clear_tid);
+asm(
+	".global __xelix_clone\n"
+	".hidden __xelix_clone\n"
+	".type __xelix_clone, @function\n"
+	"__xelix_clone:\n"
+	"	push %ebx\n"
+	"	mov 8(%esp), %ebx\n"
+	"	mov 12(%esp), %ecx\n"
+	"	mov 16(%esp), %edx\n"
+	"	mov $61, %eax\n"
+	"	int $0x80\n"
+	"	test %eax, %eax\n"
+	"	jz 2f\n"
+	"	cmp $-1, %eax\n"
+	"	jne 1f\n"
+	"	push %ebx\n"
+	"	call __errno\n"
+	"	pop %ecx\n"
+	"	mov %ecx, (%eax)\n"
+	"	mov $-1, %eax\n"
+	"1:\n"
+	"	pop %ebx\n"
+	"	ret\n"
+	"2:\n"
+	"	pop %eax\n"
+	"	call *%eax\n"
+);
+
+static inline struct __pthread* current(void) {
+	if(!_xelix_threaded) {
+		return &main_thread;
+	}
+	return (struct __pthread*)_xelix_tcb();
+}
+
+// Used by the newlib locks, so this must not touch errno
+static inline int futex(volatile int* addr, int op, int val) {
+	int err;
+	return __syscall(&err, 62, (uint32_t)addr, op, val);
+}
+
+static void lock_wait(volatile int* state) {
+	int c = __sync_val_compare_and_swap(state, 0, 1);
+	if(!c) {
+		return;
+	}
+
+	// Mark as contended so the owner knows it has to wake someone up
+	if(c != 2) {
+		c = __sync_lock_test_and_set(state, 2);
+	}
+
+	while(c) {
+		futex(state, FUTEX_WAIT, 2);
+		c = __sync_lock_test_and_set(state, 2);
+	}
+}
+
+static void lock_wake(volatile int* state) {
+	if(__sync_fetch_and_sub(state, 1) != 1) {
+		*state = 0;
+		futex(state, FUTEX_WAKE, 1);
+	}
+}
+
+void __xelix_lock_init(struct __xelix_lock* lock) {
+	lock->state = 0;
+	lock->owner = NULL;
+	lock->count = 0;
+}
+
+void __xelix_lock_acquire(struct __xelix_lock* lock, int recursive) {
+	struct __pthread* self = current();
+	if(recursive && lock->owner == self) {
+		lock->count++;
+		return;
+	}
+
+	lock_wait(&lock->state);
+	lock->owner = self;
+	lock->count = 1;
+}
+
+int __xelix_lock_try_acquire(struct __xelix_lock* lock, int recursive) {
+	struct __pthread* self = current();
+	if(recursive && lock->owner == self) {
+		lock->count++;
+		return 0;
+	}
+
+	if(__sync_val_compare_and_swap(&lock->state, 0, 1)) {
+		return -1;
+	}
+
+	lock->owner = self;
+	lock->count = 1;
+	return 0;
+}
+
+void __xelix_lock_release(struct __xelix_lock* lock) {
+	if(--lock->count) {
+		return;
+	}
+
+	lock->owner = NULL;
+	lock_wake(&lock->state);
+}
+
+static void free_thread(struct __pthread* thread) {
+	// stdio streams are shared with the main thread, see pthread_create
+	thread->reent_data.__sdidinit = 0;
+	_reclaim_reent(&thread->reent_data);
+	free(thread);
+}
+
+static void reap_dead_threads(void) {
+	__xelix_lock_acquire(&threads_lock, 0);
+	struct __pthread** prev = &dead_threads;
+	while(*prev) {
+		struct __pthread* thread = *prev;
+		if(thread->alive) {
+			prev = &thread->next_dead;
+			continue;
+		}
+
+		*prev = thread->next_dead;
+		free_thread(thread);
+	}
+	__xelix_lock_release(&threads_lock);
+}
+
+static void __attribute__((noreturn, used)) thread_start(struct __pthread* thread) {
+	pthread_exit(thread->start(thread->arg));
+}
+
+int pthread_create(pthread_t* restrict tp, const pthread_attr_t* restrict attr,
+	void* (*start)(void*), void* restrict arg) {
+
+	reap_dead_threads();
+	size_t stack_size = attr ? attr->__stacksize : DEFAULT_STACK_SIZE;
+	struct __pthread* thread = malloc(sizeof(struct __pthread) + stack_size);
+	if(!thread) {
+		return EAGAIN;
+	}
+
+	memset(thread, 0, sizeof(struct __pthread));
+	thread->self = thread;
+	thread->alive = 1;
+	thread->detached = attr && attr->__detachstate == PTHREAD_CREATE_DETACHED;
+	thread->start = start;
+	thread->arg = arg;
+
+	// Threads get their own errno etc., but share the stdio streams
+	__sinit(_GLOBAL_REENT);
+	_REENT_INIT_PTR(&thread->reent_data);
+	thread->reent_data._stdin = _GLOBAL_REENT->_stdin;
+	thread->reent_data._stdout = _GLOBAL_REENT->_stdout;
+	thread->reent_data._stderr = _GLOBAL_REENT->_stderr;
+	thread->reent_data.__sdidinit = 1;
+	thread->reent = &thread->reent_data;
+
+	if(!_xelix_threaded) {
+		main_thread.self = &main_thread;
+		main_thread.reent = _impure_ptr;
+		main_thread.tid = _xelix_execdata->pid;
+		main_thread.alive = 1;
+
+		if((int)syscall(63, &main_thread, 0, 0) < 0) {
+			free(thread);
+			return EAGAIN;
+		}
+		_xelix_threaded = 1;
+	}
+
+	// Argument and entry point for the new thread, popped in __xelix_clone
+	uintptr_t* stack = (uintptr_t*)((((uintptr_t)(thread + 1) + stack_size) & ~0xf) - 16);
+	stack[0] = (uintptr_t)thread;
+	*--stack = (uintptr_t)thread_start;
+
+	__sync_fetch_and_add(&num_threads, 1);
+	int tid = __xelix_clone(stack, thread, &thread->alive);
+	if(tid < 0) {
+		__sync_fetch_and_sub(&num_threads, 1);
+		free(thread);
+		return EAGAIN;
+	}
+
+	thread->tid = tid;
+	*tp = thread;
+	return 0;
+}
+
+void pthread_exit(void* result) {
+	struct __pthread* self = current();
+
+	for(int i = 0; i < DESTRUCTOR_ITERATIONS; i++) {
+		bool called = false;
+		for(int key = 0; key < KEYS_MAX; key++) {
+			void* value = self->specific[key];
+			if(value && key_destructors[key]) {
+				self->specific[key] = NULL;
+				key_destructors[key](value);
+				called = true;
+			}
+		}
+
+		if(!called) {
+			break;
+		}
+	}
+
+	/* The process has to keep running until all other threads have exited.
+	 * Just wait for that here, the main thread TCB is never joined.
+	 */
+	if(self == &main_thread) {
+		int num;
+		while((num = num_threads)) {
+			futex(&num_threads, FUTEX_WAIT, num);
+		}
+		exit(0);
+	}
+
+	self->result = result;
+	__xelix_lock_acquire(&threads_lock, 0);
+	self->exited = true;
+	if(self->detached) {
+		self->next_dead = dead_threads;
+		dead_threads = self;
+	}
+	__xelix_lock_release(&threads_lock);
+
+	if(!__sync_sub_and_fetch(&num_threads, 1)) {
+		futex(&num_threads, FUTEX_WAKE, 1);
+	}
+
+	syscall(64, 0, 0, 0);
+	__builtin_unreachable();
+}
+
+int pthread_join(pthread_t thread, void** result) {
+	if(thread == current()) {
+		return EDEADLK;
+	}
+	if(thread->detached || thread == &main_thread) {
+		return EINVAL;
+	}
+
+	int alive;
+	while((alive = thread->alive)) {
+		futex(&thread->alive, FUTEX_WAIT, alive);
+	}
+
+	if(result) {
+		*result = thread->result;
+	}
+	free_thread(thread);
+	return 0;
+}
+
+int pthread_detach(pthread_t thread) {
+	if(thread->detached || thread == &main_thread) {
+		return EINVAL;
+	}
+
+	__xelix_lock_acquire(&threads_lock, 0);
+	thread->detached = true;
+	if(thread->exited) {
+		thread->next_dead = dead_threads;
+		dead_threads = thread;
+	}
+	__xelix_lock_release(&threads_lock);
+	return 0;
+}
+
+pthread_t pthread_self(void) {
+	return current();
+}
+
+int pthread_equal(pthread_t t1, pthread_t t2) {
+	return t1 == t2;
+}
+
+int pthread_attr_init(pthread_attr_t* attr) {
+	attr->__detachstate = PTHREAD_CREATE_JOINABLE;
+	attr->__stacksize = DEFAULT_STACK_SIZE;
+	return 0;
+}
+
+int pthread_attr_destroy(pthread_attr_t* attr) {
+	return 0;
+}
+
+int pthread_attr_getdetachstate(const pthread_attr_t* attr, int* state) {
+	*state = attr->__detachstate;
+	return 0;
+}
+
+int pthread_attr_setdetachstate(pthread_attr_t* attr, int state) {
+	if(state != PTHREAD_CREATE_JOINABLE && state != PTHREAD_CREATE_DETACHED) {
+		return EINVAL;
+	}
+
+	attr->__detachstate = state;
+	return 0;
+}
+
+int pthread_attr_getstacksize(const pthread_attr_t* restrict attr, size_t* restrict size) {
+	*size = attr->__stacksize;
+	return 0;
+}
+
+int pthread_attr_setstacksize(pthread_attr_t* attr, size_t size) {
+	if(size < MIN_STACK_SIZE) {
+		return EINVAL;
+	}
+
+	attr->__stacksize = size;
+	return 0;
+}
+
+int pthread_mutexattr_init(pthread_mutexattr_t* attr) {
+	attr->__type = PTHREAD_MUTEX_DEFAULT;
+	return 0;
+}
+
+int pthread_mutexattr_destroy(pthread_mutexattr_t* attr) {
+	return 0;
+}
+
+int pthread_mutexattr_gettype(const pthread_mutexattr_t* attr, int* type) {
+	*type = attr->__type;
+	return 0;
+}
+
+int pthread_mutexattr_settype(pthread_mutexattr_t* attr, int type) {
+	if(type != PTHREAD_MUTEX_NORMAL && type != PTHREAD_MUTEX_RECURSIVE
+		&& type != PTHREAD_MUTEX_ERRORCHECK) {
+		return EINVAL;
+	}
+
+	attr->__type = type;
+	return 0;
+}
+
+int pthread_mutex_init(pthread_mutex_t* mutex, const pthread_mutexattr_t* attr) {
+	__xelix_lock_init(&mutex->__lock);
+	mutex->__type = attr ? attr->__type : PTHREAD_MUTEX_DEFAULT;
+	return 0;
+}
+
+int pthread_mutex_destroy(pthread_mutex_t* mutex) {
+	return mutex->__lock.state ? EBUSY : 0;
+}
+
+int pthread_mutex_lock(pthread_mutex_t* mutex) {
+	if(mutex->__type == PTHREAD_MUTEX_ERRORCHECK && mutex->__lock.owner == current()) {
+		return EDEADLK;
+	}
+
+	__xelix_lock_acquire(&mutex->__lock, mutex->__type == PTHREAD_MUTEX_RECURSIVE);
+	return 0;
+}
+
+int pthread_mutex_trylock(pthread_mutex_t* mutex) {
+	if(__xelix_lock_try_acquire(&mutex->__lock, mutex->__type == PTHREAD_MUTEX_RECURSIVE)) {
+		return EBUSY;
+	}
+	return 0;
+}
+
+int pthread_mutex_unlock(pthread_mutex_t* mutex) {
+	if(mutex->__type != PTHREAD_MUTEX_NORMAL && mutex->__lock.owner != current()) {
+		return EPERM;
+	}
+
+	__xelix_lock_release(&mutex->__lock);
+	return 0;
+}
+
+int pthread_condattr_init(pthread_condattr_t* attr) {
+	return 0;
+}
+
+int pthread_condattr_destroy(pthread_condattr_t* attr) {
+	return 0;
+}
+
+int pthread_cond_init(pthread_cond_t* restrict cond, const pthread_condattr_t* restrict attr) {
+	cond->__seq = 0;
+	return 0;
+}
+
+int pthread_cond_destroy(pthread_cond_t* cond) {
+	return 0;
+}
+
+int pthread_cond_wait(pthread_cond_t* restrict cond, pthread_mutex_t* restrict mutex) {
+	int seq = cond->__seq;
+
+	// Recursive mutexes are released completely while waiting
+	int count = mutex->__lock.count;
+	mutex->__lock.count = 1;
+	__xelix_lock_release(&mutex->__lock);
+
+	/* If the sequence number has changed since the check above, the futex
+	 * syscall returns right away, so a wakeup can't get lost.
+	 */
+	futex(&cond->__seq, FUTEX_WAIT, seq);
+
+	__xelix_lock_acquire(&mutex->__lock, 0);
+	mutex->__lock.count = count;
+	return 0;
+}
+
+int pthread_cond_signal(pthread_cond_t* cond) {
+	__sync_fetch_and_add(&cond->__seq, 1);
+	futex(&cond->__seq, FUTEX_WAKE, 1);
+	return 0;
+}
+
+int pthread_cond_broadcast(pthread_cond_t* cond) {
+	__sync_fetch_and_add(&cond->__seq, 1);
+	futex(&cond->__seq, FUTEX_WAKE, INT_MAX);
+	return 0;
+}
+
+int pthread_once(pthread_once_t* once, void (*fn)(void)) {
+	if(once->__state == 2) {
+		return 0;
+	}
+
+	if(!__sync_val_compare_and_swap(&once->__state, 0, 1)) {
+		fn();
+		__sync_synchronize();
+		once->__state = 2;
+		futex(&once->__state, FUTEX_WAKE, INT_MAX);
+		return 0;
+	}
+
+	while(once->__state == 1) {
+		futex(&once->__state, FUTEX_WAIT, 1);
+	}
+	return 0;
+}
+
+int pthread_key_create(pthread_key_t* key, void (*destructor)(void*)) {
+	__xelix_lock_acquire(&threads_lock, 0);
+	for(int i = 0; i < KEYS_MAX; i++) {
+		if(!key_used[i]) {
+			key_used[i] = true;
+			key_destructors[i] = destructor;
+			__xelix_lock_release(&threads_lock);
+
+			*key = i;
+			return 0;
+		}
+	}
+
+	__xelix_lock_release(&threads_lock);
+	return EAGAIN;
+}
+
+int pthread_key_delete(pthread_key_t key) {
+	if(key >= KEYS_MAX || !key_used[key]) {
+		return EINVAL;
+	}
+
+	key_destructors[key] = NULL;
+	key_used[key] = false;
+	return 0;
+}
+
+void* pthread_getspecific(pthread_key_t key) {
+	if(key >= KEYS_MAX) {
+		return NULL;
+	}
+	return current()->specific[key];
+}
+
+int pthread_setspecific(pthread_key_t key, const void* value) {
+	if(key >= KEYS_MAX || !key_used[key]) {
+		return EINVAL;
+	}
+
+	current()->specific[key] = (void*)value;
+	return 0;
+}
@@ -0,0 +1,282 @@
+/* Copyright © 2023 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* posix_spawn using the posix_spawn syscall. The generic newlib version (which
+ * uses vfork) is disabled using _NO_POSIX_SPAWN in configure.host.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <spawn.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/xelix.h>
+
+#define ACTION_OPEN 1
+#define ACTION_CLOSE 2
+#define ACTION_DUP2 3
+
+// Keep in sync with kernel (tasks/task.h)
+struct spawn_action {
+	int type;
+	int fd;
+	int newfd;
+	int flags;
+	char path[PATH_MAX];
+};
+
+struct spawn_ctx {
+	char* const* argv;
+	char* const* env;
+	struct spawn_action* actions;
+	uint32_t num_actions;
+	uint32_t flags;
+	uint32_t sigmask;
+	int sched_policy;
+	int sched_priority;
+};
+
+struct __posix_spawnattr {
+	short flags;
+	pid_t pgroup;
+	struct sched_param sp;
+	int policy;
+	sigset_t sigdefault;
+	sigset_t sigmask;
+};
+
+struct __posix_spawn_file_actions {
+	struct spawn_action* actions;
+	uint32_t num;
+};
+
+int posix_spawn(pid_t* pid, const char* path, const posix_spawn_file_actions_t* fa,
+	const posix_spawnattr_t* attrp, char* const argv[], char* const envp[]) {
+
+	struct spawn_ctx ctx = {
+		.argv = argv,
+		.env = envp,
+	};
+
+	if(fa && *fa) {
+		ctx.actions = (*fa)->actions;
+		ctx.num_actions = (*fa)->num;
+	}
+
+	if(attrp && *attrp) {
+		ctx.flags = (*attrp)->flags;
+		ctx.sigmask = (*attrp)->sigmask;
+		ctx.sched_policy = (*attrp)->policy;
+		ctx.sched_priority = (*attrp)->sp.sched_priority;
+	}
+
+	// posix_spawn returns the error number instead of setting errno
+	int saved_errno = errno;
+	int r = syscall(60, path, &ctx, 0);
+	if(r < 0) {
+		r = errno;
+		errno = saved_errno;
+		return r;
+	}
+
+	if(pid) {
+		*pid = r;
+	}
+	return 0;
+}
+
+int posix_spawnp(pid_t* pid, const char* file, const posix_spawn_file_actions_t* fa,
+	const posix_spawnattr_t* attrp, char* const argv[], char* const envp[]) {
+
+	if(strchr(file, '/')) {
+		return posix_spawn(pid, file, fa, attrp, argv, envp);
+	}
+
+	const char* search = getenv("PATH");
+	if(!search) {
+		search = "/usr/bin:/bin";
+	}
+
+	int r = ENOENT;
+	while(*search) {
+		const char* end = strchr(search, ':');
+		if(!end) {
+			end = search + strlen(search);
+		}
+		size_t len = end - search;
+
+		char path[PATH_MAX];
+		if(len + strlen(file) + 2 <= PATH_MAX) {
+			memcpy(path, search, len);
+			path[len] = '/';
+			strcpy(path + len + 1, file);
+
+			r = posix_spawn(pid, path, fa, attrp, argv, envp);
+			if(r != ENOENT && r != EACCES) {
+				return r;
+			}
+		}
+
+		search = *end ? end + 1 : end;
+	}
+	return r;
+}
+
+int posix_spawn_file_actions_init(posix_spawn_file_actions_t* fa) {
+	*fa = calloc(1, sizeof(struct __posix_spawn_file_actions));
+	return *fa ? 0 : ENOMEM;
+}
+
+int posix_spawn_file_actions_destroy(posix_spawn_file_actions_t* fa) {
+	free((*fa)->actions);
+	free(*fa);
+	return 0;
+}
+
+static struct spawn_action* add_action(posix_spawn_file_actions_t* fa, int type, int fd) {
+	struct __posix_spawn_file_actions* f = *fa;
+	struct spawn_action* actions = realloc(f->actions,
+		sizeof(struct spawn_action) * (f->num + 1));
+	if(!actions) {
+		return NULL;
+	}
+
+	f->actions = actions;
+	struct spawn_action* action = &actions[f->num++];
+	memset(action, 0, sizeof(struct spawn_action));
+	action->type = type;
+	action->fd = fd;
+	return action;
+}
+
+int posix_spawn_file_actions_addopen(posix_spawn_file_actions_t* restrict fa,
+	int fd, const char* restrict path, int oflag, mode_t mode) {
+
+	if(fd < 0) {
+		return EBADF;
+	}
+	if(strlen(path) >= PATH_MAX) {
+		return ENAMETOOLONG;
+	}
+
+	struct spawn_action* action = add_action(fa, ACTION_OPEN, fd);
+	if(!action) {
+		return ENOMEM;
+	}
+
+	action->flags = oflag;
+	strcpy(action->path, path);
+	return 0;
+}
+
+int posix_spawn_file_actions_adddup2(posix_spawn_file_actions_t* fa, int fd, int newfd) {
+	if(fd < 0 || newfd < 0) {
+		return EBADF;
+	}
+
+	struct spawn_action* action = add_action(fa, ACTION_DUP2, fd);
+	if(!action) {
+		return ENOMEM;
+	}
+
+	action->newfd = newfd;
+	return 0;
+}
+
+int posix_spawn_file_actions_addclose(posix_spawn_file_actions_t* fa, int fd) {
+	if(fd < 0) {
+		return EBADF;
+	}
+	return add_action(fa, ACTION_CLOSE, fd) ? 0 : ENOMEM;
+}
+
+int posix_spawnattr_init(posix_spawnattr_t* attr) {
+	*attr = calloc(1, sizeof(struct __posix_spawnattr));
+	return *attr ? 0 : ENOMEM;
+}
+
+int posix_spawnattr_destroy(posix_spawnattr_t* attr) {
+	free(*attr);
+	return 0;
+}
+
+int posix_spawnattr_getflags(const posix_spawnattr_t* restrict attr, short* restrict flags) {
+	*flags = (*attr)->flags;
+	return 0;
+}
+
+int posix_spawnattr_setflags(posix_spawnattr_t* attr, short flags) {
+	(*attr)->flags = flags;
+	return 0;
+}
+
+int posix_spawnattr_getpgroup(const posix_spawnattr_t* restrict attr, pid_t* restrict pgroup) {
+	*pgroup = (*attr)->pgroup;
+	return 0;
+}
+
+int posix_spawnattr_setpgroup(posix_spawnattr_t* attr, pid_t pgroup) {
+	(*attr)->pgroup = pgroup;
+	return 0;
+}
+
+int posix_spawnattr_getschedparam(const posix_spawnattr_t* restrict attr,
+	struct sched_param* restrict param) {
+
+	*param = (*attr)->sp;
+	return 0;
+}
+
+int posix_spawnattr_setschedparam(posix_spawnattr_t* restrict attr,
+	const struct sched_param* restrict param) {
+
+	(*attr)->sp = *param;
+	return 0;
+}
+
+int posix_spawnattr_getschedpolicy(const posix_spawnattr_t* restrict attr, int* restrict policy) {
+	*policy = (*attr)->policy;
+	return 0;
+}
+
+int posix_spawnattr_setschedpolicy(posix_spawnattr_t* attr, int policy) {
+	(*attr)->policy = policy;
+	return 0;
+}
+
+int posix_spawnattr_getsigdefault(const posix_spawnattr_t* restrict attr, sigset_t* restrict sigdefault) {
+	*sigdefault = (*attr)->sigdefault;
+	return 0;
+}
+
+int posix_spawnattr_setsigdefault(posix_spawnattr_t* restrict attr, const sigset_t* restrict sigdefault) {
+	(*attr)->sigdefault = *sigdefault;
+	return 0;
+}
+
+int posix_spawnattr_getsigmask(const posix_spawnattr_t* restrict attr, sigset_t* restrict sigmask) {
+	*sigmask = (*attr)->sigmask;
+	return 0;
+}
+
+int posix_spawnattr_setsigmask(posix_spawnattr_t* restrict attr, const sigset_t* restrict sigmask) {
+	(*attr)->sigmask = *sigmask;
+	return 0;
+}
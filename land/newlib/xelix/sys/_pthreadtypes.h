@@ -0,0 +1,82 @@
+/* Copyright © 2023 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SYS__PTHREADTYPES_H_
+#define _SYS__PTHREADTYPES_H_
+
+#if defined(_POSIX_THREADS)
+
+#include <sys/lock.h>
+
+/* The generic newlib version of this file uses plain integers as handles to
+ * objects managed by the pthread implementation. Threads on Xelix are
+ * implemented in libc (pthread.c), so these are the objects themselves.
+ */
+
+typedef struct __pthread* pthread_t;
+
+#define PTHREAD_SCOPE_PROCESS 0
+#define PTHREAD_SCOPE_SYSTEM 1
+#define PTHREAD_INHERIT_SCHED 1
+#define PTHREAD_EXPLICIT_SCHED 2
+#define PTHREAD_CREATE_DETACHED 0
+#define PTHREAD_CREATE_JOINABLE 1
+
+typedef struct {
+	int __detachstate;
+	__SIZE_TYPE__ __stacksize;
+} pthread_attr_t;
+
+#define PTHREAD_MUTEX_NORMAL 0
+#define PTHREAD_MUTEX_RECURSIVE 1
+#define PTHREAD_MUTEX_ERRORCHECK 2
+#define PTHREAD_MUTEX_DEFAULT PTHREAD_MUTEX_NORMAL
+
+typedef struct {
+	struct __xelix_lock __lock;
+	int __type;
+} pthread_mutex_t;
+
+typedef struct {
+	int __type;
+} pthread_mutexattr_t;
+
+#define _PTHREAD_MUTEX_INITIALIZER { __XELIX_LOCK_INITIALIZER, PTHREAD_MUTEX_DEFAULT }
+
+typedef struct {
+	// Incremented on every signal/broadcast, waiters sleep on it
+	volatile int __seq;
+} pthread_cond_t;
+
+typedef struct {
+	int __unused;
+} pthread_condattr_t;
+
+#define _PTHREAD_COND_INITIALIZER { 0 }
+
+typedef unsigned int pthread_key_t;
+
+typedef struct {
+	// 0 = not run yet, 1 = running, 2 = done
+	volatile int __state;
+} pthread_once_t;
+
+#define _PTHREAD_ONCE_INIT { 0 }
+
+#endif /* defined(_POSIX_THREADS) */
+#endif /* ! _SYS__PTHREADTYPES_H_ */
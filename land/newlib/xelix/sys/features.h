@@ -334,6 +334,10 @@ extern "C" {
 /*# define _POSIX_JOB_CONTROL     1*/
 /*# define _POSIX_SAVED_IDS       1*/
 # define _POSIX_VERSION 199309L
+# define _POSIX_THREADS 1
+# define _POSIX_TIMERS 1
+# define _POSIX_MONOTONIC_CLOCK 200112L
+# define _UNIX98_THREAD_MUTEX_ATTRIBUTES 1
 
 #ifdef __cplusplus
 }
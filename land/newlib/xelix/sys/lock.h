@@ -0,0 +1,67 @@
+/* Copyright © 2023 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SYS_LOCK_H__
+#define __SYS_LOCK_H__
+
+/* Locks used internally by newlib (malloc, stdio, atexit etc.). Replaces the
+ * dummy version from newlib, which is only safe for single-threaded programs.
+ * These are futexes and only enter the kernel if the lock is contended. Also
+ * used for pthread mutexes. Implemented in pthread.c.
+ */
+
+#include <_ansi.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct __xelix_lock {
+	// 0 = unlocked, 1 = locked, 2 = locked with waiters
+	volatile int state;
+	void* owner;
+	int count;
+};
+
+typedef struct __xelix_lock _LOCK_T;
+typedef struct __xelix_lock _LOCK_RECURSIVE_T;
+
+#define __XELIX_LOCK_INITIALIZER { 0, 0, 0 }
+
+#define __LOCK_INIT(class, lock) class _LOCK_T lock = __XELIX_LOCK_INITIALIZER;
+#define __LOCK_INIT_RECURSIVE(class, lock) class _LOCK_RECURSIVE_T lock = __XELIX_LOCK_INITIALIZER;
+#define __lock_init(lock) __xelix_lock_init(&(lock))
+#define __lock_init_recursive(lock) __xelix_lock_init(&(lock))
+#define __lock_close(lock) ((void)0)
+#define __lock_close_recursive(lock) ((void)0)
+#define __lock_acquire(lock) __xelix_lock_acquire(&(lock), 0)
+#define __lock_acquire_recursive(lock) __xelix_lock_acquire(&(lock), 1)
+#define __lock_try_acquire(lock) __xelix_lock_try_acquire(&(lock), 0)
+#define __lock_try_acquire_recursive(lock) __xelix_lock_try_acquire(&(lock), 1)
+#define __lock_release(lock) __xelix_lock_release(&(lock))
+#define __lock_release_recursive(lock) __xelix_lock_release(&(lock))
+
+void __xelix_lock_init(struct __xelix_lock* lock);
+void __xelix_lock_acquire(struct __xelix_lock* lock, int recursive);
+int __xelix_lock_try_acquire(struct __xelix_lock* lock, int recursive);
+void __xelix_lock_release(struct __xelix_lock* lock);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __SYS_LOCK_H__ */
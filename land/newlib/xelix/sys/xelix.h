@@ -42,6 +42,7 @@ struct _xelix_execdata {
 	uint16_t euid;
 	uint16_t egid;
 	char binary_path[PATH_MAX];
+	uint32_t flags;
 };
 
 extern struct _xelix_execdata* _xelix_execdata;
@@ -51,8 +52,76 @@ extern FILE* _xelix_serial;
 int _strace(void);
 void _serial_printf(const char* format, ...);
 
+/* Thread control block. Once the first thread has been created, the TCB of
+ * the current thread can be found at %gs:0, see pthread.c.
+ */
+struct _xelix_tcb {
+	struct _xelix_tcb* self;
+	struct _reent* reent;
+	pid_t tid;
+};
+
+extern int _xelix_threaded;
+
+static inline struct _xelix_tcb* _xelix_tcb(void) {
+	struct _xelix_tcb* tcb;
+	asm volatile("mov %%gs:0, %0" : "=r" (tcb));
+	return tcb;
+}
+
+// Set in _xelix_execdata->flags if the kernel supports sysenter syscalls
+#define _XELIX_EXECDATA_SYSENTER 1
+
+// Set in _xelix_execdata->flags if the time page is mapped
+#define _XELIX_EXECDATA_TIMEPAGE 2
+
+/* Read-only timekeeping data from the kernel, updated on every timer tick.
+ * seq is odd while an update is in progress.
+ */
+struct _xelix_time_page {
+	uint32_t seq;
+	uint32_t rate;
+	uint32_t tsc_khz;
+	uint32_t tick;
+	uint64_t tsc;
+	int64_t boot_time;
+	uint64_t ns;
+};
+
+#define _xelix_time_page ((const volatile struct _xelix_time_page*)0x9000)
+
+/* Syscalls using sysenter. Since ecx and edx are needed for the return stack
+ * and address, the second and third argument are passed in esi and edi.
+ */
+static inline uint32_t __syscall_sysenter(int* errp, uint32_t call, uint32_t arg1, uint32_t arg2, uint32_t arg3) {
+	register uint32_t _call asm("eax") = call;
+	register uint32_t _arg1 asm("ebx") = arg1;
+	register uint32_t _arg2 asm("esi") = arg2;
+	register uint32_t _arg3 asm("edi") = arg3;
+	register uint32_t result asm("eax");
+	register uint32_t sce asm("ebx");
+
+	asm volatile(
+		"mov %%esp, %%ecx;"
+		"mov $1f, %%edx;"
+		"sysenter;"
+		"1:"
+
+		: "=r" (result), "=r" (sce)
+		: "r" (_call), "r" (_arg1), "r" (_arg2), "r" (_arg3)
+		: "ecx", "edx", "memory");
+
+	*errp = sce;
+	return result;
+}
+
 #define syscall(call, a1, a2, a3) __syscall(__errno(), call, (uint32_t)a1, (uint32_t)a2, (uint32_t)a3)
 static inline uint32_t __syscall(int* errp, uint32_t call, uint32_t arg1, uint32_t arg2, uint32_t arg3) {
+	// Older kernels only support int 0x80
+	if(_xelix_execdata->flags & _XELIX_EXECDATA_SYSENTER) {
+		return __syscall_sysenter(errp, call, arg1, arg2, arg3);
+	}
+
 	register uint32_t _call asm("eax") = call;
 	register uint32_t _arg1 asm("ebx") = arg1;
 	register uint32_t _arg2 asm("ecx") = arg2;
@@ -34,6 +34,7 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <libgen.h>
 #include <stdio.h>
 #include <stdarg.h>
@@ -45,6 +46,8 @@
 #include <poll.h>
 #include <utime.h>
 #include <netdb.h>
+#include <sched.h>
+#include <time.h>
 
 /* Normally errno is defined as a macro that does reentrancy magic. However,
  * some of our syscalls (those prefixed with an underscore) get called from the
@@ -64,15 +67,55 @@ int _fork() {
 	return syscall_pf(22, 0, 0, 0);
 }
 
-pid_t vfork(void) {
-	return syscall(22, 0, 0, 0);
-}
+/* Set while running as the child of vfork. The child shares the memory of
+ * its parent, including execdata, so the IDs have to come from the kernel.
+ * Cleared again when vfork returns in the parent.
+ */
+bool _xelix_vfork_child;
+
+/* vfork can't be a regular C function: The child returns from it first and
+ * keeps using the same stack, so by the time the parent returns, the return
+ * address on the stack might have been overwritten. Keep it in a register
+ * instead. The kernel uses ebx to return errno, so save the caller's value
+ * in edx.
+ */
+asm(
+	".global vfork\n"
+	".type vfork, @function\n"
+	"vfork:\n"
+	"	pop %ecx\n"
+	"	mov %ebx, %edx\n"
+	"	mov $59, %eax\n"
+	"	int $0x80\n"
+	"	push %ecx\n"
+	"	cmp $-1, %eax\n"
+	"	je 1f\n"
+	"	test %eax, %eax\n"
+	"	setz _xelix_vfork_child\n"
+	"	mov %edx, %ebx\n"
+	"	ret\n"
+	"1:\n"
+	"	push %edx\n"
+	"	push %ebx\n"
+	"	call __errno\n"
+	"	pop %ecx\n"
+	"	mov %ecx, (%eax)\n"
+	"	pop %ebx\n"
+	"	mov $-1, %eax\n"
+	"	ret\n"
+);
 
 pid_t _getpid() {
+	if(_xelix_vfork_child) {
+		return syscall_pf(70, 0, 0, 0);
+	}
 	return (pid_t)_xelix_execdata->pid;
 }
 
 pid_t getppid(void) {
+	if(_xelix_vfork_child) {
+		return syscall(70, 1, 0, 0);
+	}
 	return (pid_t)_xelix_execdata->ppid;
 }
 
@@ -308,8 +351,87 @@ int access(const char *pathname, int mode) {
 	return syscall(4, pathname, mode, 0);
 }
 
+/* Nanoseconds since boot from the kernel time page, interpolated using the
+ * TSC since the last timer tick. Returns -1 on older kernels without a time
+ * page.
+ */
+static int time_page_read(uint64_t* ns, int64_t* boot_time) {
+	if(!(_xelix_execdata->flags & _XELIX_EXECDATA_TIMEPAGE)) {
+		return -1;
+	}
+
+	const volatile struct _xelix_time_page* page = _xelix_time_page;
+	uint32_t seq;
+	do {
+		seq = page->seq;
+		asm volatile("" ::: "memory");
+
+		uint32_t tsc_low, tsc_high;
+		asm volatile("rdtsc" : "=a" (tsc_low), "=d" (tsc_high));
+		int64_t cycles = ((uint64_t)tsc_high << 32 | tsc_low) - page->tsc;
+
+		*ns = page->ns;
+		if(page->tsc_khz && cycles > 0) {
+			*ns += cycles * 1000000 / page->tsc_khz;
+		}
+		*boot_time = page->boot_time;
+
+		asm volatile("" ::: "memory");
+	} while((seq & 1) || seq != page->seq);
+	return 0;
+}
+
 int _gettimeofday(struct timeval* p, void* tz) {
-	return syscall_pf(19, p, tz, 0);
+	uint64_t ns;
+	int64_t boot_time;
+	if(!p || time_page_read(&ns, &boot_time) < 0) {
+		return syscall_pf(19, p, tz, 0);
+	}
+
+	p->tv_sec = boot_time + ns / 1000000000;
+	p->tv_usec = ns % 1000000000 / 1000;
+	return 0;
+}
+
+int clock_gettime(clockid_t clock_id, struct timespec* tp) {
+	if(clock_id != CLOCK_REALTIME && clock_id != CLOCK_MONOTONIC) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	uint64_t ns;
+	int64_t boot_time;
+	if(time_page_read(&ns, &boot_time) < 0) {
+		return syscall(67, clock_id, tp, 0);
+	}
+
+	tp->tv_sec = ns / 1000000000;
+	tp->tv_nsec = ns % 1000000000;
+	if(clock_id == CLOCK_REALTIME) {
+		tp->tv_sec += boot_time;
+	}
+	return 0;
+}
+
+int clock_getres(clockid_t clock_id, struct timespec* res) {
+	if(clock_id != CLOCK_REALTIME && clock_id != CLOCK_MONOTONIC) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if(res) {
+		res->tv_sec = 0;
+		res->tv_nsec = 1;
+	}
+	return 0;
+}
+
+int getrusage(int who, struct rusage* r_usage) {
+	return syscall(65, who, r_usage, 0);
+}
+
+clock_t _times(struct tms* buf) {
+	return (clock_t)syscall_pf(66, buf, 0, 0);
 }
 
 int utimes(const char *path, const struct timeval times[2]) {
@@ -422,11 +544,86 @@ int umount2(const char *target, int flags) {
 	return syscall(51, target, flags, 0);
 }
 
+void sync(void) {
+	syscall(68, 0, 0, 0);
+}
+
+int reboot(int howto) {
+	return syscall(69, howto, 0, 0);
+}
+
 int sched_yield(void) {
 	asm volatile("int $0x31;");
 	return 0;
 }
 
+int sched_setscheduler(pid_t pid, int policy, const struct sched_param *param) {
+	return syscall(56, pid, policy, param);
+}
+
+int sched_getscheduler(pid_t pid) {
+	return syscall(57, pid, 0, 0);
+}
+
+int sched_getparam(pid_t pid, struct sched_param *param) {
+	return syscall(58, pid, param, 0);
+}
+
+int sched_setparam(pid_t pid, const struct sched_param *param) {
+	int policy = sched_getscheduler(pid);
+	if(policy < 0) {
+		return -1;
+	}
+	return sched_setscheduler(pid, policy, param);
+}
+
+int sched_get_priority_max(int policy) {
+	switch(policy) {
+		case SCHED_OTHER:
+			return 0;
+		case SCHED_FIFO:
+		case SCHED_RR:
+			return 99;
+		default:
+			errno = EINVAL;
+			return -1;
+	}
+}
+
+int sched_get_priority_min(int policy) {
+	switch(policy) {
+		case SCHED_OTHER:
+			return 0;
+		case SCHED_FIFO:
+		case SCHED_RR:
+			return 1;
+		default:
+			errno = EINVAL;
+			return -1;
+	}
+}
+
+int getpriority(int which, id_t who) {
+	return syscall(54, which, who, 0);
+}
+
+int setpriority(int which, id_t who, int prio) {
+	return syscall(55, which, who, prio);
+}
+
+int nice(int incr) {
+	errno = 0;
+	int prio = getpriority(PRIO_PROCESS, 0);
+	if(prio == -1 && errno) {
+		return -1;
+	}
+
+	if(setpriority(PRIO_PROCESS, 0, prio + incr) < 0) {
+		return -1;
+	}
+	return getpriority(PRIO_PROCESS, 0);
+}
+
 int umount(const char *target) {
 	umount2(target, 0);
 }
@@ -496,24 +693,37 @@ int tcflow(int fd, int action) {
 }
 
 uid_t getuid(void) {
+	if(_xelix_vfork_child) {
+		return syscall(70, 2, 0, 0);
+	}
 	return _xelix_execdata->uid;
 }
 
 uid_t geteuid(void) {
+	if(_xelix_vfork_child) {
+		return syscall(70, 3, 0, 0);
+	}
 	return _xelix_execdata->euid;
 }
 
 uid_t getgid(void) {
+	if(_xelix_vfork_child) {
+		return syscall(70, 4, 0, 0);
+	}
 	return _xelix_execdata->gid;
 }
 
 uid_t getegid(void) {
+	if(_xelix_vfork_child) {
+		return syscall(70, 5, 0, 0);
+	}
 	return _xelix_execdata->egid;
 }
 
+// In a vfork child, execdata belongs to the parent and must not be updated
 int setuid(uid_t uid) {
 	int r = syscall(42, 0, uid, 0);
-	if(r >= 0) {
+	if(r >= 0 && !_xelix_vfork_child) {
 		_xelix_execdata->uid = uid;
 	}
 	return r;
@@ -521,7 +731,7 @@ int setuid(uid_t uid) {
 
 int setgid(gid_t gid) {
 	int r = syscall(42, 1, gid, 0);
-	if(r >= 0) {
+	if(r >= 0 && !_xelix_vfork_child) {
 		_xelix_execdata->gid = gid;
 	}
 	return r;
@@ -26,7 +26,7 @@
 
 struct log_entry {
 	uint8_t level;
-	uint64_t tick;
+	uint64_t ns;
 	uint32_t timestamp;
 	uint32_t length;
 };
@@ -89,14 +89,15 @@ int main(int argc, const char** argv) {
 			case 4: level_name = "31mErr"; break;
 		}
 
+		uint32_t usec = header.ns % 1000000000 / 1000;
+		char* tstr;
 		if(header.timestamp) {
-			printf("%19s ", time2str(header.timestamp, "%Y-%m-%d %H:%M:%S"));
+			asprintf(&tstr, "%s.%06u", time2str(header.timestamp, "%Y-%m-%d %H:%M:%S"), usec);
 		} else {
-			char* tstr;
-			asprintf(&tstr, "+%d ticks", header.tick);
-			printf("%19s ", tstr);
-			free(tstr);
+			asprintf(&tstr, "+%llu.%06u", header.ns / 1000000000, usec);
 		}
+		printf("%26s ", tstr);
+		free(tstr);
 		printf("\033[%-8s\033[m %s", level_name, msg);
 	}
 
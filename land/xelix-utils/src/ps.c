@@ -36,7 +36,7 @@ int main(int argc, char* argv[]) {
 	fgets(data, 1024, fp);
 	free(data);
 
-	printf("  PID User     State     PPID TTY      Mem\n");
+	printf("  PID User     State     PPID TTY      Mem         NI     TIME\n");
 
 	while(true) {
 		if(feof(fp)) {
@@ -52,8 +52,12 @@ int main(int argc, char* argv[]) {
 		uint32_t mem;
 		char _tty[30];
 		char* tty = _tty;
+		int nice;
+		uint32_t runtime;
 
-		if(fscanf(fp, "%d %d %d %d %c \"%500[^\"]\" %d %s\n", &pid, &uid, &gid, &ppid, &cstate, name, &mem, &_tty) != 8) {
+		// Skip the resource usage columns that are not shown
+		if(fscanf(fp, "%d %d %d %d %c \"%500[^\"]\" %d %s %d %u %*u %*u %*u %*u %*u %*llu %*llu\n",
+			&pid, &uid, &gid, &ppid, &cstate, name, &mem, &_tty, &nice, &runtime) != 10) {
 			fprintf(stderr, "Matching error.\n");
 			exit(EXIT_FAILURE);
 		}
@@ -84,7 +88,9 @@ int main(int argc, char* argv[]) {
 			tty = basename(tty);
 		}
 
-		printf("%5d %-8s \033[%-11s\033[m %5d %-8s %-10s %-15s\n", pid, user, state, ppid, tty, rfs, name);
+		runtime /= 1000;
+		printf("%5d %-8s \033[%-11s\033[m %5d %-8s %-10s %3d %2d:%02d:%02d %-15s\n", pid, user,
+			state, ppid, tty, rfs, nice, runtime / 3600, (runtime / 60) % 60, runtime % 60, name);
 		free(rfs);
 	}
 
@@ -0,0 +1,408 @@
+/* bcache.c: Block buffer cache
+ * Copyright © 2023 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bcache.h"
+#include <tasks/scheduler.h>
+#include <tasks/workqueue.h>
+#include <mem/kmalloc.h>
+#include <fs/sysfs.h>
+#include <spinlock.h>
+#include <string.h>
+#include <log.h>
+
+#define HASH_SIZE 256
+
+/* Blocks are looked up by disk and absolute LBA, so a partition and the
+ * whole disk device share the same blocks. All cached blocks are kept in a
+ * hash table and on an LRU list with the most recently used block at the
+ * head. Both, as well as the reference counts, are protected by the cache
+ * lock.
+ *
+ * The block data is protected by the busy flag of the block, which is held
+ * for I/O and while copying from or to the block. Since I/O can yield, this
+ * is a sleeping lock rather than a spinlock.
+ */
+static struct bcache_buf* hash[HASH_SIZE];
+static struct bcache_buf* lru_head = NULL;
+static struct bcache_buf* lru_tail = NULL;
+static spinlock_t lock;
+
+static uint32_t num_blocks = 0;
+static uint32_t sync_gen = 0;
+static volatile uint32_t num_dirty = 0;
+static uint64_t hits = 0;
+static uint64_t misses = 0;
+
+static void flush_work_func(struct work* work);
+static struct work flush_work = WORK_INIT(flush_work_func, NULL);
+
+// Partitions use the callbacks and meta of the disk they are on
+static inline bool same_disk(struct vfs_block_dev* a, struct vfs_block_dev* b) {
+	return a->read_cb == b->read_cb && a->meta == b->meta;
+}
+
+static inline uint32_t hash_key(struct vfs_block_dev* dev, uint64_t lba) {
+	return ((uint32_t)(lba / bcache_sectors(dev)) ^ ((uintptr_t)dev->meta >> 4)) % HASH_SIZE;
+}
+
+static void lru_unlink(struct bcache_buf* buf) {
+	if(buf->lru_prev) {
+		buf->lru_prev->lru_next = buf->lru_next;
+	} else {
+		lru_head = buf->lru_next;
+	}
+
+	if(buf->lru_next) {
+		buf->lru_next->lru_prev = buf->lru_prev;
+	} else {
+		lru_tail = buf->lru_prev;
+	}
+}
+
+static void lru_push(struct bcache_buf* buf) {
+	buf->lru_prev = NULL;
+	buf->lru_next = lru_head;
+	if(lru_head) {
+		lru_head->lru_prev = buf;
+	}
+	lru_head = buf;
+	if(!lru_tail) {
+		lru_tail = buf;
+	}
+}
+
+static struct bcache_buf* lookup(struct vfs_block_dev* dev, uint64_t lba) {
+	struct bcache_buf* buf = hash[hash_key(dev, lba)];
+	for(; buf; buf = buf->hash_next) {
+		if(buf->lba == lba && same_disk(buf->dev, dev)) {
+			return buf;
+		}
+	}
+	return NULL;
+}
+
+static void unhash(struct bcache_buf* buf) {
+	struct bcache_buf** prev = &hash[hash_key(buf->dev, buf->lba)];
+	for(; *prev; prev = &(*prev)->hash_next) {
+		if(*prev == buf) {
+			*prev = buf->hash_next;
+			return;
+		}
+	}
+}
+
+void bcache_lock(struct bcache_buf* buf) {
+	while(__sync_lock_test_and_set(&buf->busy, 1)) {
+		scheduler_yield();
+	}
+}
+
+void bcache_unlock(struct bcache_buf* buf) {
+	__sync_lock_release(&buf->busy);
+}
+
+// Needs the block to be locked
+void bcache_mark_dirty(struct bcache_buf* buf) {
+	if(!buf->dirty) {
+		buf->dirty = true;
+		__sync_add_and_fetch(&num_dirty, 1);
+		queue_delayed_work(&flush_work, BCACHE_FLUSH_MS);
+	}
+}
+
+/* Write a dirty block to disk. Write errors can't be reported to whoever
+ * changed the block anymore. The block stays dirty, and writing it is tried
+ * again by the next flush.
+ */
+static bool write_back(struct bcache_buf* buf) {
+	bool ok = true;
+	bcache_lock(buf);
+	if(buf->dirty) {
+		uint64_t num = buf->len / buf->dev->block_size;
+		uint64_t written = buf->dev->write_cb(buf->dev, buf->lba, num, buf->data);
+		if(written == -1 || written < num) {
+			log(LOG_ERR, "bcache: Write error on %s at LBA %llu\n", buf->dev->name, buf->lba);
+			queue_delayed_work(&flush_work, BCACHE_FLUSH_MS);
+			ok = false;
+		} else {
+			buf->dirty = false;
+			__sync_sub_and_fetch(&num_dirty, 1);
+		}
+	}
+	bcache_unlock(buf);
+	return ok;
+}
+
+static struct bcache_buf* alloc_buf(void) {
+	struct bcache_buf* buf = zmalloc(sizeof(struct bcache_buf));
+	if(!buf) {
+		return NULL;
+	}
+
+	buf->data = kmalloc_a(BCACHE_BLOCK_SIZE);
+	if(!buf->data) {
+		kfree(buf);
+		return NULL;
+	}
+
+	num_blocks++;
+	return buf;
+}
+
+/* Allocate a new block, or once the limit is reached or memory runs out,
+ * find one to reuse starting from the least recently used one. With grow
+ * set, a new block is allocated even beyond the limit. Clean blocks are
+ * preferred. If only a dirty one is available, it is returned with dirty
+ * set and needs to be written back first. Returns NULL if there is no block
+ * at all. Needs the cache lock.
+ */
+static struct bcache_buf* take_buf(bool grow) {
+	struct bcache_buf* buf;
+	if(grow || num_blocks < BCACHE_MAX_BLOCKS) {
+		buf = alloc_buf();
+		if(buf) {
+			return buf;
+		}
+	}
+
+	struct bcache_buf* dirty = NULL;
+	for(buf = lru_tail; buf; buf = buf->lru_prev) {
+		if(buf->refs) {
+			continue;
+		}
+
+		if(!buf->dirty) {
+			unhash(buf);
+			lru_unlink(buf);
+			return buf;
+		}
+
+		if(!dirty) {
+			dirty = buf;
+		}
+	}
+
+	if(dirty) {
+		return dirty;
+	}
+
+	// Go over the limit if all blocks are in use
+	return grow ? NULL : alloc_buf();
+}
+
+/* Get a referenced, read block. block is the index of the block on the disk
+ * dev is on (not relative to the partition), in units of BCACHE_BLOCK_SIZE.
+ * Returns NULL if the block could not be read at all. Near the end of the
+ * disk, only part of the block might be available, see len.
+ */
+struct bcache_buf* bcache_get(struct vfs_block_dev* dev, uint64_t block) {
+	uint64_t lba = block * bcache_sectors(dev);
+	struct bcache_buf* buf;
+	bool grow = false;
+
+	spinlock_get(&lock, -1);
+	while(!(buf = lookup(dev, lba))) {
+		buf = take_buf(grow);
+		if(!buf) {
+			spinlock_release(&lock);
+			return NULL;
+		}
+
+		/* Write back with the lock released, then look again since somebody
+		 * else might have added the block in the meantime. If the block
+		 * can't be written, use a new one instead. If that's not possible
+		 * either, give up.
+		 */
+		if(buf->dirty) {
+			if(grow) {
+				spinlock_release(&lock);
+				return NULL;
+			}
+
+			buf->refs++;
+			spinlock_release(&lock);
+			grow = !write_back(buf);
+			spinlock_get(&lock, -1);
+			buf->refs--;
+			continue;
+		}
+
+		buf->dev = dev;
+		buf->lba = lba;
+		buf->len = 0;
+		buf->hash_next = hash[hash_key(dev, lba)];
+		hash[hash_key(dev, lba)] = buf;
+		lru_push(buf);
+		misses++;
+		break;
+	}
+
+	if(buf->len) {
+		hits++;
+	}
+
+	buf->refs++;
+	lru_unlink(buf);
+	lru_push(buf);
+	spinlock_release(&lock);
+
+	// Blocks that failed to read previously get another try
+	bcache_lock(buf);
+	if(!buf->len) {
+		uint64_t read = dev->read_cb(dev, lba, bcache_sectors(dev), buf->data);
+		buf->len = (read == -1) ? 0 : read * dev->block_size;
+	}
+	bcache_unlock(buf);
+
+	if(!buf->len) {
+		bcache_put(buf);
+		return NULL;
+	}
+	return buf;
+}
+
+void bcache_put(struct bcache_buf* buf) {
+	spinlock_get(&lock, -1);
+	buf->refs--;
+	spinlock_release(&lock);
+}
+
+/* Write back all dirty blocks on the disk of dev, or on all disks if dev is
+ * NULL. Returns -1 if any of the writes failed.
+ */
+int bcache_sync(struct vfs_block_dev* dev) {
+	int ret = 0;
+
+	// Blocks that fail to write stay dirty, so only try each block once
+	spinlock_get(&lock, -1);
+	uint32_t gen = ++sync_gen;
+	spinlock_release(&lock);
+
+	while(true) {
+		spinlock_get(&lock, -1);
+		struct bcache_buf* buf = lru_head;
+		for(; buf; buf = buf->lru_next) {
+			if(buf->dirty && buf->sync_gen != gen && (!dev || same_disk(buf->dev, dev))) {
+				break;
+			}
+		}
+
+		if(!buf) {
+			spinlock_release(&lock);
+			return ret;
+		}
+
+		buf->sync_gen = gen;
+		buf->refs++;
+		spinlock_release(&lock);
+
+		if(!write_back(buf)) {
+			ret = -1;
+		}
+		bcache_put(buf);
+	}
+}
+
+// Returns the number of sectors read
+static uint64_t read_run(struct vfs_block_dev* dev, uint64_t lba, uint64_t num, uint8_t* buf) {
+	uint64_t read = dev->read_cb(dev, lba, num, buf);
+	return (read == -1) ? 0 : MIN(read, num);
+}
+
+/* Read num device blocks (sectors) starting at the absolute lba into buf without adding them
+ * to the cache, for data that is cached elsewhere (such as file data in the
+ * page cache). Blocks that are in the cache anyway are copied from there
+ * since they might be dirty. Everything in between is read straight into
+ * buf, using one request per contiguous run. Returns the number of sectors
+ * read.
+ */
+uint64_t bcache_read_direct(struct vfs_block_dev* dev, uint64_t lba, uint64_t num, uint8_t* buf) {
+	uint64_t bs = dev->block_size;
+	uint64_t done = 0;
+	uint64_t run_start = 0;
+	uint64_t run_len = 0;
+
+	while(done < num) {
+		uint64_t offset = (lba + done) % bcache_sectors(dev);
+		uint64_t len = MIN(num - done, bcache_sectors(dev) - offset);
+
+		spinlock_get(&lock, -1);
+		struct bcache_buf* cbuf = lookup(dev, lba + done - offset);
+		if(cbuf) {
+			cbuf->refs++;
+		}
+		spinlock_release(&lock);
+
+		bool cached = false;
+		if(cbuf) {
+			if(run_len) {
+				uint64_t read = read_run(dev, lba + run_start, run_len, buf + run_start * bs);
+				if(read < run_len) {
+					bcache_put(cbuf);
+					return run_start + read;
+				}
+				run_len = 0;
+			}
+
+			// Blocks still being read by somebody else are waited for here
+			bcache_lock(cbuf);
+			if((offset + len) * bs <= cbuf->len) {
+				memcpy(buf + done * bs, cbuf->data + offset * bs, len * bs);
+				cached = true;
+			}
+			bcache_unlock(cbuf);
+			bcache_put(cbuf);
+		}
+
+		if(!cached) {
+			if(!run_len) {
+				run_start = done;
+			}
+			run_len += len;
+		}
+		done += len;
+	}
+
+	if(run_len) {
+		return run_start + read_run(dev, lba + run_start, run_len, buf + run_start * bs);
+	}
+	return num;
+}
+
+static void flush_work_func(struct work* work) {
+	bcache_sync(NULL);
+}
+
+static size_t sfs_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
+	if(ctx->fp->offset) {
+		return 0;
+	}
+
+	size_t rsize = 0;
+	sysfs_printf("# blocks dirty hits misses\n");
+	sysfs_printf("%u %u %llu %llu\n", num_blocks, num_dirty, hits, misses);
+	return rsize;
+}
+
+void bcache_init(void) {
+	struct vfs_callbacks sfs_cb = {
+		.read = sfs_read,
+	};
+	sysfs_add_file("bcache", &sfs_cb);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+/* Copyright © 2023 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <block/block.h>
+
+// Size of a cached block in bytes
+#define BCACHE_BLOCK_SIZE 4096
+
+// Number of cached blocks, unless all of them are in use
+#define BCACHE_MAX_BLOCKS 1024
+
+// Dirty blocks get written back after at most this many milliseconds
+#define BCACHE_FLUSH_MS 5000
+
+struct bcache_buf {
+	// Any device on the disk, used for I/O. Partitions share their blocks
+	struct vfs_block_dev* dev;
+
+	// Absolute LBA of the first sector
+	uint64_t lba;
+
+	// Number of bytes that could be read. Zero until the block has been read
+	uint32_t len;
+	uint8_t* data;
+
+	// Internal state, see block/bcache.c
+	uint32_t refs;
+	uint32_t sync_gen;
+	bool dirty;
+	volatile bool busy;
+	struct bcache_buf* hash_next;
+	struct bcache_buf* lru_prev;
+	struct bcache_buf* lru_next;
+};
+
+/* Devices can only be cached if their block size divides the size of a
+ * cached block. Others are accessed directly, see block/block.c.
+ */
+static inline bool bcache_usable(struct vfs_block_dev* dev) {
+	return dev->block_size > 0 && BCACHE_BLOCK_SIZE % dev->block_size == 0;
+}
+
+// Number of device blocks (sectors) in a cached block
+static inline uint32_t bcache_sectors(struct vfs_block_dev* dev) {
+	return BCACHE_BLOCK_SIZE / dev->block_size;
+}
+
+struct bcache_buf* bcache_get(struct vfs_block_dev* dev, uint64_t block);
+void bcache_put(struct bcache_buf* buf);
+void bcache_lock(struct bcache_buf* buf);
+void bcache_unlock(struct bcache_buf* buf);
+void bcache_mark_dirty(struct bcache_buf* buf);
+int bcache_sync(struct vfs_block_dev* dev);
+uint64_t bcache_read_direct(struct vfs_block_dev* dev, uint64_t lba, uint64_t num, uint8_t* buf);
+void bcache_init(void);
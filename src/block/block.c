@@ -18,6 +18,7 @@
  */
 
 #include <block/block.h>
+#include <block/bcache.h>
 #include <string.h>
 #include <mem/kmalloc.h>
 #include <block/i386-ide.h>
@@ -27,7 +28,6 @@
 #include <block/random.h>
 #include <fs/sysfs.h>
 #include <fs/mount.h>
-#include <mem/vm.h>
 #include <panic.h>
 
 static int num_devs = 0;
@@ -48,64 +48,136 @@ struct vfs_block_dev* vfs_block_get_dev(const char* path) {
 	return NULL;
 }
 
-uint64_t vfs_block_read(struct vfs_block_dev* dev, uint64_t start_block, uint64_t num_blocks, uint8_t* buf) {
-	return dev->read_cb(dev, start_block + dev->start_offset, num_blocks, buf);
-}
+/* Access to devices that can't be cached, one device block at a time.
+ * position is on the disk. Partial blocks are read, modified and written
+ * back. Returns the number of bytes that could be read or written.
+ */
+static uint64_t uncached_rw(struct vfs_block_dev* dev, uint64_t position, uint64_t size, uint8_t* buf, bool write) {
+	uint64_t bs = dev->block_size;
+	uint8_t* block = kmalloc(bs);
+	if(!block) {
+		return 0;
+	}
 
-uint64_t vfs_block_write(struct vfs_block_dev* dev, uint64_t start_block, uint64_t num_blocks, uint8_t* buf) {
-	return dev->write_cb(dev, start_block + dev->start_offset, num_blocks, buf);
-}
+	uint64_t done = 0;
+	while(done < size) {
+		uint64_t lba = (position + done) / bs;
+		uint64_t offset = (position + done) % bs;
+		uint64_t len = MIN(size - done, bs - offset);
 
-uint64_t vfs_block_sread(struct vfs_block_dev* dev, uint64_t position, uint64_t size, uint8_t* buf) {
-	int start_block = position / dev->block_size;
-	uint64_t offset = (position % dev->block_size);
-	int num_blocks = (size + offset + dev->block_size - 1) / dev->block_size;
+		if(!write || len < bs) {
+			uint64_t read = dev->read_cb(dev, lba, 1, block);
+			if(read == -1 || read < 1) {
+				break;
+			}
+		}
 
-	if(!offset && !(size % dev->block_size)) {
-		return vfs_block_read(dev, start_block, num_blocks, buf) * dev->block_size;
+		if(write) {
+			memcpy(block + offset, buf + done, len);
+			uint64_t written = dev->write_cb(dev, lba, 1, block);
+			if(written == -1 || written < 1) {
+				break;
+			}
+		} else {
+			memcpy(buf + done, block + offset, len);
+		}
+		done += len;
 	}
 
-	vm_alloc_t alloc;
-	uint64_t buffer_size = num_blocks * dev->block_size;
-	assert(buffer_size >= size);
+	kfree(block);
+	return done;
+}
 
-	uint8_t* int_buf = vm_alloc(VM_KERNEL, &alloc, RDIV(buffer_size, PAGE_SIZE), NULL, 0);
+/* All access goes through the block cache, so this copies the data from or
+ * to the cached blocks covering the range. position is relative to the
+ * device and converted to a position on the disk here, since the cache is
+ * shared between partitions. Returns the number of bytes that could be read
+ * or written.
+ */
+static uint64_t cache_rw(struct vfs_block_dev* dev, uint64_t position, uint64_t size, uint8_t* buf, bool write) {
+	position += dev->start_offset * dev->block_size;
+	if(!bcache_usable(dev)) {
+		return uncached_rw(dev, position, size, buf, write);
+	}
 
-	if(vfs_block_read(dev, start_block, num_blocks, int_buf) < num_blocks) {
-		kfree(int_buf);
-		return -1;
+	uint64_t done = 0;
+
+	while(done < size) {
+		uint64_t offset = (position + done) % BCACHE_BLOCK_SIZE;
+		uint64_t len = MIN(size - done, BCACHE_BLOCK_SIZE - offset);
+
+		struct bcache_buf* cbuf = bcache_get(dev, (position + done) / BCACHE_BLOCK_SIZE);
+		if(!cbuf) {
+			break;
+		}
+
+		if(offset + len > cbuf->len) {
+			bcache_put(cbuf);
+			break;
+		}
+
+		bcache_lock(cbuf);
+		if(write) {
+			memcpy(cbuf->data + offset, buf + done, len);
+			bcache_mark_dirty(cbuf);
+		} else {
+			memcpy(buf + done, cbuf->data + offset, len);
+		}
+		bcache_unlock(cbuf);
+		bcache_put(cbuf);
+		done += len;
 	}
 
-	memcpy(buf, int_buf + offset, size);
-	vm_free(&alloc);
-	return size;
+	return done;
+}
+
+uint64_t vfs_block_sread(struct vfs_block_dev* dev, uint64_t position, uint64_t size, uint8_t* buf) {
+	return cache_rw(dev, position, size, buf, false);
 }
 
 uint64_t vfs_block_swrite(struct vfs_block_dev* dev, uint64_t position, uint64_t size, uint8_t* buf) {
-	int start_block = position / dev->block_size;
-	uint64_t offset = (position % dev->block_size);
-	int num_blocks = (size + offset + dev->block_size - 1) / dev->block_size;
+	return cache_rw(dev, position, size, buf, true);
+}
 
-	if(!offset && !(size % dev->block_size)) {
-		return vfs_block_write(dev, start_block, num_blocks, buf) * dev->block_size;
+/* Like vfs_block_sread, but whole sectors are read straight into buf instead
+ * of being added to the block cache, see bcache_read_direct. Only partial
+ * sectors at the start and end of the range go through the cache.
+ */
+uint64_t vfs_block_sread_direct(struct vfs_block_dev* dev, uint64_t position, uint64_t size, uint8_t* buf) {
+	if(!bcache_usable(dev)) {
+		return cache_rw(dev, position, size, buf, false);
 	}
 
-	// FIXME Should only read the required parts at the beginning and end
-	uint8_t* int_buf = kmalloc(num_blocks * dev->block_size);
-	if(vfs_block_read(dev, start_block, num_blocks, int_buf) < num_blocks) {
-		kfree(int_buf);
-		return -1;
+	uint64_t bs = dev->block_size;
+	uint64_t head = MIN(size, (bs - position % bs) % bs);
+	uint64_t num = (size - head) / bs;
+	uint64_t tail = size - head - num * bs;
+
+	if(head && cache_rw(dev, position, head, buf, false) < head) {
+		return 0;
 	}
 
-	memcpy(int_buf + offset, buf, size);
+	if(num) {
+		uint64_t lba = (dev->start_offset * bs + position + head) / bs;
+		uint64_t read = bcache_read_direct(dev, lba, num, buf + head);
+		if(read < num) {
+			return head + read * bs;
+		}
+	}
 
-	if(vfs_block_write(dev, start_block, num_blocks, int_buf) < num_blocks) {
-		kfree(int_buf);
-		return -1;
+	uint64_t done = head + num * bs;
+	if(tail) {
+		done += cache_rw(dev, position + done, tail, buf + done, false);
 	}
+	return done;
+}
 
-	kfree(int_buf);
-	return size;
+uint64_t vfs_block_read(struct vfs_block_dev* dev, uint64_t start_block, uint64_t num_blocks, uint8_t* buf) {
+	return cache_rw(dev, start_block * dev->block_size, num_blocks * dev->block_size, buf, false) / dev->block_size;
+}
+
+uint64_t vfs_block_write(struct vfs_block_dev* dev, uint64_t start_block, uint64_t num_blocks, uint8_t* buf) {
+	return cache_rw(dev, start_block * dev->block_size, num_blocks * dev->block_size, buf, true) / dev->block_size;
 }
 
 static size_t sfs_block_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
@@ -187,6 +259,7 @@ void vfs_block_register_dev(char* name, uint64_t start_offset,
 }
 
 void block_init(void) {
+	bcache_init();
 	ide_init();
 
 	#ifdef CONFIG_ENABLE_VIRTIO_BLOCK
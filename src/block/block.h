@@ -48,6 +48,7 @@ uint64_t vfs_block_write(struct vfs_block_dev* dev, uint64_t start_block, uint64
 
 uint64_t vfs_block_sread(struct vfs_block_dev* dev, uint64_t offset, uint64_t size, uint8_t* buf);
 uint64_t vfs_block_swrite(struct vfs_block_dev* dev, uint64_t offset, uint64_t size, uint8_t* buf);
+uint64_t vfs_block_sread_direct(struct vfs_block_dev* dev, uint64_t offset, uint64_t size, uint8_t* buf);
 
 struct vfs_block_dev* vfs_block_get_dev(const char* path);
 void vfs_block_register_dev(char* name, uint64_t start_offset,
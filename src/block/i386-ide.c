@@ -24,6 +24,7 @@
 #include <log.h>
 #include <mem/kmalloc.h>
 #include <int/int.h>
+#include <tasks/preempt.h>
 #include <portio.h>
 #include <block/i386-ide.h>
 #include <block/block.h>
@@ -165,6 +166,7 @@ static uint64_t ide_read_cb(struct vfs_block_dev* block_dev, uint64_t lba, uint6
 		if(do_read(dev, lba + i, buf + i * 512) < 0) {
 			return i;
 		}
+		preempt_point();
 	}
 
 	return num_blocks;
@@ -199,6 +201,7 @@ static uint64_t ide_write_cb(struct vfs_block_dev* block_dev, uint64_t lba, uint
 		if(do_write(dev, lba + i, buf + i * 512) < 0) {
 			return i;
 		}
+		preempt_point();
 	}
 
 	return num_blocks;
@@ -61,7 +61,7 @@ static uint32_t vendor_device_combos[][2] = {
 };
 
 static void int_handler(task_t* task, isf_t* state, int num) {
-	inb(dev->pci_dev->iobase + 0x13);
+	virtio_int_ack(dev);
 }
 
 static uint64_t send_request(struct virtio_dev* rdev, int type, uint64_t lba, uint64_t num_blocks, void* buf) {
@@ -113,14 +113,19 @@ static uint64_t send_request(struct virtio_dev* rdev, int type, uint64_t lba, ui
 }
 
 static uint64_t read_cb(struct vfs_block_dev* block_dev, uint64_t lba, uint64_t num_blocks, void* buf) {
-	if(num_blocks < 16) {
-		return send_request(dev, VIRTIO_BLK_T_IN, lba, num_blocks, buf);
-	}
-
-	for(uint64_t i = 0; i < num_blocks; i++) {
-		if(send_request(dev, VIRTIO_BLK_T_IN, lba + i, 1, buf + (uint32_t)i * 512) == -1) {
-			return i;
+	/* Requests use a single descriptor for the buffer, which is only
+	 * physically contiguous within a page. Split at page boundaries.
+	 */
+	uint64_t done = 0;
+	while(done < num_blocks) {
+		uintptr_t addr = (uintptr_t)buf + (uint32_t)done * 512;
+		uint64_t num = MIN(num_blocks - done, (PAGE_SIZE - addr % PAGE_SIZE) / 512);
+		num = MAX(num, 1);
+
+		if(send_request(dev, VIRTIO_BLK_T_IN, lba + done, num, (void*)addr) == -1) {
+			return done;
 		}
+		done += num;
 	}
 
 	return num_blocks;
@@ -153,7 +158,7 @@ static int pci_cb(pci_device_t* pci_dev) {
 
 	dev->queues[0].available->flags = VIRTQ_AVAIL_F_NO_INTERRUPT;
 	dev->queues[0].used->flags = VIRTQ_USED_F_NO_NOTIFY;
-	int_register(IRQ(dev->pci_dev->interrupt_line), int_handler, false);
+	virtio_setup_interrupts(dev, int_handler);
 
 	dev->status |= VIRTIO_PCI_STATUS_DRIVER_OK;
 	virtio_write_status(dev);
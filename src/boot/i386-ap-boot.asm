@@ -0,0 +1,93 @@
+; i386-ap-boot.asm: Startup code for application processors
+; Copyright © 2023 Lukas Martini
+
+; This file is part of Xelix.
+;
+; Xelix is free software: you can redistribute it and/or modify
+; it under the terms of the GNU General Public License as published by
+; the Free Software Foundation, either version 3 of the License, or
+; (at your option) any later version.
+;
+; Xelix is distributed in the hope that it will be useful,
+; but WITHOUT ANY WARRANTY; without even the implied warranty of
+; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+; GNU General Public License for more details.
+;
+; You should have received a copy of the GNU General Public License
+; along with Xelix.  If not, see <http://www.gnu.org/licenses/>.
+
+; Application processors start in real mode at the address passed in the
+; startup IPI. i386-smp.c copies the code between smp_trampoline_start and
+; smp_trampoline_end to TRAMPOLINE_ADDR, so it needs to be position
+; independent and may only reference its own data relative to the start.
+
+[EXTERN paging_kernel_ctx]
+[EXTERN smp_ap_stack]
+[EXTERN smp_ap_main]
+[GLOBAL smp_trampoline_start]
+[GLOBAL smp_trampoline_end]
+
+; Keep in sync with i386-smp.c
+%define TRAMPOLINE_ADDR 0x7000
+%define REL(x) ((x) - smp_trampoline_start)
+
+[section .text]
+[BITS 16]
+smp_trampoline_start:
+	cli
+	cld
+
+	; cs is TRAMPOLINE_ADDR >> 4
+	mov ax, cs
+	mov ds, ax
+	o32 lgdt [REL(trampoline_gdtr)]
+
+	; Enable protected mode and jump to the kernel, which is identity mapped
+	mov eax, cr0
+	or eax, 1
+	mov cr0, eax
+	jmp dword 0x08:ap_start32
+
+ALIGN 8
+trampoline_gdt:
+	dq 0
+	dq 0x00cf9a000000ffff	; 0x08: Code, flat
+	dq 0x00cf92000000ffff	; 0x10: Data, flat
+trampoline_gdtr:
+	dw 3 * 8 - 1
+	dd TRAMPOLINE_ADDR + REL(trampoline_gdt)
+smp_trampoline_end:
+
+[BITS 32]
+ap_start32:
+	mov ax, 0x10
+	mov ds, ax
+	mov es, ax
+	mov fs, ax
+	mov gs, ax
+	mov ss, ax
+
+	; Enable SSE instructions, same as in i386-boot.asm
+	mov eax, cr0
+	and ax, 0xFFFB		;clear coprocessor emulation CR0.EM
+	or ax, 0x2			;set coprocessor monitoring  CR0.MP
+	mov cr0, eax
+	mov eax, cr4
+	or ax, 3 << 9		;set CR4.OSFXSR and CR4.OSXMMEXCPT at the same time
+	mov cr4, eax
+
+	; Enable paging using the kernel paging context
+	mov eax, [paging_kernel_ctx]
+	mov cr3, eax
+	mov eax, cr0
+	or eax, 0x80000000
+	mov cr0, eax
+
+	; Stack allocated by the BSP for this processor
+	mov esp, [smp_ap_stack]
+	xor ebp, ebp
+	call smp_ap_main
+
+.il:
+	hlt
+	jmp .il
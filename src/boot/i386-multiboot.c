@@ -26,6 +26,10 @@ static struct multiboot_tag_mmap* mmap_info = NULL;
 static struct multiboot_tag_basic_meminfo* mem_info = NULL;
 static struct multiboot_tag_framebuffer framebuffer_info;
 
+// Copy of the ACPI RSDP. Large enough for the ACPI 2.0+ version
+static uint8_t acpi_rsdp[36];
+static bool acpi_rsdp_new = false;
+
 /* These are set by i386-boot.asm right after boot */
 uint32_t multiboot_magic;
 void* multiboot_header;
@@ -93,6 +97,10 @@ char* multiboot_get_cmdline(void) {
 	return cmdline;
 }
 
+void* multiboot_get_acpi_rsdp(void) {
+	return *acpi_rsdp ? acpi_rsdp : NULL;
+}
+
 static int extract_symtab(struct multiboot_tag_elf_sections* multiboot_tag) {
 	int r = -2;
 	struct elf_section* elf_section = (struct elf_section*)multiboot_tag->sections;
@@ -169,6 +177,16 @@ void multiboot_init(void) {
 			case MULTIBOOT_TAG_TYPE_FRAMEBUFFER:
 				memcpy(&framebuffer_info, tag, sizeof(framebuffer_info));
 				break;
+			case MULTIBOOT_TAG_TYPE_ACPI_NEW:
+			case MULTIBOOT_TAG_TYPE_ACPI_OLD:
+				// Prefer the ACPI 2.0 RSDP if the bootloader passes both
+				if(acpi_rsdp_new && tag->type == MULTIBOOT_TAG_TYPE_ACPI_OLD) {
+					break;
+				}
+
+				memcpy(acpi_rsdp, (void*)(tag + 1), MIN(sizeof(acpi_rsdp), tag->size - sizeof(struct multiboot_tag)));
+				acpi_rsdp_new = tag->type == MULTIBOOT_TAG_TYPE_ACPI_NEW;
+				break;
 		}
 
 		log(LOG_INFO, "  %#p size %-4d %-18s %s\n", tag, tag->size, tag_type_names[tag->type], strrep);
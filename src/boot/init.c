@@ -30,10 +30,15 @@
 #include <bsp/timer.h>
 #include <fs/vfs.h>
 #include <tasks/scheduler.h>
+#include <tasks/workqueue.h>
 #include <gfx/gfx.h>
 #include <tty/term.h>
 #include <tty/console.h>
 #include <bsp/i386-pci.h>
+#include <bsp/acpi.h>
+#include <bsp/clocksource.h>
+#include <bsp/i386-apic.h>
+#include <bsp/i386-smp.h>
 #include <tasks/syscall.h>
 #include <tasks/exception.h>
 #include <mem/mem.h>
@@ -59,8 +64,20 @@ void (*boot_sequence[])(void) = {
      */
 
 	serial_init,  multiboot_init, gdt_init, mem_init, paging_init, int_init, task_exception_init,
-	timer_init, mem_late_init, cmdline_init, gfx_init, term_init, time_init, pci_init,
-	block_init, vfs_init, timer_init2, task_init
+	timer_init, mem_late_init, cmdline_init, gfx_init, term_init, time_init,
+	timer_init2, acpi_init, clocksource_init,
+#ifdef CONFIG_IRQSOFF_TRACE
+	irqsoff_init,
+#endif
+#ifdef CONFIG_APIC
+	// Before the drivers, so they can use MSI
+	apic_init,
+#endif
+	pci_init, block_init, vfs_init,
+#ifdef CONFIG_SMP
+	smp_init,
+#endif
+	task_init, workqueue_init
 #endif
 };
 
@@ -358,6 +358,7 @@ struct multiboot_tag_framebuffer* multiboot_get_framebuffer(void);
 struct elf_sym* multiboot_get_symtab(size_t* length);
 char* multiboot_get_strtab(size_t* length);
 char* multiboot_get_cmdline(void);
+void* multiboot_get_acpi_rsdp(void);
 
 #endif /* ! MULTIBOOT_HEADER */
 
@@ -0,0 +1,122 @@
+/* acpi.c: Minimal ACPI table lookup
+ * Copyright © 2023 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "acpi.h"
+#include <boot/multiboot.h>
+#include <mem/vm.h>
+#include <mem/kmalloc.h>
+#include <string.h>
+#include <log.h>
+
+/* Pointers to the physical addresses of all tables in the RSDT/XSDT. The
+ * tables themselves only get mapped when they are requested.
+ */
+static uint32_t* tables = NULL;
+static uint32_t num_tables = 0;
+
+static bool checksum_ok(void* data, size_t length) {
+	uint8_t sum = 0;
+	for(size_t i = 0; i < length; i++) {
+		sum += ((uint8_t*)data)[i];
+	}
+	return !sum;
+}
+
+// ACPI tables don't need to be page aligned, so map the surrounding pages
+static void* map_phys(uintptr_t phys, size_t size, vm_alloc_t* alloc) {
+	uintptr_t base = ALIGN_DOWN(phys, PAGE_SIZE);
+	size_t pages = RDIV(phys - base + size, PAGE_SIZE);
+
+	void* virt = vm_alloc(VM_KERNEL, alloc, pages, (void*)base, VM_RW);
+	if(!virt) {
+		return NULL;
+	}
+	return virt + (phys - base);
+}
+
+static void* map_table(uintptr_t phys) {
+	vm_alloc_t alloc;
+	struct acpi_header* header = map_phys(phys, sizeof(struct acpi_header), &alloc);
+	if(!header) {
+		return NULL;
+	}
+
+	uint32_t length = header->length;
+	vm_free(&alloc);
+
+	header = map_phys(phys, length, &alloc);
+	if(!header) {
+		return NULL;
+	}
+
+	if(!checksum_ok(header, length)) {
+		log(LOG_WARN, "acpi: Invalid checksum for table %.4s at %#x\n", header->signature, phys);
+		vm_free(&alloc);
+		return NULL;
+	}
+	return header;
+}
+
+/* Returns a pointer to the ACPI table with the given signature, or NULL if
+ * the table doesn't exist. Tables stay mapped.
+ */
+void* acpi_find_table(const char* signature) {
+	for(uint32_t i = 0; i < num_tables; i++) {
+		struct acpi_header* header = map_table(tables[i]);
+		if(!header) {
+			continue;
+		}
+
+		if(!strncmp(header->signature, signature, 4)) {
+			return header;
+		}
+		vm_free(vm_get(VM_KERNEL, header, false));
+	}
+	return NULL;
+}
+
+void acpi_init(void) {
+	struct acpi_rsdp* rsdp = multiboot_get_acpi_rsdp();
+	if(!rsdp) {
+		log(LOG_INFO, "acpi: No RSDP passed by bootloader\n");
+		return;
+	}
+
+	// Only use the XSDT if it's in the 32 bit address space
+	bool xsdt = rsdp->revision >= 2 && rsdp->xsdt_address && rsdp->xsdt_address < 0x100000000;
+	uintptr_t sdt_phys = xsdt ? (uintptr_t)rsdp->xsdt_address : rsdp->rsdt_address;
+
+	struct acpi_header* sdt = map_table(sdt_phys);
+	if(!sdt) {
+		log(LOG_WARN, "acpi: Could not map %s at %#x\n", xsdt ? "XSDT" : "RSDT", sdt_phys);
+		return;
+	}
+
+	uint32_t entry_size = xsdt ? 8 : 4;
+	num_tables = (sdt->length - sizeof(struct acpi_header)) / entry_size;
+	tables = kmalloc(sizeof(uint32_t) * num_tables);
+
+	// Both are little endian, so the low half of the XSDT entries can be used as-is
+	for(uint32_t i = 0; i < num_tables; i++) {
+		tables[i] = *(uint32_t*)((void*)(sdt + 1) + i * entry_size);
+	}
+
+	log(LOG_INFO, "acpi: %.6s revision %d, %d tables in %s\n", rsdp->oem_id,
+		rsdp->revision, num_tables, xsdt ? "XSDT" : "RSDT");
+}
@@ -0,0 +1,310 @@
+/* clocksource.c: High resolution monotonic clock
+ * Copyright © 2023 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "clocksource.h"
+#include <bsp/acpi.h>
+#include <bsp/timer.h>
+#include <int/int.h>
+#include <fs/sysfs.h>
+#include <mem/vm.h>
+#include <cmdline.h>
+#include <portio.h>
+#include <string.h>
+#include <prof.h>
+#include <log.h>
+
+#define HPET_CAPS 0x0
+#define HPET_CONFIG 0x10
+#define HPET_COUNTER 0xf0
+
+#define HPET_CAPS_COUNT_64 (1 << 13)
+#define HPET_CONFIG_ENABLE 1
+
+// Maximum counter period allowed by the HPET specification, 100 ns
+#define HPET_MAX_PERIOD 100000000
+
+#define PM_TIMER_FREQUENCY 3579545
+
+// Duration of the TSC calibration against HPET or PM timer in ms
+#define CALIBRATE_MS 50
+
+/* The monotonic clock is the time since boot in nanoseconds. Until
+ * clocksource_init has run, it is derived from the timer tick. After that,
+ * it is the value at the time the clock source was selected plus the
+ * cycles elapsed on the clock source.
+ *
+ * Most clock sources wrap around quickly (the 24 bit PM timer every 4.7
+ * seconds), so the elapsed cycles are accumulated in clocksource_update on
+ * every timer interrupt. Readers retry if seq is odd or has changed while
+ * they were reading, like with the time page.
+ */
+static struct clocksource* current = NULL;
+static volatile uint32_t seq;
+static uint64_t last;
+static uint64_t cycles;
+static uint64_t offset;
+
+static volatile void* hpet;
+static uint16_t pm_port;
+
+static uint64_t tsc_read(void) {
+	return profile_read_rdtsc();
+}
+
+static uint64_t hpet_read32(void) {
+	return *(volatile uint32_t*)(hpet + HPET_COUNTER);
+}
+
+// The upper half could change between the two reads, so retry if it does
+static uint64_t hpet_read64(void) {
+	uint32_t high;
+	uint32_t low;
+
+	do {
+		high = *(volatile uint32_t*)(hpet + HPET_COUNTER + 4);
+		low = *(volatile uint32_t*)(hpet + HPET_COUNTER);
+	} while(high != *(volatile uint32_t*)(hpet + HPET_COUNTER + 4));
+	return (uint64_t)high << 32 | low;
+}
+
+static uint64_t pm_read(void) {
+	return inl(pm_port);
+}
+
+static struct clocksource tsc_source = {
+	.name = "tsc",
+	.read = tsc_read,
+	.mask = ~0ULL,
+};
+
+static struct clocksource hpet_source = {
+	.name = "hpet",
+	.read = hpet_read32,
+	.mask = 0xffffffff,
+};
+
+static struct clocksource pm_source = {
+	.name = "acpi_pm",
+	.read = pm_read,
+	.mask = 0xffffff,
+};
+
+/* Cycles since the last update. The TSCs of different CPUs are not
+ * necessarily in sync, so a reader on another CPU might see a counter value
+ * slightly before last. Treat that as no time having passed instead of a
+ * wraparound.
+ */
+static inline uint64_t elapsed(uint64_t now) {
+	uint64_t delta = (now - last) & current->mask;
+	return delta > current->mask / 2 ? 0 : delta;
+}
+
+static uint64_t tick_ns(void) {
+	return (uint64_t)timer_get_tick() * NSEC_PER_SEC / timer_get_rate();
+}
+
+// Nanoseconds since boot
+uint64_t clock_get_ns(void) {
+	if(!current) {
+		return tick_ns();
+	}
+
+	uint32_t start;
+	uint64_t ns;
+	do {
+		start = seq;
+		asm volatile("" ::: "memory");
+		ns = offset + clocksource_cycles_to_ns(cycles + elapsed(current->read()),
+			current->freq);
+		asm volatile("" ::: "memory");
+	} while((start & 1) || start != seq);
+	return ns;
+}
+
+const char* clocksource_name(void) {
+	return current ? current->name : "tick";
+}
+
+// Called by the timer interrupt handler
+void clocksource_update(void) {
+	if(!current) {
+		return;
+	}
+
+	seq++;
+	asm volatile("" ::: "memory");
+	uint64_t now = current->read();
+	cycles += elapsed(now);
+	last = now;
+	asm volatile("" ::: "memory");
+	seq++;
+}
+
+static void set_source(struct clocksource* source) {
+	bool ints = int_save();
+	offset = clock_get_ns();
+	cycles = 0;
+	last = source->read();
+	current = source;
+	int_restore(ints);
+
+	log(LOG_INFO, "clocksource: Using %s at %llu Hz\n", source->name, source->freq);
+}
+
+/* Invariant TSCs run at a constant rate regardless of power states and
+ * frequency scaling.
+ */
+static bool tsc_invariant(void) {
+	uint32_t eax = 0x80000000;
+	uint32_t ebx;
+	uint32_t ecx = 0;
+	uint32_t edx;
+	asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+	if(eax < 0x80000007) {
+		return false;
+	}
+
+	eax = 0x80000007;
+	ecx = 0;
+	asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+	return edx & (1 << 8);
+}
+
+static bool hpet_probe(void) {
+	struct acpi_hpet* table = acpi_find_table("HPET");
+	if(!table) {
+		return false;
+	}
+
+	uint64_t phys = table->address.address;
+	if(table->address.space_id != ACPI_GAS_MEMORY || !phys || phys >= 0x100000000) {
+		return false;
+	}
+
+	hpet = vm_alloc(VM_KERNEL, NULL, 1, (void*)(uintptr_t)phys, VM_RW);
+	if(!hpet) {
+		return false;
+	}
+
+	uint32_t caps = *(volatile uint32_t*)(hpet + HPET_CAPS);
+	uint32_t period = *(volatile uint32_t*)(hpet + HPET_CAPS + 4);
+	if(!period || period > HPET_MAX_PERIOD) {
+		log(LOG_WARN, "clocksource: Invalid HPET period %u fs\n", period);
+		return false;
+	}
+
+	if(caps & HPET_CAPS_COUNT_64) {
+		hpet_source.read = hpet_read64;
+		hpet_source.mask = ~0ULL;
+	}
+
+	hpet_source.freq = 1000000000000000ULL / period;
+	*(volatile uint32_t*)(hpet + HPET_CONFIG) |= HPET_CONFIG_ENABLE;
+	return true;
+}
+
+static bool pm_probe(void) {
+	struct acpi_fadt* fadt = acpi_find_table("FACP");
+	if(!fadt || !fadt->pm_tmr_blk || fadt->pm_tmr_len < 4) {
+		return false;
+	}
+
+	pm_port = fadt->pm_tmr_blk;
+	if(fadt->flags & ACPI_FADT_TMR_VAL_EXT) {
+		pm_source.mask = 0xffffffff;
+	}
+	pm_source.freq = PM_TIMER_FREQUENCY;
+	return true;
+}
+
+/* timer_init2 has measured the TSC against the PIT over only a few ticks.
+ * Measure it again against a better reference.
+ */
+static void calibrate_tsc(struct clocksource* ref) {
+	uint64_t ref_cycles = ref->freq * CALIBRATE_MS / 1000;
+
+	bool ints = int_save();
+	uint64_t ref_start = ref->read();
+	uint64_t tsc_start = profile_read_rdtsc();
+	int_restore(ints);
+
+	uint64_t ref_delta;
+	uint64_t tsc_end;
+	do {
+		ints = int_save();
+		ref_delta = (ref->read() - ref_start) & ref->mask;
+		tsc_end = profile_read_rdtsc();
+		int_restore(ints);
+	} while(ref_delta < ref_cycles);
+
+	uint32_t khz = (tsc_end - tsc_start) * ref->freq / ref_delta / 1000;
+	log(LOG_INFO, "clocksource: TSC frequency %u kHz using %s\n", khz, ref->name);
+	timer_set_tsc_khz(khz);
+}
+
+static size_t sfs_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
+	if(ctx->fp->offset) {
+		return 0;
+	}
+
+	size_t rsize = 0;
+	sysfs_printf("%s %llu %llu", clocksource_name(),
+		current ? current->freq : (uint64_t)timer_get_rate(), clock_get_ns());
+	return rsize;
+}
+
+void clocksource_init(void) {
+	bool have_hpet = hpet_probe();
+	bool have_pm = pm_probe();
+	struct clocksource* ref = have_hpet ? &hpet_source : (have_pm ? &pm_source : NULL);
+
+	bool tsc_ok = tsc_invariant();
+	if(tsc_ok && ref) {
+		calibrate_tsc(ref);
+	}
+	tsc_source.freq = (uint64_t)timer_get_tsc_khz() * 1000;
+
+	// A TSC that changes its rate is only used if there is nothing else
+	struct clocksource* source = tsc_ok ? &tsc_source : ref;
+	if(!source && tsc_source.freq) {
+		source = &tsc_source;
+	}
+
+	// Allow overriding the choice on the command line
+	char* name = cmdline_get("clocksource");
+	if(name) {
+		struct clocksource* sources[] = {&tsc_source, &hpet_source, &pm_source};
+		for(int i = 0; i < ARRAY_SIZE(sources); i++) {
+			if(!strcmp(name, sources[i]->name) && sources[i]->freq) {
+				source = sources[i];
+			}
+		}
+	}
+
+	if(source && source->freq) {
+		set_source(source);
+	} else {
+		log(LOG_WARN, "clocksource: No usable clock source, using timer tick\n");
+	}
+
+	struct vfs_callbacks sfs_cb = {
+		.read = sfs_read,
+	};
+	sysfs_add_file("clocksource", &sfs_cb);
+}
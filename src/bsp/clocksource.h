@@ -0,0 +1,46 @@
+#pragma once
+
+/* Copyright © 2023 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define NSEC_PER_SEC 1000000000ULL
+
+// A free-running hardware counter
+struct clocksource {
+	const char* name;
+	uint64_t (*read)(void);
+
+	// Bits implemented by the counter, it wraps around after reaching mask
+	uint64_t mask;
+
+	// Counter frequency in Hz
+	uint64_t freq;
+};
+
+static inline uint64_t clocksource_cycles_to_ns(uint64_t cycles, uint64_t freq) {
+	// Split up to avoid overflowing for large cycle counts
+	return cycles / freq * NSEC_PER_SEC + cycles % freq * NSEC_PER_SEC / freq;
+}
+
+uint64_t clock_get_ns(void);
+const char* clocksource_name(void);
+void clocksource_update(void);
+void clocksource_init(void);
@@ -0,0 +1,125 @@
+/* i386-apic.c: Local APIC and IO-APIC setup, interrupt vector allocation
+ * Copyright © 2023 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef CONFIG_APIC
+
+#include "i386-apic.h"
+#include <bsp/acpi.h>
+#include <bsp/i386-lapic.h>
+#include <bsp/i386-ioapic.h>
+#include <bsp/i386-smp.h>
+#include <bsp/timer.h>
+#include <int/int.h>
+#include <int/i386-idt.h>
+#include <log.h>
+
+static bool vectors_used[APIC_MSI_VECTOR_LAST - APIC_MSI_VECTOR_FIRST + 1];
+
+/* Allocate an interrupt vector for a device that signals its interrupts
+ * directly to the local APIC, as with MSI. Returns -1 if the APIC is not in
+ * use or all vectors are taken.
+ */
+int apic_alloc_vector(void) {
+	if(!lapic_active()) {
+		return -1;
+	}
+
+	for(int i = 0; i < ARRAY_SIZE(vectors_used); i++) {
+		if(!vectors_used[i]) {
+			vectors_used[i] = true;
+			return APIC_MSI_VECTOR_FIRST + i;
+		}
+	}
+	return -1;
+}
+
+void apic_free_vector(int vector) {
+	if(apic_is_msi_vector(vector)) {
+		vectors_used[vector - APIC_MSI_VECTOR_FIRST] = false;
+	}
+}
+
+// Whether the interrupt needs to be acknowledged to the local APIC
+bool apic_int_needs_eoi(uint32_t intr) {
+	if(!lapic_active()) {
+		return false;
+	}
+
+	if(intr == LAPIC_TIMER_VECTOR || apic_is_msi_vector(intr)) {
+		return true;
+	}
+
+	#ifdef CONFIG_SMP
+	if(intr == IPI_RESCHEDULE || intr == IPI_TLB_SHOOTDOWN) {
+		return true;
+	}
+	#endif
+	return !idt_pic_active && intr >= IRQ(0) && intr <= IRQ(15);
+}
+
+static void parse_madt(struct acpi_madt* madt, uintptr_t* ioapic_addr, uint32_t* gsi_base) {
+	void* end = (void*)madt + madt->header.length;
+	struct acpi_madt_entry* entry = (struct acpi_madt_entry*)madt->entries;
+
+	for(; (void*)entry < end && entry->length; entry = (void*)entry + entry->length) {
+		switch(entry->type) {
+			case ACPI_MADT_IOAPIC:;
+				// Only the first IO-APIC is used, which has the ISA IRQs
+				struct acpi_madt_ioapic* ioapic = (struct acpi_madt_ioapic*)entry;
+				if(!*ioapic_addr) {
+					*ioapic_addr = ioapic->address;
+					*gsi_base = ioapic->gsi_base;
+				}
+				break;
+			case ACPI_MADT_ISO:;
+				struct acpi_madt_iso* iso = (struct acpi_madt_iso*)entry;
+				if(!iso->bus) {
+					ioapic_add_override(iso->source, iso->gsi, iso->flags);
+				}
+				break;
+		}
+	}
+}
+
+void apic_init(void) {
+	struct acpi_madt* madt = acpi_find_table("APIC");
+	if(!madt) {
+		log(LOG_INFO, "apic: No MADT, using PIC and PIT\n");
+		return;
+	}
+
+	lapic_init(madt->lapic_address);
+
+	uintptr_t ioapic_addr = 0;
+	uint32_t gsi_base = 0;
+	parse_madt(madt, &ioapic_addr, &gsi_base);
+
+	/* Route the ISA IRQs through the IO-APIC to the BSP. Without an IO-APIC,
+	 * keep using the PIC, which is wired to the BSP anyway.
+	 */
+	if(ioapic_addr) {
+		ioapic_init(ioapic_addr, gsi_base);
+		idt_disable_pic();
+		ioapic_route_isa(lapic_get_id());
+	}
+
+	timer_use_lapic();
+}
+
+#endif /* CONFIG_APIC */
@@ -0,0 +1,33 @@
+#pragma once
+
+/* Copyright © 2023 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Vectors handed out to PCI devices for MSI/MSI-X
+#define APIC_MSI_VECTOR_FIRST 0x40
+#define APIC_MSI_VECTOR_LAST 0x7f
+
+#define apic_is_msi_vector(intr) ((intr) >= APIC_MSI_VECTOR_FIRST && (intr) <= APIC_MSI_VECTOR_LAST)
+
+int apic_alloc_vector(void);
+void apic_free_vector(int vector);
+bool apic_int_needs_eoi(uint32_t intr);
+void apic_init(void);
@@ -0,0 +1,139 @@
+/* i386-ioapic.c: I/O APIC
+ * Copyright © 2023 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef CONFIG_APIC
+
+#include "i386-ioapic.h"
+#include <int/int.h>
+#include <stdbool.h>
+#include <mem/vm.h>
+#include <panic.h>
+#include <log.h>
+
+#define REG_SELECT 0x0
+#define REG_WINDOW 0x10
+
+#define IOAPIC_VERSION 0x1
+#define IOAPIC_REDTBL(n) (0x10 + (n) * 2)
+
+#define REDTBL_ACTIVE_LOW (1 << 13)
+#define REDTBL_LEVEL (1 << 15)
+#define REDTBL_MASKED (1 << 16)
+
+// Flags of MADT interrupt source overrides
+#define ISO_POLARITY_MASK 0x3
+#define ISO_POLARITY_LOW 0x3
+#define ISO_TRIGGER_MASK 0xc
+#define ISO_TRIGGER_LEVEL 0xc
+
+static volatile uint32_t* ioapic = NULL;
+static uint32_t gsi_base;
+static uint32_t num_pins;
+
+/* Maps ISA IRQs to global system interrupts. Unless there is an override,
+ * these are identity mapped, edge triggered and active high.
+ */
+static struct {
+	bool override;
+	uint32_t gsi;
+	uint16_t flags;
+} isa_irqs[16];
+
+static uint32_t reg_read(uint8_t reg) {
+	ioapic[REG_SELECT / 4] = reg;
+	return ioapic[REG_WINDOW / 4];
+}
+
+static void reg_write(uint8_t reg, uint32_t value) {
+	ioapic[REG_SELECT / 4] = reg;
+	ioapic[REG_WINDOW / 4] = value;
+}
+
+// Whether another ISA IRQ has been moved to the pin of this one
+static bool gsi_taken(int irq) {
+	for(int i = 0; i < ARRAY_SIZE(isa_irqs); i++) {
+		if(i != irq && isa_irqs[i].override && isa_irqs[i].gsi == isa_irqs[irq].gsi) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void set_redirect(uint32_t pin, uint8_t vector, uint8_t dest, uint32_t flags) {
+	reg_write(IOAPIC_REDTBL(pin) + 1, dest << 24);
+	reg_write(IOAPIC_REDTBL(pin), vector | flags);
+}
+
+void ioapic_add_override(uint8_t irq, uint32_t gsi, uint16_t flags) {
+	if(irq >= ARRAY_SIZE(isa_irqs)) {
+		return;
+	}
+
+	isa_irqs[irq].override = true;
+	isa_irqs[irq].gsi = gsi;
+	isa_irqs[irq].flags = flags;
+}
+
+/* Route the legacy ISA IRQs to the same vectors the PIC used, so existing
+ * interrupt handlers keep working. All interrupts get delivered to one CPU.
+ */
+void ioapic_route_isa(uint8_t lapic_id) {
+	for(int irq = 0; irq < ARRAY_SIZE(isa_irqs); irq++) {
+		if(!isa_irqs[irq].override) {
+			isa_irqs[irq].gsi = irq;
+			if(gsi_taken(irq)) {
+				continue;
+			}
+		}
+
+		uint32_t pin = isa_irqs[irq].gsi - gsi_base;
+		if(isa_irqs[irq].gsi < gsi_base || pin >= num_pins) {
+			continue;
+		}
+
+		uint32_t flags = 0;
+		uint16_t iso_flags = isa_irqs[irq].flags;
+		if((iso_flags & ISO_POLARITY_MASK) == ISO_POLARITY_LOW) {
+			flags |= REDTBL_ACTIVE_LOW;
+		}
+		if((iso_flags & ISO_TRIGGER_MASK) == ISO_TRIGGER_LEVEL) {
+			flags |= REDTBL_LEVEL;
+		}
+
+		set_redirect(pin, IRQ(irq), lapic_id, flags);
+	}
+}
+
+void ioapic_init(uintptr_t phys, uint32_t base) {
+	ioapic = vm_alloc(VM_KERNEL, NULL, 1, (void*)phys, VM_RW);
+	if(!ioapic) {
+		panic("ioapic: Could not map registers\n");
+	}
+
+	gsi_base = base;
+	num_pins = ((reg_read(IOAPIC_VERSION) >> 16) & 0xff) + 1;
+
+	for(uint32_t i = 0; i < num_pins; i++) {
+		set_redirect(i, 0, 0, REDTBL_MASKED);
+	}
+
+	log(LOG_INFO, "ioapic: Registers at %#x, %d pins starting at GSI %d\n", phys, num_pins, gsi_base);
+}
+
+#endif /* CONFIG_APIC */
@@ -0,0 +1,172 @@
+/* i386-lapic.c: Local APIC
+ * Copyright © 2023 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef CONFIG_APIC
+
+#include "i386-lapic.h"
+#include <bsp/clocksource.h>
+#include <int/int.h>
+#include <mem/vm.h>
+#include <panic.h>
+#include <log.h>
+
+#define REG_ID 0x20
+#define REG_TPR 0x80
+#define REG_EOI 0xb0
+#define REG_SVR 0xf0
+#define REG_ESR 0x280
+#define REG_ICR_LOW 0x300
+#define REG_ICR_HIGH 0x310
+#define REG_LVT_TIMER 0x320
+#define REG_TIMER_INITIAL 0x380
+#define REG_TIMER_CURRENT 0x390
+#define REG_TIMER_DIVIDE 0x3e0
+
+#define SVR_ENABLE 0x100
+#define ICR_FIXED 0x0
+#define ICR_INIT 0x500
+#define ICR_STARTUP 0x600
+#define ICR_PENDING 0x1000
+#define ICR_ASSERT 0x4000
+#define ICR_ALL_EXCLUDING_SELF 0xc0000
+
+#define LVT_MASKED (1 << 16)
+#define LVT_TIMER_PERIODIC (1 << 17)
+#define TIMER_DIVIDE_16 0x3
+
+// Duration of the timer calibration in ns
+#define CALIBRATE_NS 20000000
+
+static volatile uint32_t* lapic = NULL;
+
+static inline uint32_t reg_read(uint32_t reg) {
+	return lapic[reg / 4];
+}
+
+static inline void reg_write(uint32_t reg, uint32_t value) {
+	lapic[reg / 4] = value;
+}
+
+bool lapic_active(void) {
+	return lapic != NULL;
+}
+
+void lapic_eoi(void) {
+	reg_write(REG_EOI, 0);
+}
+
+uint8_t lapic_get_id(void) {
+	return reg_read(REG_ID) >> 24;
+}
+
+static void send(uint8_t dest, uint32_t command) {
+	// The ICR is written in two steps, so don't let an interrupt handler interfere
+	bool ints = int_save();
+	reg_write(REG_ICR_HIGH, dest << 24);
+	reg_write(REG_ICR_LOW, command);
+
+	while(reg_read(REG_ICR_LOW) & ICR_PENDING) {
+		asm volatile("pause");
+	}
+	int_restore(ints);
+}
+
+void lapic_send_ipi(uint8_t dest, uint8_t vector) {
+	send(dest, ICR_FIXED | ICR_ASSERT | vector);
+}
+
+void lapic_send_ipi_others(uint8_t vector) {
+	send(0, ICR_FIXED | ICR_ASSERT | ICR_ALL_EXCLUDING_SELF | vector);
+}
+
+void lapic_send_init(uint8_t dest) {
+	send(dest, ICR_INIT | ICR_ASSERT);
+}
+
+// addr is the physical address of the startup code and needs to be page aligned
+void lapic_send_startup(uint8_t dest, uintptr_t addr) {
+	send(dest, ICR_STARTUP | ICR_ASSERT | (addr >> 12));
+}
+
+// Called on every CPU
+void lapic_enable(void) {
+	reg_write(REG_TPR, 0);
+	reg_write(REG_SVR, SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+
+	// Writing clears the error status
+	reg_write(REG_ESR, 0);
+	reg_write(REG_ESR, 0);
+}
+
+/* The timer counts down from the initial count at the bus clock divided by
+ * 16, and raises LAPIC_TIMER_VECTOR when it reaches 0. In periodic mode, it
+ * then starts over. Each CPU has its own timer.
+ */
+void lapic_timer_periodic(uint32_t count) {
+	reg_write(REG_TIMER_DIVIDE, TIMER_DIVIDE_16);
+	reg_write(REG_LVT_TIMER, LAPIC_TIMER_VECTOR | LVT_TIMER_PERIODIC);
+	reg_write(REG_TIMER_INITIAL, count);
+}
+
+void lapic_timer_oneshot(uint32_t count) {
+	reg_write(REG_TIMER_DIVIDE, TIMER_DIVIDE_16);
+	reg_write(REG_LVT_TIMER, LAPIC_TIMER_VECTOR);
+	reg_write(REG_TIMER_INITIAL, count);
+}
+
+uint32_t lapic_timer_read(void) {
+	return reg_read(REG_TIMER_CURRENT);
+}
+
+/* Returns the timer frequency in Hz, measured against the clock source. The
+ * bus clock is the same on all CPUs, so this only needs to be done once.
+ */
+uint32_t lapic_timer_calibrate(void) {
+	reg_write(REG_TIMER_DIVIDE, TIMER_DIVIDE_16);
+	reg_write(REG_LVT_TIMER, LVT_MASKED);
+
+	bool ints = int_save();
+	uint64_t start = clock_get_ns();
+	reg_write(REG_TIMER_INITIAL, 0xffffffff);
+	int_restore(ints);
+
+	uint64_t elapsed;
+	uint32_t count;
+	do {
+		ints = int_save();
+		elapsed = clock_get_ns() - start;
+		count = reg_read(REG_TIMER_CURRENT);
+		int_restore(ints);
+	} while(elapsed < CALIBRATE_NS && count);
+
+	reg_write(REG_TIMER_INITIAL, 0);
+	return (uint64_t)(0xffffffff - count) * NSEC_PER_SEC / elapsed;
+}
+
+void lapic_init(uintptr_t phys) {
+	lapic = vm_alloc(VM_KERNEL, NULL, 1, (void*)phys, VM_RW);
+	if(!lapic) {
+		panic("lapic: Could not map registers\n");
+	}
+
+	lapic_enable();
+	log(LOG_INFO, "lapic: Registers at %#x, BSP APIC ID %d\n", phys, lapic_get_id());
+}
+
+#endif /* CONFIG_APIC */
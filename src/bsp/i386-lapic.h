@@ -0,0 +1,39 @@
+#pragma once
+
+/* Copyright © 2023 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define LAPIC_TIMER_VECTOR 0xf2
+#define LAPIC_SPURIOUS_VECTOR 0xff
+
+bool lapic_active(void);
+void lapic_eoi(void);
+uint8_t lapic_get_id(void);
+void lapic_send_ipi(uint8_t dest, uint8_t vector);
+void lapic_send_ipi_others(uint8_t vector);
+void lapic_send_init(uint8_t dest);
+void lapic_send_startup(uint8_t dest, uintptr_t addr);
+void lapic_timer_periodic(uint32_t count);
+void lapic_timer_oneshot(uint32_t count);
+uint32_t lapic_timer_read(void);
+uint32_t lapic_timer_calibrate(void);
+void lapic_enable(void);
+void lapic_init(uintptr_t phys);
@@ -18,7 +18,9 @@
  */
 
 #include <bsp/i386-pci.h>
+#include <bsp/i386-lapic.h>
 #include <mem/kmalloc.h>
+#include <mem/vm.h>
 #include <fs/sysfs.h>
 #include <string.h>
 #include <panic.h>
@@ -29,14 +31,31 @@
 #define PORT_CONFIG_DATA  0x0CFC
 
 #define CONFIG_HEADER_DEVICE   2
+#define CONFIG_HEADER_COMMAND  4
+#define CONFIG_HEADER_STATUS   6
 #define CONFIG_HEADER_REVISION 8
 #define CONFIG_HEADER_PROG_IF  9
 #define CONFIG_HEADER_SUBCLASS 10
 #define CONFIG_HEADER_CLASS    11
 #define CONFIG_HEADER_TYPE     15
+#define CONFIG_HEADER_CAPS     0x34
 #define CONFIG_HEADER_INT_LINE 0x3c
 #define CONFIG_HEADER_INT_PIN  0x3d
 
+#define COMMAND_BUS_MASTER (1 << 2)
+#define COMMAND_INT_DISABLE (1 << 10)
+#define STATUS_CAPS (1 << 4)
+
+#define MSI_ENABLE 1
+#define MSI_MULTIPLE_ENABLE 0x70
+#define MSI_64BIT (1 << 7)
+#define MSIX_TABLE_SIZE 0x7ff
+#define MSIX_FUNCTION_MASK (1 << 14)
+#define MSIX_ENABLE (1 << 15)
+
+// Fixed delivery of an edge triggered interrupt to the local APIC with this ID
+#define MSI_ADDRESS(apic_id) (0xfee00000 | ((apic_id) << 12))
+
 #define get_address(bus, dev, func, offset) (0x80000000 | (bus << 16) | \
 	(dev << 11) | (func << 8) | (offset & 0xFC))
 
@@ -76,6 +95,125 @@ uint32_t pci_get_bar(pci_device_t* device, uint8_t bar) {
 	return pci_config_read(device, _register, 4);
 }
 
+// Returns the config space offset of a capability, or 0 if the device lacks it
+uint8_t pci_find_cap(pci_device_t* dev, uint8_t id) {
+	if((dev->header_type & 0x7f) != 0 || !(pci_config_read(dev, CONFIG_HEADER_STATUS, 2) & STATUS_CAPS)) {
+		return 0;
+	}
+
+	uint8_t offset = pci_config_read(dev, CONFIG_HEADER_CAPS, 1) & 0xfc;
+
+	// Limit the number of iterations in case the list loops
+	for(int i = 0; offset && i < 48; i++) {
+		if(pci_config_read(dev, offset, 1) == id) {
+			return offset;
+		}
+		offset = pci_config_read(dev, offset + 1, 1) & 0xfc;
+	}
+	return 0;
+}
+
+#ifdef CONFIG_APIC
+/* Config space writes are always 32 bits wide. For the command register,
+ * leave the status bits in the upper half at 0, as writing 1 clears them.
+ */
+static void set_command(pci_device_t* dev, uint16_t set, uint16_t clear) {
+	uint16_t command = pci_config_read(dev, CONFIG_HEADER_COMMAND, 2);
+	pci_config_write(dev, CONFIG_HEADER_COMMAND, (command | set) & ~clear);
+}
+
+// The message control register is in the upper half of the capability header
+static void set_msg_control(pci_device_t* dev, uint8_t cap, uint16_t control) {
+	uint32_t header = pci_config_read(dev, cap, 4);
+	pci_config_write(dev, cap, (header & 0xffff) | (uint32_t)control << 16);
+}
+
+/* Message signaled interrupts are memory writes by the device to the local
+ * APIC, so they need bus mastering. They replace the legacy interrupt line.
+ * The drivers get initialized on the boot processor, which also receives
+ * the interrupts.
+ */
+int pci_enable_msi(pci_device_t* dev, uint8_t vector) {
+	uint8_t cap = pci_find_cap(dev, PCI_CAP_MSI);
+	if(!cap || !lapic_active()) {
+		return -1;
+	}
+
+	uint16_t control = pci_config_read(dev, cap + 2, 2);
+	pci_config_write(dev, cap + 4, MSI_ADDRESS(lapic_get_id()));
+	if(control & MSI_64BIT) {
+		pci_config_write(dev, cap + 8, 0);
+		pci_config_write(dev, cap + 12, vector);
+	} else {
+		pci_config_write(dev, cap + 8, vector);
+	}
+
+	// Only use a single message
+	set_msg_control(dev, cap, (control & ~MSI_MULTIPLE_ENABLE) | MSI_ENABLE);
+	set_command(dev, COMMAND_BUS_MASTER | COMMAND_INT_DISABLE, 0);
+	return 0;
+}
+
+/* Enable MSI-X, with entry i of the device's MSI-X table raising vectors[i].
+ * Fails if the device doesn't support MSI-X or has fewer than num entries.
+ */
+int pci_enable_msix(pci_device_t* dev, uint8_t* vectors, int num) {
+	uint8_t cap = pci_find_cap(dev, PCI_CAP_MSIX);
+	if(!cap || !lapic_active()) {
+		return -1;
+	}
+
+	uint16_t control = pci_config_read(dev, cap + 2, 2);
+	if((control & MSIX_TABLE_SIZE) + 1 < num) {
+		return -1;
+	}
+
+	// The table is in one of the memory BARs, the lower bits select which
+	uint32_t table = pci_config_read(dev, cap + 4, 4);
+	uint32_t bar = pci_get_bar(dev, table & 0x7);
+	if(!bar || bar & 0x1) {
+		return -1;
+	}
+
+	uintptr_t phys = (bar & 0xfffffff0) + (table & ~0x7);
+	uintptr_t base = ALIGN_DOWN(phys, PAGE_SIZE);
+	vm_alloc_t alloc;
+	void* virt = vm_alloc(VM_KERNEL, &alloc, RDIV(phys - base + num * 16, PAGE_SIZE),
+		(void*)base, VM_RW);
+	if(!virt) {
+		return -1;
+	}
+
+	// Keep all entries masked while they are being written
+	set_msg_control(dev, cap, control | MSIX_ENABLE | MSIX_FUNCTION_MASK);
+
+	volatile uint32_t* entries = virt + (phys - base);
+	for(int i = 0; i < num; i++) {
+		entries[i * 4] = MSI_ADDRESS(lapic_get_id());
+		entries[i * 4 + 1] = 0;
+		entries[i * 4 + 2] = vectors[i];
+		entries[i * 4 + 3] = 0;
+	}
+
+	vm_free(&alloc);
+	set_msg_control(dev, cap, (control | MSIX_ENABLE) & ~MSIX_FUNCTION_MASK);
+	set_command(dev, COMMAND_BUS_MASTER | COMMAND_INT_DISABLE, 0);
+	return 0;
+}
+
+// Switch back to the legacy interrupt line
+void pci_disable_msix(pci_device_t* dev) {
+	uint8_t cap = pci_find_cap(dev, PCI_CAP_MSIX);
+	if(!cap) {
+		return;
+	}
+
+	uint16_t control = pci_config_read(dev, cap + 2, 2);
+	set_msg_control(dev, cap, control & ~MSIX_ENABLE);
+	set_command(dev, 0, COMMAND_INT_DISABLE);
+}
+#endif
+
 static inline void try_load_device(uint8_t bus, uint8_t dev, uint8_t func) {
 	outl(PORT_CONFIG_ADDR, get_address(bus, dev, func, 0));
 	uint16_t vendor = inw(PORT_CONFIG_DATA);
@@ -50,6 +50,10 @@ enum pci_class {
 	PCI_CLASS_MISC = 0xFF
 };
 
+// Capability IDs
+#define PCI_CAP_MSI 0x05
+#define PCI_CAP_MSIX 0x11
+
 typedef struct pci_device {
 	uint16_t vendor;
 	uint16_t device;
@@ -79,5 +83,13 @@ void pci_config_write(pci_device_t* dev, uint8_t offset, uint32_t val);
 int pci_walk(int (*callback)(pci_device_t* dev));
 int pci_check_vendor(pci_device_t* dev, const uint32_t combos[][2]);
 uint32_t pci_get_bar(pci_device_t* device, uint8_t bar);
+uint8_t pci_find_cap(pci_device_t* dev, uint8_t id);
+
+#ifdef CONFIG_APIC
+int pci_enable_msi(pci_device_t* dev, uint8_t vector);
+int pci_enable_msix(pci_device_t* dev, uint8_t* vectors, int num);
+void pci_disable_msix(pci_device_t* dev);
+#endif
+
 void pci_init(void);
 
@@ -0,0 +1,342 @@
+/* i386-smp.c: Multiprocessor bring-up, kernel lock and inter-processor interrupts
+ * Copyright © 2023 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef CONFIG_SMP
+
+#include "i386-smp.h"
+#include <bsp/acpi.h>
+#include <bsp/i386-lapic.h>
+#include <bsp/timer.h>
+#include <int/int.h>
+#include <int/i386-idt.h>
+#include <mem/vm.h>
+#include <tasks/task.h>
+#include <tasks/scheduler.h>
+#include <tasks/syscall.h>
+#include <fs/sysfs.h>
+#include <spinlock.h>
+#include <string.h>
+#include <panic.h>
+#include <prof.h>
+#include <log.h>
+
+/* Physical address the startup code for the application processors gets
+ * copied to. Needs to be page aligned and below 1 MiB, since they start in
+ * real mode. Keep in sync with i386-ap-boot.asm.
+ */
+#define TRAMPOLINE_ADDR 0x7000
+
+struct cpu {
+	uint8_t lapic_id;
+	volatile bool online;
+
+	// Set while a TLB shootdown for this CPU has not been acknowledged
+	volatile bool tlb_pending;
+
+	// Paging context this CPU last returned to from an interrupt
+	volatile uint32_t cr3;
+};
+
+static struct cpu cpus[SMP_MAX_CPUS];
+uint32_t smp_num_cpus = 1;
+
+// Used by i386-ap-boot.asm
+void* smp_ap_stack;
+void __attribute__((noreturn)) smp_ap_main(void);
+extern void* smp_trampoline_start;
+extern void* smp_trampoline_end;
+static volatile uint32_t booting_cpu;
+
+/* The kernel lock serializes all kernel code other than the scheduler, a few
+ * interrupt handlers and system calls marked SCF_LOCKLESS, so the rest of the
+ * kernel does not need to be aware of concurrency. It is held on a CPU whenever that CPU executes kernel code
+ * on behalf of a task or worker, and is handed over or released when the
+ * scheduler switches to userland or the idle loop.
+ *
+ * Unlike other spinlocks, it doesn't disable preemption, since it is held
+ * for all of the kernel code. The atomic builtins are used directly for that.
+ */
+static spinlock_t kernel_lock = 0;
+static volatile int32_t kernel_lock_owner = -1;
+
+bool smp_cpu_online(uint32_t cpu) {
+	return cpu < smp_num_cpus && cpus[cpu].online;
+}
+
+/* Interrupts are disabled in all of the kernel lock functions, as the task
+ * could otherwise get moved to a different CPU in between getting the CPU ID
+ * and using it.
+ */
+bool smp_kernel_lock_held(void) {
+	bool ints = int_save();
+	bool held = kernel_lock_owner == (int32_t)smp_cpu_id();
+	int_restore(ints);
+	return held;
+}
+
+void smp_kernel_lock(void) {
+	bool ints = int_save();
+	int32_t cpu = smp_cpu_id();
+	if(kernel_lock_owner == cpu) {
+		int_restore(ints);
+		return;
+	}
+
+	/* The lock holder might be waiting for this CPU to acknowledge a TLB
+	 * shootdown. All kernel code runs in the kernel paging context, and the
+	 * TLB gets flushed when returning to a task, so it can be acknowledged
+	 * right away.
+	 */
+	while(__sync_lock_test_and_set(&kernel_lock, 1)) {
+		cpus[cpu].tlb_pending = false;
+		asm volatile("pause");
+	}
+
+	kernel_lock_owner = cpu;
+	int_restore(ints);
+}
+
+bool smp_kernel_trylock(void) {
+	bool ints = int_save();
+	int32_t cpu = smp_cpu_id();
+	bool locked = kernel_lock_owner == cpu;
+
+	if(!locked && !__sync_lock_test_and_set(&kernel_lock, 1)) {
+		kernel_lock_owner = cpu;
+		locked = true;
+	}
+
+	int_restore(ints);
+	return locked;
+}
+
+// Returns whether the lock was held
+bool smp_kernel_unlock(void) {
+	bool ints = int_save();
+	bool held = kernel_lock_owner == (int32_t)smp_cpu_id();
+	if(held) {
+		kernel_lock_owner = -1;
+		__sync_lock_release(&kernel_lock);
+	}
+
+	int_restore(ints);
+	return held;
+}
+
+/* Interrupts that are handled without taking the kernel lock. System calls
+ * take it in the syscall handler unless they are marked SCF_LOCKLESS.
+ */
+bool smp_int_lockless(uint32_t intr) {
+	return intr == IRQ(0) || intr == 0x31 || intr == SYSCALL_INTERRUPT
+		|| intr == IPI_RESCHEDULE || intr == IPI_TLB_SHOOTDOWN
+		|| intr == LAPIC_TIMER_VECTOR || intr == LAPIC_SPURIOUS_VECTOR;
+}
+
+/* Called by int_dispatch right before returning. `kernel` is set when
+ * returning to kernel code of a task or worker, which needs to hold the
+ * kernel lock. Userland and the idle loop don't.
+ */
+void smp_int_return(void* cr3, bool kernel) {
+	cpus[smp_cpu_id()].cr3 = (uint32_t)cr3;
+	if(kernel) {
+		smp_kernel_lock();
+	} else {
+		smp_kernel_unlock();
+	}
+}
+
+/* Make other CPUs run their scheduler. Called on every tick if the PIT is
+ * used, otherwise every CPU gets ticks from its own local APIC timer.
+ */
+void smp_send_reschedule(void) {
+	if(smp_num_cpus > 1) {
+		lapic_send_ipi_others(IPI_RESCHEDULE);
+	}
+}
+
+/* Remove stale entries for the paging context from the TLB of other CPUs.
+ * Since CR3 gets reloaded on every interrupt, this only concerns CPUs that
+ * last returned to this context and might be running in it right now. For
+ * those, an IPI is enough – the reload on interrupt entry flushes the TLB.
+ */
+void smp_tlb_shootdown(void* page_dir) {
+	if(smp_num_cpus < 2) {
+		return;
+	}
+
+	bool ints = int_save();
+	uint32_t self = smp_cpu_id();
+	for(uint32_t i = 0; i < smp_num_cpus; i++) {
+		if(i != self && cpus[i].online && cpus[i].cr3 == (uint32_t)page_dir) {
+			cpus[i].tlb_pending = true;
+			lapic_send_ipi(cpus[i].lapic_id, IPI_TLB_SHOOTDOWN);
+		}
+	}
+
+	for(uint32_t i = 0; i < smp_num_cpus; i++) {
+		while(cpus[i].tlb_pending) {
+			// Another CPU could be doing the same thing, waiting for us
+			cpus[self].tlb_pending = false;
+			asm volatile("pause");
+		}
+	}
+	int_restore(ints);
+}
+
+static void tlb_shootdown_handler(task_t* task, isf_t* state, int num) {
+	cpus[smp_cpu_id()].tlb_pending = false;
+}
+
+static void udelay(uint32_t us) {
+	uint64_t end = profile_read_rdtsc() + (uint64_t)timer_get_tsc_khz() * us / 1000;
+	while(profile_read_rdtsc() < end) {
+		asm volatile("pause");
+	}
+}
+
+// Entry point for application processors, called from i386-ap-boot.asm
+void __attribute__((noreturn)) smp_ap_main(void) {
+	uint32_t cpu = booting_cpu;
+	gdt_init_cpu(cpu, smp_ap_stack);
+	idt_load();
+	lapic_enable();
+	timer_init_cpu();
+	cpus[cpu].online = true;
+
+	/* Wait for the scheduler to be set up, then use this as the idle loop
+	 * until the first task gets scheduled on this CPU.
+	 */
+	while(*(volatile enum scheduler_state*)&scheduler_state == SCHEDULER_OFF) {
+		asm volatile("pause");
+	}
+
+	int_enable();
+	while(true) {
+		halt();
+	}
+}
+
+// INIT-SIPI-SIPI sequence as described in the Intel MP specification
+static bool start_ap(uint32_t cpu) {
+	void* stack = vm_alloc(VM_KERNEL, NULL, KERNEL_STACK_PAGES, NULL, VM_RW);
+	if(!stack) {
+		return false;
+	}
+
+	smp_ap_stack = stack + KERNEL_STACK_SIZE;
+	booting_cpu = cpu;
+
+	lapic_send_init(cpus[cpu].lapic_id);
+	udelay(10000);
+
+	for(int i = 0; i < 2 && !cpus[cpu].online; i++) {
+		lapic_send_startup(cpus[cpu].lapic_id, TRAMPOLINE_ADDR);
+
+		// Wait up to 200 µs after the first startup IPI, then 100 ms
+		uint32_t wait = i ? 100000 : 200;
+		for(uint32_t us = 0; us < wait && !cpus[cpu].online; us += 10) {
+			udelay(10);
+		}
+	}
+	return cpus[cpu].online;
+}
+
+// Collect the other processors, interrupt routing is set up by apic_init
+static void parse_madt(struct acpi_madt* madt) {
+	void* end = (void*)madt + madt->header.length;
+	struct acpi_madt_entry* entry = (struct acpi_madt_entry*)madt->entries;
+
+	for(; (void*)entry < end && entry->length; entry = (void*)entry + entry->length) {
+		if(entry->type != ACPI_MADT_LAPIC) {
+			continue;
+		}
+
+		struct acpi_madt_lapic* lapic = (struct acpi_madt_lapic*)entry;
+		if(!(lapic->flags & ACPI_MADT_LAPIC_ENABLED) || lapic->apic_id == cpus[0].lapic_id) {
+			continue;
+		}
+
+		if(smp_num_cpus >= SMP_MAX_CPUS) {
+			log(LOG_WARN, "smp: Ignoring CPU with APIC ID %d, SMP_MAX_CPUS reached\n", lapic->apic_id);
+			continue;
+		}
+
+		cpus[smp_num_cpus++].lapic_id = lapic->apic_id;
+	}
+}
+
+static size_t sfs_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
+	if(ctx->fp->offset) {
+		return 0;
+	}
+
+	size_t rsize = 0;
+	sysfs_printf("# cpu apic online tasks current\n");
+	for(uint32_t i = 0; i < smp_num_cpus; i++) {
+		uint32_t nentries;
+		int pid;
+		scheduler_get_cpu_stats(i, &nentries, &pid);
+		sysfs_printf("%d %d %d %d %d\n", i, cpus[i].lapic_id, cpus[i].online, nentries, pid);
+	}
+	return rsize;
+}
+
+void smp_init(void) {
+	cpus[0].online = true;
+
+	struct acpi_madt* madt = acpi_find_table("APIC");
+	if(!madt || !lapic_active()) {
+		log(LOG_INFO, "smp: No MADT, only using the bootstrap processor\n");
+		return;
+	}
+
+	cpus[0].lapic_id = lapic_get_id();
+	parse_madt(madt);
+
+	int_register(IPI_TLB_SHOOTDOWN, tlb_shootdown_handler, false);
+
+	/* From here on, kernel code needs to hold the kernel lock. The boot
+	 * processor keeps it until it first switches to userland.
+	 */
+	smp_kernel_lock();
+
+	vm_alloc_t trampoline_alloc;
+	void* trampoline = vm_alloc(VM_KERNEL, &trampoline_alloc, 1, (void*)TRAMPOLINE_ADDR, VM_RW);
+	memcpy(trampoline, &smp_trampoline_start, (uintptr_t)&smp_trampoline_end
+		- (uintptr_t)&smp_trampoline_start);
+
+	uint32_t online = 1;
+	for(uint32_t i = 1; i < smp_num_cpus; i++) {
+		if(start_ap(i)) {
+			online++;
+		} else {
+			log(LOG_WARN, "smp: CPU %d (APIC ID %d) did not start\n", i, cpus[i].lapic_id);
+		}
+	}
+
+	vm_free(&trampoline_alloc);
+	log(LOG_INFO, "smp: %d of %d CPUs online\n", online, smp_num_cpus);
+
+	struct vfs_callbacks sfs_cb = {
+		.read = sfs_read,
+	};
+	sysfs_add_file("cpus", &sfs_cb);
+}
+
+#endif /* CONFIG_SMP */
@@ -0,0 +1,69 @@
+#pragma once
+
+/* Copyright © 2023 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <mem/i386-gdt.h>
+
+#ifdef CONFIG_SMP
+	#define SMP_MAX_CPUS CONFIG_SMP_MAX_CPUS
+#else
+	#define SMP_MAX_CPUS 1
+#endif
+
+// Inter-processor interrupt vectors
+#define IPI_RESCHEDULE 0xf0
+#define IPI_TLB_SHOOTDOWN 0xf1
+
+/* Returns the index of the CPU this is running on. Every CPU loads its own
+ * TSS descriptor, so this can be derived from the task register.
+ */
+static inline uint32_t smp_cpu_id(void) {
+#ifdef CONFIG_SMP
+	uint16_t tr;
+	asm volatile("str %0" : "=r"(tr));
+	return tr ? (tr - GDT_SEG_TSS) / 8 : 0;
+#else
+	return 0;
+#endif
+}
+
+#ifdef CONFIG_SMP
+extern uint32_t smp_num_cpus;
+
+bool smp_cpu_online(uint32_t cpu);
+bool smp_kernel_lock_held(void);
+void smp_kernel_lock(void);
+bool smp_kernel_trylock(void);
+bool smp_kernel_unlock(void);
+bool smp_int_lockless(uint32_t intr);
+void smp_int_return(void* cr3, bool kernel);
+void smp_send_reschedule(void);
+void smp_tlb_shootdown(void* page_dir);
+void smp_init(void);
+#else
+	#define smp_num_cpus 1
+	#define smp_cpu_online(cpu) ((cpu) == 0)
+	#define smp_kernel_lock_held() true
+	#define smp_kernel_lock()
+	#define smp_kernel_trylock() true
+	#define smp_kernel_unlock() false
+	#define smp_tlb_shootdown(page_dir)
+#endif
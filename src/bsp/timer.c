@@ -21,18 +21,238 @@
 #include <int/int.h>
 #include <fs/sysfs.h>
 #include <tasks/task.h>
+#include <tasks/scheduler.h>
+#include <bsp/i386-smp.h>
+#include <bsp/clocksource.h>
+#include <bsp/i386-lapic.h>
 #include <portio.h>
+#include <prof.h>
 #include <time.h>
 
+#define PIT_FREQUENCY 1193180
+#define PIT_CHANNEL0 0x40
+#define PIT_COMMAND 0x43
+
+// Channel 0, lobyte/hibyte access, mode 3 (square wave) / mode 0 (one-shot)
+#define PIT_CMD_PERIODIC 0x36
+#define PIT_CMD_ONESHOT 0x30
+#define PIT_CMD_LATCH 0x00
+
+/* Timer hardware. This is the PIT until timer_use_lapic switches to the local
+ * APIC timers. Counts are in units of the input clock of the timer.
+ */
+struct timer_hw {
+	uint32_t vector;
+	uint32_t max_count;
+	void (*periodic)(uint32_t count);
+	void (*oneshot)(uint32_t count);
+
+	// Remaining count of the current period
+	uint32_t (*read)(void);
+};
+
 static uint32_t tick = 0;
 static uint32_t rate = 1;
+static uint32_t tsc_khz = 0;
+
+// Timer counts per tick
+static uint32_t divisor;
+
+#ifdef CONFIG_TICKLESS
+static enum {
+	PIT_MODE_PERIODIC,
+	PIT_MODE_ONESHOT,
+
+	// One-shot period has expired, PIT is silent until reprogrammed
+	PIT_MODE_STOPPED
+} mode = PIT_MODE_PERIODIC;
+
+// Number of ticks and PIT counts covered by the current one-shot period
+static uint32_t oneshot_ticks;
+static uint32_t oneshot_count;
+
+// Elapsed PIT counts not yet accounted for in tick
+static uint32_t carry;
+#endif
+
+static inline void program(uint8_t cmd, uint16_t count) {
+	outb(PIT_COMMAND, cmd);
+
+	// Divisor has to be sent byte-wise, so split here into upper/lower bytes.
+	outb(PIT_CHANNEL0, (uint8_t)(count & 0xFF));
+	outb(PIT_CHANNEL0, (uint8_t)((count >> 8) & 0xFF));
+}
+
+static void pit_periodic(uint32_t count) {
+	program(PIT_CMD_PERIODIC, count);
+}
+
+static void pit_oneshot(uint32_t count) {
+	program(PIT_CMD_ONESHOT, count);
+}
+
+static uint32_t pit_read(void) {
+	outb(PIT_COMMAND, PIT_CMD_LATCH);
+	uint8_t l = inb(PIT_CHANNEL0);
+	uint8_t h = inb(PIT_CHANNEL0);
+	return l | (h << 8);
+}
+
+static struct timer_hw pit_hw = {
+	.vector = IRQ(0),
+	.max_count = 0xffff,
+	.periodic = pit_periodic,
+	.oneshot = pit_oneshot,
+	.read = pit_read,
+};
+
+#ifdef CONFIG_APIC
+static struct timer_hw lapic_hw = {
+	.vector = LAPIC_TIMER_VECTOR,
+	.max_count = 0xffffffff,
+	.periodic = lapic_timer_periodic,
+	.oneshot = lapic_timer_oneshot,
+	.read = lapic_timer_read,
+};
+#endif
+
+static struct timer_hw* hw = &pit_hw;
+
+#ifdef CONFIG_TICKLESS
+/* Returns the number of timer counts that have elapsed in the current
+ * one-shot period. Once the PIT counter has run out, it wraps around and
+ * keeps decrementing from 0xffff, so clamp to the programmed length. The
+ * local APIC timer stops at 0.
+ */
+static inline uint32_t oneshot_elapsed(void) {
+	uint32_t remaining = hw->read();
+	if(remaining > oneshot_count) {
+		return oneshot_count;
+	}
+	return oneshot_count - remaining;
+}
+
+static inline void account(uint32_t counts) {
+	carry += counts;
+	tick += carry / divisor;
+	carry %= divisor;
+}
+
+/* Folds the time spent in the running one-shot period into tick so the timer
+ * can be reprogrammed without losing track of time.
+ */
+static inline void settle(void) {
+	if(mode == PIT_MODE_ONESHOT) {
+		account(oneshot_elapsed());
+	}
+}
+
+/* Switch back to periodic ticks. Called by the scheduler as soon as more than
+ * one task is runnable again.
+ */
+void timer_set_periodic(void) {
+	if(mode == PIT_MODE_PERIODIC) {
+		return;
+	}
+
+	settle();
+
+	// Round the partial tick so transitions don't drift in one direction
+	if(carry >= divisor / 2) {
+		tick++;
+	}
+	carry = 0;
+
+	hw->periodic(divisor);
+	mode = PIT_MODE_PERIODIC;
+}
+
+/* Program a single timer interrupt for the tick `until`, or as far into the
+ * future as the timer counter allows if `until` is -1. The 16 bit counter of
+ * the PIT limits one-shot periods to about 55 ms, so idle systems still wake
+ * up around 18 times per second. The local APIC timer could go on for much
+ * longer, but is limited to a second so the clock source still notices when
+ * its counter wraps around.
+ */
+void timer_set_oneshot(uint32_t until) {
+	uint32_t max_ticks = MIN(hw->max_count / divisor, rate);
+	if(!max_ticks) {
+		timer_set_periodic();
+		return;
+	}
 
-// The timer callback. Gets called every time the PIT fires.
+	uint32_t now = timer_get_tick();
+	uint32_t ticks = (until > now) ? until - now : 1;
+	ticks = MIN(ticks, max_ticks);
+
+	/* Don't reprogram if the active period ends no later than requested. The
+	 * next timer interrupt will run the scheduler, which then arms the
+	 * remaining time.
+	 */
+	if(mode == PIT_MODE_ONESHOT) {
+		uint32_t remaining = (oneshot_count - oneshot_elapsed()) / divisor;
+		if(remaining <= ticks) {
+			return;
+		}
+	}
+
+	settle();
+	oneshot_ticks = ticks;
+	oneshot_count = ticks * divisor;
+	hw->oneshot(oneshot_count);
+	mode = PIT_MODE_ONESHOT;
+}
+
+bool timer_is_oneshot(void) {
+	return mode != PIT_MODE_PERIODIC;
+}
+#endif
+
+// The timer callback. Gets called every time the timer fires.
 static void timer_callback(task_t* task, isf_t* state, int num) {
+	// Last interrupt from the PIT after switching to the local APIC timer
+	if(num != hw->vector) {
+		return;
+	}
+
+	#ifdef CONFIG_SMP
+	/* Local APIC timer interrupts on the other CPUs only serve to run their
+	 * scheduler. Timekeeping happens on the boot processor.
+	 */
+	if(smp_cpu_id()) {
+		return;
+	}
+	#endif
+
+	#ifdef CONFIG_TICKLESS
+	if(mode == PIT_MODE_ONESHOT) {
+		account(oneshot_count);
+		mode = PIT_MODE_STOPPED;
+		clocksource_update();
+		time_update_page(tick);
+		return;
+	}
+	#endif
+
 	tick++;
+	clocksource_update();
+	time_update_page(tick);
+
+	#ifdef CONFIG_SMP
+	// Only the boot processor gets PIT interrupts, so pass on the tick
+	if(hw == &pit_hw && scheduler_state != SCHEDULER_OFF) {
+		smp_send_reschedule();
+	}
+	#endif
 }
 
 uint32_t timer_get_tick(void) {
+	#ifdef CONFIG_TICKLESS
+	if(unlikely(mode == PIT_MODE_ONESHOT)) {
+		return tick + (carry + oneshot_elapsed()) / divisor;
+	}
+	#endif
+
 	return tick;
 }
 
@@ -40,13 +260,45 @@ uint32_t timer_get_rate(void) {
 	return rate;
 }
 
+// Calibrated TSC frequency, used to convert cycle counts to real time
+uint32_t timer_get_tsc_khz(void) {
+	return tsc_khz;
+}
+
+// Used by the clock source code once it has a better reference than the PIT
+void timer_set_tsc_khz(uint32_t khz) {
+	tsc_khz = khz;
+}
+
+/* Measure the TSC frequency against the PIT. Needs interrupts to be enabled
+ * so the tick advances.
+ */
+static void calibrate_tsc(void) {
+	const uint32_t calib_ticks = MAX(1, rate / 100);
+
+	uint32_t start_tick = tick;
+	while(*(volatile uint32_t*)&tick == start_tick) {
+		halt();
+	}
+
+	uint64_t start = profile_read_rdtsc();
+	start_tick = tick;
+	while(*(volatile uint32_t*)&tick < start_tick + calib_ticks) {
+		halt();
+	}
+
+	uint64_t cycles = profile_read_rdtsc() - start;
+	tsc_khz = cycles * rate / calib_ticks / 1000;
+	log(LOG_INFO, "pit: TSC frequency %u kHz\n", tsc_khz);
+}
+
 static size_t sfs_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
 	if(ctx->fp->offset) {
 		return 0;
 	}
 
 	size_t rsize = 0;
-	sysfs_printf("%d %d %d", uptime(), tick, rate);
+	sysfs_printf("%d %d %d", uptime(), timer_get_tick(), rate);
 	return rsize;
 }
 
@@ -59,22 +311,55 @@ void timer_init(void) {
 	// The value we send to the PIT is the value to divide it's input clock
 	// (1193180 Hz) by, to get our required frequency. Important to note is
 	// that the divisor must be small enough to fit into 16-bits.
-	uint32_t divisor = 1193180 / rate;
-	// Send the command byte.
-	outb(0x43, 0x36);
+	divisor = PIT_FREQUENCY / rate;
+	pit_periodic(divisor);
 
-	// Divisor has to be sent byte-wise, so split here into upper/lower bytes.
-	uint8_t l = (uint8_t)(divisor & 0xFF);
-	uint8_t h = (uint8_t)( (divisor>>8) & 0xFF );
+	log(LOG_DEBUG, "pit: Timer frequency %d\n", rate);
+}
 
-	// Send the frequency divisor.
-	outb(0x40, l);
-	outb(0x40, h);
+#ifdef CONFIG_APIC
+/* Switch from the PIT to the local APIC timer, which exists once per CPU and
+ * has a 32 bit counter. Called by apic_init on the boot processor, the other
+ * processors start their timer in timer_init_cpu.
+ */
+void timer_use_lapic(void) {
+	uint32_t freq = lapic_timer_calibrate();
+	if(freq / rate < 2) {
+		log(LOG_WARN, "timer: Local APIC timer too slow (%u Hz), keeping PIT\n", freq);
+		return;
+	}
 
-	log(LOG_DEBUG, "pit: Timer frequency %d\n", rate);
+	int_register(LAPIC_TIMER_VECTOR, &timer_callback, false);
+	bool ints = int_save();
+
+	#ifdef CONFIG_TICKLESS
+	timer_set_periodic();
+	#endif
+
+	// Let the PIT fire one last time, then it stays silent
+	pit_oneshot(1);
+
+	hw = &lapic_hw;
+	divisor = freq / rate;
+	hw->periodic(divisor);
+	int_restore(ints);
+
+	log(LOG_INFO, "timer: Using local APIC timer at %u Hz\n", freq);
+}
+#endif
+
+// Start the timer of an application processor
+void timer_init_cpu(void) {
+	#ifdef CONFIG_APIC
+	if(hw == &lapic_hw) {
+		hw->periodic(divisor);
+	}
+	#endif
 }
 
 void timer_init2(void) {
+	calibrate_tsc();
+
 	struct vfs_callbacks sfs_cb = {
 		.read = sfs_read,
 	};
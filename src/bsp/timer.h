@@ -19,11 +19,25 @@
  */
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #define timer_tick (timer_get_tick())
 #define timer_rate (timer_get_rate())
 
 void timer_init(void);
 void timer_init2(void);
+void timer_init_cpu(void);
 uint32_t timer_get_tick(void);
 uint32_t timer_get_rate(void);
+uint32_t timer_get_tsc_khz(void);
+void timer_set_tsc_khz(uint32_t khz);
+
+#ifdef CONFIG_APIC
+void timer_use_lapic(void);
+#endif
+
+#ifdef CONFIG_TICKLESS
+void timer_set_periodic(void);
+void timer_set_oneshot(uint32_t until);
+bool timer_is_oneshot(void);
+#endif
@@ -19,6 +19,7 @@
 
 #include <bsp/virtio.h>
 #include <bsp/i386-pci.h>
+#include <bsp/i386-apic.h>
 #include <mem/kmalloc.h>
 #include <mem/paging.h>
 #include <portio.h>
@@ -99,7 +100,7 @@ void virtio_provide_descs(struct virtio_dev* dev, uint8_t queue_id, int num, siz
 
 	__sync_synchronize();
 	queue->available->idx += num;
-	ioutw(0x10, queue_id);
+	ioutw(VIRTIO_IO_QUEUE_NOTIFY, queue_id);
 }
 
 static inline int setup_virtqueue(struct virtio_dev* dev, uint8_t queue_id) {
@@ -133,6 +134,7 @@ struct virtio_dev* virtio_init_dev(pci_device_t* pci_dev, uint32_t cap, int queu
 	struct virtio_dev* dev = zmalloc(sizeof(struct virtio_dev) + sizeof(struct virtqueue) * queues);
 	dev->pci_dev = pci_dev;
 	dev->num_queues = queues;
+	dev->config = VIRTIO_IO_CONFIG;
 
 	dev->status = VIRTIO_PCI_STATUS_RESET;
 	virtio_write_status(dev);
@@ -166,3 +168,68 @@ struct virtio_dev* virtio_init_dev(pci_device_t* pci_dev, uint32_t cap, int queu
 
 	return dev;
 }
+
+#ifdef CONFIG_APIC
+static void free_vectors(uint8_t* vectors, int num) {
+	for(int i = 0; i < num; i++) {
+		apic_free_vector(vectors[i]);
+	}
+}
+
+/* Give every queue its own MSI-X table entry and vector. The device reads
+ * back VIRTIO_MSI_NO_VECTOR if it could not allocate the entry.
+ */
+static int setup_msix(struct virtio_dev* dev, interrupt_handler_t handler) {
+	uint8_t vectors[dev->num_queues];
+	for(int i = 0; i < dev->num_queues; i++) {
+		int vector = apic_alloc_vector();
+		if(vector < 0) {
+			free_vectors(vectors, i);
+			return -1;
+		}
+		vectors[i] = vector;
+	}
+
+	if(pci_enable_msix(dev->pci_dev, vectors, dev->num_queues) < 0) {
+		free_vectors(vectors, dev->num_queues);
+		return -1;
+	}
+
+	ioutw(VIRTIO_IO_MSI_CONFIG_VECTOR, VIRTIO_MSI_NO_VECTOR);
+	for(int i = 0; i < dev->num_queues; i++) {
+		ioutw(VIRTIO_IO_QUEUE_SELECT, i);
+		ioutw(VIRTIO_IO_MSI_QUEUE_VECTOR, i);
+		if(iinw(VIRTIO_IO_MSI_QUEUE_VECTOR) != i) {
+			pci_disable_msix(dev->pci_dev);
+			free_vectors(vectors, dev->num_queues);
+			return -1;
+		}
+	}
+
+	for(int i = 0; i < dev->num_queues; i++) {
+		dev->queues[i].vector = vectors[i];
+		int_register(vectors[i], handler, false);
+	}
+
+	dev->msix = true;
+	dev->config = VIRTIO_IO_CONFIG_MSIX;
+	return 0;
+}
+#endif
+
+/* Uses MSI-X with a vector per queue if possible, so the handler doesn't
+ * need to acknowledge anything and isn't shared with other devices.
+ * Otherwise falls back to the legacy interrupt line. Needs to be called
+ * after the queues have been set up, and before reading the device config.
+ */
+void virtio_setup_interrupts(struct virtio_dev* dev, interrupt_handler_t handler) {
+	#ifdef CONFIG_APIC
+	if(setup_msix(dev, handler) == 0) {
+		log(LOG_INFO, "virtio: Using MSI-X vectors %#x-%#x\n", dev->queues[0].vector,
+			dev->queues[dev->num_queues - 1].vector);
+		return;
+	}
+	#endif
+
+	int_register(IRQ(dev->pci_dev->interrupt_line), handler, false);
+}
@@ -19,6 +19,7 @@
  */
 
 #include <bsp/i386-pci.h>
+#include <int/int.h>
 #include <portio.h>
 
 /* Virtio product id (subsystem) */
@@ -35,6 +36,18 @@
 #define VIRTIO_IO_QUEUE_SELECT 14
 #define VIRTIO_IO_QUEUE_SIZE 12
 #define VIRTIO_IO_QUEUE_PFN 8
+#define VIRTIO_IO_QUEUE_NOTIFY 16
+#define VIRTIO_IO_ISR 19
+
+// Only present if MSI-X is enabled, shifting the device config by 4 bytes
+#define VIRTIO_IO_MSI_CONFIG_VECTOR 20
+#define VIRTIO_IO_MSI_QUEUE_VECTOR 22
+
+// Start of the device specific config with and without MSI-X
+#define VIRTIO_IO_CONFIG 20
+#define VIRTIO_IO_CONFIG_MSIX 24
+
+#define VIRTIO_MSI_NO_VECTOR 0xffff
 
 #define VIRTIO_PCI_STATUS_RESET 0x00
 #define VIRTIO_PCI_STATUS_ACKNOWLEDGE 0x01
@@ -89,12 +102,21 @@ struct virtqueue {
 	size_t size;
 	size_t desc_index;
 	size_t used_index;
+
+	// Interrupt vector if MSI-X is used, 0 otherwise
+	uint32_t vector;
 };
 
 struct virtio_dev {
 	pci_device_t* pci_dev;
 	uint32_t features;
 	uint32_t status;
+
+	// Whether each queue has its own MSI-X vector instead of the shared line
+	bool msix;
+
+	// Offset of the device specific config in the I/O BAR
+	uint16_t config;
 	size_t num_queues;
 	struct virtqueue queues[];
 };
@@ -107,7 +129,16 @@ static inline void virtio_write_avail(struct virtio_dev* dev, struct virtqueue*
 	queue->available->ring[queue->available->idx % queue->size] = desc_no;
 	__sync_synchronize();
 	queue->available->idx++;
-	outw(dev->pci_dev->iobase + 0x10, queue->id);
+	outw(dev->pci_dev->iobase + VIRTIO_IO_QUEUE_NOTIFY, queue->id);
+}
+
+/* Acknowledge an interrupt. Only needed for the legacy interrupt line, where
+ * reading the ISR status also tells whether the device raised it.
+ */
+static inline void virtio_int_ack(struct virtio_dev* dev) {
+	if(!dev->msix) {
+		inb(dev->pci_dev->iobase + VIRTIO_IO_ISR);
+	}
 }
 
 int virtio_write(struct virtio_dev* dev, uint8_t queue_id, int num_buffers,
@@ -115,3 +146,4 @@ int virtio_write(struct virtio_dev* dev, uint8_t queue_id, int num_buffers,
 
 void virtio_provide_descs(struct virtio_dev* dev, uint8_t queue_id, int num, size_t size);
 struct virtio_dev* virtio_init_dev(pci_device_t* dev, uint32_t cap, int queues);
+void virtio_setup_interrupts(struct virtio_dev* dev, interrupt_handler_t handler);
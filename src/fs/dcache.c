@@ -0,0 +1,226 @@
+/* dcache.c: Cache for directory entry lookups
+ * Copyright © 2023 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "dcache.h"
+#include <mem/kmalloc.h>
+#include <fs/sysfs.h>
+#include <spinlock.h>
+#include <string.h>
+
+#define HASH_SIZE 512
+
+/* Maps (owner, parent directory inode, name) to the inode of the entry. The
+ * owner is the mount instance. Negative entries with an inode of 0 record
+ * names that don't exist. Entries are kept in a hash table and on an LRU list
+ * with the most recently used entry at the head.
+ *
+ * File systems add entries after searching a directory, and remove them
+ * whenever they change a directory. A lookup that was started before a
+ * change could add an outdated entry afterwards, so every change increments
+ * gen, and dcache_add ignores entries from lookups started before that.
+ */
+struct dentry {
+	void* owner;
+	uint32_t parent;
+	uint32_t hash;
+	uint32_t inode;
+	uint8_t type;
+
+	struct dentry* hash_next;
+	struct dentry* lru_prev;
+	struct dentry* lru_next;
+	char name[];
+};
+
+static struct dentry* hash[HASH_SIZE];
+static struct dentry* lru_head = NULL;
+static struct dentry* lru_tail = NULL;
+static spinlock_t lock;
+
+static uint32_t gen = 0;
+static uint32_t num_entries = 0;
+static uint64_t hits = 0;
+static uint64_t misses = 0;
+
+// FNV-1a
+static uint32_t name_hash(void* owner, uint32_t parent, const char* name) {
+	uint32_t h = 2166136261 ^ parent ^ ((uintptr_t)owner >> 4);
+	for(; *name; name++) {
+		h = (h ^ (uint8_t)*name) * 16777619;
+	}
+	return h;
+}
+
+static void lru_unlink(struct dentry* entry) {
+	if(entry->lru_prev) {
+		entry->lru_prev->lru_next = entry->lru_next;
+	} else {
+		lru_head = entry->lru_next;
+	}
+
+	if(entry->lru_next) {
+		entry->lru_next->lru_prev = entry->lru_prev;
+	} else {
+		lru_tail = entry->lru_prev;
+	}
+}
+
+static void lru_push(struct dentry* entry) {
+	entry->lru_prev = NULL;
+	entry->lru_next = lru_head;
+	if(lru_head) {
+		lru_head->lru_prev = entry;
+	}
+	lru_head = entry;
+	if(!lru_tail) {
+		lru_tail = entry;
+	}
+}
+
+static struct dentry* find(void* owner, uint32_t parent, const char* name, uint32_t h) {
+	struct dentry* entry = hash[h % HASH_SIZE];
+	for(; entry; entry = entry->hash_next) {
+		if(entry->hash == h && entry->owner == owner && entry->parent == parent
+			&& !strcmp(entry->name, name)) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+static void remove_entry(struct dentry* entry) {
+	struct dentry** prev = &hash[entry->hash % HASH_SIZE];
+	for(; *prev; prev = &(*prev)->hash_next) {
+		if(*prev == entry) {
+			*prev = entry->hash_next;
+			break;
+		}
+	}
+
+	lru_unlink(entry);
+	num_entries--;
+	kfree(entry);
+}
+
+/* Returns true if the entry is cached, with inode set to 0 if it does not
+ * exist.
+ */
+bool dcache_lookup(void* owner, uint32_t parent, const char* name, uint32_t* inode, uint8_t* type) {
+	uint32_t h = name_hash(owner, parent, name);
+	spinlock_get(&lock, -1);
+	struct dentry* entry = find(owner, parent, name, h);
+	if(!entry) {
+		misses++;
+		spinlock_release(&lock);
+		return false;
+	}
+
+	*inode = entry->inode;
+	if(type) {
+		*type = entry->type;
+	}
+
+	lru_unlink(entry);
+	lru_push(entry);
+	hits++;
+	spinlock_release(&lock);
+	return true;
+}
+
+// Returns the current generation, to be passed to dcache_add
+uint32_t dcache_gen(void) {
+	return gen;
+}
+
+/* Add the result of a directory search. An inode of 0 adds a negative
+ * entry. search_gen is the value of dcache_gen from before the search.
+ */
+void dcache_add(void* owner, uint32_t parent, const char* name, uint32_t inode, uint8_t type, uint32_t search_gen) {
+	size_t len = strlen(name);
+	struct dentry* new = kmalloc(sizeof(struct dentry) + len + 1);
+	new->owner = owner;
+	new->parent = parent;
+	new->hash = name_hash(owner, parent, name);
+	new->inode = inode;
+	new->type = type;
+	memcpy(new->name, name, len + 1);
+
+	spinlock_get(&lock, -1);
+	if(search_gen != gen || find(owner, parent, name, new->hash)) {
+		spinlock_release(&lock);
+		kfree(new);
+		return;
+	}
+
+	if(num_entries >= DCACHE_MAX_ENTRIES && lru_tail) {
+		remove_entry(lru_tail);
+	}
+
+	new->hash_next = hash[new->hash % HASH_SIZE];
+	hash[new->hash % HASH_SIZE] = new;
+	lru_push(new);
+	num_entries++;
+	spinlock_release(&lock);
+}
+
+// Called after name has been added to or removed from parent
+void dcache_remove(void* owner, uint32_t parent, const char* name) {
+	spinlock_get(&lock, -1);
+	gen++;
+	struct dentry* entry = find(owner, parent, name, name_hash(owner, parent, name));
+	if(entry) {
+		remove_entry(entry);
+	}
+	spinlock_release(&lock);
+}
+
+/* Drop all entries in the directory parent, for example once it has been
+ * deleted. A parent of 0 drops all entries of owner.
+ */
+void dcache_invalidate(void* owner, uint32_t parent) {
+	spinlock_get(&lock, -1);
+	gen++;
+	struct dentry* entry = lru_head;
+	while(entry) {
+		struct dentry* next = entry->lru_next;
+		if(entry->owner == owner && (!parent || entry->parent == parent)) {
+			remove_entry(entry);
+		}
+		entry = next;
+	}
+	spinlock_release(&lock);
+}
+
+static size_t sfs_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
+	if(ctx->fp->offset) {
+		return 0;
+	}
+
+	size_t rsize = 0;
+	sysfs_printf("# entries hits misses\n");
+	sysfs_printf("%u %llu %llu\n", num_entries, hits, misses);
+	return rsize;
+}
+
+void dcache_init(void) {
+	struct vfs_callbacks sfs_cb = {
+		.read = sfs_read,
+	};
+	sysfs_add_file("dcache", &sfs_cb);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+/* Copyright © 2023 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Maximum number of cached entries, including negative ones
+#define DCACHE_MAX_ENTRIES 2048
+
+bool dcache_lookup(void* owner, uint32_t parent, const char* name, uint32_t* inode, uint8_t* type);
+void dcache_add(void* owner, uint32_t parent, const char* name, uint32_t inode, uint8_t type, uint32_t search_gen);
+void dcache_remove(void* owner, uint32_t parent, const char* name);
+void dcache_invalidate(void* owner, uint32_t parent);
+uint32_t dcache_gen(void);
+void dcache_init(void);
@@ -31,6 +31,8 @@
 #include <mem/kmalloc.h>
 #include <fs/vfs.h>
 #include <fs/mount.h>
+#include <fs/pagecache.h>
+#include <fs/dcache.h>
 #include <block/block.h>
 
 static vfs_file_t* ext2_open(struct vfs_callback_ctx* ctx, uint32_t flags);
@@ -42,16 +44,16 @@ static struct inode* get_inode_and_check_owner(struct ext2_fs* fs, struct vfs_ca
 		return NULL;
 	}
 
-	struct inode* inode = kmalloc(fs->superblock->inode_size);
-	if(!ext2_inode_read(fs, inode, (*dirent)->inode)) {
+	struct inode* inode = ext2_inode_get(fs, (*dirent)->inode);
+	if(!inode) {
 		kfree(*dirent);
-		kfree(inode);
 		sc_errno = ENOENT;
 		return NULL;
 	}
 
 	if(inode->uid != ctx->task->euid) {
-		kfree(inode);
+		ext2_inode_put(fs, inode);
+		kfree(*dirent);
 		sc_errno = EPERM;
 		return NULL;
 	}
@@ -68,9 +70,9 @@ static int ext2_chmod(struct vfs_callback_ctx* ctx, uint32_t mode) {
 	}
 
 	inode->mode = vfs_mode_to_filetype(inode->mode) | (mode & 0xfff);
-	ext2_inode_write(fs, inode, dirent->inode);
+	ext2_inode_dirty(fs, inode);
+	ext2_inode_put(fs, inode);
 	kfree(dirent);
-	kfree(inode);
 	return 0;
 }
 
@@ -88,9 +90,9 @@ static int ext2_chown(struct vfs_callback_ctx* ctx, uint16_t uid, uint16_t gid)
 	if(gid != -1) {
 		inode->gid = gid;
 	}
-	ext2_inode_write(fs, inode, dirent->inode);
+	ext2_inode_dirty(fs, inode);
+	ext2_inode_put(fs, inode);
 	kfree(dirent);
-	kfree(inode);
 	return 0;
 }
 
@@ -102,10 +104,9 @@ static int ext2_stat(struct vfs_callback_ctx* ctx, vfs_stat_t* dest) {
 		return -1;
 	}
 
-	struct inode* inode = kmalloc(fs->superblock->inode_size);
-	if(!ext2_inode_read(fs, inode, dirent->inode)) {
+	struct inode* inode = ext2_inode_get(fs, dirent->inode);
+	if(!inode) {
 		kfree(dirent);
-		kfree(inode);
 		sc_errno = ENOENT;
 		return -1;
 	}
@@ -124,8 +125,8 @@ static int ext2_stat(struct vfs_callback_ctx* ctx, vfs_stat_t* dest) {
 	dest->st_blksize = bl_off(1);
 	dest->st_blocks = inode->block_count;
 
+	ext2_inode_put(fs, inode);
 	kfree(dirent);
-	kfree(inode);
 	return 0;
 }
 
@@ -148,32 +149,37 @@ static int ext2_mkdir(struct vfs_callback_ctx* ctx, uint32_t mode) {
 		return -1;
 	}
 
-	struct inode* parent_inode = kmalloc(fs->superblock->inode_size);
-	if(!ext2_inode_read(fs, parent_inode, parent->inode)) {
+	struct inode* parent_inode = ext2_inode_get(fs, parent->inode);
+	if(!parent_inode) {
 		kfree(parent);
-		kfree(parent_inode);
 		sc_errno = ENOENT;
 		return -1;
 	}
 
-	if(ext2_inode_check_perm(PERM_CHECK_WRITE, parent_inode, ctx->task) < 0) {
+	int perm = ext2_inode_check_perm(PERM_CHECK_WRITE, parent_inode, ctx->task);
+	ext2_inode_put(fs, parent_inode);
+	if(perm < 0) {
 		kfree(parent);
-		kfree(parent_inode);
 		sc_errno = EACCES;
 		return -1;
 	}
-	kfree(parent_inode);
 
 	// Ensure directory doesn't already exist
 	struct dirent* check_dirent = ext2_dirent_find(fs, ctx->path, NULL, ctx->task);
 	if(check_dirent) {
 		kfree(check_dirent);
+		kfree(parent);
 		sc_errno = EEXIST;
 		return -1;
 	}
 
-	struct inode* inode = kmalloc(fs->superblock->inode_size);
-	uint32_t inode_num = ext2_inode_new(fs, inode, FT_IFDIR | S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
+	uint32_t inode_num;
+	struct inode* inode = ext2_inode_new(fs, FT_IFDIR | S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH, &inode_num);
+	if(!inode) {
+		kfree(parent);
+		sc_errno = EIO;
+		return -1;
+	}
 
 	// Create empty dirent block
 	struct dirent* buf = (struct dirent*)zmalloc(bl_off(1));
@@ -182,6 +188,7 @@ static int ext2_mkdir(struct vfs_callback_ctx* ctx, uint32_t mode) {
 	buf->record_len = bl_off(1);
 
 	if(!ext2_inode_write_data(fs, inode, inode_num, 0, sizeof(struct dirent), (uint8_t*)buf)) {
+		ext2_inode_put(fs, inode);
 		kfree(parent);
 		kfree(buf);
 		sc_errno = ENOENT;
@@ -198,19 +205,15 @@ static int ext2_mkdir(struct vfs_callback_ctx* ctx, uint32_t mode) {
 		inode->gid = 0;
 	}
 
-	ext2_inode_write(fs, inode, inode_num);
+	ext2_inode_dirty(fs, inode);
 	ext2_dirent_add(fs, parent->inode, inode_num, basename(ctx->path), EXT2_DIRENT_FT_DIR);
 
 	// Add . and .. dirents
 	ext2_dirent_add(fs, inode_num, inode_num, ".", EXT2_DIRENT_FT_DIR);
 	ext2_dirent_add(fs, inode_num, parent->inode, "..", EXT2_DIRENT_FT_DIR);
 
-	uint32_t blockgroup_num = inode_to_blockgroup(inode_num);
-	fs->blockgroup_table[blockgroup_num].used_directories++;
-	write_blockgroup_table();
-
+	ext2_inode_put(fs, inode);
 	kfree(parent);
-	kfree(inode);
 	return 0;
 }
 
@@ -222,16 +225,15 @@ static int ext2_utimes(struct vfs_callback_ctx* ctx, struct timeval times[2]) {
 		return -1;
 	}
 
-	struct inode* inode = kmalloc(fs->superblock->inode_size);
-	if(!ext2_inode_read(fs, inode, dirent->inode)) {
-		kfree(inode);
+	struct inode* inode = ext2_inode_get(fs, dirent->inode);
+	if(!inode) {
 		kfree(dirent);
 		sc_errno = ENOENT;
 		return -1;
 	}
 
 	if(ext2_inode_check_perm(PERM_CHECK_WRITE, inode, ctx->task) < 0) {
-		kfree(inode);
+		ext2_inode_put(fs, inode);
 		kfree(dirent);
 		sc_errno = EACCES;
 		return -1;
@@ -248,8 +250,8 @@ static int ext2_utimes(struct vfs_callback_ctx* ctx, struct timeval times[2]) {
 		inode->ctime = t;
 	}
 
-	ext2_inode_write(fs, inode, dirent->inode);
-	kfree(inode);
+	ext2_inode_dirty(fs, inode);
+	ext2_inode_put(fs, inode);
 	kfree(dirent);
 	return 0;
 }
@@ -268,16 +270,15 @@ static int do_unlink(struct ext2_fs* fs, char* path, bool is_dir, task_t* task)
 		return -1;
 	}
 
-	struct inode* inode = kmalloc(fs->superblock->inode_size);
-	if(!ext2_inode_read(fs, inode, dirent->inode)) {
-		kfree(inode);
+	struct inode* inode = ext2_inode_get(fs, dirent->inode);
+	if(!inode) {
 		kfree(dirent);
 		sc_errno = ENOENT;
 		return -1;
 	}
 
 	if(ext2_inode_check_perm(PERM_CHECK_WRITE, inode, task) < 0) {
-		kfree(inode);
+		ext2_inode_put(fs, inode);
 		kfree(dirent);
 		sc_errno = EACCES;
 		return -1;
@@ -293,7 +294,7 @@ static int do_unlink(struct ext2_fs* fs, char* path, bool is_dir, task_t* task)
 	if(is_dir) {
 		if(vfs_mode_to_filetype(inode->mode) != FT_IFDIR) {
 			sc_errno = ENOTDIR;
-			kfree(inode);
+			ext2_inode_put(fs, inode);
 			kfree(dirent);
 			return -1;
 		}
@@ -301,7 +302,7 @@ static int do_unlink(struct ext2_fs* fs, char* path, bool is_dir, task_t* task)
 		// FIXME Should probably check more throroughly it only contains ./..
 		// and has no hard links
 		if(link_count > 2) {
-			kfree(inode);
+			ext2_inode_put(fs, inode);
 			kfree(dirent);
 			sc_errno = ENOTEMPTY;
 			return -1;
@@ -311,7 +312,7 @@ static int do_unlink(struct ext2_fs* fs, char* path, bool is_dir, task_t* task)
 		link_count -= 2;
 	} else {
 		if(vfs_mode_to_filetype(inode->mode) == FT_IFDIR) {
-			kfree(inode);
+			ext2_inode_put(fs, inode);
 			kfree(dirent);
 			sc_errno = EISDIR;
 			return -1;
@@ -326,53 +327,30 @@ static int do_unlink(struct ext2_fs* fs, char* path, bool is_dir, task_t* task)
 		debug("do_unlink: inode %d link count < 1, purging.\n", dirent->inode);
 		inode->dtime = time_get();
 		inode->link_count = 0;
+		pagecache_invalidate(fs, dirent->inode);
+		dcache_invalidate(fs, dirent->inode);
 
-		// Free data blocks
-		struct blockgroup* blockgroup = fs->blockgroup_table + inode_to_blockgroup(dirent->inode);
-		struct ext2_blocknum_resolver_cache* res_cache = zmalloc(sizeof(struct ext2_blocknum_resolver_cache));
-
-		for(int i = 0; true; i++) {
-			uint32_t num = ext2_resolve_blocknum(fs, inode, i, res_cache);
-			if(!num) {
-				break;
-			}
-
-			ext2_bitmap_free(fs, blockgroup->block_bitmap, num % fs->superblock->blocks_per_group);
-		}
-
-		ext2_free_blocknum_resolver_cache(res_cache);
-		ext2_bitmap_free(fs, blockgroup->inode_bitmap, (dirent->inode - 1) % fs->superblock->inodes_per_group);
-		fs->superblock->free_inodes++;
-		blockgroup->free_inodes++;
-
-		// inode->block_count counts IDE blocks, free_blocks counts ext2 blocks.
-		fs->superblock->free_blocks += inode->block_count / 8;
-		blockgroup->free_blocks += inode->block_count / 8;
+		ext2_inode_free_blocks(fs, inode);
+		ext2_inode_free_num(fs, dirent->inode, is_dir);
 
 		if(is_dir) {
-			blockgroup->used_directories--;
-
 			// Decrease parent directory link count (removed .. entry)
-			struct inode* dir_inode = kmalloc(fs->superblock->inode_size);
-			if(!ext2_inode_read(fs, dir_inode, dir_ino)) {
-				kfree(dir_inode);
-				kfree(inode);
+			struct inode* dir_inode = ext2_inode_get(fs, dir_ino);
+			if(!dir_inode) {
+				ext2_inode_put(fs, inode);
 				kfree(dirent);
 				sc_errno = ENOENT;
 				return -1;
 			}
 
 			dir_inode->link_count--;
-			ext2_inode_write(fs, dir_inode, dir_ino);
-			kfree(dir_inode);
+			ext2_inode_dirty(fs, dir_inode);
+			ext2_inode_put(fs, dir_inode);
 		}
-
-		write_superblock();
-		write_blockgroup_table();
 	}
 
-	ext2_inode_write(fs, inode, dirent->inode);
-	kfree(inode);
+	ext2_inode_dirty(fs, inode);
+	ext2_inode_put(fs, inode);
 	kfree(dirent);
 	return 0;
 }
@@ -432,9 +410,8 @@ static int ext2_access(struct vfs_callback_ctx* ctx, uint32_t amode) {
 		return -1;
 	}
 
-	struct inode* inode = kmalloc(fs->superblock->inode_size);
-	if(!ext2_inode_read(fs, inode, dirent->inode)) {
-		kfree(inode);
+	struct inode* inode = ext2_inode_get(fs, dirent->inode);
+	if(!inode) {
 		kfree(dirent);
 		sc_errno = ENOENT;
 		return -1;
@@ -450,15 +427,12 @@ static int ext2_access(struct vfs_callback_ctx* ctx, uint32_t amode) {
 	if(amode & X_OK) {
 		perm_check += ext2_inode_check_perm(PERM_CHECK_EXEC, inode, ctx->task);
 	}
+	ext2_inode_put(fs, inode);
+	kfree(dirent);
 	if(perm_check < 0) {
-		kfree(inode);
-		kfree(dirent);
 		sc_errno = EACCES;
 		return -1;
 	}
-
-	kfree(inode);
-	kfree(dirent);
 	return 0;
 }
 
@@ -470,35 +444,40 @@ static int ext2_readlink(struct vfs_callback_ctx* ctx, char* buf, size_t size) {
 		return -1;
 	}
 
-	struct inode* inode = kmalloc(fs->superblock->inode_size);
-	if(!ext2_inode_read(fs, inode, dirent->inode)) {
-		kfree(inode);
-		kfree(dirent);
+	struct inode* inode = ext2_inode_get(fs, dirent->inode);
+	kfree(dirent);
+	if(!inode) {
 		sc_errno = ENOENT;
 		return -1;
 	}
 
 	if(ext2_inode_check_perm(PERM_CHECK_READ, inode, ctx->task) < 0) {
-		kfree(inode);
-		kfree(dirent);
+		ext2_inode_put(fs, inode);
 		sc_errno = EACCES;
 		return -1;
 	}
 
 	if(vfs_mode_to_filetype(inode->mode) != FT_IFLNK) {
-		kfree(inode);
-		kfree(dirent);
+		ext2_inode_put(fs, inode);
 		sc_errno = EINVAL;
 		return -1;
 	}
 
 	size_t len = strlcpy(buf, (char*)inode->blocks, size);
-	kfree(inode);
-	kfree(dirent);
+	ext2_inode_put(fs, inode);
 	return len;
 }
 
 
+// Reads file data for the page cache, meta is the inode
+static size_t fill_page(struct pagecache_file* file, uint64_t offset, size_t size, uint8_t* buf) {
+	struct ext2_fs* fs = file->owner;
+	if(!ext2_inode_read_data(fs, (struct inode*)file->meta, offset, size, buf)) {
+		return -1;
+	}
+	return size;
+}
+
 static size_t ext2_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
 	struct ext2_fs* fs = ctx->mp->instance;
 	if(!ctx->fp || !ctx->fp->inode || !fs) {
@@ -509,15 +488,14 @@ static size_t ext2_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
 
 	debug("ext2_read_file for %s, off %d, size %d\n", ctx->fp->mount_path, ctx->fp->offset, size);
 
-	struct inode* inode = kmalloc(fs->superblock->inode_size);
-	if(!ext2_inode_read(fs, inode, ctx->fp->inode)) {
-		kfree(inode);
+	struct inode* inode = ext2_inode_get(fs, ctx->fp->inode);
+	if(!inode) {
 		sc_errno = EBADF;
 		return -1;
 	}
 
 	if(ext2_inode_check_perm(PERM_CHECK_READ, inode, ctx->task) < 0) {
-		kfree(inode);
+		ext2_inode_put(fs, inode);
 		sc_errno = EACCES;
 		return -1;
 	}
@@ -532,13 +510,13 @@ static size_t ext2_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
 			"(0x%x: %s)\n", inode->mode,
 			vfs_filetype_to_verbose(vfs_mode_to_filetype(inode->mode)));
 
-		kfree(inode);
+		ext2_inode_put(fs, inode);
 		sc_errno = EISDIR;
 		return -1;
 	}
 
 	if(inode->size < 1 || ctx->fp->offset >= inode->size) {
-		kfree(inode);
+		ext2_inode_put(fs, inode);
 		return 0;
 	}
 
@@ -547,13 +525,17 @@ static size_t ext2_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
 		debug("ext2: Capping read size to 0x%x\n", size);
 	}
 
-	uint8_t* read = ext2_inode_read_data(fs, inode, ctx->fp->offset, size, dest);
-	kfree(inode);
+	struct pagecache_file file = {
+		.owner = fs,
+		.inode = ctx->fp->inode,
+		.size = inode->size,
+		.fill = fill_page,
+		.meta = inode,
+	};
 
-	if(!read) {
-		return 0;
-	}
-	return size;
+	size_t read = pagecache_read(&file, ctx->fp, ctx->fp->offset, size, dest);
+	ext2_inode_put(fs, inode);
+	return read;
 }
 
 static size_t ext2_write(struct vfs_callback_ctx* ctx, void* source, size_t size) {
@@ -566,15 +548,14 @@ static size_t ext2_write(struct vfs_callback_ctx* ctx, void* source, size_t size
 
 	debug("ext2_write_file for %s, off %d, size %d\n", ctx->fp->mount_path, ctx->fp->offset, size);
 
-	struct inode* inode = kmalloc(fs->superblock->inode_size);
-	if(!ext2_inode_read(fs, inode, ctx->fp->inode)) {
-		kfree(inode);
+	struct inode* inode = ext2_inode_get(fs, ctx->fp->inode);
+	if(!inode) {
 		sc_errno = EBADF;
 		return -1;
 	}
 
 	if(ext2_inode_check_perm(PERM_CHECK_WRITE, inode, ctx->task) < 0) {
-		kfree(inode);
+		ext2_inode_put(fs, inode);
 		sc_errno = EACCES;
 		return -1;
 	}
@@ -588,42 +569,42 @@ static size_t ext2_write(struct vfs_callback_ctx* ctx, void* source, size_t size
 			"(0x%x: %s)\n", inode->mode,
 			vfs_filetype_to_verbose(vfs_mode_to_filetype(inode->mode)));
 
-		kfree(inode);
+		ext2_inode_put(fs, inode);
 		sc_errno = EISDIR;
 		return -1;
 	}
 
 	if(!ext2_inode_write_data(fs, inode, ctx->fp->inode, ctx->fp->offset, size, source)) {
-		kfree(inode);
+		ext2_inode_put(fs, inode);
 		return -1;
 	}
 
+	pagecache_write(fs, ctx->fp->inode, ctx->fp->offset, size, source);
+
 	inode->size = ctx->fp->offset + size;
 	inode->mtime = time_get();
-	ext2_inode_write(fs, inode, ctx->fp->inode);
-	kfree(inode);
+	ext2_inode_dirty(fs, inode);
+	ext2_inode_put(fs, inode);
 	return size;
 }
 
 
 static size_t ext2_getdents(struct vfs_callback_ctx* ctx, void* buf, size_t size) {
 	struct ext2_fs* fs = ctx->mp->instance;
-	struct inode* inode = kmalloc(fs->superblock->inode_size);
-
-	if(!ext2_inode_read(fs, inode, ctx->fp->inode)) {
-		kfree(inode);
+	struct inode* inode = ext2_inode_get(fs, ctx->fp->inode);
+	if(!inode) {
 		sc_errno = EBADF;
 		return -1;
 	}
 
 	if(ext2_inode_check_perm(PERM_CHECK_EXEC, inode, ctx->task) < 0) {
-		kfree(inode);
+		ext2_inode_put(fs, inode);
 		sc_errno = EACCES;
 		return -1;
 	}
 
 	if(vfs_mode_to_filetype(inode->mode) != FT_IFDIR) {
-		kfree(inode);
+		ext2_inode_put(fs, inode);
 		sc_errno = ENOTDIR;
 		return -1;
 	}
@@ -646,7 +627,7 @@ static size_t ext2_getdents(struct vfs_callback_ctx* ctx, void* buf, size_t size
 		kfree(ent);
 	}
 
-	kfree(inode);
+	ext2_inode_put(fs, inode);
 	kfree(rd_reent);
 	return offset;
 }
@@ -669,7 +650,6 @@ static vfs_file_t* handle_symlink(struct vfs_callback_ctx* ctx, struct inode* in
 	 */
 	if(inode->size > 60) {
 		log(LOG_WARN, "ext2: Symlinks with length >60 are not supported right now.\n");
-		kfree(inode);
 		return NULL;
 	}
 
@@ -730,35 +710,41 @@ static vfs_file_t* ext2_open(struct vfs_callback_ctx* ctx, uint32_t flags) {
 	}
 
 	uint32_t inode_num;
-	struct inode* inode = kmalloc(fs->superblock->inode_size);
+	struct inode* inode;
 
 	if(!dirent || !dirent->inode) {
-		inode_num = ext2_inode_new(fs, inode, FT_IFREG | S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-		ext2_dirent_add(fs, parent_inode, inode_num, basename(ctx->path), EXT2_DIRENT_FT_REG_FILE);
+		kfree(dirent);
+		inode = ext2_inode_new(fs, FT_IFREG | S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH, &inode_num);
+		if(!inode) {
+			sc_errno = EIO;
+			return NULL;
+		}
 
 		if(ctx->task) {
 			inode->uid = ctx->task->euid;
 			inode->gid = ctx->task->egid;
+			ext2_inode_dirty(fs, inode);
 		}
+
+		ext2_dirent_add(fs, parent_inode, inode_num, basename(ctx->path), EXT2_DIRENT_FT_REG_FILE);
 	} else {
 		inode_num = dirent->inode;
 		kfree(dirent);
 
 		if((flags & O_CREAT) && (flags & O_EXCL)) {
-			kfree(inode);
 			sc_errno = EEXIST;
 			return NULL;
 		}
 
-		if(!ext2_inode_read(fs, inode, inode_num)) {
-			kfree(inode);
+		inode = ext2_inode_get(fs, inode_num);
+		if(!inode) {
 			sc_errno = ENOENT;
 			return NULL;
 		}
 
 		if((flags & O_WRONLY) || (flags & O_RDWR)) {
 			if(ext2_inode_check_perm(PERM_CHECK_WRITE, inode, ctx->task) < 0) {
-				kfree(inode);
+				ext2_inode_put(fs, inode);
 				sc_errno = EACCES;
 				return NULL;
 			}
@@ -767,17 +753,17 @@ static vfs_file_t* ext2_open(struct vfs_callback_ctx* ctx, uint32_t flags) {
 
 	uint16_t ft = vfs_mode_to_filetype(inode->mode);
 	if(ft == FT_IFDIR && (flags & O_WRONLY || flags & O_RDWR)) {
-		kfree(inode);
+		ext2_inode_put(fs, inode);
 		sc_errno = EISDIR;
 		return NULL;
 	}
 
 	if(ft == FT_IFLNK) {
 		vfs_file_t* r = handle_symlink(ctx, inode, flags);
-		kfree(inode);
+		ext2_inode_put(fs, inode);
 		return r;
 	}
-	kfree(inode);
+	ext2_inode_put(fs, inode);
 
 	vfs_file_t* fp = vfs_alloc_fileno(ctx->task, 3);
 	if(!fp) {
@@ -792,6 +778,40 @@ static vfs_file_t* ext2_open(struct vfs_callback_ctx* ctx, uint32_t flags) {
 	return fp;
 }
 
+// Write back dirty inodes and allocation counts to the block cache
+static int sync_fs(struct ext2_fs* fs) {
+	int ret = ext2_inode_sync(fs);
+	if(ext2_write_meta(fs) < 0) {
+		ret = -1;
+	}
+	return ret;
+}
+
+static void sync_work_func(struct work* work) {
+	sync_fs((struct ext2_fs*)work->data);
+}
+
+static int ext2_sync(struct vfs_callback_ctx* ctx) {
+	return sync_fs(ctx->mp->instance);
+}
+
+// Give back blocks preallocated for writes to the file
+static int ext2_close(struct vfs_callback_ctx* ctx) {
+	struct ext2_fs* fs = ctx->mp->instance;
+	if(!ctx->fp->inode || !(ctx->fp->flags & (O_WRONLY | O_RDWR))) {
+		return 0;
+	}
+
+	struct inode* inode = ext2_inode_get(fs, ctx->fp->inode);
+	if(!inode) {
+		return -1;
+	}
+
+	ext2_inode_release_prealloc(fs, inode);
+	ext2_inode_put(fs, inode);
+	return 0;
+}
+
 struct vfs_callbacks cb = {
 	.open = ext2_open,
 	.stat = ext2_stat,
@@ -809,6 +829,8 @@ struct vfs_callbacks cb = {
 	.readlink = ext2_readlink,
 	.access = ext2_access,
 	.build_path_tree = ext2_build_path_tree,
+	.sync = ext2_sync,
+	.close = ext2_close,
 };
 
 int ext2_mount(struct vfs_block_dev* dev, const char* path) {
@@ -862,18 +884,24 @@ int ext2_mount(struct vfs_block_dev* dev, const char* path) {
 		return -1;
 	}
 
-	// Cache root inode
-	struct inode* root_inode_buf = kmalloc(fs->superblock->inode_size);
-	if(!ext2_inode_read(fs, root_inode_buf, ROOT_INODE)) {
+	fs->num_groups = RDIV(fs->superblock->block_count - fs->superblock->first_data_block,
+		fs->superblock->blocks_per_group);
+	fs->block_bitmaps = zmalloc(fs->num_groups * sizeof(uint32_t*));
+	fs->inode_bitmaps = zmalloc(fs->num_groups * sizeof(uint32_t*));
+	work_init(&fs->sync_work, sync_work_func, fs);
+
+	// Keep the root inode referenced for as long as the file system is mounted
+	fs->root_inode = ext2_inode_get(fs, ROOT_INODE);
+	if(!fs->root_inode) {
 		log(LOG_ERR, "ext2: Could not read root inode.\n");
+		kfree(fs->block_bitmaps);
+		kfree(fs->inode_bitmaps);
 		kfree(fs->superblock);
 		kfree(fs->blockgroup_table);
-		kfree(root_inode_buf);
 		kfree(fs);
 		return -1;
 	}
 
-	fs->root_inode = root_inode_buf;
 	fs->superblock->mount_count++;
 	fs->superblock->mount_time = time_get();
 	fs->callbacks = &cb;
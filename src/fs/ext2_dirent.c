@@ -29,9 +29,12 @@
 #include <mem/kmalloc.h>
 #include <fs/vfs.h>
 #include <fs/ftree.h>
+#include <fs/dcache.h>
 
 #define dirent_off *offset - reent->read_off
-vfs_dirent_t* ext2_readdir_r(struct ext2_fs* fs, struct inode* inode, uint64_t* offset, struct rd_r* reent) {
+
+// Returns the next used entry in the read buffer, or NULL at the end
+static struct dirent* next_dirent(struct ext2_fs* fs, struct inode* inode, uint64_t* offset, struct rd_r* reent) {
 	while(1) {
 		if(dirent_off + sizeof(struct dirent) >= reent->read_len) {
 			if(*offset >= inode->size) {
@@ -54,43 +57,65 @@ vfs_dirent_t* ext2_readdir_r(struct ext2_fs* fs, struct inode* inode, uint64_t*
 
 		reent->last_len = ent->record_len;
 		*offset += ent->record_len;
-		if(!ent->inode) {
-			continue;
+		if(ent->inode) {
+			return ent;
 		}
+	}
+}
 
-		// Convert ext2 dirent format to regular dirent
-		size_t length = sizeof(vfs_dirent_t) + ent->name_len + 2;
-		vfs_dirent_t* result = (vfs_dirent_t*)zmalloc(length);
-		result->d_ino = ent->inode;
-		result->d_type = ent->type;
-		result->d_reclen = length;
-		memcpy(result->d_name, ent->name, ent->name_len);
-		result->d_name[ent->name_len] = 0;
-		return result;
+vfs_dirent_t* ext2_readdir_r(struct ext2_fs* fs, struct inode* inode, uint64_t* offset, struct rd_r* reent) {
+	struct dirent* ent = next_dirent(fs, inode, offset, reent);
+	if(!ent) {
+		return NULL;
 	}
+
+	// Convert ext2 dirent format to regular dirent
+	size_t length = sizeof(vfs_dirent_t) + ent->name_len + 2;
+	vfs_dirent_t* result = (vfs_dirent_t*)zmalloc(length);
+	result->d_ino = ent->inode;
+	result->d_type = ent->type;
+	result->d_reclen = length;
+	memcpy(result->d_name, ent->name, ent->name_len);
+	result->d_name[ent->name_len] = 0;
+	return result;
 }
 
-// Looks for a directory entry with name `search` in a directory inode
-static struct dirent* search_dir(struct ext2_fs* fs, struct inode* inode, const char* search) {
-	struct dirent* result = NULL;
+/* Looks for a directory entry with name `search` in a directory inode.
+ * Returns the inode number, or 0 if there is no such entry.
+ */
+static uint32_t search_dir(struct ext2_fs* fs, struct inode* inode, const char* search, uint8_t* type) {
+	uint32_t result = 0;
+	size_t len = strlen(search);
 	struct rd_r* rd_reent = zmalloc(sizeof(struct rd_r));
 
-	vfs_dirent_t* ent = NULL;
+	struct dirent* ent = NULL;
 	uint64_t offset = 0;
-	while((ent = ext2_readdir_r(fs, inode, &offset, rd_reent))) {
-		if(!strcmp(ent->d_name, search)) {
-			result = kmalloc(ent->d_reclen);
-			memcpy(result, ent, ent->d_reclen);
-			kfree(ent);
+	while((ent = next_dirent(fs, inode, &offset, rd_reent))) {
+		if(ent->name_len == len && !memcmp(ent->name, search, len)) {
+			result = ent->inode;
+			*type = ent->type;
 			break;
 		}
-		kfree(ent);
 	}
 
 	kfree(rd_reent);
 	return result;
 }
 
+// Look up a name in a directory, using the dentry cache
+static uint32_t dir_lookup(struct ext2_fs* fs, struct inode* dir, uint32_t dir_num, const char* name, uint8_t* type) {
+	uint32_t inode_num;
+	if(dcache_lookup(fs, dir_num, name, &inode_num, type)) {
+		return inode_num;
+	}
+
+	uint32_t gen = dcache_gen();
+	*type = EXT2_DIRENT_FT_UNKNOWN;
+	inode_num = search_dir(fs, dir, name, type);
+	dcache_add(fs, dir_num, name, inode_num, *type, gen);
+	return inode_num;
+}
+
 struct dirent* ext2_dirent_find(struct ext2_fs* fs, const char* path, uint32_t* parent_ino, task_t* task) {
 
 	if(unlikely(!strcmp("/", path)))
@@ -103,7 +128,7 @@ struct dirent* ext2_dirent_find(struct ext2_fs* fs, const char* path, uint32_t*
 	// Throwaway pointer for strtok_r
 	char* path_tmp = strndup(path, 500);
 	pch = strtok_r(path_tmp, "/", &sp);
-	struct inode* inode = kmalloc(fs->superblock->inode_size);
+	struct inode* inode = NULL;
 	struct dirent* dirent = NULL;
 	struct dirent* result = NULL;
 
@@ -111,27 +136,35 @@ struct dirent* ext2_dirent_find(struct ext2_fs* fs, const char* path, uint32_t*
 	struct ftree_file* ft_root = NULL;
 	#endif
 
-	if(unlikely(!ext2_inode_read(fs, inode, ROOT_INODE))) {
+	inode = ext2_inode_get(fs, ROOT_INODE);
+	if(unlikely(!inode)) {
 		goto bye;
 	}
 
 	while(pch != NULL) {
-		int inode_num = dirent ? dirent->inode : ROOT_INODE;
-		if(dirent) {
-			kfree(dirent);
-		}
-
+		uint32_t inode_num = dirent ? dirent->inode : ROOT_INODE;
 		if(parent_ino) {
 			*parent_ino = inode_num;
 		}
 
-		dirent = search_dir(fs, inode, pch);
-		if(!dirent) {
+		uint8_t type;
+		uint32_t found = dir_lookup(fs, inode, inode_num, pch, &type);
+		if(!found) {
 			sc_errno = ENOENT;
 			goto bye;
 		}
 
-		if(!ext2_inode_read(fs, inode, dirent->inode)) {
+		if(!dirent) {
+			dirent = kmalloc(sizeof(struct dirent));
+		}
+		dirent->inode = found;
+		dirent->record_len = sizeof(struct dirent);
+		dirent->name_len = 0;
+		dirent->type = type;
+
+		ext2_inode_put(fs, inode);
+		inode = ext2_inode_get(fs, dirent->inode);
+		if(!inode) {
 			sc_errno = ENOENT;
 			goto bye;
 		}
@@ -166,22 +199,26 @@ struct dirent* ext2_dirent_find(struct ext2_fs* fs, const char* path, uint32_t*
 	}
 	result = dirent;
 bye:
+	if(!result && dirent) {
+		kfree(dirent);
+	}
 	kfree(path_tmp);
-	kfree(inode);
+	if(inode) {
+		ext2_inode_put(fs, inode);
+	}
 	return result;
 }
 
 void ext2_dirent_rm(struct ext2_fs* fs, uint32_t inode_num, char* name) {
-	struct inode* inode = kmalloc(fs->superblock->inode_size);
-	if(!ext2_inode_read(fs, inode, inode_num)) {
-		kfree(inode);
+	struct inode* inode = ext2_inode_get(fs, inode_num);
+	if(!inode) {
 		return;
 	}
 
 	uint8_t* dirent_block = kmalloc(inode->size);
 	if(!ext2_inode_read_data(fs, inode, 0, inode->size, dirent_block)) {
 		kfree(dirent_block);
-		kfree(inode);
+		ext2_inode_put(fs, inode);
 		return;
 	}
 
@@ -211,7 +248,7 @@ void ext2_dirent_rm(struct ext2_fs* fs, uint32_t inode_num, char* name) {
 
 	if(!found) {
 		kfree(dirent_block);
-		kfree(inode);
+		ext2_inode_put(fs, inode);
 		return;
 	}
 
@@ -221,8 +258,9 @@ void ext2_dirent_rm(struct ext2_fs* fs, uint32_t inode_num, char* name) {
 	}
 
 	ext2_inode_write_data(fs, inode, inode_num, 0, inode->size, dirent_block);
+	dcache_remove(fs, inode_num, name);
 	kfree(dirent_block);
-	kfree(inode);
+	ext2_inode_put(fs, inode);
 }
 
 static inline uint32_t align_dirent_len(uint32_t dlen) {
@@ -238,21 +276,20 @@ static inline uint32_t align_dirent_len(uint32_t dlen) {
 void ext2_dirent_add(struct ext2_fs* fs, uint32_t dir_num, uint32_t inode_num, char* name, uint8_t type) {
 	debug("ext2_new_dirent dir %d ino %d name %s\n", dir_num, inode_num, name);
 
-	struct inode* dir = kmalloc(fs->superblock->inode_size);
-	if(!ext2_inode_read(fs, dir, dir_num)) {
-		kfree(dir);
+	struct inode* dir = ext2_inode_get(fs, dir_num);
+	if(!dir) {
 		return;
 	}
 
 	if(dir->flags & EXT2_INDEX_FL) {
 		log(LOG_ERR, "ext2_dirent_add: No support for writing to indexed dirents.\n");
-		kfree(dir);
+		ext2_inode_put(fs, dir);
 		return;
 	}
 
 	void* dirents = kmalloc(dir->size);
 	if(!ext2_inode_read_data(fs, dir, 0, dir->size, dirents)) {
-		kfree(dir);
+		ext2_inode_put(fs, dir);
 		kfree(dirents);
 		return;
 	}
@@ -296,12 +333,14 @@ void ext2_dirent_add(struct ext2_fs* fs, uint32_t dir_num, uint32_t inode_num, c
 	}
 
 	ext2_inode_write_data(fs, dir, dir_num, 0, dir->size, dirents);
+	dcache_remove(fs, dir_num, name);
 
 	// Increase inode link count
-	struct inode* inode = kmalloc(fs->superblock->inode_size);
-	if(ext2_inode_read(fs, inode, inode_num)) {
+	struct inode* inode = ext2_inode_get(fs, inode_num);
+	if(inode) {
 		inode->link_count++;
-		ext2_inode_write(fs, inode, inode_num);
+		ext2_inode_dirty(fs, inode);
+		ext2_inode_put(fs, inode);
 	}
 
 	// FIXME Update parent directory mtime/ctime
@@ -311,7 +350,7 @@ void ext2_dirent_add(struct ext2_fs* fs, uint32_t dir_num, uint32_t inode_num, c
 	}
 
 	kfree(dirents);
-	kfree(dir);
+	ext2_inode_put(fs, dir);
 }
 
 #endif /* CONFIG_ENABLE_EXT2 */
@@ -28,6 +28,11 @@
 #include <mem/kmalloc.h>
 #include <fs/vfs.h>
 #include <block/block.h>
+#include <tasks/preempt.h>
+#include <tasks/workqueue.h>
+#include <tasks/scheduler.h>
+#include <spinlock.h>
+#include <stddef.h>
 
 
 static uint64_t find_inode(struct ext2_fs* fs, uint32_t inode_num) {
@@ -48,67 +53,296 @@ static uint64_t find_inode(struct ext2_fs* fs, uint32_t inode_num) {
 		+ ((inode_num - 1) % fs->superblock->inodes_per_group * fs->superblock->inode_size);
 }
 
-static struct inode* check_cache(struct ext2_fs* fs, uint32_t inode_num) {
-	for(int i = 0; i < INODE_CACHE_MAX && fs->inode_cache[i].num; i++) {
-		if(fs->inode_cache[i].num == inode_num) {
-			return &fs->inode_cache[i].inode;
+/* In-core inode table. Callers borrow inodes using ext2_inode_get and return
+ * them using ext2_inode_put, so everybody using an inode shares the same copy.
+ * Changes are made to the borrowed inode directly and then flagged using
+ * ext2_inode_dirty. Dirty inodes are written back by the sync work of the
+ * file system, on sync and on unmount.
+ *
+ * Entries are kept in a hash table and on an LRU list with the most recently
+ * used one at the head. Both, as well as reference counts and dirty flags,
+ * are protected by fs->inode_lock. Once there are more than INODE_CACHE_MAX
+ * entries, unreferenced clean ones get evicted starting from the tail.
+ */
+// Slots for the indirect tables on the way to a block, see map_block
+#define MAP_SLOTS 6
+
+/* Indirect block tables used by the last lookups on an inode, so sequential
+ * access doesn't have to read them again for every block. Kept with the
+ * in-core inode so all users see the same tables. Protected by busy, which
+ * is held while reading tables and allocating blocks.
+ *
+ * Regular files also get a preallocation window of up to EXT2_PREALLOC
+ * blocks that directly follow the last allocated one. These are already
+ * marked as used in the block bitmap, and are freed again on close using
+ * ext2_inode_release_prealloc.
+ */
+struct block_map {
+	uint32_t blocks[MAP_SLOTS];
+	uint32_t* tables[MAP_SLOTS];
+	uint32_t last_alloc;
+	uint32_t prealloc_block;
+	uint32_t prealloc_count;
+	volatile bool busy;
+};
+
+struct ext2_cached_inode {
+	uint32_t num;
+	uint32_t refs;
+	bool dirty;
+	struct block_map map;
+
+	struct ext2_cached_inode* hash_next;
+	struct ext2_cached_inode* lru_prev;
+	struct ext2_cached_inode* lru_next;
+
+	// Followed by the rest of the inode if the on-disk inode size is larger
+	struct inode inode;
+};
+
+#define cached_inode(inode) ((struct ext2_cached_inode*)((uintptr_t)(inode) \
+	- offsetof(struct ext2_cached_inode, inode)))
+
+static void lru_unlink(struct ext2_fs* fs, struct ext2_cached_inode* entry) {
+	if(entry->lru_prev) {
+		entry->lru_prev->lru_next = entry->lru_next;
+	} else {
+		fs->inode_lru_head = entry->lru_next;
+	}
+
+	if(entry->lru_next) {
+		entry->lru_next->lru_prev = entry->lru_prev;
+	} else {
+		fs->inode_lru_tail = entry->lru_prev;
+	}
+}
+
+static void lru_push(struct ext2_fs* fs, struct ext2_cached_inode* entry) {
+	entry->lru_prev = NULL;
+	entry->lru_next = fs->inode_lru_head;
+	if(fs->inode_lru_head) {
+		fs->inode_lru_head->lru_prev = entry;
+	}
+	fs->inode_lru_head = entry;
+	if(!fs->inode_lru_tail) {
+		fs->inode_lru_tail = entry;
+	}
+}
+
+static void map_lock(struct block_map* map) {
+	while(__sync_lock_test_and_set(&map->busy, 1)) {
+		scheduler_yield();
+	}
+}
+
+static void map_unlock(struct block_map* map) {
+	__sync_lock_release(&map->busy);
+}
+
+// Forget all cached tables. Needs the map lock, or the inode to be unused.
+static void map_clear(struct block_map* map) {
+	for(int i = 0; i < MAP_SLOTS; i++) {
+		if(map->tables[i]) {
+			kfree(map->tables[i]);
+		}
+		map->tables[i] = NULL;
+		map->blocks[i] = 0;
+	}
+	map->last_alloc = 0;
+}
+
+// Free the unused part of the preallocation window. Needs the map lock.
+static void map_release(struct ext2_fs* fs, struct block_map* map) {
+	for(uint32_t i = 0; i < map->prealloc_count; i++) {
+		ext2_block_free(fs, map->prealloc_block + i);
+	}
+	map->prealloc_count = 0;
+}
+
+static struct ext2_cached_inode* lookup(struct ext2_fs* fs, uint32_t inode_num) {
+	struct ext2_cached_inode* entry = fs->inode_hash[inode_num % INODE_CACHE_HASH];
+	for(; entry; entry = entry->hash_next) {
+		if(entry->num == inode_num) {
+			return entry;
 		}
 	}
 	return NULL;
 }
 
-bool ext2_inode_read(struct ext2_fs* fs, struct inode* buf, uint32_t inode_num) {
-	if(inode_num == ROOT_INODE && fs->root_inode) {
-		memcpy(buf, fs->root_inode, fs->superblock->inode_size);
-		return true;
+static void unhash(struct ext2_fs* fs, struct ext2_cached_inode* entry) {
+	struct ext2_cached_inode** prev = &fs->inode_hash[entry->num % INODE_CACHE_HASH];
+	for(; *prev; prev = &(*prev)->hash_next) {
+		if(*prev == entry) {
+			*prev = entry->hash_next;
+			return;
+		}
+	}
+}
+
+// Needs the inode lock
+static inline struct inode* borrow(struct ext2_fs* fs, struct ext2_cached_inode* entry) {
+	entry->refs++;
+	lru_unlink(fs, entry);
+	lru_push(fs, entry);
+	return &entry->inode;
+}
+
+/* Evict unreferenced clean inodes beyond the limit. Dirty inodes have to be
+ * written back first, returns true if the sync work should be run for that.
+ * Needs the inode lock.
+ */
+static bool shrink(struct ext2_fs* fs) {
+	bool need_sync = false;
+	struct ext2_cached_inode* entry = fs->inode_lru_tail;
+	while(entry && fs->inode_cache_size > INODE_CACHE_MAX) {
+		struct ext2_cached_inode* prev = entry->lru_prev;
+		if(entry->dirty) {
+			need_sync = true;
+		} else if(!entry->refs && !entry->map.prealloc_count) {
+			unhash(fs, entry);
+			lru_unlink(fs, entry);
+			fs->inode_cache_size--;
+			map_clear(&entry->map);
+			kfree(entry);
+		}
+		entry = prev;
 	}
+	return need_sync;
+}
 
-	struct inode* cache_in = check_cache(fs, inode_num);
-	if(cache_in) {
-		memcpy(buf, cache_in, sizeof(struct inode));
-		return true;
+// Borrow an inode. Needs to be returned using ext2_inode_put.
+struct inode* ext2_inode_get(struct ext2_fs* fs, uint32_t inode_num) {
+	spinlock_get(&fs->inode_lock, -1);
+	struct ext2_cached_inode* entry = lookup(fs, inode_num);
+	if(entry) {
+		struct inode* inode = borrow(fs, entry);
+		spinlock_release(&fs->inode_lock);
+		return inode;
 	}
+	spinlock_release(&fs->inode_lock);
 
+	// Read with the lock released, the block cache might have to wait for the disk
 	uint64_t inode_off = find_inode(fs, inode_num);
 	if(!inode_off) {
-		return false;
+		return NULL;
 	}
 
-	if(vfs_block_sread(fs->dev, inode_off, fs->superblock->inode_size, (uint8_t*)buf) < fs->superblock->inode_size) {
-		return false;
+	struct ext2_cached_inode* new = zmalloc(offsetof(struct ext2_cached_inode, inode)
+		+ MAX(fs->superblock->inode_size, sizeof(struct inode)));
+
+	if(vfs_block_sread(fs->dev, inode_off, fs->superblock->inode_size, (uint8_t*)&new->inode) < fs->superblock->inode_size) {
+		kfree(new);
+		return NULL;
 	}
 
-	struct inode_cache_entry* cache = &fs->inode_cache[fs->inode_cache_end];
-	memcpy(&cache->inode, buf, sizeof(struct inode));
-	cache->num = inode_num;
-	fs->inode_cache_end = (fs->inode_cache_end + 1) % INODE_CACHE_MAX;
-	return true;
-}
+	spinlock_get(&fs->inode_lock, -1);
 
-bool ext2_inode_write(struct ext2_fs* fs, struct inode* buf, uint32_t inode_num) {
-	if(inode_num == ROOT_INODE && fs->root_inode) {
-		memcpy(fs->root_inode, buf, fs->superblock->inode_size);
+	// Somebody else might have read the same inode in the meantime
+	entry = lookup(fs, inode_num);
+	if(entry) {
+		struct inode* inode = borrow(fs, entry);
+		spinlock_release(&fs->inode_lock);
+		kfree(new);
+		return inode;
 	}
 
-	uint64_t inode_off = find_inode(fs, inode_num);
-	if(!inode_off) {
-		return false;
+	new->num = inode_num;
+	new->refs = 1;
+	new->hash_next = fs->inode_hash[inode_num % INODE_CACHE_HASH];
+	fs->inode_hash[inode_num % INODE_CACHE_HASH] = new;
+	lru_push(fs, new);
+	fs->inode_cache_size++;
+
+	bool need_sync = shrink(fs);
+	spinlock_release(&fs->inode_lock);
+
+	if(need_sync) {
+		queue_work(&fs->sync_work);
+	}
+	return &new->inode;
+}
+
+void ext2_inode_put(struct ext2_fs* fs, struct inode* inode) {
+	spinlock_get(&fs->inode_lock, -1);
+	cached_inode(inode)->refs--;
+	spinlock_release(&fs->inode_lock);
+}
+
+// Flag changes to a borrowed inode so it gets written back
+void ext2_inode_dirty(struct ext2_fs* fs, struct inode* inode) {
+	struct ext2_cached_inode* entry = cached_inode(inode);
+	spinlock_get(&fs->inode_lock, -1);
+	bool was_dirty = entry->dirty;
+	entry->dirty = true;
+	spinlock_release(&fs->inode_lock);
+
+	if(!was_dirty) {
+		queue_delayed_work(&fs->sync_work, EXT2_SYNC_MS);
 	}
+}
+
+/* Write back all dirty inodes. This only updates the block cache, so it needs
+ * to be followed by bcache_sync to get the changes to disk. Returns -1 if any
+ * of the inodes could not be written.
+ */
+int ext2_inode_sync(struct ext2_fs* fs) {
+	int ret = 0;
+	uint8_t* buf = kmalloc(fs->superblock->inode_size);
+
+	while(true) {
+		spinlock_get(&fs->inode_lock, -1);
+		struct ext2_cached_inode* entry = fs->inode_lru_head;
+		for(; entry; entry = entry->lru_next) {
+			if(entry->dirty) {
+				break;
+			}
+		}
+
+		if(!entry) {
+			spinlock_release(&fs->inode_lock);
+			break;
+		}
 
-	struct inode* cache_in = check_cache(fs,inode_num);
-	if(cache_in) {
-		memcpy(cache_in, buf, sizeof(struct inode));
+		/* Copy with the lock held, so any changes made while writing flag the
+		 * inode as dirty again.
+		 */
+		memcpy(buf, &entry->inode, fs->superblock->inode_size);
+		entry->dirty = false;
+		uint32_t inode_num = entry->num;
+		spinlock_release(&fs->inode_lock);
+
+		uint64_t inode_off = find_inode(fs, inode_num);
+		if(!inode_off || vfs_block_swrite(fs->dev, inode_off,
+			fs->superblock->inode_size, buf) < fs->superblock->inode_size) {
+
+			log(LOG_ERR, "ext2: Could not write back inode %u\n", inode_num);
+			ret = -1;
+		}
 	}
 
-	return vfs_block_swrite(fs->dev, inode_off, fs->superblock->inode_size, (uint8_t*)buf);
+	kfree(buf);
+	return ret;
 }
 
-uint32_t ext2_inode_new(struct ext2_fs* fs, struct inode* inode, uint16_t mode) {
-	struct blockgroup* blockgroup = fs->blockgroup_table;
-	while(!blockgroup->free_inodes) { blockgroup++; }
+// Allocate a new inode. Returns it borrowed, like ext2_inode_get.
+struct inode* ext2_inode_new(struct ext2_fs* fs, uint16_t mode, uint32_t* inode_num) {
+	bool dir = vfs_mode_to_filetype(mode) == FT_IFDIR;
+	*inode_num = ext2_inode_alloc_num(fs, dir);
+	if(!*inode_num) {
+		return NULL;
+	}
+
+	// Might still be cached from before it was freed
+	struct inode* inode = ext2_inode_get(fs, *inode_num);
+	if(!inode) {
+		ext2_inode_free_num(fs, *inode_num, dir);
+		return NULL;
+	}
 
-	// Inodes are 1-indexed, so add 1 to result.
-	uint32_t inode_num = ext2_bitmap_search_and_claim(fs, blockgroup->inode_bitmap) + 1;
+	struct block_map* map = &cached_inode(inode)->map;
+	map_lock(map);
+	map_clear(map);
+	map_unlock(map);
 
 	bzero(inode, fs->superblock->inode_size);
 	inode->mode = mode;
@@ -117,158 +351,307 @@ uint32_t ext2_inode_new(struct ext2_fs* fs, struct inode* inode, uint16_t mode)
 	inode->ctime = t;
 	inode->mtime = t;
 	inode->atime = t;
-	ext2_inode_write(fs, inode, inode_num);
-
-	fs->superblock->free_inodes--;
-	blockgroup->free_inodes--;
-	write_superblock();
-	write_blockgroup_table();
-	return inode_num;
+	ext2_inode_dirty(fs, inode);
+	return inode;
 }
 
-void ext2_free_blocknum_resolver_cache(struct ext2_blocknum_resolver_cache* cache) {
-	if(cache->indirect_table) {
-		kfree(cache->indirect_table);
+// Returns the table in block, reading it unless it is cached in slot
+static uint32_t* map_table(struct ext2_fs* fs, struct block_map* map, int slot, uint32_t block) {
+	if(map->blocks[slot] == block) {
+		return map->tables[slot];
 	}
 
-	if(cache->double_table) {
-		kfree(cache->double_table);
+	if(!map->tables[slot]) {
+		map->tables[slot] = kmalloc(bl_off(1));
 	}
 
-	if(cache->double_second_table) {
-		kfree(cache->double_second_table);
+	if(vfs_block_sread(fs->dev, bl_off(block), bl_off(1), (uint8_t*)map->tables[slot]) < bl_off(1)) {
+		map->blocks[slot] = 0;
+		return NULL;
 	}
 
-	kfree(cache);
+	map->blocks[slot] = block;
+	return map->tables[slot];
 }
 
-// FIXME This is a mess (and also has no triply-indirect block support).
-uint32_t ext2_resolve_blocknum(struct ext2_fs* fs, struct inode* inode, uint32_t block_num, struct ext2_blocknum_resolver_cache* cache) {
-	uint32_t real_block_num = 0;
-	const uint32_t entries_per_block = bl_off(1) / sizeof(uint32_t);
+/* Allocate a block for the inode, preferably right after the last one.
+ * New indirect tables get cleared. Needs the map lock.
+ */
+static uint32_t map_alloc(struct ext2_fs* fs, struct inode* inode, struct block_map* map,
+	uint32_t inode_num, bool table) {
 
-	if(block_num < 12) {
-		real_block_num = inode->blocks[block_num];
-	} else if(block_num < entries_per_block + 12) {
-		if(!inode->blocks[12]) {
+	uint32_t goal = map->last_alloc ? map->last_alloc + 1 : 0;
+	uint32_t block;
+
+	if(map->prealloc_count && map->prealloc_block == goal) {
+		block = map->prealloc_block++;
+		map->prealloc_count--;
+	} else {
+		map_release(fs, map);
+		uint32_t count = 1;
+		if(vfs_mode_to_filetype(inode->mode) == FT_IFREG) {
+			count += EXT2_PREALLOC;
+		}
+
+		block = ext2_block_new(fs, inode_num, goal, &count);
+		if(!block) {
 			return 0;
 		}
 
-		if(!cache->indirect_table) {
-			cache->indirect_table = (uint32_t*)zmalloc(bl_off(1));
-			vfs_block_sread(fs->dev, bl_off(inode->blocks[12]), bl_off(1), (uint8_t*)cache->indirect_table);
+		map->prealloc_block = block + 1;
+		map->prealloc_count = count - 1;
+	}
+
+	map->last_alloc = block;
+
+	if(table) {
+		uint8_t* zero = zmalloc(bl_off(1));
+		uint64_t written = vfs_block_swrite(fs->dev, bl_off(block), bl_off(1), zero);
+		kfree(zero);
+
+		if(written < bl_off(1)) {
+			ext2_block_free(fs, block);
+			return 0;
 		}
+	}
+
+	// Counts 512-byte sectors, not ext2 blocks
+	inode->block_count += bl_off(1) / 512;
+	ext2_inode_dirty(fs, inode);
+	return block;
+}
 
-		real_block_num = cache->indirect_table[block_num - 12];
-	} else if(block_num < entries_per_block * entries_per_block + 12) {
-		if(!inode->blocks[13]) {
+/* Find the physical block for block block_num of the inode. The first 12
+ * blocks are listed in the inode, the following ones in single, double and
+ * triple indirect tables. If alloc_inode_num is set, missing blocks and
+ * tables are allocated on the way. Returns 0 if there is no such block.
+ * Needs the map lock.
+ */
+static uint32_t map_block(struct ext2_fs* fs, struct inode* inode, struct block_map* map,
+	uint32_t block_num, uint32_t alloc_inode_num) {
+
+	const uint64_t per_table = bl_off(1) / sizeof(uint32_t);
+	uint32_t offsets[3];
+	int depth = 0;
+	int slot = 0;
+	int index = block_num;
+	uint64_t num = block_num;
+
+	if(num >= 12) {
+		num -= 12;
+		if(num < per_table) {
+			depth = 1;
+			index = 12;
+			offsets[0] = num;
+		} else if((num -= per_table) < per_table * per_table) {
+			depth = 2;
+			index = 13;
+			slot = 1;
+			offsets[0] = num / per_table;
+			offsets[1] = num % per_table;
+		} else if((num -= per_table * per_table) < per_table * per_table * per_table) {
+			depth = 3;
+			index = 14;
+			slot = 3;
+			offsets[0] = num / (per_table * per_table);
+			offsets[1] = num / per_table % per_table;
+			offsets[2] = num % per_table;
+		} else {
 			return 0;
 		}
+	}
+
+	// Continue after the previous block of the file if nothing was allocated yet
+	if(alloc_inode_num && !map->last_alloc && block_num) {
+		map->last_alloc = map_block(fs, inode, map, block_num - 1, 0);
+	}
 
-		if(!cache->double_table) {
-			cache->double_table = (uint32_t*)zmalloc(bl_off(1));
-			vfs_block_sread(fs->dev, bl_off(inode->blocks[13]), bl_off(1), (uint8_t*)cache->double_table);
+	uint32_t block = inode->blocks[index];
+	if(!block) {
+		if(!alloc_inode_num) {
+			return 0;
 		}
 
-		uint32_t indir_block_num = cache->double_table[(block_num - entries_per_block - 12) / entries_per_block];
-		if(!indir_block_num) {
+		block = map_alloc(fs, inode, map, alloc_inode_num, depth > 0);
+		if(!block) {
 			return 0;
 		}
+		inode->blocks[index] = block;
+	}
 
-		if(!cache->double_second_table) {
-			cache->double_second_table = (uint32_t*)zmalloc(bl_off(1));
+	for(int level = 0; level < depth; level++) {
+		uint32_t* table = map_table(fs, map, slot + level, block);
+		if(!table) {
+			return 0;
 		}
 
-		if(cache->double_second_block != indir_block_num) {
-			vfs_block_sread(fs->dev, bl_off(indir_block_num), bl_off(1), (uint8_t*)cache->double_second_table);
-			cache->double_second_block = indir_block_num;
+		uint32_t next = table[offsets[level]];
+		if(!next) {
+			if(!alloc_inode_num) {
+				return 0;
+			}
+
+			next = map_alloc(fs, inode, map, alloc_inode_num, level + 1 < depth);
+			if(!next) {
+				return 0;
+			}
+
+			if(vfs_block_swrite(fs->dev, bl_off(block) + offsets[level] * sizeof(uint32_t),
+				sizeof(uint32_t), (uint8_t*)&next) < sizeof(uint32_t)) {
+				return 0;
+			}
+			table[offsets[level]] = next;
 		}
+		block = next;
+	}
 
-		real_block_num = cache->double_second_table[(block_num - entries_per_block - 12) % entries_per_block];
-	} else {
+	return block;
+}
+
+/* Resolves block block_num of a borrowed inode, allocating it if
+ * write_inode_num is set and it does not exist yet. Returns 0 if there is no
+ * such block.
+ */
+static uint32_t get_block(struct ext2_fs* fs, struct inode* inode, uint32_t write_inode_num, uint32_t block_num) {
+	struct block_map* map = &cached_inode(inode)->map;
+	map_lock(map);
+	uint32_t block = map_block(fs, inode, map, block_num, write_inode_num);
+	map_unlock(map);
+	return block;
+}
+
+uint32_t ext2_resolve_blocknum(struct ext2_fs* fs, struct inode* inode, uint32_t block_num) {
+	return get_block(fs, inode, 0, block_num);
+}
+
+// Frees a table and everything it points to, returns the number of blocks freed
+static uint32_t free_table(struct ext2_fs* fs, uint32_t block, int depth) {
+	if(!depth) {
+		ext2_block_free(fs, block);
+		return 1;
+	}
+
+	uint32_t* table = kmalloc(bl_off(1));
+	if(vfs_block_sread(fs->dev, bl_off(block), bl_off(1), (uint8_t*)table) < bl_off(1)) {
+		log(LOG_ERR, "ext2: Could not read indirect block %u, leaking blocks\n", block);
+		kfree(table);
 		return 0;
 	}
 
-	return real_block_num;
+	uint32_t freed = 0;
+	for(uint32_t i = 0; i < bl_off(1) / sizeof(uint32_t); i++) {
+		if(table[i]) {
+			freed += free_table(fs, table[i], depth - 1);
+		}
+	}
+
+	kfree(table);
+	ext2_block_free(fs, block);
+	return freed + 1;
+}
+
+/* Free all data blocks and indirect tables of a borrowed inode. The caller
+ * needs to write the superblock and blockgroup table afterwards.
+ */
+uint32_t ext2_inode_free_blocks(struct ext2_fs* fs, struct inode* inode) {
+	// Fast symlinks store their target in the block list
+	if(vfs_mode_to_filetype(inode->mode) == FT_IFLNK && !inode->block_count) {
+		return 0;
+	}
+
+	struct block_map* map = &cached_inode(inode)->map;
+	map_lock(map);
+
+	uint32_t freed = 0;
+	for(int i = 0; i < 15; i++) {
+		if(inode->blocks[i]) {
+			freed += free_table(fs, inode->blocks[i], i < 12 ? 0 : i - 11);
+			inode->blocks[i] = 0;
+		}
+	}
+
+	map_release(fs, map);
+	map_clear(map);
+	map_unlock(map);
+
+	inode->block_count = 0;
+	ext2_inode_dirty(fs, inode);
+	return freed;
+}
+
+// Free the unused preallocated blocks of a borrowed inode, for example on close
+void ext2_inode_release_prealloc(struct ext2_fs* fs, struct inode* inode) {
+	struct block_map* map = &cached_inode(inode)->map;
+	map_lock(map);
+	map_release(fs, map);
+	map_unlock(map);
 }
 
 /* Will write if write_inode_num is set, otherwise read. Use
  * exta_inode_read_data/exta_inode_write_data macros instead.
+ *
+ * Runs of physically contiguous blocks are transferred using a single
+ * request. Regular file data is cached in the page cache, so it gets read
+ * directly into buf rather than through the block cache.
  */
 uint8_t* ext2_inode_data_rw(struct ext2_fs* fs, struct inode* inode, uint32_t write_inode_num,
 	uint64_t offset, size_t length, uint8_t* buf) {
 
-
-	uint32_t num_blocks = bl_size(length);
-	if(bl_mod(length)) {
-		num_blocks++;
-	}
-	if(bl_mod(offset) && bl_mod(offset) + bl_mod(length) > bl_off(1)) {
-		num_blocks++;
+	if(!length) {
+		return buf;
 	}
 
-	uint32_t buf_offset = 0;
-	struct ext2_blocknum_resolver_cache* res_cache = zmalloc(sizeof(struct ext2_blocknum_resolver_cache));
-	for(int i = 0; i < num_blocks; i++) {
-		uint32_t block_num = ext2_resolve_blocknum(fs, inode, i + bl_size(offset), res_cache);
+	uint32_t first_block = bl_size(offset);
+	uint32_t num_blocks = bl_size(offset + length - 1) - first_block + 1;
+	bool direct = !write_inode_num && vfs_mode_to_filetype(inode->mode) == FT_IFREG;
 
-		if(!block_num) {
-			if(!write_inode_num) {
-				return NULL;
-			}
-
-			block_num = ext2_block_new(fs, write_inode_num);
-			if(!block_num) {
-				ext2_free_blocknum_resolver_cache(res_cache);
-				return NULL;
-			}
+	uint8_t* result = buf;
+	uint64_t buf_offset = 0;
 
-			// Counts 512-byte ide blocks, not ext2 blocks, so 8.
-			// FIXME Properly calculate from block size rather than hardcoding
-			inode->block_count += 8;
-
-			if(i < 12) {
-				inode->blocks[i] = block_num;
-			} else {
-				// TODO
-				log(LOG_ERR, "ext2: Indirect block writes not supported atm.\n");
-				ext2_free_blocknum_resolver_cache(res_cache);
-				return NULL;
-			}
+	for(uint32_t i = 0; i < num_blocks;) {
+		uint32_t block_num = get_block(fs, inode, write_inode_num, first_block + i);
+		if(!block_num) {
+			result = NULL;
+			break;
+		}
 
-			ext2_inode_write(fs, inode, write_inode_num);
+		uint32_t run = 1;
+		while(i + run < num_blocks && get_block(fs, inode, write_inode_num,
+			first_block + i + run) == block_num + run) {
+			run++;
 		}
 
-		uint64_t wr_offset = bl_off(block_num);
-		uint64_t wr_size = bl_off(1);
+		uint64_t rw_offset = bl_off(block_num);
+		uint64_t rw_size = bl_off(run);
 
 		// Handle remainder of offset if first block
 		if(i == 0) {
-			wr_offset += bl_mod(offset);
-			wr_size -= bl_mod(offset);
+			rw_offset += bl_mod(offset);
+			rw_size -= bl_mod(offset);
 		}
 
-		if(wr_size > length - buf_offset) {
-			wr_size = length - buf_offset;
-		}
+		rw_size = MIN(rw_size, length - buf_offset);
 
-		int nread = -1;
+		uint64_t done;
 		if(write_inode_num) {
-			nread = vfs_block_swrite(fs->dev, wr_offset, wr_size, buf + buf_offset);
+			done = vfs_block_swrite(fs->dev, rw_offset, rw_size, buf + buf_offset);
+		} else if(direct) {
+			done = vfs_block_sread_direct(fs->dev, rw_offset, rw_size, buf + buf_offset);
 		} else {
-			nread = vfs_block_sread(fs->dev, wr_offset, wr_size, buf + buf_offset);
+			done = vfs_block_sread(fs->dev, rw_offset, rw_size, buf + buf_offset);
 		}
 
-		if(nread < wr_size) {
-			ext2_free_blocknum_resolver_cache(res_cache);
-			return NULL;
+		if(done < rw_size) {
+			result = NULL;
+			break;
 		}
 
-		buf_offset += wr_size;
+		buf_offset += rw_size;
+		i += run;
+		preempt_point();
 	}
 
-	ext2_free_blocknum_resolver_cache(res_cache);
-	return buf;
+	return result;
 }
 
 int ext2_inode_check_perm(enum inode_check_op op, struct inode* inode, task_t* task) {
@@ -43,22 +43,18 @@ struct inode {
 	uint16_t inode_size;
 } __attribute__((packed));
 
-struct ext2_blocknum_resolver_cache {
-	uint32_t* indirect_table;
-	uint32_t* double_table;
-	uint32_t double_second_block;
-	uint32_t* double_second_table;
-};
-
 #define ext2_inode_read_data(fs, inode, offset, length, buf) ext2_inode_data_rw(fs, inode, 0, offset, length, buf)
 #define ext2_inode_write_data ext2_inode_data_rw
 
 struct ext2_fs;
-bool ext2_inode_write(struct ext2_fs* fs, struct inode* buf, uint32_t inode_num);
-bool ext2_inode_read(struct ext2_fs* fs, struct inode* buf, uint32_t inode_num);
-uint32_t ext2_inode_new(struct ext2_fs* fs, struct inode* inode, uint16_t mode);
-uint32_t ext2_resolve_blocknum(struct ext2_fs* fs, struct inode* inode, uint32_t block_num, struct ext2_blocknum_resolver_cache* cache);
-void ext2_free_blocknum_resolver_cache(struct ext2_blocknum_resolver_cache* cache);
+struct inode* ext2_inode_get(struct ext2_fs* fs, uint32_t inode_num);
+void ext2_inode_put(struct ext2_fs* fs, struct inode* inode);
+void ext2_inode_dirty(struct ext2_fs* fs, struct inode* inode);
+struct inode* ext2_inode_new(struct ext2_fs* fs, uint16_t mode, uint32_t* inode_num);
+int ext2_inode_sync(struct ext2_fs* fs);
+uint32_t ext2_resolve_blocknum(struct ext2_fs* fs, struct inode* inode, uint32_t block_num);
+uint32_t ext2_inode_free_blocks(struct ext2_fs* fs, struct inode* inode);
+void ext2_inode_release_prealloc(struct ext2_fs* fs, struct inode* inode);
 uint8_t* ext2_inode_data_rw(struct ext2_fs* fs, struct inode* inode, uint32_t write_inode_num,
 	uint64_t offset, size_t length, uint8_t* buf);
 
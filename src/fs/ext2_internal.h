@@ -24,6 +24,8 @@
 #include <fs/vfs.h>
 #include <block/block.h>
 #include <tasks/task.h>
+#include <tasks/workqueue.h>
+#include <spinlock.h>
 
 #ifdef CONFIG_EXT2_DEBUG
   #define debug(args...) log(LOG_DEBUG, "ext2: " args)
@@ -81,11 +83,17 @@ struct blockgroup {
 	uint32_t reserved[3];
 } __attribute__((packed));
 
-#define INODE_CACHE_MAX 0x100
-struct inode_cache_entry {
-	uint32_t num;
-	struct inode inode;
-};
+// Unreferenced inodes kept in memory before the oldest ones get evicted
+#define INODE_CACHE_MAX 0x400
+#define INODE_CACHE_HASH 0x100
+
+// Blocks preallocated after the one being allocated when appending to a file
+#define EXT2_PREALLOC 8
+
+// Dirty inodes are written back at most this long after the first change
+#define EXT2_SYNC_MS 5000
+
+struct ext2_cached_inode;
 
 struct ext2_fs {
 	struct vfs_block_dev* dev;
@@ -94,8 +102,21 @@ struct ext2_fs {
 	struct inode* root_inode;
 	struct vfs_callbacks* callbacks;
 
-	struct inode_cache_entry inode_cache[INODE_CACHE_MAX];
-	uint32_t inode_cache_end;
+	// In-core inode table, see ext2_inode.c
+	struct ext2_cached_inode* inode_hash[INODE_CACHE_HASH];
+	struct ext2_cached_inode* inode_lru_head;
+	struct ext2_cached_inode* inode_lru_tail;
+	uint32_t inode_cache_size;
+	spinlock_t inode_lock;
+
+	// Allocation bitmaps per blockgroup, see ext2_misc.c
+	uint32_t num_groups;
+	uint32_t** block_bitmaps;
+	uint32_t** inode_bitmaps;
+	volatile bool alloc_busy;
+	bool meta_dirty;
+
+	struct work sync_work;
 };
 
 #define SUPERBLOCK_MAGIC 0xEF53
@@ -131,4 +152,5 @@ struct ext2_fs {
 #define write_blockgroup_table() vfs_block_swrite(fs->dev, bl_off(blockgroup_table_start), \
 	bl_off(blockgroup_table_size), (uint8_t*)fs->blockgroup_table)
 
-uint32_t ext2_block_new(struct ext2_fs* fs, uint32_t neighbor);
+uint32_t ext2_block_new(struct ext2_fs* fs, uint32_t neighbor, uint32_t goal, uint32_t* count);
+void ext2_block_free(struct ext2_fs* fs, uint32_t block_num);
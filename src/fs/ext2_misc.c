@@ -23,67 +23,255 @@
 #include "ext2_misc.h"
 #include <mem/kmalloc.h>
 #include <block/block.h>
-#include <bitmap.h>
-
-uint32_t ext2_bitmap_search_and_claim(struct ext2_fs* fs, uint32_t bitmap_block) {
-	// Todo check blockgroup->free_blocks to see if any blocks are free and otherwise switch block group
-	uint8_t* bitmap = kmalloc(bl_off(1));
-	vfs_block_sread(fs->dev, bl_off(bitmap_block), bl_off(1), bitmap);
-	uint32_t result = 0;
-
-	for(int i = 0; i < bl_off(1); i++) {
-		uint8_t* blt = bitmap + i;
-
-		if(*blt != 0xff) {
-			for(int j = 0; j < 8; j++) {
-				if(!bit_get(*blt, j)) {
-					*blt = bit_set(*blt, j);
-					result = i*8 + j;
-					break;
-				}
+#include <tasks/scheduler.h>
+
+/* Block and inode bitmaps are read once per blockgroup and then kept in
+ * memory. Changes to a bitmap are written through to the block cache one
+ * word at a time. The free counts in the superblock and blockgroup table are
+ * only changed in memory and written back by the sync work of the file
+ * system. All of this is protected by fs->alloc_busy, a sleeping lock since
+ * loading bitmaps can yield.
+ */
+static void alloc_lock(struct ext2_fs* fs) {
+	while(__sync_lock_test_and_set(&fs->alloc_busy, 1)) {
+		scheduler_yield();
+	}
+}
+
+static void alloc_unlock(struct ext2_fs* fs) {
+	__sync_lock_release(&fs->alloc_busy);
+}
+
+// Needs the allocation lock
+static void meta_dirty(struct ext2_fs* fs) {
+	fs->meta_dirty = true;
+	queue_delayed_work(&fs->sync_work, EXT2_SYNC_MS);
+}
+
+// Returns the bitmap in block, reading it on first use
+static uint32_t* get_bitmap(struct ext2_fs* fs, uint32_t** cache, uint32_t block) {
+	if(!*cache) {
+		uint32_t* bitmap = kmalloc(bl_off(1));
+		if(vfs_block_sread(fs->dev, bl_off(block), bl_off(1), (uint8_t*)bitmap) < bl_off(1)) {
+			log(LOG_ERR, "ext2: Could not read bitmap in block %u\n", block);
+			kfree(bitmap);
+			return NULL;
+		}
+		*cache = bitmap;
+	}
+	return *cache;
+}
+
+/* Find a clear bit among the first num_bits bits, starting at start and
+ * wrapping around. Returns -1 if all bits are set.
+ */
+static int64_t find_clear(uint32_t* bitmap, uint32_t num_bits, uint32_t start) {
+	uint32_t num_words = RDIV(num_bits, 32);
+	if(start >= num_bits) {
+		start = 0;
+	}
+
+	// The first word is checked again at the end for the bits before start
+	for(uint32_t i = 0; i <= num_words; i++) {
+		uint32_t word_num = (start / 32 + i) % num_words;
+		uint32_t word = bitmap[word_num];
+		if(!i) {
+			word |= (1U << (start % 32)) - 1;
+		}
+
+		if(word == 0xffffffff) {
+			continue;
+		}
+
+		uint32_t bit = word_num * 32 + __builtin_ctz(~word);
+		if(bit < num_bits) {
+			return bit;
+		}
+	}
+	return -1;
+}
+
+static bool update_bit(struct ext2_fs* fs, uint32_t* bitmap, uint32_t bitmap_block, uint32_t bit, bool set) {
+	uint32_t word = bit / 32;
+	if(set) {
+		bitmap[word] |= 1U << (bit % 32);
+	} else {
+		bitmap[word] &= ~(1U << (bit % 32));
+	}
+
+	return vfs_block_swrite(fs->dev, bl_off(bitmap_block) + word * sizeof(uint32_t),
+		sizeof(uint32_t), (uint8_t*)&bitmap[word]) == sizeof(uint32_t);
+}
+
+static inline bool test_bit(uint32_t* bitmap, uint32_t bit) {
+	return bitmap[bit / 32] & (1U << (bit % 32));
+}
+
+// The last blockgroup can be smaller
+static inline uint32_t group_blocks(struct ext2_fs* fs, uint32_t group_num) {
+	uint32_t start = group_num * fs->superblock->blocks_per_group + fs->superblock->first_data_block;
+	return MIN(fs->superblock->blocks_per_group, fs->superblock->block_count - start);
+}
+
+/* Allocate up to *count contiguous blocks, but at least one. The search
+ * starts at the goal block, or in the blockgroup of the inode neighbor if
+ * goal is 0. Blockgroups without free blocks are skipped. Returns the first
+ * block and sets count to the number of blocks allocated, or returns 0 if
+ * there are no free blocks.
+ */
+uint32_t ext2_block_new(struct ext2_fs* fs, uint32_t neighbor, uint32_t goal, uint32_t* count) {
+	uint32_t first_group = inode_to_blockgroup(neighbor);
+	uint32_t start = 0;
+	if(goal >= fs->superblock->first_data_block && goal < fs->superblock->block_count) {
+		first_group = (goal - fs->superblock->first_data_block) / fs->superblock->blocks_per_group;
+		start = (goal - fs->superblock->first_data_block) % fs->superblock->blocks_per_group;
+	}
+
+	alloc_lock(fs);
+	for(uint32_t i = 0; i < fs->num_groups; i++) {
+		uint32_t group_num = (first_group + i) % fs->num_groups;
+		struct blockgroup* blockgroup = fs->blockgroup_table + group_num;
+		if(!blockgroup->free_blocks) {
+			continue;
+		}
+
+		uint32_t* bitmap = get_bitmap(fs, &fs->block_bitmaps[group_num], blockgroup->block_bitmap);
+		if(!bitmap) {
+			continue;
+		}
+
+		uint32_t num_bits = group_blocks(fs, group_num);
+		int64_t bit = find_clear(bitmap, num_bits, i ? 0 : start);
+		if(bit < 0) {
+			continue;
+		}
+
+		uint32_t num = 0;
+		while(num < *count && bit + num < num_bits && !test_bit(bitmap, bit + num)) {
+			if(!update_bit(fs, bitmap, blockgroup->block_bitmap, bit + num, true)) {
+				break;
 			}
+			num++;
+		}
 
-			break;
+		if(!num) {
+			continue;
 		}
+
+		fs->superblock->free_blocks -= num;
+		blockgroup->free_blocks -= num;
+		meta_dirty(fs);
+		alloc_unlock(fs);
+
+		*count = num;
+		return group_num * fs->superblock->blocks_per_group
+			+ fs->superblock->first_data_block + bit;
 	}
 
-	if(result) {
-		vfs_block_swrite(fs->dev, bl_off(bitmap_block), bl_off(1), bitmap);
+	alloc_unlock(fs);
+	log(LOG_ERR, "ext2: Could not find a free block.\n");
+	return 0;
+}
+
+void ext2_block_free(struct ext2_fs* fs, uint32_t block_num) {
+	uint32_t bit = block_num - fs->superblock->first_data_block;
+	uint32_t group_num = bit / fs->superblock->blocks_per_group;
+	struct blockgroup* blockgroup = fs->blockgroup_table + group_num;
+	bit %= fs->superblock->blocks_per_group;
+
+	alloc_lock(fs);
+	uint32_t* bitmap = get_bitmap(fs, &fs->block_bitmaps[group_num], blockgroup->block_bitmap);
+	if(!bitmap || !test_bit(bitmap, bit)) {
+		log(LOG_WARN, "ext2: Freeing block %u, which is not in use\n", block_num);
+		alloc_unlock(fs);
+		return;
 	}
 
-	kfree(bitmap);
-	return result;
+	update_bit(fs, bitmap, blockgroup->block_bitmap, bit, false);
+	fs->superblock->free_blocks++;
+	blockgroup->free_blocks++;
+	meta_dirty(fs);
+	alloc_unlock(fs);
 }
 
-void ext2_bitmap_free(struct ext2_fs* fs, uint32_t bitmap_block, uint32_t bit) {
-	uint8_t* bitmap = kmalloc(bl_off(1));
-	vfs_block_sread(fs->dev, bl_off(bitmap_block), bl_off(1), bitmap);
-	bitmap[bit / 8] = bit_clear(bitmap[bit / 8], bit % 8);
-	vfs_block_swrite(fs->dev, bl_off(bitmap_block), bl_off(1), bitmap);
-	kfree(bitmap);
+// Allocate an inode number. Returns 0 if there are no free inodes.
+uint32_t ext2_inode_alloc_num(struct ext2_fs* fs, bool dir) {
+	alloc_lock(fs);
+	for(uint32_t group_num = 0; group_num < fs->num_groups; group_num++) {
+		struct blockgroup* blockgroup = fs->blockgroup_table + group_num;
+		if(!blockgroup->free_inodes) {
+			continue;
+		}
+
+		uint32_t* bitmap = get_bitmap(fs, &fs->inode_bitmaps[group_num], blockgroup->inode_bitmap);
+		if(!bitmap) {
+			continue;
+		}
+
+		int64_t bit = find_clear(bitmap, fs->superblock->inodes_per_group, 0);
+		if(bit < 0 || !update_bit(fs, bitmap, blockgroup->inode_bitmap, bit, true)) {
+			continue;
+		}
+
+		fs->superblock->free_inodes--;
+		blockgroup->free_inodes--;
+		if(dir) {
+			blockgroup->used_directories++;
+		}
+
+		meta_dirty(fs);
+		alloc_unlock(fs);
+
+		// Inodes are 1-indexed
+		return group_num * fs->superblock->inodes_per_group + bit + 1;
+	}
+
+	alloc_unlock(fs);
+	log(LOG_ERR, "ext2: Could not find a free inode.\n");
+	return 0;
 }
 
-uint32_t ext2_block_new(struct ext2_fs* fs, uint32_t neighbor) {
-	uint32_t pref_blockgroup = inode_to_blockgroup(neighbor);
+void ext2_inode_free_num(struct ext2_fs* fs, uint32_t inode_num, bool dir) {
+	uint32_t group_num = inode_to_blockgroup(inode_num);
+	uint32_t bit = (inode_num - 1) % fs->superblock->inodes_per_group;
+	struct blockgroup* blockgroup = fs->blockgroup_table + group_num;
 
-	struct blockgroup* blockgroup = fs->blockgroup_table + pref_blockgroup;
-	if(!blockgroup || !blockgroup->inode_table) {
-		log(LOG_ERR, "ext2: Could not locate entry %d in blockgroup table\n", pref_blockgroup);
-		return 0;
+	alloc_lock(fs);
+	uint32_t* bitmap = get_bitmap(fs, &fs->inode_bitmaps[group_num], blockgroup->inode_bitmap);
+	if(!bitmap || !test_bit(bitmap, bit)) {
+		log(LOG_WARN, "ext2: Freeing inode %u, which is not in use\n", inode_num);
+		alloc_unlock(fs);
+		return;
 	}
 
-	uint32_t block_num = ext2_bitmap_search_and_claim(fs, blockgroup->block_bitmap);
-	if(!block_num) {
-		log(LOG_ERR, "ext2: Could not find free block in preferred blockgroup %d.\n", pref_blockgroup);
-		return 0;
+	update_bit(fs, bitmap, blockgroup->inode_bitmap, bit, false);
+	fs->superblock->free_inodes++;
+	blockgroup->free_inodes++;
+	if(dir) {
+		blockgroup->used_directories--;
 	}
 
-	fs->superblock->free_blocks--;
-	blockgroup->free_blocks--;
-	write_superblock();
-	write_blockgroup_table();
-	return block_num;
+	meta_dirty(fs);
+	alloc_unlock(fs);
+}
 
+/* Write the superblock and blockgroup table if any of the counts changed.
+ * Like for inodes, this only updates the block cache.
+ */
+int ext2_write_meta(struct ext2_fs* fs) {
+	int ret = 0;
+	alloc_lock(fs);
+	if(fs->meta_dirty) {
+		fs->meta_dirty = false;
+		if(write_superblock() < sizeof(struct superblock)
+			|| write_blockgroup_table() < bl_off(blockgroup_table_size)) {
+
+			log(LOG_ERR, "ext2: Could not write superblock or blockgroup table\n");
+			ret = -1;
+		}
+	}
+	alloc_unlock(fs);
+	return ret;
 }
 
 #endif /* CONFIG_ENABLE_EXT2 */
@@ -20,7 +20,10 @@
 #include <fs/mount.h>
 #include <fs/vfs.h>
 #include <block/block.h>
+#include <block/bcache.h>
 #include <fs/sysfs.h>
+#include <fs/pagecache.h>
+#include <fs/dcache.h>
 #include <fs/ext2.h>
 #include <tasks/task.h>
 #include <mem/kmalloc.h>
@@ -145,6 +148,17 @@ int vfs_mount(task_t* task, const char* source, const char* target, int flags) {
 	return r;
 }
 
+// Let the file system write back its own caches to the block cache
+static void sync_mountpoint(struct vfs_mountpoint* mp, task_t* task) {
+	if(mp->callbacks.sync) {
+		struct vfs_callback_ctx ctx = {
+			.mp = mp,
+			.task = task,
+		};
+		mp->callbacks.sync(&ctx);
+	}
+}
+
 int vfs_umount(task_t* task, const char* target, int flags) {
 	if(task->euid != 0) {
 		sc_errno = EPERM;
@@ -174,14 +188,29 @@ int vfs_umount(task_t* task, const char* target, int flags) {
 		mountpoints = mp->next;
 	}
 
+	sync_mountpoint(mp, task);
 	if(mp->dev) {
+		bcache_sync(mp->dev);
 		mp->dev->mounted = false;
 	}
 
+	pagecache_invalidate(mp->instance, 0);
+	dcache_invalidate(mp->instance, 0);
+
 	kfree(mp);
 	return 0;
 }
 
+// Write back all cached data to disk
+int vfs_sync(task_t* task) {
+	for(struct vfs_mountpoint* mp = mountpoints; mp; mp = mp->next) {
+		sync_mountpoint(mp, task);
+	}
+
+	bcache_sync(NULL);
+	return 0;
+}
+
 static size_t sfs_mounts_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
 	if(ctx->fp->offset) {
 		return 0;
@@ -37,4 +37,5 @@ int vfs_mount_register(struct vfs_block_dev* dev, const char* path, void* instan
 struct vfs_mountpoint* vfs_mount_get(const char* path, char** mount_path);
 int vfs_mount(struct task* task, const char* source, const char* target, int flags);
 int vfs_umount(struct task* task, const char* target, int flags);
+int vfs_sync(struct task* task);
 void vfs_mount_init(const char* root_path);
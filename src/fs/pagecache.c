@@ -0,0 +1,493 @@
+/* pagecache.c: Cache for regular file data
+ * Copyright © 2023 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pagecache.h"
+#include <mem/kmalloc.h>
+#include <mem/paging.h>
+#include <fs/sysfs.h>
+#include <spinlock.h>
+#include <string.h>
+
+#define INODE_HASH_SIZE 64
+#define PAGE_HASH_SIZE 512
+
+/* Each cached inode has a list of its pages, which are indexed by file
+ * offset / PAGE_SIZE. Inodes only stay around as long as they have pages.
+ * All pages are also in a hash table and on an LRU list with the most
+ * recently used page at the head.
+ *
+ * Pages are never dirty. Writes go to the file system as usual and are then
+ * copied to the cached pages, so pages can be reclaimed at any time unless
+ * somebody is copying from them. A page that is still being read is not
+ * ready, and readers that find it read from the file system instead.
+ */
+struct cached_inode {
+	void* owner;
+	uint32_t num;
+	struct cached_page* pages;
+	struct cached_inode* hash_next;
+};
+
+struct cached_page {
+	struct cached_inode* inode;
+	uint32_t index;
+
+	// Number of valid bytes, less than PAGE_SIZE at the end of the file
+	uint32_t len;
+	uint8_t* data;
+
+	uint32_t refs;
+	bool ready;
+	bool hashed;
+	struct cached_page* hash_next;
+	struct cached_page* inode_prev;
+	struct cached_page* inode_next;
+	struct cached_page* lru_prev;
+	struct cached_page* lru_next;
+};
+
+static struct cached_inode* inode_hash[INODE_HASH_SIZE];
+static struct cached_page* page_hash[PAGE_HASH_SIZE];
+static struct cached_page* lru_head = NULL;
+static struct cached_page* lru_tail = NULL;
+static spinlock_t lock;
+
+static uint32_t num_pages = 0;
+static uint64_t hits = 0;
+static uint64_t misses = 0;
+static uint64_t readahead = 0;
+
+#define inode_key(owner, num) (((uintptr_t)(owner) >> 4 ^ (num)) % INODE_HASH_SIZE)
+#define page_key(inode, index) (((uintptr_t)(inode) >> 4 ^ (index)) % PAGE_HASH_SIZE)
+
+static void lru_unlink(struct cached_page* page) {
+	if(page->lru_prev) {
+		page->lru_prev->lru_next = page->lru_next;
+	} else {
+		lru_head = page->lru_next;
+	}
+
+	if(page->lru_next) {
+		page->lru_next->lru_prev = page->lru_prev;
+	} else {
+		lru_tail = page->lru_prev;
+	}
+}
+
+static void lru_push(struct cached_page* page) {
+	page->lru_prev = NULL;
+	page->lru_next = lru_head;
+	if(lru_head) {
+		lru_head->lru_prev = page;
+	}
+	lru_head = page;
+	if(!lru_tail) {
+		lru_tail = page;
+	}
+}
+
+static struct cached_inode* find_inode(void* owner, uint32_t num) {
+	struct cached_inode* inode = inode_hash[inode_key(owner, num)];
+	for(; inode; inode = inode->hash_next) {
+		if(inode->owner == owner && inode->num == num) {
+			return inode;
+		}
+	}
+	return NULL;
+}
+
+static struct cached_page* find_page(struct cached_inode* inode, uint32_t index) {
+	struct cached_page* page = page_hash[page_key(inode, index)];
+	for(; page; page = page->hash_next) {
+		if(page->inode == inode && page->index == index) {
+			return page;
+		}
+	}
+	return NULL;
+}
+
+static void add_page(struct cached_inode* inode, struct cached_page* page, uint32_t index) {
+	page->inode = inode;
+	page->index = index;
+	page->refs = 1;
+	page->ready = false;
+	page->hashed = true;
+
+	page->hash_next = page_hash[page_key(inode, index)];
+	page_hash[page_key(inode, index)] = page;
+
+	page->inode_prev = NULL;
+	page->inode_next = inode->pages;
+	if(inode->pages) {
+		inode->pages->inode_prev = page;
+	}
+	inode->pages = page;
+
+	lru_push(page);
+	num_pages++;
+}
+
+static void free_page(struct cached_page* page) {
+	kfree(page->data);
+	kfree(page);
+}
+
+static void remove_inode(struct cached_inode* inode) {
+	struct cached_inode** prev = &inode_hash[inode_key(inode->owner, inode->num)];
+	for(; *prev; prev = &(*prev)->hash_next) {
+		if(*prev == inode) {
+			*prev = inode->hash_next;
+			break;
+		}
+	}
+	kfree(inode);
+}
+
+/* Remove a page from the cache. It is freed once the last reference is
+ * dropped. Removing the last page of an inode also frees the inode.
+ */
+static void remove_page(struct cached_page* page) {
+	struct cached_inode* inode = page->inode;
+	struct cached_page** prev = &page_hash[page_key(inode, page->index)];
+	for(; *prev; prev = &(*prev)->hash_next) {
+		if(*prev == page) {
+			*prev = page->hash_next;
+			break;
+		}
+	}
+
+	if(page->inode_prev) {
+		page->inode_prev->inode_next = page->inode_next;
+	} else {
+		inode->pages = page->inode_next;
+	}
+	if(page->inode_next) {
+		page->inode_next->inode_prev = page->inode_prev;
+	}
+
+	lru_unlink(page);
+	page->hashed = false;
+	num_pages--;
+
+	if(!inode->pages) {
+		remove_inode(inode);
+	}
+	if(!page->refs) {
+		free_page(page);
+	}
+}
+
+static void put_page(struct cached_page* page) {
+	spinlock_get(&lock, -1);
+	if(!--page->refs && !page->hashed) {
+		free_page(page);
+	}
+	spinlock_release(&lock);
+}
+
+static uint32_t reclaim(uint32_t num) {
+	uint32_t freed = 0;
+	struct cached_page* page = lru_tail;
+	while(page && freed < num) {
+		struct cached_page* prev = page->lru_prev;
+		if(!page->refs) {
+			remove_page(page);
+			freed++;
+		}
+		page = prev;
+	}
+	return freed;
+}
+
+// Take a reference to a cached page, or return NULL if it is not ready yet
+static struct cached_page* hit(struct cached_page* page) {
+	if(!page->ready) {
+		return NULL;
+	}
+
+	page->refs++;
+	lru_unlink(page);
+	lru_push(page);
+	hits++;
+	return page;
+}
+
+/* Get a referenced, ready page. On a miss, the page is read along with up to
+ * window pages following it that are not cached yet, in a single request to
+ * the file system. Returns NULL if the page could not be cached.
+ */
+static struct cached_page* get_page(struct pagecache_file* file, uint32_t index, uint32_t window) {
+	spinlock_get(&lock, -1);
+	struct cached_inode* inode = find_inode(file->owner, file->inode);
+	struct cached_page* page = inode ? find_page(inode, index) : NULL;
+	if(page) {
+		page = hit(page);
+		spinlock_release(&lock);
+		return page;
+	}
+	spinlock_release(&lock);
+
+	uint32_t last = (file->size - 1) / PAGE_SIZE;
+	uint32_t num = MIN(1 + window, last - index + 1);
+
+	// Allocate without the lock held, so the shrinker can reclaim
+	struct cached_page* new[PAGECACHE_RA_MAX + 1];
+	for(uint32_t i = 0; i < num; i++) {
+		new[i] = zmalloc(sizeof(struct cached_page));
+		new[i]->data = kmalloc_a(PAGE_SIZE);
+	}
+	struct cached_inode* new_inode = zmalloc(sizeof(struct cached_inode));
+
+	// Reclaim first, as that can free the inode
+	spinlock_get(&lock, -1);
+	if(num_pages + num > PAGECACHE_MAX_PAGES) {
+		reclaim(num_pages + num - PAGECACHE_MAX_PAGES);
+	}
+
+	// Somebody else might have added the page in the meantime
+	inode = find_inode(file->owner, file->inode);
+	page = inode ? find_page(inode, index) : NULL;
+	uint32_t added = 0;
+
+	if(page) {
+		page = hit(page);
+	} else {
+		if(!inode) {
+			inode = new_inode;
+			new_inode = NULL;
+			inode->owner = file->owner;
+			inode->num = file->inode;
+			inode->hash_next = inode_hash[inode_key(inode->owner, inode->num)];
+			inode_hash[inode_key(inode->owner, inode->num)] = inode;
+		}
+
+		for(; added < num; added++) {
+			if(added && find_page(inode, index + added)) {
+				break;
+			}
+			add_page(inode, new[added], index + added);
+		}
+
+		misses++;
+		readahead += added - 1;
+	}
+	spinlock_release(&lock);
+
+	for(uint32_t i = added; i < num; i++) {
+		free_page(new[i]);
+	}
+	if(new_inode) {
+		kfree(new_inode);
+	}
+
+	if(!added) {
+		return page;
+	}
+
+	uint64_t offset = (uint64_t)index * PAGE_SIZE;
+	size_t size = MIN(added * PAGE_SIZE, file->size - offset);
+	uint8_t* buf = added > 1 ? kmalloc_a(added * PAGE_SIZE) : new[0]->data;
+	size_t read = file->fill(file, offset, size, buf);
+	if(read == -1) {
+		read = 0;
+	}
+
+	for(uint32_t i = 0; i < added; i++) {
+		size_t start = i * PAGE_SIZE;
+		new[i]->len = read > start ? MIN(read - start, PAGE_SIZE) : 0;
+		if(added > 1 && new[i]->len) {
+			memcpy(new[i]->data, buf + start, new[i]->len);
+		}
+	}
+	if(added > 1) {
+		kfree(buf);
+	}
+
+	// Pages that were written to in the meantime have been removed already
+	spinlock_get(&lock, -1);
+	for(uint32_t i = 0; i < added; i++) {
+		if(new[i]->hashed) {
+			if(new[i]->len) {
+				new[i]->ready = true;
+			} else {
+				remove_page(new[i]);
+			}
+		}
+
+		if(!i && new[i]->ready) {
+			page = new[i];
+			continue;
+		}
+
+		if(!--new[i]->refs && !new[i]->hashed) {
+			free_page(new[i]);
+		}
+	}
+	spinlock_release(&lock);
+	return page;
+}
+
+/* Read from a regular file through the cache. Reads that continue where the
+ * previous read on fp ended grow the readahead window, others reset it.
+ * Returns the number of bytes read.
+ */
+size_t pagecache_read(struct pagecache_file* file, vfs_file_t* fp, uint64_t offset, size_t size, uint8_t* dest) {
+	uint32_t window = 0;
+	if(fp) {
+		if(offset == fp->ra_next) {
+			window = fp->ra_window ? MIN(fp->ra_window * 2, PAGECACHE_RA_MAX) : PAGECACHE_RA_MIN;
+		}
+		fp->ra_next = offset + size;
+		fp->ra_window = window;
+	}
+
+	size_t done = 0;
+	while(done < size) {
+		uint64_t pos = offset + done;
+		size_t page_off = pos % PAGE_SIZE;
+		size_t len = MIN(size - done, PAGE_SIZE - page_off);
+
+		struct cached_page* page = NULL;
+		if(pos < file->size) {
+			page = get_page(file, pos / PAGE_SIZE, window);
+		}
+
+		if(page && page_off + len <= page->len) {
+			memcpy(dest + done, page->data + page_off, len);
+		} else {
+			size_t read = file->fill(file, pos, len, dest + done);
+			if(read == -1 || read < len) {
+				if(page) {
+					put_page(page);
+				}
+				break;
+			}
+		}
+
+		if(page) {
+			put_page(page);
+		}
+		done += len;
+	}
+	return done;
+}
+
+/* Update cached pages after data has been written to the file. Pages that
+ * are not completely valid yet are dropped instead.
+ */
+void pagecache_write(void* owner, uint32_t inode_num, uint64_t offset, size_t size, uint8_t* src) {
+	if(!size) {
+		return;
+	}
+
+	spinlock_get(&lock, -1);
+	struct cached_inode* inode = find_inode(owner, inode_num);
+	uint32_t last = (offset + size - 1) / PAGE_SIZE;
+
+	for(uint32_t index = offset / PAGE_SIZE; inode && index <= last; index++) {
+		struct cached_page* page = find_page(inode, index);
+		if(!page) {
+			continue;
+		}
+
+		uint64_t start = (uint64_t)index * PAGE_SIZE;
+		uint64_t from = MAX(offset, start);
+		uint64_t to = MIN(offset + size, start + PAGE_SIZE);
+
+		if(!page->ready || to > start + page->len) {
+			// Inode goes away along with its last page
+			bool last_page = !page->inode_prev && !page->inode_next;
+			remove_page(page);
+			if(last_page) {
+				break;
+			}
+			continue;
+		}
+
+		memcpy(page->data + (from - start), src + (from - offset), to - from);
+	}
+	spinlock_release(&lock);
+}
+
+static void invalidate_inode(struct cached_inode* inode) {
+	struct cached_page* page = inode->pages;
+	while(page) {
+		struct cached_page* next = page->inode_next;
+		remove_page(page);
+		page = next;
+	}
+}
+
+/* Drop all cached pages of an inode, for example after it was freed. An
+ * inode number of 0 drops all pages of owner.
+ */
+void pagecache_invalidate(void* owner, uint32_t inode_num) {
+	spinlock_get(&lock, -1);
+	if(inode_num) {
+		struct cached_inode* inode = find_inode(owner, inode_num);
+		if(inode) {
+			invalidate_inode(inode);
+		}
+	} else {
+		for(int i = 0; i < INODE_HASH_SIZE; i++) {
+			struct cached_inode* inode = inode_hash[i];
+			while(inode) {
+				struct cached_inode* next = inode->hash_next;
+				if(inode->owner == owner) {
+					invalidate_inode(inode);
+				}
+				inode = next;
+			}
+		}
+	}
+	spinlock_release(&lock);
+}
+
+/* Shrinker for kmalloc. Frees at least size bytes worth of pages if
+ * possible. Gives up if the lock is already held, which might be by the
+ * caller of kmalloc.
+ */
+size_t pagecache_reclaim(size_t size) {
+	if(!spinlock_raw_try(&lock)) {
+		return 0;
+	}
+
+	uint32_t freed = reclaim(RDIV(size, PAGE_SIZE));
+	spinlock_release(&lock);
+	return freed * PAGE_SIZE;
+}
+
+static size_t sfs_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
+	if(ctx->fp->offset) {
+		return 0;
+	}
+
+	size_t rsize = 0;
+	sysfs_printf("# pages hits misses readahead\n");
+	sysfs_printf("%u %llu %llu %llu\n", num_pages, hits, misses, readahead);
+	return rsize;
+}
+
+void pagecache_init(void) {
+	struct vfs_callbacks sfs_cb = {
+		.read = sfs_read,
+	};
+	sysfs_add_file("pagecache", &sfs_cb);
+	kmalloc_register_shrinker(pagecache_reclaim);
+}
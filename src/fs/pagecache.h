@@ -0,0 +1,48 @@
+#pragma once
+
+/* Copyright © 2023 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <fs/vfs.h>
+
+// Number of cached pages before the least recently used ones get reclaimed
+#define PAGECACHE_MAX_PAGES 2048
+
+// Readahead window in pages for sequential reads, doubles on every read
+#define PAGECACHE_RA_MIN 4
+#define PAGECACHE_RA_MAX 32
+
+/* A file as seen by the page cache. owner is the mount instance the inode
+ * belongs to. fill reads size bytes at offset from the file into buf and
+ * returns the number of bytes read, or -1.
+ */
+struct pagecache_file {
+	void* owner;
+	uint32_t inode;
+	uint64_t size;
+	size_t (*fill)(struct pagecache_file* file, uint64_t offset, size_t size, uint8_t* buf);
+	void* meta;
+};
+
+size_t pagecache_read(struct pagecache_file* file, vfs_file_t* fp, uint64_t offset, size_t size, uint8_t* dest);
+void pagecache_write(void* owner, uint32_t inode, uint64_t offset, size_t size, uint8_t* src);
+void pagecache_invalidate(void* owner, uint32_t inode);
+size_t pagecache_reclaim(size_t size);
+void pagecache_init(void);
@@ -20,6 +20,7 @@
 #include <fs/poll.h>
 #include <fs/vfs.h>
 #include <tasks/task.h>
+#include <tasks/preempt.h>
 #include <mem/kmalloc.h>
 #include <errno.h>
 
@@ -46,16 +47,21 @@ int vfs_poll(task_t* task, struct pollfd* fds, uint32_t nfds, int timeout) {
 		}
 	}
 
+	/* The callbacks lock what they look at, so they can run with interrupts
+	 * enabled. Only don't get switched away from in the middle of one.
+	 */
+	int_enable();
 	while(1) {
 		for(uint32_t i = 0; i < nfds; i++) {
-			int_disable();
+			preempt_disable();
 			int r = contexts[i]->fp->callbacks.poll(contexts[i], fds[i].events);
+			preempt_enable();
+
 			if(r > 0) {
 				fds[i].revents = r;
 				ret = 1;
 				goto bye;
 			}
-			int_enable();
 		}
 
 		if(timeout_end && timer_get_tick() > timeout_end) {
@@ -32,6 +32,8 @@
 #include <fs/mount.h>
 #include <block/block.h>
 #include <fs/sysfs.h>
+#include <fs/pagecache.h>
+#include <fs/dcache.h>
 #include <block/part.h>
 #include <fs/ext2.h>
 #include <fs/ftree.h>
@@ -114,11 +116,11 @@ char* vfs_normalize_path(const char* orig_path, char* cwd) {
 }
 
 vfs_file_t* vfs_get_from_id(int fd, task_t* task) {
-	if(fd < 0 || fd >= ARRAY_SIZE(task->files)) {
+	if(fd < 0 || fd >= CONFIG_VFS_MAX_OPENFILES) {
 		return NULL;
 	}
 
-	vfs_file_t* fp = task ? &task->files[fd] : &kernel_files[fd];
+	vfs_file_t* fp = task ? &task->files->fds[fd] : &kernel_files[fd];
 	if(!fp->refs) {
 		return NULL;
 	}
@@ -177,7 +179,7 @@ struct vfs_callback_ctx* vfs_context_from_path(const char* path, task_t* task) {
 }
 
 vfs_file_t* vfs_alloc_fileno(task_t* task, int min) {
-	vfs_file_t* file = &(task ? task->files : kernel_files)[min];
+	vfs_file_t* file = &(task ? task->files->fds : kernel_files)[min];
 
 	for(int i = min; i < CONFIG_VFS_MAX_OPENFILES; i++, file++) {
 		if(!file->refs) {
@@ -261,6 +263,9 @@ size_t vfs_read(task_t* task, int fd, void* dest, size_t size) {
 	int_enable();
 	size_t read = ctx->fp->callbacks.read(ctx, dest, size);
 	ctx->fp->offset += read;
+	if(task && read != -1) {
+		task->acct.rchar += read;
+	}
 	vfs_free_context(ctx);
 	return read;
 }
@@ -291,6 +296,9 @@ size_t vfs_write(task_t* task, int fd, void* source, size_t size) {
 
 	size_t written = ctx->fp->callbacks.write(ctx, source, size);
 	ctx->fp->offset += written;
+	if(task && written != -1) {
+		task->acct.wchar += written;
+	}
 	vfs_free_context(ctx);
 	return written;
 }
@@ -382,7 +390,7 @@ int vfs_fcntl(task_t* task, int fd, int cmd, int arg3) {
 		return 0;
 	} else if(cmd == F_GETPATH) {
 		vm_alloc_t alloc;
-		void* dest = vm_map(VM_KERNEL, &alloc, &task->vmem, (void*)arg3,
+		void* dest = vm_map(VM_KERNEL, &alloc, task->vmem, (void*)arg3,
 			VFS_PATH_MAX, VM_MAP_USER_ONLY | VM_RW);
 
 		if(!dest) {
@@ -410,7 +418,7 @@ int vfs_dup2(task_t* task, int fd1, int fd2) {
 		task->ctty = (struct term*)fp1->meta;
 	}
 
-	vfs_file_t* fp2 = task? &task->files[fd2] : &kernel_files[fd2];
+	vfs_file_t* fp2 = task? &task->files->fds[fd2] : &kernel_files[fd2];
 	if(!__sync_bool_compare_and_swap(&fp2->refs, 0, 1)) {
 		// Can't use fd as dup target that is already a duplication source
 		if(fp2->refs > 1) {
@@ -511,6 +519,17 @@ int vfs_close(task_t* task, int fd) {
 		}
 		#endif
 
+		if(fp->callbacks.close) {
+			struct vfs_callback_ctx ctx = {
+				.fp = fp,
+				.orig_path = fp->path,
+				.path = fp->mount_path,
+				.mp = fp->mp,
+				.task = task,
+			};
+			fp->callbacks.close(&ctx);
+		}
+
 		bzero(fp, sizeof(vfs_file_t));
 	}
 	return 0;
@@ -713,6 +732,8 @@ void vfs_init(void) {
 	#endif
 
 	sysfs_init();
+	pagecache_init();
+	dcache_init();
 	vfs_mount_init(root_path);
 
 	bzero(kernel_files, sizeof(kernel_files));
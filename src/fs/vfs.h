@@ -156,6 +156,8 @@ struct vfs_callbacks {
 	int (*ioctl)(struct vfs_callback_ctx* ctx, int request, void* arg);
 	int (*poll)(struct vfs_callback_ctx* ctx, int events);
 	int (*build_path_tree)(struct vfs_callback_ctx* ctx);
+	int (*sync)(struct vfs_callback_ctx* ctx);
+	int (*close)(struct vfs_callback_ctx* ctx);
 
 };
 
@@ -175,6 +177,10 @@ typedef struct vfs_file {
 	uint64_t offset;
 	uint32_t inode;
 
+	// Readahead state, see fs/pagecache.c
+	uint64_t ra_next;
+	uint32_t ra_window;
+
 	// File-system specific
 	uint32_t meta;
 } vfs_file_t;
@@ -114,7 +114,7 @@ struct gfx_handle* gfx_handle_init(struct vm_ctx* ctx) {
 static int sfs_ioctl(struct vfs_callback_ctx* ctx, int request, void* _arg) {
 	if(request == 0x2f01) {
 		vm_alloc_t alloc;
-		struct gfx_ul_desc* user_desc = vm_map(VM_KERNEL, &alloc, &ctx->task->vmem, _arg,
+		struct gfx_ul_desc* user_desc = vm_map(VM_KERNEL, &alloc, ctx->task->vmem, _arg,
 			sizeof(struct gfx_ul_desc), VM_MAP_USER_ONLY | VM_RW);
 
 		if(!user_desc) {
@@ -123,7 +123,7 @@ static int sfs_ioctl(struct vfs_callback_ctx* ctx, int request, void* _arg) {
 			return -1;
 		}
 
-		struct gfx_handle* handle = gfx_handle_init(&ctx->task->vmem);
+		struct gfx_handle* handle = gfx_handle_init(ctx->task->vmem);
 		if(!handle) {
 			vm_free(&alloc);
 			return -1;
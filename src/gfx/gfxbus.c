@@ -22,6 +22,7 @@
  */
 
 #include <gfx/gfxbus.h>
+#include <tasks/scheduler.h>
 #include <mem/mem.h>
 #include <fs/sysfs.h>
 #include <fs/poll.h>
@@ -52,17 +53,17 @@ static size_t sfs_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
 static size_t sfs_write(struct vfs_callback_ctx* ctx, void* source, size_t size) {
 	int wr = buffer_write(buf, source, size);
 	int_enable();
-	while(buffer_size(buf));
+	while(buffer_size(buf)) {
+		scheduler_yield();
+	}
 	int_disable();
 	return wr;
 }
 
 static int sfs_poll(struct vfs_callback_ctx* ctx, int events) {
-	int_enable();
 	if(events & POLLIN && buffer_size(buf)) {
 		return POLLIN;
 	}
-	int_disable();
 	return 0;
 }
 
@@ -79,7 +80,7 @@ static int sfs_ioctl(struct vfs_callback_ctx* ctx, int request, void* _arg) {
 
 		task_t* task = ctx->task;
 		int flags[] = {VM_USER | VM_RW | VM_ZERO, VM_USER | VM_RW};
-		struct vm_ctx* vm_ctx[] = {&master_task->vmem, &task->vmem};
+		struct vm_ctx* vm_ctx[] = {master_task->vmem, task->vmem};
 
 		void* addr = vm_alloc_many(2, vm_ctx, NULL, RDIV(size, PAGE_SIZE), NULL, flags);
 		if(!addr) {
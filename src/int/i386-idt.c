@@ -38,6 +38,9 @@ struct {
 	uint32_t base;
 } __attribute__((packed)) lidt_pointer;
 
+// Checked by the assembly interrupt handler to decide whether to send EOIs to the PIC
+uint32_t idt_pic_active UL_VISIBLE("data") = 1;
+
 static void set_gate(uint8_t num, void (*handler)(void), uint8_t flags) {
 	idt_entries[num].base_lo = (intptr_t)handler & 0xFFFF;
 	idt_entries[num].base_hi = ((intptr_t)handler >> 16) & 0xFFFF;
@@ -332,5 +335,17 @@ void idt_init(void) {
 	log(LOG_INFO, "interrupts: Setting IDT, descriptor=%#x, limit=%#x, base=%#x\n",
 		&lidt_pointer, lidt_pointer.limit,lidt_pointer.base);
 
+	idt_load();
+}
+
+// Load the IDT on the current CPU. Also used by application processors
+void idt_load(void) {
 	asm volatile("lidt (%0);":: "m" (lidt_pointer));
 }
+
+// Mask all IRQs on the PIC when they get routed through the IO-APIC instead
+void idt_disable_pic(void) {
+	outb(0x21, 0xff);
+	outb(0xa1, 0xff);
+	idt_pic_active = 0;
+}
@@ -18,4 +18,10 @@
  * along with Xelix.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdint.h>
+
+extern uint32_t idt_pic_active;
+
 void idt_init(void);
+void idt_load(void);
+void idt_disable_pic(void);
@@ -18,7 +18,7 @@
 
 [EXTERN int_dispatch]
 [EXTERN paging_kernel_ctx]
-[EXTERN sse_state]
+[EXTERN idt_pic_active]
 
 %define PIT_MASTER	0x20
 %define PIT_SLAVE	0xA0
@@ -31,6 +31,10 @@
 ; Acknowledges interrupts to PIC where necessary. Expects interrupt number in
 ; ebx. Returns 1 in eax if the interrupt was spurious, 0 otherwise.
 handle_eoi:
+	; When the IO-APIC is used, int_dispatch acknowledges the local APIC
+	cmp dword [idt_pic_active], 0
+	je .return
+
 	; Is this a spurious interrupt on the master PIC? If yes, return
 	cmp ebx, IRQ7
 	je .spurious
@@ -86,15 +90,14 @@ int_i386_dispatch:
 	mov eax, cr3
 	push eax
 
-	sub esp, 512
-	fxsave [sse_state]
+	; FPU/SSE state is not saved here, see tasks/i386-fpu.c
 
-	; load the kernel data segment descriptor
+	; load the kernel data segment descriptor. gs is used for thread-local
+	; storage by userland and left alone, see gdt_set_tls.
 	mov ax, 0x10
 	mov ds, ax
 	mov es, ax
 	mov fs, ax
-	mov gs, ax
 
 	; ebx still contains the interrupt number from the handlers above
 	call handle_eoi
@@ -115,9 +118,6 @@ int_i386_dispatch:
 	mov esp, eax
 
 .return:
-	fxrstor [sse_state]
-	add esp, 512
-
 	; Set paging context
 	pop eax
 	mov cr3, eax
@@ -130,7 +130,6 @@ int_i386_dispatch:
 	mov ds, ax
 	mov es, ax
 	mov fs, ax
-	mov gs, ax
 
 	popa
 	pop esp
@@ -21,58 +21,119 @@
 #include <string.h>
 #include <int/i386-idt.h>
 #include <tasks/scheduler.h>
+#include <tasks/acct.h>
+#include <tasks/preempt.h>
 #include <mem/paging.h>
 #include <mem/i386-gdt.h>
+#include <bsp/timer.h>
+#include <bsp/i386-smp.h>
+#include <bsp/i386-lapic.h>
+#include <bsp/i386-apic.h>
+#include <prof.h>
 
 #define debug(args...) log(LOG_DEBUG, "interrupts: " args)
 
 isf_t* __fastcall int_dispatch(uint32_t intr, isf_t* state);
 
 struct interrupt_reg int_handlers[512][10];
-uint8_t sse_state[512] __aligned(16) UL_VISIBLE("bss");
-uint8_t* int_sse_target UL_VISIBLE("data") = sse_state;
 
-// Called by architecture-specific assembly handlers
-isf_t* __fastcall int_dispatch(uint32_t intr, isf_t* state) {
-	memcpy(state->sse_state, sse_state, 512);
-	scheduler_store_isf(state);
+static inline bool from_user(isf_t* state) {
+	return ((iret_t*)state->esp)->cs & 3;
+}
 
-	struct interrupt_reg* reg = int_handlers[intr];
-	task_t* task = scheduler_get_current();
+/* Final part of interrupt return. On SMP, takes care of the kernel lock and
+ * local APIC. Interrupts that return to kernel code of a task or worker hold
+ * the kernel lock.
+ */
+static inline isf_t* int_return(isf_t* state) {
+	bool user = from_user(state);
+	if(user) {
+		task_t* task = scheduler_get_current();
+		if(task) {
+			task_acct_charge(task, false, profile_read_rdtsc());
+		}
+	}
 
-	#ifdef CONFIG_INTERRUPTS_DEBUG
-	debug("state before:\n");
-	dump_isf(LOG_DEBUG, state);
+	#ifdef CONFIG_SMP
+	smp_int_return((void*)state->cr3, !user && !scheduler_is_idle());
 	#endif
 
-	int_disable();
+	#ifdef CONFIG_IRQSOFF_TRACE
+	if(((iret_t*)state->esp)->eflags & EFLAGS_IF) {
+		irqsoff_end();
+	}
+	#endif
+	return state;
+}
 
-	for(int i = 0; i < 10; i++) {
-		if(!reg[i].handler) {
-			break;
-		}
+/* Common part of interrupt entry. Also used by the sysenter fast path for
+ * system calls, which does not go through int_dispatch.
+ */
+void int_enter(uint32_t intr, isf_t* state) {
+	irqsoff_begin(intr);
+	scheduler_store_isf(state);
 
-		if(reg[i].can_reent) {
-			int_enable();
+	if(from_user(state)) {
+		task_t* task = scheduler_get_current();
+		if(task) {
+			task_acct_charge(task, true, profile_read_rdtsc());
 		}
+	}
 
-		reg[i].handler((task_t*)task, state, intr);
+	#ifdef CONFIG_SMP
+	if(!smp_int_lockless(intr)) {
+		smp_kernel_lock();
+	}
+	#endif
+}
+
+// Runs the scheduler if needed and returns the state to continue with
+isf_t* int_leave(uint32_t intr, task_t* task, isf_t* state) {
+	/* Run scheduler every tick, or when task yields. In tickless mode, there
+	 * is no regular tick, so also reschedule on other hardware interrupts
+	 * since their handlers may have made a task runnable. With the PIT, other
+	 * CPUs get their tick from the boot processor using an IPI.
+	 */
+	bool resched = intr == IRQ(0) || intr == 0x31 || (task && task->interrupt_yield);
+	#ifdef CONFIG_APIC
+	resched = resched || intr == LAPIC_TIMER_VECTOR;
+	#endif
+	#ifdef CONFIG_SMP
+	resched = resched || intr == IPI_RESCHEDULE;
+	#endif
+	#ifdef CONFIG_TICKLESS
+	bool hw_irq = intr > IRQ(0) && intr <= IRQ(15);
+	#ifdef CONFIG_APIC
+	hw_irq = hw_irq || apic_is_msi_vector(intr);
+	#endif
+	resched = resched || (hw_irq && timer_is_oneshot());
+	#endif
+
+	bool yield = intr == 0x31 || (task && task->interrupt_yield);
+
+	/* Kernel code holding a spinlock only gets switched away from if it
+	 * yields. Otherwise, try again on the next tick.
+	 */
+	if(resched && !yield && preempt_count()) {
+		resched = false;
+		#ifdef CONFIG_TICKLESS
+		timer_set_periodic();
+		#endif
 	}
 
-	// Run scheduler every tick, or when task yields
-	if(intr == IRQ(0) || intr == 0x31 || (task && task->interrupt_yield)) {
+	if(resched) {
 		if((task && task->interrupt_yield)) {
 			task->interrupt_yield = false;
 		}
 
-		isf_t* new_state = scheduler_select(state);
+		isf_t* new_state = scheduler_select(state, yield);
 		if(new_state) {
 			#ifdef CONFIG_INTERRUPTS_DEBUG
 			debug("state after (task selection):\n");
 			dump_isf(LOG_DEBUG, new_state);
 			#endif
 
-			return new_state;
+			return int_return(new_state);
 		}
 	}
 
@@ -81,8 +142,42 @@ isf_t* __fastcall int_dispatch(uint32_t intr, isf_t* state) {
 	dump_isf(LOG_DEBUG, state);
 	#endif
 
-	memcpy(sse_state, state->sse_state, 512);
-	return state;
+	return int_return(state);
+}
+
+// Called by architecture-specific assembly handlers
+isf_t* __fastcall int_dispatch(uint32_t intr, isf_t* state) {
+	int_enter(intr, state);
+
+	struct interrupt_reg* reg = int_handlers[intr];
+	task_t* task = scheduler_get_current();
+
+	#ifdef CONFIG_INTERRUPTS_DEBUG
+	debug("state before:\n");
+	dump_isf(LOG_DEBUG, state);
+	#endif
+
+	int_disable();
+
+	for(int i = 0; i < 10; i++) {
+		if(!reg[i].handler) {
+			break;
+		}
+
+		if(reg[i].can_reent) {
+			int_enable();
+		}
+
+		reg[i].handler((task_t*)task, state, intr);
+	}
+
+	#ifdef CONFIG_APIC
+	if(apic_int_needs_eoi(intr)) {
+		lapic_eoi();
+	}
+	#endif
+
+	return int_leave(intr, task, state);
 }
 
 void int_init(void) {
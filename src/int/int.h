@@ -21,19 +21,43 @@
 #include <log.h>
 #include <stdbool.h>
 
+#ifdef CONFIG_IRQSOFF_TRACE
+	void irqsoff_begin(int intr);
+	void irqsoff_end(void);
+	void irqsoff_init(void);
+#else
+	#define irqsoff_begin(intr)
+	#define irqsoff_end()
+#endif
+
 #ifdef __i386__
 	#define IRQ(n) (n + 0x20)
 	#define EFLAGS_IF 0x200
 
-	#define int_disable() asm volatile("cli")
-	#define int_enable() asm volatile("sti")
+	#define int_disable() do { asm volatile("cli"); irqsoff_begin(-1); } while(0)
+	#define int_enable() do { irqsoff_end(); asm volatile("sti"); } while(0)
+
+	// Disable interrupts and return whether they were enabled before
+	static inline bool int_save(void) {
+		uint32_t flags;
+		asm volatile("pushf; pop %0; cli" : "=r"(flags) :: "memory");
+		if(flags & EFLAGS_IF) {
+			irqsoff_begin(-1);
+		}
+		return flags & EFLAGS_IF;
+	}
+
+	static inline void int_restore(bool enabled) {
+		if(enabled) {
+			int_enable();
+		}
+	}
 #endif
 
 struct task;
 
 /* Interrupt stack frame */
 typedef struct {
-	uint8_t sse_state[512];
 	uint32_t cr3;
 	void* cr2;
 	uint32_t ds;
@@ -99,4 +123,6 @@ static inline void dump_isf(uint32_t level, isf_t* state) {
 	log(level, "  ESI=0x%-10x EDI=0x%-10x EBP=0x%-10x ESP=0x%-10x\n", state->esi, state->edi, state->ebp, state->esp);
 }
 
+void int_enter(uint32_t intr, isf_t* state);
+isf_t* int_leave(uint32_t intr, struct task* task, isf_t* state);
 void int_init(void);
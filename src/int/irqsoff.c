@@ -0,0 +1,119 @@
+/* irqsoff.c: Measure sections with interrupts disabled
+ * Copyright © 2023 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef CONFIG_IRQSOFF_TRACE
+
+#include <int/int.h>
+#include <tasks/scheduler.h>
+#include <bsp/timer.h>
+#include <bsp/i386-smp.h>
+#include <fs/sysfs.h>
+#include <panic.h>
+#include <prof.h>
+
+/* A section starts when interrupts get disabled, either by interrupt entry or
+ * by int_disable/int_save, and ends when they are enabled again or an
+ * interrupt returns to code that runs with interrupts enabled. Only the
+ * longest section on each CPU since the scheduler started (or the last write
+ * to /sys/irqsoff) is kept. All of this runs with interrupts disabled on the
+ * CPU the data belongs to.
+ */
+struct section {
+	uint64_t cycles;
+
+	// Interrupt number, or -1 if started by code at start_ip
+	int intr;
+	void* start_ip;
+	void* end_ip;
+};
+
+static struct irqsoff_cpu {
+	uint64_t start;
+	struct section current;
+	struct section max;
+} cpus[SMP_MAX_CPUS];
+
+void irqsoff_begin(int intr) {
+	struct irqsoff_cpu* cpu = &cpus[smp_cpu_id()];
+	if(cpu->start || scheduler_state != SCHEDULER_INITIALIZED) {
+		return;
+	}
+
+	cpu->start = profile_read_rdtsc();
+	cpu->current.intr = intr;
+	cpu->current.start_ip = __builtin_return_address(0);
+}
+
+void irqsoff_end(void) {
+	struct irqsoff_cpu* cpu = &cpus[smp_cpu_id()];
+	if(!cpu->start) {
+		return;
+	}
+
+	cpu->current.cycles = profile_read_rdtsc() - cpu->start;
+	cpu->start = 0;
+	if(cpu->current.cycles > cpu->max.cycles) {
+		cpu->current.end_ip = __builtin_return_address(0);
+		cpu->max = cpu->current;
+	}
+}
+
+static char* ip_name(void* ip) {
+	char* name = addr2name((intptr_t)ip);
+	return name ? name : "???";
+}
+
+static size_t sfs_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
+	if(ctx->fp->offset) {
+		return 0;
+	}
+
+	size_t rsize = 0;
+	uint32_t khz = timer_get_tsc_khz();
+	sysfs_printf("# cpu max_us start end\n");
+
+	for(uint32_t i = 0; i < smp_num_cpus; i++) {
+		struct section max = cpus[i].max;
+		uint64_t us = khz ? max.cycles * 1000 / khz : 0;
+		if(max.intr >= 0) {
+			sysfs_printf("%u %llu int:%#x %s\n", i, us, max.intr, ip_name(max.end_ip));
+		} else {
+			sysfs_printf("%u %llu %s %s\n", i, us, ip_name(max.start_ip), ip_name(max.end_ip));
+		}
+	}
+	return rsize;
+}
+
+// Any write resets the measurements
+static size_t sfs_write(struct vfs_callback_ctx* ctx, void* src, size_t size) {
+	for(uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+		cpus[i].max.cycles = 0;
+	}
+	return size;
+}
+
+void irqsoff_init(void) {
+	struct vfs_callbacks sfs_cb = {
+		.read = sfs_read,
+		.write = sfs_write,
+	};
+	sysfs_add_file("irqsoff", &sfs_cb);
+}
+
+#endif /* CONFIG_IRQSOFF_TRACE */
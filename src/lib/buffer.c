@@ -20,8 +20,12 @@
 #include <buffer.h>
 #include <mem/kmalloc.h>
 #include <mem/mem.h>
+#include <tasks/preempt.h>
 #include <errno.h>
 
+// Maximum amount of data copied at once by buffer_write
+#define BUFFER_WRITE_CHUNK (4 * PAGE_SIZE)
+
 struct buffer* buffer_new(size_t max_pages) {
 	struct buffer* buf = zmalloc(sizeof(struct buffer));
 	buf->max_pages = max_pages;
@@ -36,7 +40,7 @@ struct buffer* buffer_new(size_t max_pages) {
 	return buf;
 }
 
-size_t buffer_write(struct buffer* buf, const void* src, size_t size) {
+static size_t write_chunk(struct buffer* buf, const void* src, size_t size) {
 	if(!spinlock_get(&buf->lock, -1)) {
 		return -1;
 	}
@@ -47,12 +51,14 @@ size_t buffer_write(struct buffer* buf, const void* src, size_t size) {
 		size_t size_new = MIN(size_wanted, buf->max_pages);
 
 		if(size_needed > buf->max_pages) {
+			spinlock_release(&buf->lock);
 			sc_errno = EFBIG;
 			return -1;
 		}
 
 		vm_alloc_t vmem;
 		if(!vm_alloc(VM_KERNEL, &vmem, size_new, NULL, VM_RW)) {
+			spinlock_release(&buf->lock);
 			return -1;
 		}
 
@@ -69,6 +75,26 @@ size_t buffer_write(struct buffer* buf, const void* src, size_t size) {
 	return size;
 }
 
+/* Large writes are copied in chunks, with a preemption point in between. Data
+ * from other writers can end up between two chunks. Writes from interrupt
+ * handlers are always small enough to fit into one.
+ */
+size_t buffer_write(struct buffer* buf, const void* src, size_t size) {
+	size_t written = 0;
+	do {
+		if(written) {
+			preempt_point();
+		}
+
+		size_t chunk = MIN(size - written, BUFFER_WRITE_CHUNK);
+		if(write_chunk(buf, src + written, chunk) == -1) {
+			return written ? written : -1;
+		}
+		written += chunk;
+	} while(written < size);
+	return written;
+}
+
 static inline size_t do_read(struct buffer* buf, void* dest, size_t size, size_t offset) {
 	if(offset >= buf->size) {
 		return 0;
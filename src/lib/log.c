@@ -19,7 +19,7 @@
 
 #include <log.h>
 #include <printf.h>
-#include <bsp/timer.h>
+#include <bsp/clocksource.h>
 #include <stdarg.h>
 #include <string.h>
 #include <time.h>
@@ -31,7 +31,9 @@
 #ifdef CONFIG_LOG_STORE
 struct log_entry {
 	uint8_t level;
-	uint64_t tick;
+
+	// Monotonic clock in nanoseconds, and Unix time if the RTC has been read
+	uint64_t ns;
 	uint32_t timestamp;
 	uint32_t length;
 	char message[];
@@ -68,7 +70,7 @@ static void store(uint8_t level, char* string, size_t len) {
 
 	struct log_entry* entry = (struct log_entry*)((uintptr_t)buffer + log_size);
 	entry->level = level;
-	entry->tick = timer_tick;
+	entry->ns = clock_get_ns();
 	entry->timestamp = time_get();
 	entry->length = len;
 	memcpy(entry->message, string, len);
@@ -18,17 +18,20 @@
  * along with Xelix.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-static inline uint64_t profile_read_rdtsc() {
+#include <bsp/clocksource.h>
+
+static inline uint64_t profile_read_rdtsc(void) {
 	register uint32_t timer_low asm("eax");
 	register uint32_t timer_high asm("edx");
 	asm volatile("rdtsc;" : "=r" (timer_low), "=r" (timer_high));
 	return timer_low | (uint64_t)timer_high << 32;
 }
 
-static inline uint64_t profile_start() {
-	return profile_read_rdtsc();
+// Measure the duration of a code section in nanoseconds using the clock source
+static inline uint64_t profile_start(void) {
+	return clock_get_ns();
 }
 
 static inline uint64_t profile_stop(uint64_t start) {
-	return profile_read_rdtsc() - start;
+	return clock_get_ns() - start;
 }
@@ -20,14 +20,16 @@
 
 #include <stdbool.h>
 #include <log.h>
+#include <tasks/preempt.h>
 
 extern void scheduler_yield(void);
 
 /* See https://gcc.gnu.org/onlinedocs/gcc-4.4.3/gcc/Atomic-Builtins.html for
  * documentation on the GCC builtin atomic function used here.
+ *
+ * Holding a spinlock disables preemption, see tasks/preempt.h.
  */
 
-#define spinlock_release(x) __sync_lock_release(x)
 #define spinlock_cmd(command, tries, retval) \
 	static spinlock_t lock = 0; \
 	if(!spinlock_get(&lock, tries)) return retval; \
@@ -35,11 +37,19 @@ extern void scheduler_yield(void);
 	spinlock_release(&lock);
 
 typedef uint8_t spinlock_t;
+
+static inline void spinlock_release(spinlock_t* lock) {
+	__sync_lock_release(lock);
+	preempt_enable();
+}
+
 static inline bool spinlock_get(spinlock_t* lock, uint32_t retries) {
 	for(uint32_t i = 0; i < retries || retries == -1; i++) {
+		preempt_disable();
 		if(!__sync_lock_test_and_set(lock, 1)) {
 			return true;
 		}
+		preempt_enable();
 
 		if(unlikely(i == 10000)) {
 			log(LOG_WARN, "Stuck spinlock %s (retry 10000 max %d)\n", lock, retries);
@@ -50,3 +60,24 @@ static inline bool spinlock_get(spinlock_t* lock, uint32_t retries) {
 	return false;
 }
 
+/* Variants that busy-wait instead of yielding. For code that can't call into
+ * the scheduler, such as the scheduler itself and interrupt handlers. These
+ * don't disable interrupts, so callers need to take care of that if the lock
+ * can also be taken from an interrupt handler.
+ */
+static inline bool spinlock_raw_try(spinlock_t* lock) {
+	if(__sync_lock_test_and_set(lock, 1)) {
+		return false;
+	}
+
+	preempt_disable();
+	return true;
+}
+
+static inline void spinlock_raw_get(spinlock_t* lock) {
+	while(!spinlock_raw_try(lock)) {
+		while(*(volatile spinlock_t*)lock) {
+			asm volatile("pause");
+		}
+	}
+}
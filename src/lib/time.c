@@ -23,9 +23,13 @@
 #include <portio.h>
 #include <block/random.h>
 #include <bsp/timer.h>
+#include <bsp/clocksource.h>
 #include <fs/sysfs.h>
 #include <tasks/task.h>
+#include <mem/vm.h>
 #include <log.h>
+#include <prof.h>
+#include <errno.h>
 #include "time.h"
 
 #define CURRENT_YEAR        2018
@@ -33,8 +37,32 @@
 // FIXME Should get this from ACPI
 int century_register = 0x00;
 
-time_t last_timestamp = 0;
-uint64_t last_tick = 0;
+// Unix time at which the monotonic clock was 0
+static int64_t boot_time;
+
+/* Timekeeping data that is mapped read-only into every task, so userland can
+ * get the time without a syscall. It gets updated on every timer interrupt.
+ * seq is odd while an update is in progress, readers retry if it is odd or
+ * has changed while they were reading. Keep in sync with newlib sys/xelix.h.
+ */
+struct time_page {
+	volatile uint32_t seq;
+	uint32_t rate;
+	uint32_t tsc_khz;
+	uint32_t tick;
+
+	// TSC value at the time tick was updated
+	uint64_t tsc;
+
+	// Unix time at which ns was 0
+	int64_t boot_time;
+
+	// Monotonic clock in nanoseconds at the time tick was updated
+	uint64_t ns;
+};
+
+static struct time_page* time_page = NULL;
+static void* time_page_phys;
 
 static int in_progress(void) {
 	outb(0x70, 0x0A);
@@ -154,20 +182,53 @@ static time_t read_rtc(void) {
 }
 
 uint32_t time_get(void) {
-	uint32_t stick = timer_tick;
-	if(stick <= last_tick + timer_rate) {
-		return last_timestamp;
+	return boot_time + clock_get_ns() / NSEC_PER_SEC;
+}
+
+int time_get_timeval(task_t* task, struct timeval* tv) {
+	uint64_t ns = clock_get_ns();
+	tv->tv_sec = boot_time + ns / NSEC_PER_SEC;
+	tv->tv_usec = ns % NSEC_PER_SEC / 1000;
+	return 0;
+}
+
+int time_clock_gettime(task_t* task, int clock_id, struct timespec* tp) {
+	if(clock_id != CLOCK_REALTIME && clock_id != CLOCK_MONOTONIC) {
+		sc_errno = EINVAL;
+		return -1;
 	}
 
-	uint32_t offset = (stick - last_tick);
-	last_timestamp += offset / timer_rate;
-	last_tick = stick;
-	return last_timestamp;
+	uint64_t ns = clock_get_ns();
+	tp->tv_sec = ns / NSEC_PER_SEC;
+	tp->tv_nsec = ns % NSEC_PER_SEC;
+	if(clock_id == CLOCK_REALTIME) {
+		tp->tv_sec += boot_time;
+	}
+	return 0;
 }
 
-int time_get_timeval(task_t* task, struct timeval* tv) {
-	tv->tv_sec = time_get();
-	tv->tv_usec = 0;
+// Called by the timer interrupt handler after the tick has changed
+void time_update_page(uint32_t tick) {
+	if(!time_page) {
+		return;
+	}
+
+	time_page->seq++;
+	asm volatile("" ::: "memory");
+	time_page->tick = tick;
+	time_page->ns = clock_get_ns();
+	time_page->tsc = profile_read_rdtsc();
+	time_page->tsc_khz = timer_get_tsc_khz();
+	asm volatile("" ::: "memory");
+	time_page->seq++;
+}
+
+// Map the time page read-only into an address space
+int time_map_page(struct vm_ctx* ctx, void* addr) {
+	if(!time_page || !vm_alloc_at(ctx, NULL, 1, addr, time_page_phys,
+		VM_USER | VM_FIXED)) {
+		return -1;
+	}
 	return 0;
 }
 
@@ -182,10 +243,22 @@ static size_t sfs_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
 }
 
 void time_init(void) {
-	last_timestamp = read_rtc();
-	last_tick = timer_tick;
-	log(LOG_INFO, "time: Initial last_timestamp is %u at tick %llu\n", last_timestamp, last_tick);
-	block_random_seed(last_timestamp + last_tick);
+	time_t rtc = read_rtc();
+	uint32_t tick = timer_tick;
+	boot_time = rtc - clock_get_ns() / NSEC_PER_SEC;
+	log(LOG_INFO, "time: Initial timestamp is %u at tick %u\n", rtc, tick);
+	block_random_seed(rtc + tick);
+
+	vm_alloc_t alloc;
+	time_page = vm_alloc(VM_KERNEL, &alloc, 1, NULL, VM_RW | VM_ZERO);
+	if(time_page) {
+		time_page_phys = alloc.phys;
+		time_page->rate = timer_get_rate();
+		time_page->boot_time = boot_time;
+		time_update_page(tick);
+	} else {
+		log(LOG_WARN, "time: Could not allocate time page\n");
+	}
 
 	struct vfs_callbacks sfs_cb = {
 		.read = sfs_read,
@@ -29,8 +29,22 @@ struct timeval {
 	int32_t tv_usec;
 };
 
+struct timespec {
+	int64_t tv_sec;
+	int32_t tv_nsec;
+};
+
+// clock_gettime clock IDs, same values as in newlib
+#define CLOCK_REALTIME 1
+#define CLOCK_MONOTONIC 4
+
+struct vm_ctx;
+
 uint32_t time_get(void);
 int time_get_timeval(struct task* task, struct timeval* tv);
+int time_clock_gettime(struct task* task, int clock_id, struct timespec* tp);
+void time_update_page(uint32_t tick);
+int time_map_page(struct vm_ctx* ctx, void* addr);
 void time_init(void);
 
 #define sleep(t) sleep_ticks((t) * timer_rate)
@@ -32,7 +32,6 @@ gdt_flush:
 	jmp 0x08:.flush   ; 0x08 is the offset to our code segment: Far jump!
 .flush:
 
-	xor eax, eax
-	mov ax, 0x28
+	mov eax, [esp+8]  ; TSS selector of this CPU
 	ltr ax
 	ret
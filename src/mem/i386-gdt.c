@@ -23,6 +23,7 @@
 #include <string.h>
 #include <log.h>
 #include <mem/kmalloc.h>
+#include <bsp/i386-smp.h>
 
 #define SEG_DESCTYPE(x)  ((x) << 0x04) // Descriptor type (0 for system, 1 for code/data)
 #define SEG_PRES(x)      ((x) << 0x07) // Present
@@ -65,11 +66,24 @@
                      SEG_LONG(0)     | SEG_SIZE(1) | SEG_GRAN(1) | \
                      SEG_PRIV(3)     | SEG_DATA_RDWR
 
-extern void gdt_flush(void*);
+#define CPUID_EDX_SEP (1 << 11)
+#define MSR_SYSENTER_CS 0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+extern void gdt_flush(void* pointer, uint16_t tss_selector);
+extern void syscall_sysenter_entry(void);
 extern void* stack_end;
-static uint8_t initial_tss[0x60] UL_VISIBLE("bss");
-static uint32_t* tss = (uint32_t*)&initial_tss;
-static uint64_t descs[6] UL_VISIBLE("bss");
+
+bool gdt_sysenter_enabled = false;
+
+/* One TSS per CPU, with the descriptors following GDT_SEG_TSS. These are
+ * followed by one thread-local storage segment per CPU, see gdt_set_tls.
+ */
+#define TLS_DESC(cpu) (5 + SMP_MAX_CPUS + (cpu))
+
+static uint32_t tss[SMP_MAX_CPUS][0x18] UL_VISIBLE("bss");
+static uint64_t descs[5 + SMP_MAX_CPUS * 2] UL_VISIBLE("bss");
 
 static struct {
 	// The upper 16 bits of all selector limits.
@@ -93,17 +107,54 @@ static void create_descriptor(uint32_t num, uint32_t base, uint32_t limit, uint1
     descs[num] |= limit  & 0x0000FFFF;               // set limit bits 15:0
 }
 
+static inline void wrmsr(uint32_t msr, uint32_t value) {
+	asm volatile("wrmsr" :: "c"(msr), "a"(value), "d"(0));
+}
+
+static bool has_sysenter(void) {
+	uint32_t eax = 1, ebx, ecx = 0, edx;
+	asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+	return edx & CPUID_EDX_SEP;
+}
+
+// Set the kernel stack used for interrupts from userland on this CPU
 void gdt_set_tss(void* addr) {
-	bzero(tss, 0x60);
-	*(tss + 1) = (uint32_t)addr;
-	*(tss + 2) = 0x10;
+	tss[smp_cpu_id()][1] = (uint32_t)addr;
+}
+
+/* Set the base address of the %gs segment used by userland for thread-local
+ * storage, and load it. The interrupt handlers leave %gs alone, so this only
+ * needs to be done when switching tasks.
+ */
+void gdt_set_tls(void* base) {
+	uint32_t desc = TLS_DESC(smp_cpu_id());
+	create_descriptor(desc, (uint32_t)base, 0xffffffff, GDT_DATA_PL3);
+	asm volatile("mov %0, %%gs" :: "r"((uint16_t)(desc * 8 | 3)));
+}
 
-	create_descriptor(5, (uint32_t)tss, 0x60, 0x89);
-	gdt_flush(&pointer);
+// Load the GDT and the TSS of a CPU. Called once on every CPU
+void gdt_init_cpu(uint32_t cpu, void* stack) {
+	bzero(tss[cpu], sizeof(tss[cpu]));
+	tss[cpu][1] = (uint32_t)stack;
+	tss[cpu][2] = GDT_SEG_DATA_PL0;
+
+	create_descriptor(5 + cpu, (uint32_t)tss[cpu], sizeof(tss[cpu]), 0x89);
+	create_descriptor(TLS_DESC(cpu), 0, 0xffffffff, GDT_DATA_PL3);
+	gdt_flush(&pointer, GDT_SEG_TSS + cpu * 8);
+
+	/* The stack pointer for sysenter is fixed, so point it right after the
+	 * esp0 field of the TSS. The entry code loads the kernel stack from there.
+	 */
+	if(has_sysenter()) {
+		wrmsr(MSR_SYSENTER_CS, GDT_SEG_CODE_PL0);
+		wrmsr(MSR_SYSENTER_ESP, (uint32_t)&tss[cpu][2]);
+		wrmsr(MSR_SYSENTER_EIP, (uint32_t)syscall_sysenter_entry);
+		gdt_sysenter_enabled = true;
+	}
 }
 
 void gdt_init(void) {
-	pointer.limit = (sizeof(uint64_t) * 6) - 1;
+	pointer.limit = sizeof(descs) - 1;
 	pointer.base = descs;
 
 	create_descriptor(0, 0, 0, 0);
@@ -112,6 +163,6 @@ void gdt_init(void) {
 	create_descriptor(3, 0, 0xffffffff, GDT_CODE_PL3); // 0x1b
 	create_descriptor(4, 0, 0xffffffff, GDT_DATA_PL3); // 0x23
 
-	gdt_set_tss(&stack_end);
+	gdt_init_cpu(0, &stack_end);
     log(LOG_INFO, "gdt: Set initial tss %#x\n", &stack_end);
 }
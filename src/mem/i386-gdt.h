@@ -23,6 +23,15 @@
 #define GDT_SEG_DATA_PL0 0x10
 #define GDT_SEG_CODE_PL3 0x1b
 #define GDT_SEG_DATA_PL3 0x23
+#define GDT_SEG_TSS 0x28
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Whether syscalls can use sysenter, see tasks/i386-sysenter.asm
+extern bool gdt_sysenter_enabled;
 
 void gdt_set_tss(void* addr);
+void gdt_set_tls(void* base);
+void gdt_init_cpu(uint32_t cpu, void* stack);
 void gdt_init(void);
@@ -23,6 +23,7 @@
 #include <string.h>
 #include <panic.h>
 #include <int/int.h>
+#include <bsp/i386-smp.h>
 
 // Used in interrupt handlers to return to kernel paging context
 struct paging_context* paging_kernel_ctx UL_VISIBLE("bss");
@@ -86,6 +87,11 @@ void paging_set_range(struct paging_context* ctx, void* virt_addr, void* phys_ad
 			asm volatile("invlpg (%0)":: "r" (current_virt));
 		}
 	}
+
+	// Other CPUs could be running in this context
+	if(ctx != paging_kernel_ctx) {
+		smp_tlb_shootdown(ctx);
+	}
 }
 
 void paging_clear_range(struct paging_context* ctx, void* virt_addr, size_t size) {
@@ -116,6 +122,11 @@ void paging_clear_range(struct paging_context* ctx, void* virt_addr, size_t size
 			asm volatile("invlpg (%0)":: "r" (current_virt));
 		}
 	}
+
+	// Other CPUs could be running in this context
+	if(ctx != paging_kernel_ctx) {
+		smp_tlb_shootdown(ctx);
+	}
 }
 
 void paging_rm_context(struct paging_context* ctx) {
@@ -108,6 +108,10 @@ static uintptr_t alloc_start;
 static uintptr_t alloc_end;
 static uintptr_t alloc_max;
 
+#define MAX_SHRINKERS 4
+static kmalloc_shrinker_t shrinkers[MAX_SHRINKERS];
+static int num_shrinkers = 0;
+
 static inline void unlink_free_block(struct free_block* fb) {
 	if(fb->next) {
 		fb->next->prev = fb->prev;
@@ -252,6 +256,19 @@ static inline struct mem_block* get_free_block(size_t sz, bool align) {
 	return NULL;
 }
 
+/* Called with the lock held when the heap is exhausted. Drops the lock
+ * while the shrinkers run, since they free memory.
+ */
+static bool shrink(size_t size) {
+	size_t freed = 0;
+	spinlock_release(&kmalloc_lock);
+	for(int i = 0; i < num_shrinkers && freed < size; i++) {
+		freed += shrinkers[i](size - freed);
+	}
+	spinlock_get(&kmalloc_lock, -1);
+	return freed > 0;
+}
+
 void* __attribute__((alloc_size(1))) _kmalloc(size_t sz, bool align, bool zero DEBUGREGS) {
 	if(unlikely(!kmalloc_ready)) {
 		panic("Attempt to kmalloc before allocator is kmalloc_ready.\n");
@@ -269,6 +286,10 @@ void* __attribute__((alloc_size(1))) _kmalloc(size_t sz, bool align, bool zero D
 	}
 
 	struct mem_block* header = get_free_block(sz_needed, align);
+	if(!header && alloc_end + sz_needed + PAGE_SIZE >= alloc_max && shrink(sz_needed + PAGE_SIZE)) {
+		header = get_free_block(sz_needed, align);
+	}
+
 	size_t alignment_offset = 0;
 
 	if(align) {
@@ -380,6 +401,18 @@ void kmalloc_init() {
 	log(LOG_DEBUG, "kmalloc: Allocating from %p - %p\n", alloc_start, alloc_max);
 }
 
+/* Caches that can give memory back register a shrinker, which gets called
+ * before kmalloc runs out of memory. It should free at least size bytes if
+ * possible and return the number of bytes freed.
+ */
+void kmalloc_register_shrinker(kmalloc_shrinker_t shrinker) {
+	if(num_shrinkers >= MAX_SHRINKERS) {
+		log(LOG_WARN, "kmalloc: Too many shrinkers\n");
+		return;
+	}
+	shrinkers[num_shrinkers++] = shrinker;
+}
+
 void kmalloc_get_stats(uint32_t* total, uint32_t* used) {
 	*total = alloc_max - alloc_start;
 	*used = alloc_end - alloc_start;
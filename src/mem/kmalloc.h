@@ -19,6 +19,7 @@
  */
 
 #include <stdbool.h>
+#include <stddef.h>
 
 extern bool kmalloc_ready;
 
@@ -57,5 +58,8 @@ extern bool kmalloc_ready;
 	kfree(arr); \
 } while(0)
 
+typedef size_t (*kmalloc_shrinker_t)(size_t size);
+
 void kmalloc_init(void);
+void kmalloc_register_shrinker(kmalloc_shrinker_t shrinker);
 void kmalloc_get_stats(uint32_t* total, uint32_t* used);
@@ -45,7 +45,7 @@ static int have_malloc_ranges = 50;
  * and could cause trouble during later reallocations (such as VM_ZERO in
  * vm_copy).
  */
-#define CLEANUP_FLAGS(x) ((x) & (VM_RW | VM_USER | VM_FREE | VM_TFORK | VM_NOCOW))
+#define CLEANUP_FLAGS(x) ((x) & (VM_RW | VM_USER | VM_FREE | VM_TFORK | VM_NOCOW | VM_SHARED))
 
 static inline vm_alloc_t* new_range(void) {
 	/* During initialization, kmalloc_init calls vm_alloc once to get its
@@ -461,6 +461,14 @@ int vm_clone(struct vm_ctx* dest, struct vm_ctx* src) {
 			continue;
 		}
 
+		if(range->flags & VM_SHARED) {
+			if(!vm_alloc_at(dest, NULL, RDIV(range->size, PAGE_SIZE), range->addr,
+				range->phys, range->flags | VM_FIXED)) {
+				return -1;
+			}
+			continue;
+		}
+
 		if(vm_copy(dest, range->addr, NULL, range, range->flags) != 0) {
 			return -1;
 		}
@@ -519,6 +527,9 @@ int vm_free(vm_alloc_t* range) {
 
 int vm_new(struct vm_ctx* ctx, struct paging_context* page_dir) {
 	ctx->lock = 0;
+	ctx->refs = 1;
+	ctx->sbrk = NULL;
+	ctx->stack_size = 0;
 	ctx->ranges = NULL;
 	ctx->bitmap.data = ctx->bitmap_data;
 	ctx->bitmap.size = PAGE_ALLOC_BITMAP_SIZE;
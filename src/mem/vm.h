@@ -49,6 +49,11 @@
 // Zero out address space after allocation
 #define VM_ZERO 32
 
+/* Share the physical memory of this range with the new context in vm_clone
+ * instead of copying it. Only makes sense for read-only ranges.
+ */
+#define VM_SHARED 64
+
 #define VM_DEBUG 4096
 
 /* Flags to vm_map */
@@ -74,6 +79,15 @@
 struct vm_alloc;
 struct vm_ctx {
 	spinlock_t lock;
+
+	// Number of tasks using this context, see task_free
+	uint32_t refs;
+
+	/* Program break and size of the initial stack. Only used by task code,
+	 * but they belong to the address space rather than to a single thread.
+	 */
+	void* sbrk;
+	size_t stack_size;
 	uint32_t bitmap_data[bitmap_size(VM_BITMAP_SIZE)];
 	struct bitmap bitmap;
 	struct vm_alloc* ranges;
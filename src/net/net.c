@@ -29,15 +29,18 @@
 #include <net/i386-rtl8139.h>
 #include <net/i386-ne2k.h>
 #include <net/virtio_net.h>
-#include <tasks/worker.h>
-#include <tasks/scheduler.h>
+#include <tasks/workqueue.h>
 #include <time.h>
 
+// Interval of the PicoTCP timer tick while there is no traffic
+#define NET_TICK_MS 10
+
 #ifdef CONFIG_ENABLE_PICOTCP
 
 spinlock_t net_pico_lock;
 static bool initialized = false;
 static uint32_t dhcp_xid;
+static struct work net_work;
 
 static void dhcp_cb(void* cli, int code) {
 	if(code & PICO_DHCP_ERROR) {
@@ -77,6 +80,14 @@ void net_receive(struct net_device* dev, void* data, size_t len) {
 	}
 
 	dev->pico_dev.__serving_interrupt = 1;
+	net_kick();
+}
+
+// Run the PicoTCP stack as soon as possible to handle incoming or outgoing data
+void net_kick(void) {
+	if(likely(initialized)) {
+		queue_work(&net_work);
+	}
 }
 
 struct net_device* net_add_device(char* name, uint8_t mac[6], net_send_callback_t* send_cb) {
@@ -108,18 +119,15 @@ struct net_device* net_add_device(char* name, uint8_t mac[6], net_send_callback_
 	return dev;
 }
 
-static void __attribute__((fastcall, noreturn)) net_worker_entry(worker_t* worker) {
-	while(1) {
-		if(likely(initialized)) {
-			pico_stack_tick();
-		}
-		scheduler_yield();
-	}
+static void net_tick(struct work* work) {
+	pico_stack_tick();
+	queue_delayed_work(work, NET_TICK_MS);
 }
 
 void net_init() {
 	log(LOG_INFO, "net: Initializing PicoTCP\n");
 	pico_stack_init();
+	work_init(&net_work, net_tick, NULL);
 	initialized = true;
 
 	uint32_t ilo_addr;
@@ -152,8 +160,7 @@ void net_init() {
 	rtl8139_init();
 	#endif
 
-	worker_t* net_worker = worker_new("knetworkd", net_worker_entry);
-	scheduler_add_worker(net_worker);
+	queue_work(&net_work);
 }
 
 #endif /* ENABLE_PICOTCP */
@@ -31,6 +31,7 @@ typedef int (net_send_callback_t)(struct pico_device* pico_dev, void* data, int
 extern spinlock_t net_pico_lock;
 
 void net_receive(struct net_device* dev, void* data, size_t len);
+void net_kick(void);
 struct net_device* net_add_device(char* name, uint8_t mac[6], net_send_callback_t* write_cb);
 
 void net_init(void);
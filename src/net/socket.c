@@ -191,7 +191,7 @@ int net_recvfrom(task_t* task, struct recvfrom_data* data, int struct_size) {
 	}
 
 	vm_alloc_t alloc;
-	void* dest = vm_map(VM_KERNEL, &alloc, &task->vmem, data->dest,
+	void* dest = vm_map(VM_KERNEL, &alloc, task->vmem, data->dest,
 		data->size, VM_MAP_USER_ONLY | VM_RW);
 
 	if(!dest) {
@@ -232,6 +232,7 @@ static size_t vfs_write_cb(struct vfs_callback_ctx* ctx, void* source, size_t si
 	}
 	size_t written = pico_socket_write(sock->pico_socket, source, size);
 	spinlock_release(&net_pico_lock);
+	net_kick();
 
 	sc_errno = pico_err;
 	return written;
@@ -429,7 +430,7 @@ int net_accept(task_t* task, int sockfd, struct sockaddr* oaddr,
 		 * we can't use the syscall system's automagic kernel memory mapping.
 		 */
 		vm_alloc_t alloc;
-		addr = vm_map(VM_KERNEL, &alloc, &task->vmem, oaddr,
+		addr = vm_map(VM_KERNEL, &alloc, task->vmem, oaddr,
 			*addrlen, VM_MAP_USER_ONLY | VM_RW);
 
 		if(!addr) {
@@ -441,7 +442,7 @@ int net_accept(task_t* task, int sockfd, struct sockaddr* oaddr,
 
 	int_enable();
 	while(!sock->conn_requests) {
-		asm("hlt\n");
+		scheduler_yield();
 	}
 	int_disable();
 
@@ -504,7 +505,7 @@ int net_getpeername(task_t* task, int sockfd, struct sockaddr* osa,
 	 * we can't use the syscall system's automagic kernel memory mapping.
 	 */
 	vm_alloc_t alloc;
-	struct sockaddr* sa = vm_map(VM_KERNEL, &alloc, &task->vmem, osa,
+	struct sockaddr* sa = vm_map(VM_KERNEL, &alloc, task->vmem, osa,
 		*addrlen, VM_MAP_USER_ONLY | VM_RW);
 
 	if(!sa) {
@@ -540,7 +541,7 @@ int net_getsockname(task_t* task, int sockfd, struct sockaddr* oaddr,
 	 * we can't use the syscall system's automagic kernel memory mapping.
 	 */
 	vm_alloc_t alloc;
-	struct sockaddr* addr = vm_map(VM_KERNEL, &alloc, &task->vmem, oaddr,
+	struct sockaddr* addr = vm_map(VM_KERNEL, &alloc, task->vmem, oaddr,
 		*addrlen, VM_MAP_USER_ONLY | VM_RW);
 
 	if(!addr) {
@@ -659,6 +660,7 @@ int net_connect(task_t* task, int sockfd, const struct sockaddr* sa, uint32_t ad
 	}
 
 	spinlock_release(&net_pico_lock);
+	net_kick();
 	sock->state = SOCK_CONNECTED;
 	return 0;
 }
@@ -29,6 +29,7 @@
 #include <int/int.h>
 #include <mem/kmalloc.h>
 #include <tasks/task.h>
+#include <tasks/workqueue.h>
 #include <pico_device.h>
 
 #define QUEUE_RX1 0
@@ -122,13 +123,15 @@ static void used_cb(struct virtqueue* queue, struct virtq_desc* desc, uint32_t l
 	}
 }
 
-static void int_handler(task_t* task, isf_t* state, int num) {
-	inb(dev->pci_dev->iobase + 0x13);
-
+/* Handles used descriptors. Runs as deferred work, with device interrupts
+ * suppressed from the time the interrupt arrives until the queues are empty.
+ * Interrupts stay disabled so the kworker can't be preempted by another one
+ * sending on the TX queue.
+ */
+static void used_work_cb(struct work* work) {
+	bool ints = int_save();
 	for(int i = 0; i < dev->num_queues; i++) {
 		struct virtqueue* queue = &dev->queues[i];
-		queue->available->flags = VIRTQ_AVAIL_F_NO_INTERRUPT;
-
 		for(; queue->used_index < queue->used->idx; queue->used_index++) {
 			struct virtq_used_elem* el = &queue->used->ring[queue->used_index % queue->size];
 			struct virtq_desc* desc = &queue->descriptors[el->id];
@@ -147,6 +150,21 @@ static void int_handler(task_t* task, isf_t* state, int num) {
 
 		queue->available->flags = 0;
 	}
+	int_restore(ints);
+}
+
+static struct work used_work = WORK_INIT(used_work_cb, NULL);
+
+// With MSI-X, only the queue that raised the interrupt gets suppressed
+static void int_handler(task_t* task, isf_t* state, int num) {
+	virtio_int_ack(dev);
+
+	for(int i = 0; i < dev->num_queues; i++) {
+		if(!dev->msix || dev->queues[i].vector == num) {
+			dev->queues[i].available->flags = VIRTQ_AVAIL_F_NO_INTERRUPT;
+		}
+	}
+	queue_work(&used_work);
 }
 
 static int pci_cb(pci_device_t* pci_dev) {
@@ -172,12 +190,12 @@ static int pci_cb(pci_device_t* pci_dev) {
 
 	dev->queues[QUEUE_TX1].available->flags = VIRTQ_AVAIL_F_NO_INTERRUPT;
 	virtio_provide_descs(dev, QUEUE_RX1, 50, 1500);
-	int_register(IRQ(dev->pci_dev->interrupt_line), int_handler, false);
+	virtio_setup_interrupts(dev, int_handler);
 
 	uint8_t mac[6] = {0x52, 0x54, 0x00, 0x12, 0x34, 0x56};
 	if(dev->features & VIRTIO_NET_F_MAC) {
 		for(int i = 0; i < 6; i++) {
-			mac[i] = inb(dev->pci_dev->iobase + 0x14 + i);
+			mac[i] = inb(dev->pci_dev->iobase + dev->config + i);
 		}
 	}
 
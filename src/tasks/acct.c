@@ -0,0 +1,74 @@
+/* acct.c: Task resource usage
+ * Copyright © 2023 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <tasks/acct.h>
+#include <bsp/timer.h>
+#include <errno.h>
+
+/* CPU time is measured using the TSC on every transition between userland and
+ * the kernel (see int_enter/int_leave) and on task switches, so unlike the
+ * scheduler runtime, it is split into user and system time. The counters are
+ * only written by the CPU the task is running on.
+ *
+ * Usage is tracked per task, so for threads, RUSAGE_SELF only covers the
+ * calling thread.
+ */
+
+uint32_t task_acct_ms(uint64_t cycles) {
+	uint32_t khz = timer_get_tsc_khz();
+	return khz ? cycles / khz : 0;
+}
+
+static void cycles_to_timeval(uint64_t cycles, struct timeval* tv) {
+	uint32_t khz = timer_get_tsc_khz();
+	uint64_t us = khz ? cycles * 1000 / khz : 0;
+	tv->tv_sec = us / 1000000;
+	tv->tv_usec = us % 1000000;
+}
+
+// Called by waitpid once a child has been collected
+void task_acct_reap(task_t* parent, task_t* child) {
+	parent->acct.cutime += child->acct.utime + child->acct.cutime;
+	parent->acct.cstime += child->acct.stime + child->acct.cstime;
+}
+
+int task_getrusage(task_t* task, int who, struct task_rusage* usage) {
+	switch(who) {
+		case RUSAGE_SELF:
+			cycles_to_timeval(task->acct.utime, &usage->utime);
+			cycles_to_timeval(task->acct.stime, &usage->stime);
+			return 0;
+		case RUSAGE_CHILDREN:
+			cycles_to_timeval(task->acct.cutime, &usage->utime);
+			cycles_to_timeval(task->acct.cstime, &usage->stime);
+			return 0;
+	}
+
+	sc_errno = EINVAL;
+	return -1;
+}
+
+// Returns the time since boot in milliseconds, like the times() return value
+int task_times(task_t* task, struct task_tms* buf) {
+	buf->utime = task_acct_ms(task->acct.utime);
+	buf->stime = task_acct_ms(task->acct.stime);
+	buf->cutime = task_acct_ms(task->acct.cutime);
+	buf->cstime = task_acct_ms(task->acct.cstime);
+	return (uint64_t)timer_get_tick() * 1000 / timer_get_rate();
+}
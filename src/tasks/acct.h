@@ -0,0 +1,59 @@
+#pragma once
+
+/* Copyright © 2023 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <tasks/task.h>
+#include <time.h>
+
+// `who` argument of getrusage, same values as in newlib
+#define RUSAGE_SELF 0
+#define RUSAGE_CHILDREN -1
+
+// Keep in sync with struct rusage in newlib
+struct task_rusage {
+	struct timeval utime;
+	struct timeval stime;
+};
+
+// Keep in sync with struct tms in newlib. Times are in milliseconds.
+struct task_tms {
+	uint32_t utime;
+	uint32_t stime;
+	uint32_t cutime;
+	uint32_t cstime;
+};
+
+/* Add the time since the last call to the user or system time of a task.
+ * Called when entering the kernel from userland, when returning to userland,
+ * and when switching away from a task.
+ */
+static inline void task_acct_charge(task_t* task, bool user, uint64_t now) {
+	uint64_t delta = now - task->acct.last;
+	if(user) {
+		task->acct.utime += delta;
+	} else {
+		task->acct.stime += delta;
+	}
+	task->acct.last = now;
+}
+
+uint32_t task_acct_ms(uint64_t cycles);
+void task_acct_reap(task_t* parent, task_t* child);
+int task_getrusage(task_t* task, int who, struct task_rusage* usage);
+int task_times(task_t* task, struct task_tms* buf);
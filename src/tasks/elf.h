@@ -0,0 +1,57 @@
+#pragma once
+
+/* Copyright © 2023 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+
+/* Just enough ELF to map the program headers of xelix-loader. Loading of
+ * regular binaries is done by the loader in userland.
+ */
+
+#define ELF_TYPE_EXEC 2
+#define ELF_PT_LOAD 1
+#define ELF_PF_W 2
+
+struct elf_header {
+	unsigned char ident[16];
+	uint16_t type;
+	uint16_t machine;
+	uint32_t version;
+	void* entry;
+	uint32_t phoff;
+	uint32_t shoff;
+	uint32_t flags;
+	uint16_t ehsize;
+	uint16_t phentsize;
+	uint16_t phnum;
+	uint16_t shentsize;
+	uint16_t shnum;
+	uint16_t shstrndx;
+} __attribute__((packed));
+
+struct elf_program_header {
+	uint32_t type;
+	uint32_t offset;
+	void* vaddr;
+	void* paddr;
+	uint32_t filesz;
+	uint32_t memsz;
+	uint32_t flags;
+	uint32_t align;
+} __attribute__((packed));
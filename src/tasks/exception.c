@@ -22,6 +22,7 @@
 #include <int/int.h>
 #include <tasks/task.h>
 #include <tasks/exception.h>
+#include <tasks/i386-fpu.h>
 #include <mem/mem.h>
 
 // Page fault error code flags
@@ -70,6 +71,8 @@ static inline void handle_page_fault(task_t* task, isf_t* state, void* eip) {
 		state->err_code & PFE_INST ? " (instruction fetch)" : "");
 
 	if(task && (state->err_code & PFE_USER)) {
+		task->acct.faults++;
+
 		// Some task page faults can be handled gracefully
 		// (Copy on write, stack allocations)
 		if(task_page_fault_cb(task, state->cr2) == 0) {
@@ -79,7 +82,7 @@ static inline void handle_page_fault(task_t* task, isf_t* state, void* eip) {
 		log(LOG_WARN, "Page fault in task %d <%s> %s\n", task->pid,
 			task->name, message);
 
-		vm_alloc_t* range = vm_get(&task->vmem, state->cr2, false);
+		vm_alloc_t* range = vm_get(task->vmem, state->cr2, false);
 		if(range) {
 			log(LOG_WARN, "  phys: %p, flags: rw %d, user %d\n",
 				valloc_translate_ptr(range, state->cr2, false),
@@ -123,5 +126,8 @@ static void int_handler(task_t* task, isf_t* state, int num) {
 }
 
 void task_exception_init(void) {
-	int_register_bulk(0, 31, int_handler, true);
+	// Device not available is used for lazy FPU switching
+	int_register_bulk(0, 6, int_handler, true);
+	int_register(7, fpu_trap, false);
+	int_register_bulk(8, 31, int_handler, true);
 }
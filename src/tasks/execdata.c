@@ -19,9 +19,11 @@
 
 #include <tasks/task.h>
 #include <tasks/execdata.h>
+#include <mem/i386-gdt.h>
 #include <mem/kmalloc.h>
 #include <mem/mem.h>
 #include <string.h>
+#include <time.h>
 
 struct execdata {
 	uint32_t pid;
@@ -39,10 +41,11 @@ struct execdata {
 	uint16_t euid;
 	uint16_t egid;
 	char binary_path[VFS_PATH_MAX];
+	uint32_t flags;
 };
 
 /* Sets up four pages of runtime data for the program, including PID, argv,
- * environment etc.
+ * environment etc., and maps the time page after them.
  *
  * Page layout:
  * - struct execdata
@@ -54,8 +57,8 @@ struct execdata {
 void task_setup_execdata(task_t* task) {
 	vm_alloc_t vmem;
 	// FIXME error checking
-	vm_alloc(VM_KERNEL, &vmem, 4, NULL, VM_RW | VM_ZERO);
-	vm_alloc_at(&task->vmem, NULL, 4, (void*)CONFIG_EXECDATA_LOCATION, vmem.phys,
+	vm_alloc(VM_KERNEL, &vmem, EXECDATA_PAGES, NULL, VM_RW | VM_ZERO);
+	vm_alloc_at(task->vmem, NULL, EXECDATA_PAGES, (void*)CONFIG_EXECDATA_LOCATION, vmem.phys,
 		VM_USER | VM_RW | VM_FREE | VM_FIXED);
 
 	size_t offset = 0;
@@ -94,5 +97,13 @@ void task_setup_execdata(task_t* task) {
 	memcpy(exc->binary_path, task->binary_path, VFS_PATH_MAX);
 	memcpy(exc->old_binary_path, task->binary_path, 256);
 
+	if(gdt_sysenter_enabled) {
+		exc->flags |= EXECDATA_SYSENTER;
+	}
+
+	if(time_map_page(task->vmem, (void*)EXECDATA_TIME_PAGE) == 0) {
+		exc->flags |= EXECDATA_TIMEPAGE;
+	}
+
 	vm_free(&vmem);
 }
@@ -20,4 +20,13 @@
 
 #include <tasks/task.h>
 
+// Userland can use sysenter instead of int 0x80 for syscalls
+#define EXECDATA_SYSENTER 1
+
+// The time page is mapped at EXECDATA_TIME_PAGE, see lib/time.c
+#define EXECDATA_TIMEPAGE 2
+
+#define EXECDATA_PAGES 4
+#define EXECDATA_TIME_PAGE (CONFIG_EXECDATA_LOCATION + EXECDATA_PAGES * PAGE_SIZE)
+
 void task_setup_execdata(task_t* task);
@@ -0,0 +1,151 @@
+/* futex.c: Userland wait queues
+ * Copyright © 2023 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <tasks/futex.h>
+#include <tasks/scheduler.h>
+#include <int/int.h>
+#include <spinlock.h>
+#include <errno.h>
+
+#define HASH_SIZE 64
+#define hash(addr) (((addr) >> 2) % HASH_SIZE)
+
+/* Tasks waiting on a futex, hashed by userland address. Waiters are matched
+ * by address space and address, so futexes work between the threads of a
+ * process, but not in memory shared between processes.
+ *
+ * futex_wake also gets called from the scheduler when a thread exits, so
+ * interrupts need to be disabled while holding the lock.
+ */
+static task_t* buckets[HASH_SIZE];
+static spinlock_t lock;
+
+static int futex_wait(task_t* task, uintptr_t addr, uint32_t val) {
+	vm_alloc_t alloc;
+	uint32_t* value = vm_map(VM_KERNEL, &alloc, task->vmem, (void*)addr,
+		sizeof(uint32_t), VM_MAP_USER_ONLY);
+	if(!value) {
+		sc_errno = EFAULT;
+		return -1;
+	}
+
+	bool ints = int_save();
+	spinlock_raw_get(&lock);
+
+	/* Compare with the lock held so a futex_wake between the check in
+	 * userland and this one can't get lost.
+	 */
+	if(*(volatile uint32_t*)value != val) {
+		spinlock_release(&lock);
+		int_restore(ints);
+		vm_free(&alloc);
+		sc_errno = EAGAIN;
+		return -1;
+	}
+
+	task->futex_addr = addr;
+	task->futex_next = buckets[hash(addr)];
+	buckets[hash(addr)] = task;
+	task->task_state = TASK_STATE_BLOCKED;
+
+	spinlock_release(&lock);
+	int_restore(ints);
+	vm_free(&alloc);
+
+	// The scheduler won't run this task again until the state is changed
+	while((volatile int)task->task_state == TASK_STATE_BLOCKED) {
+		scheduler_yield();
+	}
+
+	// Still queued, so this was a signal rather than futex_wake
+	if(task->futex_addr) {
+		futex_cancel(task);
+		sc_errno = EINTR;
+		return -1;
+	}
+	return 0;
+}
+
+// Wake up to num tasks waiting on addr. Returns the number of woken tasks.
+int futex_wake(struct vm_ctx* ctx, uintptr_t addr, int num) {
+	int woken = 0;
+	bool ints = int_save();
+	spinlock_raw_get(&lock);
+
+	task_t** prev = &buckets[hash(addr)];
+	for(task_t* task = *prev; task && woken < num; task = *prev) {
+		if(task->vmem != ctx || task->futex_addr != addr) {
+			prev = &task->futex_next;
+			continue;
+		}
+
+		*prev = task->futex_next;
+		task->futex_next = NULL;
+		task->futex_addr = 0;
+
+		// Could also have been stopped or killed in the meantime
+		if(task->task_state == TASK_STATE_BLOCKED) {
+			scheduler_wake(task);
+		}
+		woken++;
+	}
+
+	spinlock_release(&lock);
+	int_restore(ints);
+	return woken;
+}
+
+// Remove a task from its wait queue, if any
+void futex_cancel(task_t* task) {
+	bool ints = int_save();
+	spinlock_raw_get(&lock);
+
+	if(task->futex_addr) {
+		task_t** prev = &buckets[hash(task->futex_addr)];
+		for(; *prev; prev = &(*prev)->futex_next) {
+			if(*prev == task) {
+				*prev = task->futex_next;
+				break;
+			}
+		}
+
+		task->futex_next = NULL;
+		task->futex_addr = 0;
+	}
+
+	spinlock_release(&lock);
+	int_restore(ints);
+}
+
+int task_futex(task_t* task, uintptr_t addr, int op, uint32_t val) {
+	if(!addr || addr % sizeof(uint32_t)) {
+		sc_errno = EINVAL;
+		return -1;
+	}
+
+	switch(op) {
+		case FUTEX_WAIT:
+			return futex_wait(task, addr, val);
+		case FUTEX_WAKE:
+			return futex_wake(task->vmem, addr, val);
+	}
+
+	sc_errno = EINVAL;
+	return -1;
+}
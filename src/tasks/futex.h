@@ -0,0 +1,29 @@
+#pragma once
+
+/* Copyright © 2023 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <tasks/task.h>
+
+// futex operations, keep in sync with newlib
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
+
+int futex_wake(struct vm_ctx* ctx, uintptr_t addr, int num);
+void futex_cancel(task_t* task);
+int task_futex(task_t* task, uintptr_t addr, int op, uint32_t val);
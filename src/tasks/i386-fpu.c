@@ -0,0 +1,161 @@
+/* i386-fpu.c: Lazy FPU/SSE context switching
+ * Copyright © 2023 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "i386-fpu.h"
+#include <int/int.h>
+#include <mem/kmalloc.h>
+#include <bsp/i386-smp.h>
+#include <tasks/signal.h>
+#include <string.h>
+#include <errno.h>
+#include <panic.h>
+#include <log.h>
+
+#define CR0_TS 8
+#define FPU_STATE_SIZE 512
+#define MXCSR_DEFAULT 0x1f80
+
+/* The kernel is built with -mgeneral-regs-only, so the FPU/SSE registers only
+ * ever contain userland state. Rather than saving and restoring them on every
+ * interrupt, CR0.TS is set when switching to a task whose state is not loaded.
+ * The first FPU instruction the task runs then raises a device not available
+ * exception (#NM), in which the state gets swapped in.
+ *
+ * This stores the task whose state is currently loaded on each CPU.
+ */
+static task_t* fpu_owner[SMP_MAX_CPUS];
+
+static inline bool get_ts(void) {
+	uint32_t cr0;
+	asm volatile("mov %%cr0, %0" : "=r"(cr0));
+	return cr0 & CR0_TS;
+}
+
+static inline void set_ts(bool ts) {
+	if(ts == get_ts()) {
+		return;
+	}
+
+	if(ts) {
+		uint32_t cr0;
+		asm volatile("mov %%cr0, %0" : "=r"(cr0));
+		asm volatile("mov %0, %%cr0" :: "r"(cr0 | CR0_TS));
+	} else {
+		asm volatile("clts");
+	}
+}
+
+// Write the state of the task to memory if it is loaded on this CPU
+static void save(task_t* task, uint32_t cpu) {
+	if(fpu_owner[cpu] != task || task->fpu_cpu != cpu) {
+		return;
+	}
+
+	bool ts = get_ts();
+	set_ts(false);
+	asm volatile("fxsave (%0)" :: "r"(task->fpu_state) : "memory");
+	set_ts(ts);
+}
+
+// Called by the scheduler with interrupts disabled
+void fpu_switch(task_t* prev, task_t* next) {
+	uint32_t cpu = smp_cpu_id();
+
+	#ifdef CONFIG_SMP
+	/* The previous task could get picked up by a different CPU, so its state
+	 * can't stay behind in the registers of this one.
+	 */
+	if(prev && prev->fpu_state && !get_ts()) {
+		save(prev, cpu);
+	}
+	#endif
+
+	set_ts(!next || fpu_owner[cpu] != next || next->fpu_cpu != cpu);
+}
+
+// #NM exception handler
+void fpu_trap(task_t* task, isf_t* state, int num) {
+	iret_t* iret = (iret_t*)state->esp;
+	if(!task || !(iret->cs & 3)) {
+		panic("FPU used by kernel at %p\n", iret->eip);
+	}
+
+	uint32_t cpu = smp_cpu_id();
+	set_ts(false);
+	if(fpu_owner[cpu] == task && task->fpu_cpu == cpu) {
+		return;
+	}
+
+	#ifndef CONFIG_SMP
+	// Registers still contain the state of the task that used them last
+	if(fpu_owner[cpu]) {
+		save(fpu_owner[cpu], cpu);
+	}
+	#endif
+
+	if(!task->fpu_state) {
+		task->fpu_state = kmalloc_a(FPU_STATE_SIZE);
+
+		// Can't run the task without somewhere to save its registers
+		if(!task->fpu_state) {
+			log(LOG_ERR, "fpu: Could not allocate FPU state for task %d <%s>\n",
+				task->pid, task->name);
+			set_ts(true);
+			task_signal(task, NULL, SIGKILL);
+			return;
+		}
+
+		uint32_t mxcsr = MXCSR_DEFAULT;
+		asm volatile("fninit; ldmxcsr %0" :: "m"(mxcsr));
+	} else {
+		asm volatile("fxrstor (%0)" :: "r"(task->fpu_state) : "memory");
+	}
+
+	fpu_owner[cpu] = task;
+	task->fpu_cpu = cpu;
+}
+
+int fpu_fork(task_t* task, task_t* parent) {
+	if(!parent->fpu_state) {
+		return 0;
+	}
+
+	task->fpu_state = kmalloc_a(FPU_STATE_SIZE);
+	if(!task->fpu_state) {
+		sc_errno = ENOMEM;
+		return -1;
+	}
+
+	bool ints = int_save();
+	save(parent, smp_cpu_id());
+	int_restore(ints);
+
+	memcpy(task->fpu_state, parent->fpu_state, FPU_STATE_SIZE);
+	return 0;
+}
+
+void fpu_free(task_t* task) {
+	for(int i = 0; i < SMP_MAX_CPUS; i++) {
+		__sync_bool_compare_and_swap(&fpu_owner[i], task, NULL);
+	}
+
+	if(task->fpu_state) {
+		kfree(task->fpu_state);
+	}
+}
@@ -0,0 +1,112 @@
+; i386-sysenter.asm: Fast system call entry using sysenter/sysexit
+; Copyright © 2023 Lukas Martini
+
+; This file is part of Xelix.
+;
+; Xelix is free software: you can redistribute it and/or modify
+; it under the terms of the GNU General Public License as published by
+; the Free Software Foundation, either version 3 of the License, or
+; (at your option) any later version.
+;
+; Xelix is distributed in the hope that it will be useful,
+; but WITHOUT ANY WARRANTY; without even the implied warranty of
+; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+; GNU General Public License for more details.
+;
+; You should have received a copy of the GNU General Public License
+; along with Xelix.  If not, see <http://www.gnu.org/licenses/>.
+
+[EXTERN syscall_sysenter_dispatch]
+[EXTERN paging_kernel_ctx]
+
+%define EFLAGS_IF	0x200
+
+[section .text.ul_visible]
+
+; Userland passes the call number in eax and the arguments in ebx, esi and edi,
+; since ecx and edx hold the stack pointer and the return address for sysexit.
+;
+; The stack pointer loaded by sysenter points right after the esp0 field in
+; the TSS of this CPU (see gdt_init_cpu), from where we get the kernel stack.
+;
+; We build the same isf_t an int 0x80 from userland would have left, with the
+; arguments moved to their usual registers, so the syscall handlers, the
+; scheduler and signals can treat it like any other interrupt. If we return to
+; that same frame, we can leave using sysexit. Otherwise (task switch, execve)
+; the interrupt return path using iret is taken.
+[GLOBAL syscall_sysenter_entry]
+syscall_sysenter_entry:
+	mov esp, [esp - 4]
+
+	; Mimic the frame pushed by the CPU on interrupts from userland
+	push dword 0x23
+	push ecx
+	pushf
+	or dword [esp], EFLAGS_IF
+	push dword 0x1b
+	push edx
+
+	; Error code field and pointer to the frame above, see i386-int.asm
+	push dword 0
+	push esp
+	add dword [esp], 4
+
+	mov ecx, esi
+	mov edx, edi
+	pusha
+
+	; push ds, cr2 & cr3
+	xor eax, eax
+	mov ax, ds
+	push eax
+
+	mov eax, cr2
+	push eax
+
+	mov eax, cr3
+	push eax
+
+	mov ax, 0x10
+	mov ds, ax
+	mov es, ax
+	mov fs, ax
+
+	mov ecx, [paging_kernel_ctx]
+	mov cr3, ecx
+
+	; ebx is preserved across the call, keep our frame there for comparison
+	mov ecx, esp
+	mov ebx, esp
+	call syscall_sysenter_dispatch
+	mov esp, eax
+
+	; Set paging context, drop cr2, reload segment descriptors
+	pop ecx
+	mov cr3, ecx
+	add esp, 4
+	pop ecx
+	mov ds, cx
+	mov es, cx
+	mov fs, cx
+
+	cmp eax, ebx
+	jne .iret
+
+	popa
+	pop esp
+
+	; sysexit takes the return address in edx and the stack in ecx. Restore
+	; eflags with interrupts still disabled, then enable them using sti,
+	; which only takes effect after the following instruction.
+	mov edx, [esp]
+	mov ecx, [esp + 12]
+	and dword [esp + 8], ~EFLAGS_IF
+	add esp, 8
+	popf
+	sti
+	sysexit
+
+.iret:
+	popa
+	pop esp
+	iret
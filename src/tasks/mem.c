@@ -19,6 +19,9 @@
 
 #include <tasks/mem.h>
 #include <tasks/task.h>
+#include <tasks/i386-fpu.h>
+#include <tasks/futex.h>
+#include <tasks/pid.h>
 #include <mem/kmalloc.h>
 #include <mem/mem.h>
 #include <errno.h>
@@ -34,18 +37,18 @@
 #define MAP_FIXED 8
 
 static int task_stack_grow(task_t* task, size_t alloc_size) {
-	if(task->stack_size + alloc_size > PAGE_SIZE * 512) {
+	if(task->vmem->stack_size + alloc_size > PAGE_SIZE * 512) {
 		sc_errno = ENOMEM;
 		return -1;
 	}
 
-	uintptr_t stack_lower = TASK_STACK_LOCATION - task->stack_size;
-	if(!vm_alloc_at(&task->vmem, NULL, RDIV(alloc_size, PAGE_SIZE), (void*)(stack_lower - alloc_size), NULL,
+	uintptr_t stack_lower = TASK_STACK_LOCATION - task->vmem->stack_size;
+	if(!vm_alloc_at(task->vmem, NULL, RDIV(alloc_size, PAGE_SIZE), (void*)(stack_lower - alloc_size), NULL,
 		VM_USER | VM_RW | VM_FREE | VM_NOCOW | VM_TFORK | VM_ZERO | VM_FIXED)) {
 		return -1;
 	}
 
-	task->stack_size += alloc_size;
+	task->vmem->stack_size += alloc_size;
 	return 0;
 }
 
@@ -57,7 +60,7 @@ int task_page_fault_cb(task_t* task, void* _addr) {
 	uintptr_t addr = (uintptr_t)_addr;
 	addr = ALIGN_DOWN(addr, PAGE_SIZE);
 
-	uintptr_t stack_lower = TASK_STACK_LOCATION - task->stack_size;
+	uintptr_t stack_lower = TASK_STACK_LOCATION - task->vmem->stack_size;
 	if(addr >= stack_lower) {
 		return -1;
 	}
@@ -66,25 +69,56 @@ int task_page_fault_cb(task_t* task, void* _addr) {
 	return task_stack_grow(task, alloc_size);
 }
 
-// Free a task and all associated memory
+/* Free a task and all associated memory. Also used to unwind partially set up
+ * tasks, so everything past the task struct itself may still be missing.
+ */
 void task_free(task_t* t) {
-	vm_cleanup(&t->vmem);
-	kfree_array(t->environ, t->envc);
-	kfree_array(t->argv, t->argc);
+	task_unlink(t);
+	fpu_free(t);
+	futex_cancel(t);
+
+	if(t->files && !__sync_sub_and_fetch(&t->files->refs, 1)) {
+		kfree(t->files);
+	}
+	if(t->signals && !__sync_sub_and_fetch(&t->signals->refs, 1)) {
+		kfree(t->signals);
+	}
+
+	if(t->vmem && __sync_sub_and_fetch(&t->vmem->refs, 1)) {
+		/* The address space is still in use by other threads or by a vfork
+		 * parent, so only remove the state and kernel stack of this task.
+		 */
+		if(t->state) {
+			vm_free(vm_get(t->vmem, t->state, false));
+		}
+		if(t->kernel_stack) {
+			vm_free(vm_get(t->vmem, t->kernel_stack, false));
+		}
+	} else if(t->vmem) {
+		vm_cleanup(t->vmem);
+		kfree(t->vmem);
+	}
+
+	if(t->environ) {
+		kfree_array(t->environ, t->envc);
+	}
+	if(t->argv) {
+		kfree_array(t->argv, t->argc);
+	}
 	kfree(t);
 }
 
 void* task_sbrk(task_t* task, int32_t length) {
 	if(length <= 0) {
-		return task->sbrk;
+		return task->vmem->sbrk;
 	}
 
 	length = ALIGN(length, PAGE_SIZE);
 
-	void* virt_addr = task->sbrk;
-	task->sbrk += length;
+	// Other threads could be calling sbrk at the same time
+	void* virt_addr = __sync_fetch_and_add(&task->vmem->sbrk, length);
 
-	if(!vm_alloc_at(&task->vmem, NULL, RDIV(length, PAGE_SIZE), virt_addr, NULL,
+	if(!vm_alloc_at(task->vmem, NULL, RDIV(length, PAGE_SIZE), virt_addr, NULL,
 		VM_USER | VM_RW | VM_NOCOW | VM_TFORK | VM_FREE | VM_FIXED)) {
 		return (void*)-1;
 	}
@@ -135,7 +169,7 @@ void* task_mmap(task_t* task, struct task_mmap_ctx* ctx) {
 		req = (void*)CONFIG_MMAP_BASE;
 	}
 
-	void* addr = vm_alloc_at(&task->vmem, NULL, RDIV(ctx->len, PAGE_SIZE), req, NULL, vaflags);
+	void* addr = vm_alloc_at(task->vmem, NULL, RDIV(ctx->len, PAGE_SIZE), req, NULL, vaflags);
 	if(!addr) {
 		return (void*)-1;
 	}
@@ -164,12 +198,12 @@ char** task_copy_strings(task_t* task, char** array, uint32_t* count) {
 	int i = 0;
 	for(; i < size; i++) {
 		vm_alloc_t vmem;
-		char* old_string = vm_map(VM_KERNEL, &vmem, &task->vmem, array[i], VFS_PATH_MAX, 0);
+		char* old_string = vm_map(VM_KERNEL, &vmem, task->vmem, array[i], VFS_PATH_MAX, 0);
 
 		if(!old_string) {
 			// Retry with shorter length to stay within the page
 			max_length = ALIGN(array[i], PAGE_SIZE) - array[i] - 1;
-			old_string = vm_map(VM_KERNEL, &vmem, &task->vmem, array[i], max_length, 0);
+			old_string = vm_map(VM_KERNEL, &vmem, task->vmem, array[i], max_length, 0);
 			if(!old_string) {
 				return NULL;
 			}
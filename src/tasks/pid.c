@@ -0,0 +1,246 @@
+/* pid.c: Task lookup by PID and task relationships
+ * Copyright © 2023 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <tasks/pid.h>
+#include <int/int.h>
+#include <spinlock.h>
+
+#define HASH_SIZE 256
+
+/* Tasks hashed by PID. After execve, the old and the new task share a PID
+ * until the old one has been cleaned up, so lookups skip tasks that are on
+ * their way out.
+ *
+ * The lock also protects the children lists and the thread rings. These get
+ * modified by task_userland_eol, which is called from the scheduler, so
+ * interrupts need to be disabled while holding it.
+ */
+static task_t* pid_hash[HASH_SIZE];
+static spinlock_t lock;
+
+static inline bool lock_get(void) {
+	bool ints = int_save();
+	spinlock_raw_get(&lock);
+	return ints;
+}
+
+static inline void lock_release(bool ints) {
+	spinlock_release(&lock);
+	int_restore(ints);
+}
+
+task_t* task_find(uint32_t pid) {
+	bool ints = lock_get();
+	task_t* task = pid_hash[pid % HASH_SIZE];
+	for(; task; task = task->pid_next) {
+		if(task->pid == pid && task->task_state != TASK_STATE_REPLACED &&
+			task->task_state != TASK_STATE_TERMINATED &&
+			task->task_state != TASK_STATE_REAPED) {
+			break;
+		}
+	}
+
+	lock_release(ints);
+	return task;
+}
+
+static void add_child(task_t* parent, task_t* task) {
+	task->sibling_next = parent->children;
+	if(parent->children) {
+		parent->children->sibling_pprev = &task->sibling_next;
+	}
+
+	parent->children = task;
+	task->sibling_pprev = &parent->children;
+}
+
+static void remove_child(task_t* task) {
+	if(!task->sibling_pprev) {
+		return;
+	}
+
+	*task->sibling_pprev = task->sibling_next;
+	if(task->sibling_next) {
+		task->sibling_next->sibling_pprev = task->sibling_pprev;
+	}
+
+	task->sibling_next = NULL;
+	task->sibling_pprev = NULL;
+}
+
+static bool reparent(task_t* from, task_t* to) {
+	bool zombies = from->zombies != NULL;
+	while(from->zombies) {
+		task_t* zombie = from->zombies;
+		from->zombies = zombie->zombie_next;
+		zombie->zombie_next = NULL;
+
+		if(to) {
+			zombie->zombie_next = to->zombies;
+			to->zombies = zombie;
+		} else {
+			zombie->task_state = TASK_STATE_REAPED;
+		}
+	}
+
+	while(from->children) {
+		task_t* child = from->children;
+		remove_child(child);
+		child->parent = to;
+
+		// The vfork parent can't be waiting anymore
+		if(child->vfork_parent == from) {
+			child->vfork_parent = NULL;
+		}
+		if(to) {
+			add_child(to, child);
+		}
+	}
+	return zombies;
+}
+
+// Makes a task findable and adds it to its parent. Called by scheduler_add.
+void task_link(task_t* task) {
+	bool ints = lock_get();
+	task->pid_next = pid_hash[task->pid % HASH_SIZE];
+	pid_hash[task->pid % HASH_SIZE] = task;
+
+	if(task->parent) {
+		add_child(task->parent, task);
+	}
+	lock_release(ints);
+}
+
+// Called by task_free
+void task_unlink(task_t* task) {
+	bool ints = lock_get();
+	task_t** prev = &pid_hash[task->pid % HASH_SIZE];
+	for(; *prev; prev = &(*prev)->pid_next) {
+		if(*prev == task) {
+			*prev = task->pid_next;
+			break;
+		}
+	}
+
+	remove_child(task);
+	if(task->parent) {
+		prev = &task->parent->zombies;
+		for(; *prev; prev = &(*prev)->zombie_next) {
+			if(*prev == task) {
+				*prev = task->zombie_next;
+				break;
+			}
+		}
+	}
+
+	// Should have been handed over to init already, but just to be safe
+	reparent(task, NULL);
+
+	if(task->group_next) {
+		task->group_prev->group_next = task->group_next;
+		task->group_next->group_prev = task->group_prev;
+	}
+	lock_release(ints);
+}
+
+// Adds a new thread to the thread ring of `group`
+void task_join_group(task_t* thread, task_t* group) {
+	bool ints = lock_get();
+	thread->group_next = group->group_next;
+	thread->group_prev = group;
+	group->group_next->group_prev = thread;
+	group->group_next = thread;
+	lock_release(ints);
+}
+
+/* Hands all children of `from` over to `to`. Used for orphans, which go to
+ * init, and by execve. Returns true if any of them were zombies.
+ */
+bool task_reparent_children(task_t* from, task_t* to) {
+	bool ints = lock_get();
+	bool zombies = reparent(from, to);
+	lock_release(ints);
+	return zombies;
+}
+
+/* Whether the task has a child with the PID that can still be waited for, or
+ * any such child if pid is 0.
+ */
+bool task_has_children(task_t* task, uint32_t pid) {
+	bool ints = lock_get();
+	task_t* child = task->children;
+	for(; child; child = child->sibling_next) {
+		if((!pid || child->pid == pid) &&
+			child->task_state != TASK_STATE_REPLACED &&
+			child->task_state != TASK_STATE_REAPED) {
+			break;
+		}
+	}
+
+	lock_release(ints);
+	return child != NULL;
+}
+
+// Called by task_userland_eol once a child has exited
+void task_add_zombie(task_t* parent, task_t* child) {
+	bool ints = lock_get();
+	child->zombie_next = parent->zombies;
+	parent->zombies = child;
+	lock_release(ints);
+}
+
+/* Removes an exited child with the PID, or any exited child if pid is 0, from
+ * the zombie list and returns it.
+ */
+task_t* task_take_zombie(task_t* parent, uint32_t pid) {
+	bool ints = lock_get();
+	task_t** prev = &parent->zombies;
+	task_t* child = NULL;
+	for(; *prev; prev = &(*prev)->zombie_next) {
+		if(!pid || (*prev)->pid == pid) {
+			child = *prev;
+			*prev = child->zombie_next;
+			child->zombie_next = NULL;
+			break;
+		}
+	}
+
+	lock_release(ints);
+	return child;
+}
+
+// Terminate all other threads of the process of task
+void task_kill_threads(task_t* task) {
+	bool ints = lock_get();
+	for(task_t* t = task->group_next; t && t != task; t = t->group_next) {
+		switch(t->task_state) {
+			case TASK_STATE_TERMINATED:
+			case TASK_STATE_ZOMBIE:
+			case TASK_STATE_REAPED:
+			case TASK_STATE_REPLACED:
+				break;
+			default:
+				// Exit status of the process is reported by the leader
+				t->task_state = TASK_STATE_TERMINATED;
+				t->exit_code = task->exit_code;
+				t->interrupt_yield = true;
+		}
+	}
+	lock_release(ints);
+}
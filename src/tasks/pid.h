@@ -0,0 +1,30 @@
+#pragma once
+
+/* Copyright © 2023 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <tasks/task.h>
+
+task_t* task_find(uint32_t pid);
+void task_link(task_t* task);
+void task_unlink(task_t* task);
+void task_join_group(task_t* thread, task_t* group);
+bool task_reparent_children(task_t* from, task_t* to);
+bool task_has_children(task_t* task, uint32_t pid);
+void task_add_zombie(task_t* parent, task_t* child);
+task_t* task_take_zombie(task_t* parent, uint32_t pid);
@@ -0,0 +1,78 @@
+#pragma once
+
+/* Copyright © 2023 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <int/int.h>
+#include <bsp/i386-smp.h>
+
+/* Kernel code only gets switched away from when interrupts are enabled, or
+ * when it yields. As long as the preempt count of the CPU is non-zero, timer
+ * interrupts don't switch to another task, and preemption points do nothing.
+ * It is incremented for every spinlock held. The count belongs to the code
+ * running on the CPU, so scheduler_yield takes it along to wherever the
+ * yielding code continues.
+ */
+extern volatile uint32_t preempt_counts[SMP_MAX_CPUS];
+
+static inline uint32_t preempt_count(void) {
+	return preempt_counts[smp_cpu_id()];
+}
+
+// Interrupts are disabled so the CPU can't change in between
+static inline void preempt_disable(void) {
+	bool ints = int_save();
+	preempt_counts[smp_cpu_id()]++;
+	int_restore(ints);
+}
+
+static inline void preempt_enable(void) {
+	bool ints = int_save();
+	preempt_counts[smp_cpu_id()]--;
+	int_restore(ints);
+}
+
+// Take the count of the current CPU, leaving it at zero. Needs interrupts disabled
+static inline uint32_t preempt_save(void) {
+	uint32_t count = preempt_counts[smp_cpu_id()];
+	preempt_counts[smp_cpu_id()] = 0;
+	return count;
+}
+
+static inline void preempt_restore(uint32_t count) {
+	bool ints = int_save();
+	preempt_counts[smp_cpu_id()] = count;
+	int_restore(ints);
+}
+
+/* Preemption point for long running kernel code that has interrupts
+ * disabled, such as system calls looping over many blocks. Briefly enables
+ * interrupts, so pending ones get handled and a timer interrupt can switch to
+ * another task right here. Only call this where that is safe.
+ */
+static inline void preempt_point(void) {
+	bool ints = int_save();
+	if(!ints && !preempt_count()) {
+		int_enable();
+		asm volatile("nop" ::: "memory");
+		int_disable();
+	}
+	int_restore(ints);
+}
@@ -24,205 +24,773 @@
 #include <mem/kmalloc.h>
 #include <mem/i386-gdt.h>
 #include <tasks/worker.h>
+#include <tasks/pid.h>
+#include <tasks/acct.h>
+#include <tasks/preempt.h>
+#include <tasks/i386-fpu.h>
+#include <bsp/timer.h>
+#include <bsp/i386-smp.h>
+#include <spinlock.h>
+#include <prof.h>
+
+/* Every CPU has its own run queue, which is a ring of entries. The queues are
+ * only modified with their lock held and interrupts disabled. The idle entry
+ * is not part of the ring.
+ */
+struct scheduler_rq {
+	spinlock_t lock;
+	uint32_t cpu;
+	struct scheduler_qentry* head;
+	struct scheduler_qentry* current;
+	struct scheduler_qentry idle;
+
+	// Entry that was switched away from, but whose stack could still be in use
+	struct scheduler_qentry* prev;
+
+	// Unlinked entries waiting to be cleaned up. Only used by the owning CPU
+	struct scheduler_qentry* dead;
+
+	// Number of entries currently linked into the ring
+	uint32_t nentries;
 
-static struct scheduler_qentry* current_entry = NULL;
-struct scheduler_qentry idle_qentry;
+	// Monotonically increasing lower bound of the runnable entries' vruntime
+	uint64_t min_vruntime;
+
+	uint64_t rt_period_start;
+	uint64_t rt_time;
+	bool rt_throttled;
+};
+
+static struct scheduler_rq runqueues[SMP_MAX_CPUS];
 enum scheduler_state scheduler_state;
+volatile uint32_t preempt_counts[SMP_MAX_CPUS];
+
+// Total number of entries in all run queues
+static uint32_t total_entries = 0;
+
+static inline struct scheduler_rq* this_rq(void) {
+	return &runqueues[smp_cpu_id()];
+}
 
 task_t* scheduler_get_current(void) {
-	return current_entry ? current_entry->task : NULL;
+	// Don't get moved to another CPU while looking at the run queue
+	bool ints = int_save();
+	struct scheduler_qentry* current = this_rq()->current;
+	task_t* task = current ? current->task : NULL;
+	int_restore(ints);
+	return task;
 }
 
-void scheduler_add(task_t* task) {
-	struct scheduler_qentry* entry = kmalloc(sizeof(struct scheduler_qentry));
-	entry->task = task;
-	entry->worker = NULL;
-	task->qentry = entry;
+bool scheduler_is_idle(void) {
+	struct scheduler_rq* rq = this_rq();
+	return rq->current == &rq->idle;
+}
+
+/* Weights for nice levels -20 to 19. Each step amounts to roughly 10% of CPU
+ * time relative to a task at the neighbouring level, same as in Linux CFS.
+ */
+static const uint32_t nice_weights[] = {
+	88761, 71755, 56483, 46273, 36291, 29154, 23254, 18705, 14949, 11916,
+	9548, 7620, 6100, 4904, 3906, 3121, 2501, 1991, 1586, 1277,
+	1024, 820, 655, 526, 423, 335, 272, 215, 172, 137,
+	110, 87, 70, 56, 45, 36, 29, 23, 18, 15
+};
+
+#define NICE_0_WEIGHT 1024
+
+/* Minimum time in ticks the running entry may get ahead of the most eligible
+ * other one before it is preempted. Prevents ping-ponging between tasks with
+ * near-identical vruntime on every tick.
+ */
+#define SCHED_GRANULARITY_TICKS 1
+
+/* How far in ticks a task that has been sleeping or blocked can fall behind
+ * min_vruntime. This gives interactive tasks a small head start when they
+ * wake up without letting them monopolize the CPU afterwards.
+ */
+#define SCHED_SLEEPER_CREDIT_TICKS 3
+
+// Time slice of SCHED_RR tasks before they rotate with equal priority ones
+#define SCHED_RR_TIMESLICE_MS 100
 
-	// No entry yet?
-	if(current_entry == NULL) {
-		current_entry = entry;
+/* Real-time tasks may only use SCHED_RT_RUNTIME_MS out of every
+ * SCHED_RT_PERIOD_MS. Once they exceed that, they are scheduled like normal
+ * tasks for the rest of the period, so a runaway RT task can't lock up the
+ * system.
+ */
+#define SCHED_RT_PERIOD_MS 1000
+#define SCHED_RT_RUNTIME_MS 950
+
+static inline uint64_t ticks_to_cycles(uint32_t ticks) {
+	return (uint64_t)timer_get_tsc_khz() * 1000 * ticks / timer_get_rate();
+}
+
+static inline uint64_t ms_to_cycles(uint32_t ms) {
+	return (uint64_t)timer_get_tsc_khz() * ms;
+}
+
+static inline bool is_rt(struct scheduler_qentry* entry) {
+	return entry->task && entry->task->sched_policy != SCHED_OTHER;
+}
+
+static inline uint32_t entry_weight(struct scheduler_qentry* entry) {
+	if(!entry->task) {
+		return NICE_0_WEIGHT;
+	}
+	return nice_weights[entry->task->nice - SCHED_NICE_MIN];
+}
+
+uint32_t scheduler_runtime_ms(struct scheduler_qentry* entry) {
+	uint32_t khz = timer_get_tsc_khz();
+	return khz ? entry->runtime / khz : 0;
+}
+
+// Link an entry into the ring of a run queue. Needs the queue lock held
+static void rq_add(struct scheduler_rq* rq, struct scheduler_qentry* entry) {
+	entry->rq = rq;
+	rq->nentries++;
+
+	if(!rq->head) {
+		rq->head = entry;
 		entry->next = entry;
 		entry->prev = entry;
+		return;
+	}
+
+	struct scheduler_qentry* anchor = rq->head;
+	entry->next = anchor->next;
+	entry->next->prev = entry;
+	entry->prev = anchor;
+	anchor->next = entry;
+}
+
+static void rq_remove(struct scheduler_rq* rq, struct scheduler_qentry* entry) {
+	if(entry->next == entry) {
+		rq->head = NULL;
 	} else {
-		entry->next = current_entry->next;
-		entry->next->prev = entry;
-		entry->prev = current_entry;
-		current_entry->next = entry;
+		entry->next->prev = entry->prev;
+		entry->prev->next = entry->next;
+		if(rq->head == entry) {
+			rq->head = entry->next;
+		}
 	}
+	rq->nentries--;
+}
 
-	if(task->ctty) {
+// Pick the run queue with the fewest entries for new tasks
+static struct scheduler_rq* pick_rq(void) {
+	struct scheduler_rq* rq = &runqueues[0];
+	for(uint32_t i = 1; i < smp_num_cpus; i++) {
+		if(smp_cpu_online(i) && runqueues[i].nentries < rq->nentries) {
+			rq = &runqueues[i];
+		}
+	}
+	return rq;
+}
+
+static void enqueue(struct scheduler_qentry* entry) {
+	entry->runtime = 0;
+	entry->exec_start = 0;
+	entry->slice_start = 0;
+	entry->on_cpu = false;
+	entry->yielded = false;
+
+	bool ints = int_save();
+	struct scheduler_rq* rq = pick_rq();
+	spinlock_raw_get(&rq->lock);
+	entry->vruntime = rq->min_vruntime;
+	rq_add(rq, entry);
+	__sync_add_and_fetch(&total_entries, 1);
+	spinlock_release(&rq->lock);
+	int_restore(ints);
+	scheduler_kick();
+}
+
+void scheduler_add(task_t* task) {
+	struct scheduler_qentry* entry = kmalloc(sizeof(struct scheduler_qentry));
+	entry->task = task;
+	entry->worker = NULL;
+	task->qentry = entry;
+	task_link(task);
+	enqueue(entry);
+
+	// Threads don't take over the terminal from the rest of their process
+	if(task->ctty && task->pid == task->tgid) {
 		task->ctty->fg_task = task;
 	}
 }
 
+/* Make sure the scheduler runs again within a tick after an entry has become
+ * runnable. In tickless mode, the timer might otherwise stay silent until
+ * the next sleeping task wakes up.
+ */
+void scheduler_kick(void) {
+	#ifdef CONFIG_TICKLESS
+	bool ints = int_save();
+	timer_set_periodic();
+	int_restore(ints);
+	#endif
+}
+
+// Make a blocked task runnable again
+void scheduler_wake(task_t* task) {
+	task->task_state = TASK_STATE_RUNNING;
+	scheduler_kick();
+}
+
 void scheduler_add_worker(worker_t* worker) {
 	struct scheduler_qentry* entry = kmalloc(sizeof(struct scheduler_qentry));
 	entry->worker = worker;
 	entry->task = NULL;
+	enqueue(entry);
+}
 
-	// No entry yet?
-	if(current_entry == NULL) {
-		current_entry = entry;
-		entry->next = entry;
-		entry->prev = entry;
-	} else {
-		entry->next = current_entry->next;
-		entry->next->prev = entry;
-		entry->prev = current_entry;
-		current_entry->next = entry;
+void scheduler_yield() {
+	/* Let other CPUs into the kernel while this waits. The lock is taken
+	 * again when returning to this task.
+	 */
+	#ifdef CONFIG_SMP
+	smp_kernel_unlock();
+	#endif
+
+	// Whatever runs next starts out preemptible, and this might continue on another CPU
+	int_disable();
+	uint32_t preempt = preempt_save();
+	int_enable();
+	asm("int $0x31;");
+	preempt_restore(preempt);
+}
+
+// Called by the owning CPU with the queue locked
+static inline void unlink(struct scheduler_rq* rq, struct scheduler_qentry* entry) {
+	if(__sync_sub_and_fetch(&total_entries, 1) == 0) {
+		panic("scheduler: No more queued tasks to execute (PID 1 killed?).\n");
 	}
+
+	rq_remove(rq, entry);
+	entry->dead_next = rq->dead;
+	rq->dead = entry;
 }
 
-task_t* scheduler_find(uint32_t pid) {
-	struct scheduler_qentry* start = current_entry;
-	for(struct scheduler_qentry* entry = start; entry->next != start; entry = entry->next) {
-		task_t* t = entry->task;
-		if(!t) {
+/* Clean up unlinked entries. This needs the kernel lock, and can't be done
+ * for entries whose kernel stack might still be in use.
+ */
+static void reap(struct scheduler_rq* rq) {
+	struct scheduler_qentry** prev = &rq->dead;
+	for(struct scheduler_qentry* entry = rq->dead; entry; entry = *prev) {
+		if(entry->on_cpu) {
+			prev = &entry->dead_next;
 			continue;
 		}
 
-		if(t->pid == pid && t->task_state != TASK_STATE_REPLACED &&
-			t->task_state != TASK_STATE_TERMINATED &&
-			t->task_state != TASK_STATE_REAPED) {
-			return t;
+		*prev = entry->dead_next;
+		if(entry->task) {
+			task_cleanup(entry->task);
 		}
 
-		if(entry->next == entry) {
-			break;
+		kfree(entry);
+	}
+}
+
+enum entry_state {
+	ENTRY_RUNNABLE,
+	ENTRY_BLOCKED,
+	ENTRY_TERMINATED,
+	ENTRY_DEAD
+};
+
+static inline enum entry_state get_entry_state(struct scheduler_qentry* qe) {
+	if(qe->worker) {
+		if(qe->worker->stopped) {
+			return ENTRY_DEAD;
 		}
+		return worker_is_sleeping(qe->worker) ? ENTRY_BLOCKED : ENTRY_RUNNABLE;
+	}
+
+	task_t* task = qe->task;
+	switch(task->task_state) {
+		case TASK_STATE_TERMINATED:
+			return ENTRY_TERMINATED;
+		case TASK_STATE_REAPED:
+		case TASK_STATE_REPLACED:
+			return ENTRY_DEAD;
+		case TASK_STATE_STOPPED:
+		case TASK_STATE_WAITING:
+		case TASK_STATE_BLOCKED:
+		case TASK_STATE_ZOMBIE:
+			return ENTRY_BLOCKED;
+		case TASK_STATE_SLEEPING:
+			return timer_get_tick() >= task->sleep_until ? ENTRY_RUNNABLE : ENTRY_BLOCKED;
+		default:
+			return ENTRY_RUNNABLE;
 	}
-	return NULL;
 }
 
-void scheduler_yield() {
-	int_enable();
-	asm("int $0x31;");
+/* Tasks that have terminated need some cleanup that requires the kernel lock,
+ * but can't be done with the run queue locked. Collect them while walking the
+ * queue and handle them afterwards.
+ */
+#define MAX_EOL 8
+
+struct eol_list {
+	uint32_t num;
+	task_t* tasks[MAX_EOL];
+};
+
+/* Checks whether an entry can be run, and unlinks entries of tasks that have
+ * exited or been replaced. Returns -1 if the entry was unlinked.
+ */
+static inline int check_runnable(struct scheduler_rq* rq, struct scheduler_qentry* qe,
+	struct eol_list* eol) {
+
+	switch(get_entry_state(qe)) {
+		case ENTRY_TERMINATED:
+			if(eol->num < MAX_EOL) {
+				eol->tasks[eol->num++] = qe->task;
+			}
+			return 0;
+		case ENTRY_DEAD:
+			unlink(rq, qe);
+			return -1;
+		case ENTRY_BLOCKED:
+			return 0;
+		default:
+			return 1;
+	}
 }
 
-static inline void unlink(struct scheduler_qentry* entry) {
-	if(entry->next == entry || entry->prev == entry) {
-		panic("scheduler: No more queued tasks to execute (PID 1 killed?).\n");
+/* Blocking in the kernel is mostly implemented by calling scheduler_yield in
+ * a loop until a condition is met. To the scheduler, such entries look
+ * runnable, but they would keep taking turns with each other while their
+ * vruntime barely grows. Entries that have yielded during the current tick
+ * are therefore deferred behind all other runnable entries, and get to check
+ * their condition again once per tick.
+ */
+static inline bool is_deferred(struct scheduler_qentry* entry, uint32_t tick) {
+	return entry->yielded && entry->yield_tick == tick;
+}
+
+/* Walks the whole ring once and returns the runnable entry with the lowest
+ * vruntime other than the current one (`start`), not counting deferred
+ * entries. The deferred entry with the lowest vruntime is returned in
+ * `waiter`. `best_rt` receives the runnable real-time entry with the highest
+ * priority, again excluding `start` and deferred entries. Between equal
+ * priorities, the first one in ring order wins, which rotates SCHED_RR tasks.
+ * `start_runnable` is set according to whether `start` itself can keep
+ * running.
+ */
+static inline struct scheduler_qentry* find_runnable_qentry(
+	struct scheduler_rq* rq, bool* start_runnable, struct scheduler_qentry** waiter,
+	struct scheduler_qentry** best_rt, struct eol_list* eol) {
+
+	struct scheduler_qentry* start = rq->current;
+	struct scheduler_qentry* best = NULL;
+	struct scheduler_qentry* qe = (start == &rq->idle) ? rq->head : start->next;
+	uint64_t sleeper_credit = ticks_to_cycles(SCHED_SLEEPER_CREDIT_TICKS);
+	uint32_t tick = timer_get_tick();
+	uint32_t count = rq->nentries;
+	*start_runnable = false;
+	*waiter = NULL;
+	*best_rt = NULL;
+
+	for(uint32_t i = 0; i < count; i++, qe = qe->next) {
+		if(unlikely(qe == NULL)) {
+			panic("scheduler: qentry list corrupted (current_entry->next was NULL).\n");
+		}
+
+		int runnable = check_runnable(rq, qe, eol);
+		if(runnable < 1) {
+			continue;
+		}
+
+		/* Entries that have been blocked or sleeping have not accumulated
+		 * vruntime in the meantime. Limit how much they can catch up.
+		 */
+		if(qe->vruntime + sleeper_credit < rq->min_vruntime) {
+			qe->vruntime = rq->min_vruntime - sleeper_credit;
+		}
+
+		if(qe == start) {
+			*start_runnable = true;
+			continue;
+		}
+
+		if(is_deferred(qe, tick)) {
+			if(!*waiter || qe->vruntime < (*waiter)->vruntime) {
+				*waiter = qe;
+			}
+			continue;
+		}
+
+		if(!best || qe->vruntime < best->vruntime) {
+			best = qe;
+		}
+
+		if(is_rt(qe) && (!*best_rt ||
+			qe->task->rt_priority > (*best_rt)->task->rt_priority)) {
+			*best_rt = qe;
+		}
 	}
 
-	entry->next->prev = entry->prev;
-	entry->prev->next = entry->next;
+	return best;
+}
 
-	if(entry->task) {
-		task_cleanup(entry->task);
+/* Charge the CPU time used since the entry was last selected to its
+ * runtime, and weighted by its nice value to its vruntime.
+ */
+static inline void update_runtime(struct scheduler_rq* rq, uint64_t now) {
+	struct scheduler_qentry* entry = rq->current;
+	if(entry == &rq->idle || !entry->exec_start) {
+		return;
 	}
 
-	// FIXME Free entry
-	//kfree(entry);
+	uint64_t delta = now - entry->exec_start;
+	entry->runtime += delta;
+	entry->vruntime += delta * NICE_0_WEIGHT / entry_weight(entry);
+
+	if(is_rt(entry)) {
+		rq->rt_time += delta;
+	}
 }
 
-static inline struct scheduler_qentry* find_runnable_qentry(struct scheduler_qentry* start) {
-	struct scheduler_qentry* qe = start->next;
-	struct scheduler_qentry* orig = qe;
-	bool initial = true;
+static inline void update_rt_throttle(struct scheduler_rq* rq, uint64_t now) {
+	if(now - rq->rt_period_start >= ms_to_cycles(SCHED_RT_PERIOD_MS)) {
+		rq->rt_period_start = now;
+		rq->rt_time = 0;
+		rq->rt_throttled = false;
+		return;
+	}
 
-	for(;; qe = qe->next) {
-		if(unlikely(qe == NULL)) {
-			panic("scheduler: qentry list corrupted (current_entry->next was NULL).\n");
+	// Can't enforce limits before the TSC is calibrated
+	uint64_t limit = ms_to_cycles(SCHED_RT_RUNTIME_MS);
+	if(!rq->rt_throttled && limit && rq->rt_time >= limit) {
+		static bool warned = false;
+		if(!warned) {
+			log(LOG_WARN, "scheduler: Real-time tasks exceeded their runtime limit, throttling\n");
+			warned = true;
 		}
+		rq->rt_throttled = true;
+	}
+}
 
-		if(qe == orig && !initial) {
-			return NULL;
+/* Select among real-time entries. Higher priorities always preempt lower ones.
+ * At equal priority, SCHED_FIFO tasks keep running until they block or yield,
+ * while SCHED_RR tasks rotate once their time slice has expired. Returns NULL
+ * if no real-time entry is runnable.
+ */
+static inline struct scheduler_qentry* pick_rt(struct scheduler_rq* rq,
+	struct scheduler_qentry* best, bool keep_current, uint64_t now) {
+
+	struct scheduler_qentry* current = rq->current;
+	if(!keep_current) {
+		return best;
+	}
+
+	if(best && best->task->rt_priority > current->task->rt_priority) {
+		return best;
+	}
+
+	if(current->task->sched_policy == SCHED_RR &&
+		now - current->slice_start >= ms_to_cycles(SCHED_RR_TIMESLICE_MS)) {
+
+		if(best && best->task->rt_priority == current->task->rt_priority) {
+			return best;
 		}
+		current->slice_start = now;
+	}
+	return current;
+}
+
+#ifdef CONFIG_TICKLESS
+/* Longest time in ms without a tick while entries wait in yield loops, in
+ * case the selected one stops yielding and the others need to run.
+ */
+#define SCHED_TICKLESS_WAIT_MS 10
 
-		if(initial) {
-			initial = false;
+/* Decide whether the periodic timer tick is needed. If no entry besides the
+ * selected one is runnable, there is nothing to preempt to, so only program
+ * a one-shot interrupt for the next sleeping task wakeup.
+ *
+ * If the selected entry is waiting in a yield loop itself, other waiting
+ * entries don't need the tick either, since they take turns by yielding.
+ * They do need it while anything else is running.
+ */
+static inline void tickless_update(struct scheduler_rq* rq) {
+	struct scheduler_qentry* selected = rq->current;
+	struct scheduler_qentry* qe = rq->head;
+	bool selected_waiting = selected != &rq->idle && selected->yielded;
+	uint32_t wakeup = -1;
+
+	// Unlinked entries still need to be cleaned up
+	if(rq->dead) {
+		timer_set_periodic();
+		return;
+	}
+
+	for(uint32_t i = 0; i < rq->nentries; i++) {
+		if(qe == selected) {
+			goto next;
 		}
 
 		if(qe->worker) {
-			if(qe->worker->stopped == true) {
-				unlink(qe);
-				continue;
+			worker_t* worker = qe->worker;
+			if(worker->stopped || (worker->sleeping && !worker->sleep_until)) {
+				goto next;
 			}
 
-			break;
-		} else if(qe->task) {
-			task_t* task = qe->task;
-			if(task->task_state == TASK_STATE_TERMINATED) {
-				task_userland_eol(task);
-				continue;
+			if(worker->sleeping) {
+				wakeup = MIN(wakeup, worker->sleep_until);
+				goto next;
 			}
 
-			if(task->task_state == TASK_STATE_REAPED ||
-				task->task_state == TASK_STATE_REPLACED) {
-				unlink(qe);
-				continue;
+			if(selected_waiting && qe->yielded) {
+				goto waiting;
 			}
 
-			if(task->task_state == TASK_STATE_STOPPED ||
-				task->task_state == TASK_STATE_WAITING ||
-				task->task_state == TASK_STATE_ZOMBIE) {
-				continue;
-			}
+			timer_set_periodic();
+			return;
+		}
 
-			if(task->task_state == TASK_STATE_SLEEPING) {
-			}
+		switch(qe->task->task_state) {
+			case TASK_STATE_SLEEPING:
+				wakeup = MIN(wakeup, qe->task->sleep_until);
+				break;
+			case TASK_STATE_STOPPED:
+			case TASK_STATE_WAITING:
+			case TASK_STATE_BLOCKED:
+			case TASK_STATE_ZOMBIE:
+				break;
+			case TASK_STATE_TERMINATED:
+			case TASK_STATE_REAPED:
+			case TASK_STATE_REPLACED:
+				// Waiting for the scheduler to clean up
+				timer_set_periodic();
+				return;
+			default:
+				if(selected_waiting && qe->yielded) {
+					goto waiting;
+				}
+
+				timer_set_periodic();
+				return;
+		}
+		goto next;
+
+	waiting:
+		wakeup = MIN(wakeup, timer_get_tick() + MAX(1,
+			SCHED_TICKLESS_WAIT_MS * timer_get_rate() / 1000));
+	next:
+		qe = qe->next;
+	}
 
-			if(task->task_state == TASK_STATE_SLEEPING &&
-				timer_get_tick() < task->sleep_until) {
+	timer_set_oneshot(wakeup);
+}
+#endif
+
+#ifdef CONFIG_SMP
+/* Take over a runnable entry from another CPU's run queue. Used when there
+ * is nothing left to do on this CPU. Entries that are currently running or
+ * whose stack is still in use on the other CPU can't be moved. Needs the
+ * queue of this CPU to be locked.
+ */
+static struct scheduler_qentry* steal(struct scheduler_rq* rq) {
+	for(uint32_t i = 1; i < smp_num_cpus; i++) {
+		struct scheduler_rq* victim = &runqueues[(rq->cpu + i) % smp_num_cpus];
+
+		// Only try once to avoid lock ordering problems
+		if(!victim->nentries || !spinlock_raw_try(&victim->lock)) {
+			continue;
+		}
+
+		struct scheduler_qentry* qe = victim->head;
+		for(uint32_t j = 0; j < victim->nentries; j++, qe = qe->next) {
+			if(qe == victim->current || qe->on_cpu || get_entry_state(qe) != ENTRY_RUNNABLE) {
 				continue;
 			}
-		}
 
-		break;
-	}
+			rq_remove(victim, qe);
+			spinlock_release(&victim->lock);
 
-	return qe;
+			// Keep the relative position in the vruntime order
+			qe->vruntime = qe->vruntime - MIN(qe->vruntime, victim->min_vruntime) + rq->min_vruntime;
+			rq_add(rq, qe);
+			return qe;
+		}
+		spinlock_release(&victim->lock);
+	}
+	return NULL;
 }
+#endif
 
 void scheduler_store_isf(isf_t* last_regs) {
-	if(unlikely(scheduler_state != SCHEDULER_INITIALIZED || !current_entry)) {
+	struct scheduler_rq* rq = this_rq();
+	if(unlikely(scheduler_state != SCHEDULER_INITIALIZED || !rq->current)) {
 		return;
 	}
 
+	/* Since an interrupt has happened, this CPU is no longer using the stack
+	 * of the entry it last switched away from.
+	 */
+	if(rq->prev) {
+		rq->prev->on_cpu = false;
+		rq->prev = NULL;
+	}
+
 	// Save CPU register state of previous task
-	if(current_entry->task) {
-		memcpy(current_entry->task->state, last_regs, sizeof(isf_t));
-	} else if(current_entry->worker) {
-		memcpy(current_entry->worker->state, last_regs, sizeof(isf_t));
+	struct scheduler_qentry* current = rq->current;
+	if(current->task) {
+		memcpy(current->task->state, last_regs, sizeof(isf_t));
+	} else if(current->worker) {
+		memcpy(current->worker->state, last_regs, sizeof(isf_t));
 	}
 }
 
-isf_t* scheduler_select(isf_t* last_regs) {
+isf_t* scheduler_select(isf_t* last_regs, bool yield) {
 	int_disable();
+	struct scheduler_rq* rq = this_rq();
 
 	if(unlikely(scheduler_state != SCHEDULER_INITIALIZED)) {
-		if(scheduler_state == SCHEDULER_INITIALIZING) {
-			scheduler_state = SCHEDULER_INITIALIZED;
-			goto ret;
+		// The boot processor starts the scheduler, the others join in once it's running
+		if(scheduler_state == SCHEDULER_OFF || rq->cpu != 0) {
+			return NULL;
+		}
+		scheduler_state = SCHEDULER_INITIALIZED;
+	}
+
+	spinlock_raw_get(&rq->lock);
+	uint64_t now = profile_read_rdtsc();
+	update_runtime(rq, now);
+	update_rt_throttle(rq, now);
+
+	struct scheduler_qentry* current = rq->current;
+	if(current != &rq->idle) {
+		current->yielded = yield;
+		current->yield_tick = timer_get_tick();
+	}
+
+	struct eol_list eol = { .num = 0 };
+	bool current_runnable;
+	struct scheduler_qentry* waiter;
+	struct scheduler_qentry* best_rt;
+	struct scheduler_qentry* best = find_runnable_qentry(rq, &current_runnable,
+		&waiter, &best_rt, &eol);
+
+	/* Real-time entries run before all others. Since blocking in the kernel
+	 * is implemented by yielding in a loop, a yielding real-time task has to
+	 * give way to normal tasks as well, or it would starve them while
+	 * waiting. Deferred real-time entries are not considered here, so several
+	 * waiting ones don't just hand the CPU to each other.
+	 */
+	struct scheduler_qentry* qe = NULL;
+	if(!rq->rt_throttled) {
+		bool keep_current = current_runnable && !yield && is_rt(current);
+		qe = pick_rt(rq, best_rt, keep_current, now);
+	}
+
+	/* Otherwise, keep running the current entry unless it yielded or has
+	 * gotten far enough ahead of the best candidate. A yielding entry only
+	 * gets the CPU back right away if there is nothing else to run, and
+	 * otherwise goes behind the deferred entries.
+	 */
+	if(!qe) {
+		qe = best;
+		if(current_runnable && !yield && (!best || current->vruntime <
+			best->vruntime + ticks_to_cycles(SCHED_GRANULARITY_TICKS))) {
+
+			qe = current;
 		}
+	}
 
-		// SCHEDULER_OFF
-		return NULL;
+	if(!qe) {
+		qe = waiter ? waiter : (current_runnable ? current : NULL);
 	}
 
-	struct scheduler_qentry* qe = find_runnable_qentry(current_entry);
 	if(qe) {
-		current_entry = qe;
-	} else {
-		idle_qentry.next = current_entry->next;
-		idle_qentry.prev = current_entry;
-		current_entry = &idle_qentry;
+		uint64_t lowest = best ? best->vruntime : qe->vruntime;
+		if(waiter) {
+			lowest = MIN(lowest, waiter->vruntime);
+		}
+		if(current_runnable) {
+			lowest = MIN(lowest, current->vruntime);
+		}
+		rq->min_vruntime = MAX(rq->min_vruntime, lowest);
 	}
 
-ret:
-	if(current_entry->task) {
-		current_entry->task->task_state = TASK_STATE_RUNNING;
+	#ifdef CONFIG_SMP
+	if(!qe) {
+		qe = steal(rq);
+	}
+	#endif
 
-		// FIXME per-task storage of SSE state needed?
-		//memcpy(sse_state, new_task->state->sse_state, 512);
-		gdt_set_tss(current_entry->task->kernel_stack + KERNEL_STACK_SIZE);
-		return current_entry->task->state;
-	} else if(current_entry->worker) {
-		// FIXME TSS for workers?
-		return current_entry->worker->state;
+	if(!qe) {
+		qe = &rq->idle;
 	}
-	return NULL;
+
+	if(qe != current) {
+		// Our stack could be the one of the current entry, so it has to stay put for now
+		current->on_cpu = true;
+		rq->prev = current;
+		qe->slice_start = now;
+
+		if(current->task) {
+			task_acct_charge(current->task, false, now);
+			if(yield || !current_runnable) {
+				current->task->acct.nvcsw++;
+			} else {
+				current->task->acct.nivcsw++;
+			}
+		}
+
+		if(qe->task) {
+			qe->task->acct.last = now;
+		}
+	}
+
+	qe->on_cpu = true;
+	qe->exec_start = now;
+	rq->current = qe;
+
+	#ifdef CONFIG_TICKLESS
+	tickless_update(rq);
+	#endif
+
+	spinlock_release(&rq->lock);
+
+	if(qe != current) {
+		fpu_switch(current->task, qe->task);
+	}
+
+	/* Clean up after tasks that have terminated or been unlinked. If another
+	 * CPU is in the kernel right now, try again next time.
+	 */
+	if((eol.num || rq->dead) && smp_kernel_trylock()) {
+		for(uint32_t i = 0; i < eol.num; i++) {
+			if(eol.tasks[i]->task_state == TASK_STATE_TERMINATED) {
+				task_userland_eol(eol.tasks[i]);
+			}
+		}
+		reap(rq);
+	}
+
+	if(qe->task) {
+		qe->task->task_state = TASK_STATE_RUNNING;
+
+		gdt_set_tss(qe->task->kernel_stack + KERNEL_STACK_SIZE);
+		if(qe != current) {
+			gdt_set_tls(qe->task->tls);
+		}
+		return qe->task->state;
+	}
+
+	// FIXME TSS for workers?
+	return qe->worker->state;
+}
+
+void scheduler_get_cpu_stats(uint32_t cpu, uint32_t* nentries, int* pid) {
+	struct scheduler_rq* rq = &runqueues[cpu];
+	struct scheduler_qentry* current = rq->current;
+	*nentries = rq->nentries;
+	*pid = (current && current->task) ? current->task->pid : 0;
 }
 
 static size_t sfs_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
@@ -230,53 +798,71 @@ static size_t sfs_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
 		return 0;
 	}
 
-	struct scheduler_qentry* entry = current_entry;
 	size_t rsize = 0;
-	sysfs_printf("# pid uid gid ppid state name memory tty\n")
-
-	do {
-		task_t* task = entry->task;
-		if(!task) {
-			sysfs_printf("-1 0 0 0 R \"%s\" 0 /dev/null\n", entry->worker->name);
-			goto next;
-		}
+	sysfs_printf("# pid uid gid ppid state name memory tty nice runtime utime stime "
+		"nvcsw nivcsw faults rchar wchar\n")
+
+	for(uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+		struct scheduler_rq* rq = &runqueues[cpu];
+		bool ints = int_save();
+		spinlock_raw_get(&rq->lock);
+
+		struct scheduler_qentry* entry = rq->head;
+		for(uint32_t i = 0; i < rq->nentries; i++, entry = entry->next) {
+			task_t* task = entry->task;
+			if(!task) {
+				sysfs_printf("-1 0 0 0 %c \"%s\" 0 /dev/null 0 %u 0 %u 0 0 0 0 0\n",
+					worker_is_sleeping(entry->worker) ? 'W' : 'R',
+					entry->worker->name, scheduler_runtime_ms(entry),
+					scheduler_runtime_ms(entry));
+				continue;
+			}
 
-		if(task->task_state == TASK_STATE_REPLACED) {
-			goto next;
-		}
+			if(task->task_state == TASK_STATE_REPLACED) {
+				continue;
+			}
 
-		uint32_t ppid = task->parent ? task->parent->pid : 0;
-
-		char state = '?';
-		switch(task->task_state) {
-			case TASK_STATE_TERMINATED: state = 'T'; break;
-			case TASK_STATE_STOPPED: state = 'S'; break;
-			case TASK_STATE_RUNNING: state = 'R'; break;
-			case TASK_STATE_WAITING: state = 'W'; break;
-			case TASK_STATE_SYSCALL: state = 'C'; break;
-			case TASK_STATE_SLEEPING: state = 'W'; break;
-			default: state = 'U'; break;
-		}
+			uint32_t ppid = task->parent ? task->parent->pid : 0;
+
+			char state = '?';
+			switch(task->task_state) {
+				case TASK_STATE_TERMINATED: state = 'T'; break;
+				case TASK_STATE_STOPPED: state = 'S'; break;
+				case TASK_STATE_RUNNING: state = 'R'; break;
+				case TASK_STATE_WAITING: state = 'W'; break;
+				case TASK_STATE_SYSCALL: state = 'C'; break;
+				case TASK_STATE_SLEEPING: state = 'W'; break;
+				case TASK_STATE_BLOCKED: state = 'W'; break;
+				default: state = 'U'; break;
+			}
 
-		vm_alloc_t* range = task->vmem.ranges;
-		uint32_t mem_alloc = 0;
-		for(; range; range = range->next) {
-			if(range->flags & VM_TFORK) {
-				mem_alloc += range->size;
+			/* Userland memory is always backed by physical pages, so this is
+			 * the resident set size. Includes ranges shared with other tasks.
+			 */
+			vm_alloc_t* range = task->vmem->ranges;
+			uint32_t mem_alloc = 0;
+			for(; range; range = range->next) {
+				if(range->flags & VM_USER) {
+					mem_alloc += range->size;
+				}
 			}
-		}
 
-		sysfs_printf("%d %d %d %d %c \"%s", task->pid, task->euid, task->gid,
-			ppid, state, task->name);
+			sysfs_printf("%d %d %d %d %c \"%s", task->pid, task->euid, task->gid,
+				ppid, state, task->name);
 
-		for(int i = 1; i < task->argc; i++) {
-			sysfs_printf(" %s", task->argv[i]);
+			for(int arg = 1; arg < task->argc; arg++) {
+				sysfs_printf(" %s", task->argv[arg]);
+			}
+			sysfs_printf("\" %d %s %d %u", mem_alloc, task->ctty ? task->ctty->path : "-",
+				task->nice, scheduler_runtime_ms(entry));
+			sysfs_printf(" %u %u %u %u %u %llu %llu\n", task_acct_ms(task->acct.utime),
+				task_acct_ms(task->acct.stime), task->acct.nvcsw, task->acct.nivcsw,
+				task->acct.faults, task->acct.rchar, task->acct.wchar);
 		}
-		sysfs_printf("\" %d %s\n", mem_alloc, task->ctty ? task->ctty->path : "-");
 
-	next:
-		entry = entry->next;
-	} while(entry != current_entry);
+		spinlock_release(&rq->lock);
+		int_restore(ints);
+	}
 
 	return rsize;
 }
@@ -289,9 +875,18 @@ static void __attribute__((fastcall, noreturn)) do_idle(worker_t* worker) {
 }
 
 void scheduler_init(void) {
-	worker_t* idle_worker = worker_new("kidle", &do_idle);
-	idle_qentry.task = NULL;
-	idle_qentry.worker = idle_worker;
+	for(uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+		struct scheduler_rq* rq = &runqueues[cpu];
+		rq->cpu = cpu;
+		rq->idle.task = NULL;
+		rq->idle.worker = worker_new("kidle", &do_idle);
+		rq->idle.rq = rq;
+
+		/* Whatever runs on the CPU right now becomes its idle loop. For the
+		 * boot processor, that gets discarded on the first task switch.
+		 */
+		rq->current = &rq->idle;
+	}
 
 	scheduler_state = SCHEDULER_INITIALIZING;
 	struct vfs_callbacks sfs_cb = {
@@ -28,20 +28,76 @@ enum scheduler_state {
 	SCHEDULER_INITIALIZED
 };
 
+// Range of nice values, as in POSIX setpriority
+#define SCHED_NICE_MIN -20
+#define SCHED_NICE_MAX 19
+
+// Scheduling policies, keep in sync with newlib sys/sched.h
+#define SCHED_OTHER 0
+#define SCHED_FIFO 1
+#define SCHED_RR 2
+
+#define SCHED_RT_PRIO_MIN 1
+#define SCHED_RT_PRIO_MAX 99
+
+struct sched_param {
+	int sched_priority;
+};
+
+struct scheduler_rq;
+
 struct scheduler_qentry {
     struct scheduler_qentry* next;
     struct scheduler_qentry* prev;
     task_t* task;
     worker_t* worker;
+
+    // Run queue of the CPU this entry is scheduled on
+    struct scheduler_rq* rq;
+
+    /* Set while the entry is running, and after a switch until the CPU is
+     * done using its kernel stack. Such entries can't be moved to another
+     * CPU or cleaned up.
+     */
+    volatile bool on_cpu;
+
+    // Next entry waiting for cleanup after being unlinked
+    struct scheduler_qentry* dead_next;
+
+    /* Virtual runtime in TSC cycles, weighted by the nice value. The entry
+     * with the lowest vruntime is the one that is furthest behind its fair
+     * share and gets to run next.
+     */
+    uint64_t vruntime;
+
+    // Actual CPU time consumed, in TSC cycles
+    uint64_t runtime;
+
+    // TSC value at the time this entry was last selected
+    uint64_t exec_start;
+
+    // TSC value at the start of the current SCHED_RR time slice
+    uint64_t slice_start;
+
+    /* Set when the entry last gave up the CPU by yielding rather than being
+     * preempted, which usually means it is waiting for something in a
+     * scheduler_yield loop. yield_tick is the timer tick of the last yield.
+     */
+    bool yielded;
+    uint32_t yield_tick;
 };
 
 extern enum scheduler_state scheduler_state;
 
 void scheduler_add(task_t *task);
 void scheduler_add_worker(worker_t* worker);
-task_t* scheduler_find(uint32_t pid);
 void scheduler_store_isf(isf_t* last_regs);
 task_t* scheduler_get_current(void);
+bool scheduler_is_idle(void);
+void scheduler_get_cpu_stats(uint32_t cpu, uint32_t* nentries, int* pid);
 void scheduler_yield(void);
-isf_t* scheduler_select(isf_t* lastRegs);
+void scheduler_kick(void);
+void scheduler_wake(task_t* task);
+isf_t* scheduler_select(isf_t* lastRegs, bool yield);
+uint32_t scheduler_runtime_ms(struct scheduler_qentry* entry);
 void scheduler_init(void);
@@ -19,6 +19,8 @@
 
 #include <tasks/signal.h>
 #include <tasks/task.h>
+#include <tasks/pid.h>
+#include <tasks/scheduler.h>
 #include <errno.h>
 #include <bitmap.h>
 
@@ -38,8 +40,13 @@ int task_signal(task_t* task, task_t* source, int sig) {
 	}
 
 	if(sig == SIGKILL || sig == SIGSTOP) {
+		if(sig == SIGKILL) {
+			task_kill_threads(task);
+		}
+
 		task->task_state = (sig == SIGKILL) ? TASK_STATE_TERMINATED : TASK_STATE_STOPPED;
 		task->interrupt_yield = true;
+		scheduler_kick();
 		return 0;
 	}
 
@@ -48,7 +55,7 @@ int task_signal(task_t* task, task_t* source, int sig) {
 		return 0;
 	}
 
-	struct sigaction sa = task->signal_handlers[sig];
+	struct sigaction sa = task->signals->handlers[sig];
 	if((uint32_t)sa.sa_handler == SIG_IGN) {
 		return 0;
 	}
@@ -60,7 +67,7 @@ int task_signal(task_t* task, task_t* source, int sig) {
 		iret->user_esp -= 11 * sizeof(uint32_t);
 
 		vm_alloc_t alloc;
-		uint32_t* user_stack = vm_map(VM_KERNEL, &alloc, &task->vmem, iret->user_esp,
+		uint32_t* user_stack = vm_map(VM_KERNEL, &alloc, task->vmem, iret->user_esp,
 			sizeof(uint32_t) * 11, VM_MAP_USER_ONLY | VM_RW);
 
 		if(!user_stack) {
@@ -86,14 +93,14 @@ int task_signal(task_t* task, task_t* source, int sig) {
 		*(user_stack + 10) = (uint32_t)iret->eip;
 		iret->eip = task_sigjmp_crt0;
 
-		task->task_state = TASK_STATE_RUNNING;
+		scheduler_wake(task);
 		vm_free(&alloc);
 		return 0;
 	}
 
 	// Default handlers
 	if(sig == SIGCONT && task->task_state == TASK_STATE_STOPPED) {
-		task->task_state = TASK_STATE_RUNNING;
+		scheduler_wake(task);
 		return 0;
 	}
 
@@ -101,15 +108,17 @@ int task_signal(task_t* task, task_t* source, int sig) {
 		return 0;
 	}
 
-	task->task_state = TASK_STATE_TERMINATED;
 	task->exit_code = 0x100 | sig;
+	task_kill_threads(task);
+	task->task_state = TASK_STATE_TERMINATED;
 	task->interrupt_yield = true;
+	scheduler_kick();
 	return 0;
 }
 
 // Syscall API
 int task_signal_syscall(task_t* source, int target_pid, int sig) {
-	task_t* target_task = scheduler_find(target_pid);
+	task_t* target_task = task_find(target_pid);
 	if(!target_task) {
 		sc_errno = ESRCH;
 		return -1;
@@ -156,7 +165,7 @@ int task_sigaction(task_t* task, int sig, const struct sigaction* act,
 		return -1;
 	}
 
-	struct sigaction* tbl_entry = &task->signal_handlers[sig];
+	struct sigaction* tbl_entry = &task->signals->handlers[sig];
 	if(oact) {
 		memcpy(oact, tbl_entry, sizeof(struct sigaction));
 	}
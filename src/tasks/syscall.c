@@ -29,6 +29,7 @@
 #include <variadic.h>
 #include <mem/kmalloc.h>
 #include <tty/serial.h>
+#include <bsp/i386-smp.h>
 
 #include "syscalls.h"
 
@@ -76,6 +77,17 @@ static void int_handler(task_t* task, isf_t* state, int num) {
 		call_fail();
 	}
 
+	/* Syscalls run without the kernel lock only if they have been audited for
+	 * it. Debug output, strace and signals on bad arguments still take it.
+	 */
+	bool lockless = def.flags & SCF_LOCKLESS;
+	#ifdef CONFIG_SYSCALL_DEBUG
+	lockless = false;
+	#endif
+	if(!lockless) {
+		smp_kernel_lock();
+	}
+
 	int num_args = 0;
 	vm_alloc_t vmem[3] = {0};
 	size_t ptr_sizes[3] = {0};
@@ -134,7 +146,7 @@ static void int_handler(task_t* task, isf_t* state, int num) {
 			call_fail();
 		}
 
-		args[i] = (uint32_t)vm_map(VM_KERNEL, &vmem[i], &task->vmem,
+		args[i] = (uint32_t)vm_map(VM_KERNEL, &vmem[i], task->vmem,
 			(void*)args[i], ptr_sizes[i], map_flags);
 
 		if(unlikely(!args[i])) {
@@ -147,6 +159,7 @@ static void int_handler(task_t* task, isf_t* state, int num) {
 
 			log(LOG_WARN, "tasks: %d %s: Invalid memory pointer in argument %d to syscall %d %s\n",
 				task->pid, task->name, i, scnum, def.name);
+			smp_kernel_lock();
 			task_signal(task, NULL, SIGSEGV);
 			call_fail();
 		}
@@ -157,6 +170,7 @@ static void int_handler(task_t* task, isf_t* state, int num) {
 			if(slen == ptr_sizes[i]) {
 				log(LOG_WARN, "tasks: %d %s: Unterminated string in argument %d to syscall %d %s\n",
 					task->pid, task->name, i, scnum, def.name);
+				smp_kernel_lock();
 				task_signal(task, NULL, SIGSEGV);
 				call_fail();
 			}
@@ -208,10 +222,18 @@ static void int_handler(task_t* task, isf_t* state, int num) {
 #endif
 
 	if(unlikely(task->strace_observer && task->strace_fd)) {
+		smp_kernel_lock();
 		send_strace(task, state, scnum, args, oargs, flags);
 	}
 }
 
+// Called by the sysenter fast path in i386-sysenter.asm
+isf_t* __fastcall syscall_sysenter_dispatch(isf_t* state) {
+	int_enter(SYSCALL_INTERRUPT, state);
+	task_t* task = scheduler_get_current();
+	int_handler(task, state, SYSCALL_INTERRUPT);
+	return int_leave(SYSCALL_INTERRUPT, task, state);
+}
 
 static inline char* arg_type_name(int flags) {
 	if(flags & SCA_INT) {
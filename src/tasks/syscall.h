@@ -24,6 +24,7 @@
 #define SYSCALL_INTERRUPT 0x80
 
 #define SCF_STATE 1
+#define SCF_LOCKLESS 2
 
 #define SCA_INT 1
 #define SCA_POINTER 2
@@ -64,5 +65,6 @@ struct syscall_definition {
 	size_t ptr_size;
 };
 
+isf_t* __fastcall syscall_sysenter_dispatch(isf_t* state);
 char** syscall_copy_array(task_t* task, char** array, uint32_t* count);
 void syscall_init(void);
@@ -23,6 +23,8 @@
 #include <tasks/signal.h>
 #include <tasks/task.h>
 #include <tasks/wait.h>
+#include <tasks/futex.h>
+#include <tasks/acct.h>
 #include <net/socket.h>
 #include <fs/vfs.h>
 #include <fs/pipe.h>
@@ -42,8 +44,11 @@
  *  typedef uint32_t (*syscall_cb)(task_t* task, [isf_t* state],
  * 		syscall arguments..)
  *
- * The only currently defined flag is SCF_STATE, in which case the isf state is
- * passed after the task.
+ * Flags:
+ *
+ * SCF_STATE The isf state is passed after the task.
+ * SCF_LOCKLESS The callback only uses data of the calling task or subsystems
+ * with their own locks, and runs without the SMP kernel lock.
  *
  * In addition, each argument has an individual flags field. If the flags field
  * for an argument is 0, the argument is ignored (and the callback will be
@@ -89,7 +94,7 @@ const struct syscall_definition syscall_table[] = {
 		SCA_STRING, SCA_INT, 0, 0},
 
 	// 7
-	{"sbrk", (syscall_cb)task_sbrk, 0,
+	{"sbrk", (syscall_cb)task_sbrk, SCF_LOCKLESS,
 		SCA_INT, 0, 0, 0},
 
 	// 8
@@ -137,7 +142,7 @@ const struct syscall_definition syscall_table[] = {
 		SCA_INT, SCA_INT, 0, 0},
 
 	// 19
-	{"time", (syscall_cb)time_get_timeval, 0,
+	{"time", (syscall_cb)time_get_timeval, SCF_LOCKLESS,
 		SCA_POINTER, 0, 0, sizeof(struct timeval)},
 
 	// 20
@@ -324,6 +329,74 @@ const struct syscall_definition syscall_table[] = {
 		SCA_STRING, SCA_POINTER, 0, VFS_PATH_MAX},
 
 	// 53
-	{"sleep", (syscall_cb)task_sleep, 0,
+	{"sleep", (syscall_cb)task_sleep, SCF_LOCKLESS,
 		SCA_POINTER, 0, 0, sizeof(struct timeval)},
+
+	// 54
+	{"getpriority", (syscall_cb)task_getpriority, 0,
+		SCA_INT, SCA_INT, 0, 0},
+
+	// 55
+	{"setpriority", (syscall_cb)task_setpriority, 0,
+		SCA_INT, SCA_INT, SCA_INT, 0},
+
+	// 56
+	{"sched_setscheduler", (syscall_cb)task_setscheduler, 0,
+		SCA_INT, SCA_INT, SCA_POINTER, sizeof(struct sched_param)},
+
+	// 57
+	{"sched_getscheduler", (syscall_cb)task_getscheduler, 0,
+		SCA_INT, 0, 0, 0},
+
+	// 58
+	{"sched_getparam", (syscall_cb)task_getparam, 0,
+		SCA_INT, SCA_POINTER, 0, sizeof(struct sched_param)},
+
+	// 59
+	{"vfork", (syscall_cb)task_vfork, SCF_STATE,
+		0, 0, 0, 0},
+
+	// 60
+	{"posix_spawn", (syscall_cb)task_spawn, 0,
+		SCA_STRING, SCA_POINTER, 0, sizeof(struct task_spawn_ctx)},
+
+	// 61
+	{"clone", (syscall_cb)task_clone, SCF_STATE,
+		SCA_INT, SCA_INT, SCA_INT, 0},
+
+	// 62
+	{"futex", (syscall_cb)task_futex, SCF_LOCKLESS,
+		SCA_INT, SCA_INT, SCA_INT, 0},
+
+	// 63
+	{"set_tls", (syscall_cb)task_set_tls, SCF_LOCKLESS,
+		SCA_INT, 0, 0, 0},
+
+	// 64
+	{"thread_exit", (syscall_cb)task_thread_exit, 0,
+		SCA_INT, 0, 0, 0},
+
+	// 65
+	{"getrusage", (syscall_cb)task_getrusage, SCF_LOCKLESS,
+		SCA_INT, SCA_POINTER, 0, sizeof(struct task_rusage)},
+
+	// 66
+	{"times", (syscall_cb)task_times, SCF_LOCKLESS,
+		SCA_POINTER, 0, 0, sizeof(struct task_tms)},
+
+	// 67
+	{"clock_gettime", (syscall_cb)time_clock_gettime, SCF_LOCKLESS,
+		SCA_INT, SCA_POINTER, 0, sizeof(struct timespec)},
+
+	// 68
+	{"sync", (syscall_cb)vfs_sync, 0,
+		0, 0, 0, 0},
+
+	// 69
+	{"reboot", (syscall_cb)task_reboot, 0,
+		SCA_INT, 0, 0, 0},
+
+	// 70
+	{"getid", (syscall_cb)task_getid, 0,
+		SCA_INT, 0, 0, 0},
 };
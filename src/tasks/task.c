@@ -21,6 +21,11 @@
 #include <tasks/execdata.h>
 #include <tasks/syscall.h>
 #include <tasks/wait.h>
+#include <tasks/i386-fpu.h>
+#include <tasks/elf.h>
+#include <tasks/futex.h>
+#include <tasks/pid.h>
+#include <tasks/acct.h>
 #include <mem/kmalloc.h>
 #include <mem/mem.h>
 #include <mem/vm.h>
@@ -29,32 +34,88 @@
 #include <fs/vfs.h>
 #include <fs/sysfs.h>
 #include <fs/pipe.h>
+#include <fs/mount.h>
+#include <portio.h>
 #include <string.h>
 #include <errno.h>
 #include <panic.h>
 
-static vm_alloc_t loader_alloc;
+#define LOADER_PATH "/usr/libexec/system/xelix-loader"
+#define LOADER_MAX_SEGMENTS 8
+
+/* Segments of xelix-loader, read once in task_init. Read-only segments are
+ * mapped into all tasks using the same physical pages, writable ones get
+ * copied for each task.
+ */
+static struct {
+	vm_alloc_t alloc;
+	void* addr;
+	bool writable;
+} loader_segments[LOADER_MAX_SEGMENTS];
+static int loader_num_segments = 0;
+static void* loader_entry;
 static uint32_t highest_pid = 0;
 static size_t sfs_read(struct vfs_callback_ctx* ctx, void* dest, size_t size);
 
+// Flags for alloc_task and _fork
+#define FORK_VFORK 1
+#define FORK_THREAD 2
+
+/* Allocates a new task. With FORK_VFORK, the task shares the address space of
+ * `share` instead of getting a new one. FORK_THREAD additionally shares open
+ * files and signal handlers.
+ */
 static task_t* alloc_task(task_t* parent, uint32_t pid, char name[VFS_NAME_MAX],
-	char** environ, uint32_t envc, char** argv, uint32_t argc) {
+	char** environ, uint32_t envc, char** argv, uint32_t argc, task_t* share, int flags) {
 
 	task_t* task = zmalloc(sizeof(task_t));
-	vm_new(&task->vmem, NULL);
+	if(!task) {
+		return NULL;
+	}
 
-	/* Map parts of the kernel marked as UL_VISIBLE into the task address
-	 * space (But readable only to PL0). These are the functions and data
-	 * structures used in the interrupt handler before the paging context is
-	 * switched.
-	 */
-	if(!vm_alloc_at(&task->vmem, NULL, RDIV(UL_VISIBLE_SIZE, PAGE_SIZE),
-		UL_VISIBLE_START, UL_VISIBLE_START, VM_FIXED)) {
+	if(flags & FORK_THREAD) {
+		__sync_add_and_fetch(&share->files->refs, 1);
+		__sync_add_and_fetch(&share->signals->refs, 1);
+		task->files = share->files;
+		task->signals = share->signals;
+	} else {
+		task->files = zmalloc(sizeof(struct task_files));
+		task->signals = zmalloc(sizeof(struct task_signals));
+		if(!task->files || !task->signals) {
+			goto fail;
+		}
 
-		return NULL;
+		task->files->refs = 1;
+		task->signals->refs = 1;
+	}
+
+	if(flags & (FORK_VFORK | FORK_THREAD)) {
+		__sync_add_and_fetch(&share->vmem->refs, 1);
+		task->vmem = share->vmem;
+	} else {
+		task->vmem = kmalloc(sizeof(struct vm_ctx));
+		if(!task->vmem) {
+			goto fail;
+		}
+
+		vm_new(task->vmem, NULL);
+
+		/* Map parts of the kernel marked as UL_VISIBLE into the task address
+		 * space (But readable only to PL0). These are the functions and data
+		 * structures used in the interrupt handler before the paging context
+		 * is switched.
+		 */
+		if(!vm_alloc_at(task->vmem, NULL, RDIV(UL_VISIBLE_SIZE, PAGE_SIZE),
+			UL_VISIBLE_START, UL_VISIBLE_START, VM_FIXED)) {
+
+			goto fail;
+		}
 	}
 
 	task->pid = pid ? pid : __sync_add_and_fetch(&highest_pid, 1);
+	task->tgid = (flags & FORK_THREAD) ? share->tgid : task->pid;
+	task->group_next = task;
+	task->group_prev = task;
 	task->task_state = TASK_STATE_RUNNING;
 	task->interrupt_yield = false;
 
@@ -68,11 +129,11 @@ static task_t* alloc_task(task_t* parent, uint32_t pid, char name[VFS_NAME_MAX],
 	task->parent = parent;
 	task->envc = envc;
 	task->argc = argc;
-	task->environ = kmalloc(sizeof(char*) * task->envc);
-	task->argv = kmalloc(sizeof(char*) * task->argc);
+	task->environ = zmalloc(sizeof(char*) * task->envc);
+	task->argv = zmalloc(sizeof(char*) * task->argc);
 
 	if(!task->environ || !task->argv) {
-		return NULL;
+		goto fail;
 	}
 
 	for(int i = 0; i < task->envc; i++) {
@@ -90,8 +151,17 @@ static task_t* alloc_task(task_t* parent, uint32_t pid, char name[VFS_NAME_MAX],
 	};
 
 	task->sysfs_file = sysfs_add_file(tname, &sfs_cb);
+	if(!task->sysfs_file) {
+		goto fail;
+	}
+
 	task->sysfs_file->meta = (void*)task;
 	return task;
+
+fail:
+	task_free(task);
+	sc_errno = ENOMEM;
+	return NULL;
 }
 
 static inline int map_task(task_t* task) {
@@ -100,10 +170,9 @@ static inline int map_task(task_t* task) {
 	vm_alloc_t* mvmem[] = {&vmem1, &vmem2};
 
 	int flags[] = {VM_RW, VM_FREE};
-	struct vm_ctx* ctx[] = {VM_KERNEL, &task->vmem};
+	struct vm_ctx* ctx[] = {VM_KERNEL, task->vmem};
 
 	if(!vm_alloc_many(2, ctx, mvmem, 1, NULL, flags)) {
-		kfree(task);
 		return -1;
 	}
 
@@ -114,7 +183,7 @@ static inline int map_task(task_t* task) {
 	if(!vm_alloc_many(2, ctx, mvmem, KERNEL_STACK_PAGES, NULL, flags)) {
 		vm_free(&vmem1);
 		vm_free(&vmem2);
-		kfree(task);
+		task->state = NULL;
 		return -1;
 	}
 
@@ -122,6 +191,27 @@ static inline int map_task(task_t* task) {
 	return 0;
 }
 
+// Map the ELF binary loader into task memory space
+static int map_loader(task_t* task) {
+	for(int i = 0; i < loader_num_segments; i++) {
+		vm_alloc_t* alloc = &loader_segments[i].alloc;
+		void* addr = loader_segments[i].addr;
+
+		if(loader_segments[i].writable) {
+			if(vm_copy(task->vmem, addr, NULL, alloc, VM_USER | VM_RW | VM_TFORK | VM_FREE) < 0) {
+				return -1;
+			}
+			continue;
+		}
+
+		if(!vm_alloc_at(task->vmem, NULL, RDIV(alloc->size, PAGE_SIZE), addr, alloc->phys,
+			VM_USER | VM_TFORK | VM_SHARED | VM_FIXED)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
 /* Sets up a new task, including the necessary paging context, stacks,
  * interrupt stack frame etc.
  */
@@ -132,21 +222,21 @@ task_t* task_new(task_t* parent, uint32_t pid, char name[VFS_NAME_MAX],
 		return NULL;
 	}
 
-	task_t* task = alloc_task(parent, pid, name, environ, envc, argv, argc);
+	task_t* task = alloc_task(parent, pid, name, environ, envc, argv, argc, NULL, 0);
 	if(!task) {
 		return NULL;
 	}
 
 	if(map_task(task) != 0) {
-		return NULL;
+		goto fail;
 	}
 
 	// Allocate initial stack. Will dynamically grow, so be conservative.
-	task->stack_size = PAGE_SIZE * 2;
+	task->vmem->stack_size = PAGE_SIZE * 2;
 
-	if(!vm_alloc_at(&task->vmem, NULL, 2, (void*)TASK_STACK_LOCATION - task->stack_size, NULL,
+	if(!vm_alloc_at(task->vmem, NULL, 2, (void*)TASK_STACK_LOCATION - task->vmem->stack_size, NULL,
 		VM_USER | VM_RW | VM_FREE | VM_TFORK | VM_FIXED)) {
-		return NULL;
+		goto fail;
 	}
 
 	vfs_open(task, "/dev/stdin", O_RDONLY);
@@ -157,26 +247,28 @@ task_t* task_new(task_t* parent, uint32_t pid, char name[VFS_NAME_MAX],
 	strlcpy(task->binary_path, abs_path, VFS_PATH_MAX);
 	kfree(abs_path);
 
-	// Load ELF binary loader into task memory space
-	if(vm_copy(&task->vmem, (void*)0x500000, NULL, &loader_alloc, VM_USER | VM_RW | VM_TFORK | VM_FREE) < 0) {
-		return NULL;
+	if(map_loader(task) < 0) {
+		goto fail;
 	}
 
-	task->entry = (void*)0x500000;
+	task->entry = loader_entry;
 	// FIXME
-	task->sbrk = (void*)0xf000000;
+	task->vmem->sbrk = (void*)0xf000000;
 
 	task_setup_execdata(task);
 
 	task->state->ds = GDT_SEG_DATA_PL3;
-	task->state->cr3 = (uint32_t)vm_pagedir(&task->vmem);
+	task->state->cr3 = (uint32_t)vm_pagedir(task->vmem);
 	task->state->ebp = 0;
 	task->state->esp = (void*)TASK_STACK_LOCATION - sizeof(iret_t);
 
 	// Temporarily map part of the userland stack into kernel memory to set up
 	// stack for initial iret
 	vm_alloc_t alloc;
-	iret_t* iret = vm_map(VM_KERNEL, &alloc, &task->vmem, task->state->esp, sizeof(iret_t), 0);
+	iret_t* iret = vm_map(VM_KERNEL, &alloc, task->vmem, task->state->esp, sizeof(iret_t), 0);
+	if(!iret) {
+		goto fail;
+	}
 
 	iret->eip = task->entry;
 	iret->cs = GDT_SEG_CODE_PL3;
@@ -186,6 +278,42 @@ task_t* task_new(task_t* parent, uint32_t pid, char name[VFS_NAME_MAX],
 
 	vm_free(&alloc);
 	return task;
+
+fail:
+	task_cleanup(task);
+	return NULL;
+}
+
+/* Called once a vforked task stops using the address space of its parent by
+ * calling execve or exiting. Lets the parent continue.
+ */
+static void vfork_release(task_t* task) {
+	task_t* parent = task->vfork_parent;
+	if(!parent) {
+		return;
+	}
+
+	task->vfork_parent = NULL;
+	parent->vfork_pending = false;
+}
+
+/* Let pthread_join know that a thread is gone. It won't run again, so its
+ * stack can be freed after this.
+ */
+static void clear_tid(task_t* t) {
+	if(!t->clear_tid) {
+		return;
+	}
+
+	vm_alloc_t alloc;
+	uint32_t* tid = vm_map(VM_KERNEL, &alloc, t->vmem, t->clear_tid,
+		sizeof(uint32_t), VM_MAP_USER_ONLY | VM_RW);
+	if(tid) {
+		*tid = 0;
+		vm_free(&alloc);
+	}
+
+	futex_wake(t->vmem, (uintptr_t)t->clear_tid, INT32_MAX);
 }
 
 /* Called by the scheduler whenever a task terminates from the userland
@@ -195,18 +323,24 @@ task_t* task_new(task_t* parent, uint32_t pid, char name[VFS_NAME_MAX],
  */
 void task_userland_eol(task_t* t) {
 	t->task_state = TASK_STATE_ZOMBIE;
+	vfork_release(t);
 
-	task_t* init = scheduler_find(1);
-	for(struct scheduler_qentry* e = t->qentry->next; e->next != t->qentry->next; e = e->next) {
-		if(e->task && e->task->parent == t) {
-			e->task->parent = init;
-		}
+	// Hand over orphaned children to init
+	task_t* init = task_find(1);
+	if(task_reparent_children(t, init) && init) {
+		wait_notify(init, NULL);
+	}
+
+	// Threads have no parent to notify and can be cleaned up right away
+	if(t->pid != t->tgid) {
+		clear_tid(t);
+		t->task_state = TASK_STATE_REAPED;
+		return;
 	}
 
 	if(t->parent) {
-		if(t->parent->task_state == TASK_STATE_WAITING) {
-			wait_finish(t->parent, t);
-		}
+		task_add_zombie(t->parent, t);
+		wait_notify(t->parent, t);
 		task_signal(t->parent, t, SIGCHLD);
 	}
 
@@ -232,45 +366,83 @@ void task_cleanup(task_t* t) {
 	task_free(t);
 }
 
-static task_t* _fork(task_t* to_fork, isf_t* state) {
-	task_t* task = alloc_task(to_fork, 0, to_fork->name, to_fork->environ,
-		to_fork->envc, to_fork->argv, to_fork->argc);
+// Copy credentials, scheduling parameters, working directory and open files
+static void inherit(task_t* task, task_t* from) {
+	task->uid = from->uid;
+	task->gid = from->gid;
+	task->euid = from->euid;
+	task->egid = from->egid;
+	task->ctty = from->ctty;
+	task->nice = from->nice;
+	task->sched_policy = from->sched_policy;
+	task->rt_priority = from->rt_priority;
+	memcpy(task->cwd, from->cwd, VFS_PATH_MAX);
+
+	// Threads share the table
+	if(task->files == from->files) {
+		return;
+	}
 
-	task->uid = to_fork->uid;
-	task->gid = to_fork->gid;
-	task->euid = to_fork->euid;
-	task->egid = to_fork->egid;
-	task->ctty = to_fork->ctty;
-	task->stack_size = to_fork->stack_size;
-	task->sbrk = to_fork->sbrk;
+	// Most of the table is usually unused, so only copy open files
+	for(int i = 0; i < CONFIG_VFS_MAX_OPENFILES; i++) {
+		struct vfs_file* file = &from->files->fds[i];
 
-	memcpy(task->cwd, to_fork->cwd, VFS_PATH_MAX);
-	memcpy(task->binary_path, to_fork->binary_path, sizeof(task->binary_path));
-	memcpy(task->files, to_fork->files, sizeof(vfs_file_t) * CONFIG_VFS_MAX_OPENFILES);
+		// FIXME flags seem to get mangled during fork/execve
+		//if(file->refs && !(file->flags & O_CLOEXEC)) {
+		if(file->refs) {
+			memcpy(&task->files->fds[i], file, sizeof(struct vfs_file));
+		}
+	}
+}
 
-	if(vm_clone(&task->vmem, &to_fork->vmem) != 0) {
+/* With FORK_VFORK or FORK_THREAD set, the new task borrows the address space
+ * of the forked one instead of getting a copy of it. For FORK_VFORK, the caller
+ * is responsible for suspending the forked task until vfork_release. The new
+ * task still needs to be added to the scheduler.
+ */
+static task_t* _fork(task_t* to_fork, isf_t* state, int flags) {
+	task_t* task = alloc_task(to_fork, 0, to_fork->name, to_fork->environ,
+		to_fork->envc, to_fork->argv, to_fork->argc, to_fork, flags);
+	if(!task) {
 		return NULL;
 	}
 
-	// FIXME transfer potentially updated environ
-	task_setup_execdata(task);
+	inherit(task, to_fork);
+	task->tls = to_fork->tls;
+	memcpy(task->binary_path, to_fork->binary_path, sizeof(task->binary_path));
+
+	if(!(flags & (FORK_VFORK | FORK_THREAD))) {
+		if(vm_clone(task->vmem, to_fork->vmem) != 0) {
+			goto fail;
+		}
+
+		task->vmem->sbrk = to_fork->vmem->sbrk;
+		task->vmem->stack_size = to_fork->vmem->stack_size;
+
+		// FIXME transfer potentially updated environ
+		task_setup_execdata(task);
+	}
 
 	/* Allocate task state and kernel stack. It's important this is done after
 	 * the vm_clone above, since it could otherwise end up in a memory region
 	 * that was already occupied in the forked task.
 	 */
 	if(map_task(task) != 0) {
-		return NULL;
+		goto fail;
 	}
 
-	memcpy(task->state, state, sizeof(isf_t));
-	memcpy(task->kernel_stack, to_fork->kernel_stack, KERNEL_STACK_SIZE);
-
-	// Adjust kernel esp
+	/* Only the part of the kernel stack above the interrupt stack frame
+	 * is needed to return to userland.
+	 */
 	intptr_t diff = state->esp - to_fork->kernel_stack;
+	memcpy(task->state, state, sizeof(isf_t));
+	memcpy(task->kernel_stack + diff, state->esp, KERNEL_STACK_SIZE - diff);
 	task->state->esp = task->kernel_stack + diff;
+	if(fpu_fork(task, to_fork) != 0) {
+		goto fail;
+	}
 
-	task->state->cr3 = (uint32_t)vm_pagedir(&task->vmem);
+	task->state->cr3 = (uint32_t)vm_pagedir(task->vmem);
 
 	/* Set syscall return values for the forked task – need to set here since
 	 * the regular syscall return handling only affects the main process.
@@ -278,20 +450,90 @@ static task_t* _fork(task_t* to_fork, isf_t* state) {
 	task->state->eax = 0;
 	task->state->ebx = 0;
 
-	scheduler_add(task);
 	return task;
+
+fail:
+	task_cleanup(task);
+	sc_errno = ENOMEM;
+	return NULL;
 }
 
 int task_fork(task_t* to_fork, isf_t* state) {
-	task_t* task = _fork(to_fork, state);
+	task_t* task = _fork(to_fork, state, 0);
 	if(task) {
+		scheduler_add(task);
 		return task->pid;
 	} else {
 		return -1;
 	}
 }
 
+/* Suspends the calling task until the child has called execve or exited, at
+ * which point it hands back the address space.
+ */
+int task_vfork(task_t* to_fork, isf_t* state) {
+	task_t* task = _fork(to_fork, state, FORK_VFORK);
+	if(!task) {
+		return -1;
+	}
+
+	// Needs to be set before the child can run and call vfork_release
+	task->vfork_parent = to_fork;
+	to_fork->vfork_pending = true;
+	scheduler_add(task);
+
+	// The child could already be gone once we wake up
+	int pid = task->pid;
+	while(to_fork->vfork_pending) {
+		scheduler_yield();
+	}
+	return pid;
+}
+
+/* Creates a new thread in the process of task. The thread shares address
+ * space, open files and signal handlers with the calling task and returns
+ * from the syscall with 0 on the given stack, similar to fork.
+ */
+int task_clone(task_t* task, isf_t* state, void* stack, void* tls, void* clear_tid) {
+	if(!stack) {
+		sc_errno = EINVAL;
+		return -1;
+	}
+
+	task_t* thread = _fork(task, state, FORK_THREAD);
+	if(!thread) {
+		return -1;
+	}
+
+	// Threads are not waited for by the parent of the process
+	thread->parent = NULL;
+	thread->tls = tls;
+	thread->clear_tid = clear_tid;
+
+	iret_t* iret = thread->state->esp;
+	iret->user_esp = stack;
+
+	task_join_group(thread, task);
+	scheduler_add(thread);
+	return thread->pid;
+}
+
+int task_set_tls(task_t* task, void* tls) {
+	task->tls = tls;
+	gdt_set_tls(tls);
+	return 0;
+}
+
 int task_exit(task_t* task, int code) {
+	task->exit_code = code << 8;
+	task_kill_threads(task);
+	task->task_state = TASK_STATE_TERMINATED;
+	task->interrupt_yield = true;
+	return 0;
+}
+
+// Only terminates the calling thread, for pthread_exit
+int task_thread_exit(task_t* task, int code) {
 	task->task_state = TASK_STATE_TERMINATED;
 	task->exit_code = code << 8;
 	task->interrupt_yield = true;
@@ -319,6 +561,173 @@ int task_setid(task_t* task, int which, int id) {
 	return -1;
 }
 
+/* Counterpart to task_setid. Userland normally reads these from execdata, but
+ * a vfork child still sees the execdata of its parent.
+ */
+int task_getid(task_t* task, int which) {
+	switch(which) {
+		case 0:
+			return task->tgid;
+		case 1:
+			return task->parent ? task->parent->pid : 0;
+		case 2:
+			return task->uid;
+		case 3:
+			return task->euid;
+		case 4:
+			return task->gid;
+		case 5:
+			return task->egid;
+	}
+	sc_errno = EINVAL;
+	return -1;
+}
+
+/* Write back all cached file system data, then reset the machine using the
+ * keyboard controller. Only RB_AUTOBOOT is supported.
+ */
+int task_reboot(task_t* task, int howto) {
+	if(task->euid != 0) {
+		sc_errno = EPERM;
+		return -1;
+	}
+
+	if(howto != RB_AUTOBOOT) {
+		sc_errno = EINVAL;
+		return -1;
+	}
+
+	log(LOG_INFO, "task: Rebooting on request of PID %d\n", task->pid);
+	vfs_sync(task);
+
+	int_disable();
+	while(inb(0x64) & 2);
+	outb(0x64, 0xfe);
+	while(true) {
+		halt();
+	}
+}
+
+static task_t* priority_target(task_t* task, int which, int who) {
+	// Process groups and users are not supported yet
+	if(which != PRIO_PROCESS) {
+		sc_errno = EINVAL;
+		return NULL;
+	}
+
+	task_t* target = who ? task_find(who) : task;
+	if(!target) {
+		sc_errno = ESRCH;
+		return NULL;
+	}
+	return target;
+}
+
+/* Returns the nice value of a process. Since -1 is a valid nice value,
+ * callers have to check errno to detect errors.
+ */
+int task_getpriority(task_t* task, int which, int who) {
+	task_t* target = priority_target(task, which, who);
+	if(!target) {
+		return -1;
+	}
+	return target->nice;
+}
+
+int task_setpriority(task_t* task, int which, int who, int prio) {
+	task_t* target = priority_target(task, which, who);
+	if(!target) {
+		return -1;
+	}
+
+	if(task->euid != 0 && task->euid != target->euid) {
+		sc_errno = EPERM;
+		return -1;
+	}
+
+	prio = MAX(SCHED_NICE_MIN, MIN(SCHED_NICE_MAX, prio));
+
+	// Only root may raise priority
+	if(task->euid != 0 && prio < target->nice) {
+		sc_errno = EACCES;
+		return -1;
+	}
+
+	target->nice = prio;
+	return 0;
+}
+
+static task_t* sched_target(task_t* task, int pid) {
+	if(pid < 0) {
+		sc_errno = EINVAL;
+		return NULL;
+	}
+
+	task_t* target = pid ? task_find(pid) : task;
+	if(!target) {
+		sc_errno = ESRCH;
+		return NULL;
+	}
+	return target;
+}
+
+static int set_scheduler(task_t* task, task_t* target, int policy, int prio) {
+	switch(policy) {
+		case SCHED_OTHER:
+			if(prio != 0) {
+				sc_errno = EINVAL;
+				return -1;
+			}
+			break;
+		case SCHED_FIFO:
+		case SCHED_RR:
+			if(prio < SCHED_RT_PRIO_MIN || prio > SCHED_RT_PRIO_MAX) {
+				sc_errno = EINVAL;
+				return -1;
+			}
+			break;
+		default:
+			sc_errno = EINVAL;
+			return -1;
+	}
+
+	// Real-time policies can starve everything else, so reserve them for root
+	if(task->euid != 0 && (policy != SCHED_OTHER || task->euid != target->euid)) {
+		sc_errno = EPERM;
+		return -1;
+	}
+
+	target->sched_policy = policy;
+	target->rt_priority = prio;
+	return 0;
+}
+
+int task_setscheduler(task_t* task, int pid, int policy, struct sched_param* param) {
+	task_t* target = sched_target(task, pid);
+	if(!target) {
+		return -1;
+	}
+	return set_scheduler(task, target, policy, param->sched_priority);
+}
+
+int task_getscheduler(task_t* task, int pid) {
+	task_t* target = sched_target(task, pid);
+	if(!target) {
+		return -1;
+	}
+	return target->sched_policy;
+}
+
+int task_getparam(task_t* task, int pid, struct sched_param* param) {
+	task_t* target = sched_target(task, pid);
+	if(!target) {
+		return -1;
+	}
+
+	param->sched_priority = target->rt_priority;
+	return 0;
+}
+
 int task_execve(task_t* task, char* path, char** argv, char** env) {
 	uint32_t __argc = 0;
 	uint32_t __envc = 0;
@@ -346,31 +755,152 @@ int task_execve(task_t* task, char* path, char** argv, char** env) {
 	kfree_array(__argv, __argc);
 	kfree_array(__env, __envc);
 
-	memcpy(new_task->cwd, task->cwd, VFS_PATH_MAX);
-	new_task->uid = task->uid;
-	new_task->gid = task->gid;
-	new_task->euid = task->euid;
-	new_task->egid = task->egid;
+	inherit(new_task, task);
 	new_task->strace_observer = task->strace_observer;
 	new_task->strace_fd = task->strace_fd;
-	new_task->ctty = task->ctty;
 
-	for(int i = 0; i < CONFIG_VFS_MAX_OPENFILES; i++) {
-		struct vfs_file* file = &task->files[i];
+	scheduler_add(new_task);
+	task_reparent_children(task, new_task);
 
-		// FIXME flags seem to get mangled during fork/execve
-		//if(file->refs && !(file->flags & O_CLOEXEC)) {
-		if(file->refs) {
-			memcpy(&new_task->files[i], file, sizeof(struct vfs_file));
-		}
-	}
+	// Keep accumulated CPU time, otherwise execve could be used to reset it
+	new_task->qentry->vruntime = task->qentry->vruntime;
+	new_task->qentry->runtime = task->qentry->runtime;
+	new_task->acct = task->acct;
 
-	scheduler_add(new_task);
+	vfork_release(task);
+	task_kill_threads(task);
 	task->task_state = TASK_STATE_REPLACED;
 	task->interrupt_yield = true;
 	return 0;
 }
 
+// Copies a NULL-terminated string array from task memory
+static char** copy_user_strings(task_t* task, char** array, uint32_t* count) {
+	vm_alloc_t vmem;
+	char** mapped = vm_map(VM_KERNEL, &vmem, task->vmem, array, PAGE_SIZE * 2,
+		VM_MAP_USER_ONLY | VM_MAP_LESS_OK);
+	if(!mapped) {
+		return NULL;
+	}
+
+	char** copy = task_copy_strings(task, mapped, count);
+	vm_free(&vmem);
+	return copy;
+}
+
+// Open a file for posix_spawn_file_actions_addopen and move it to the requested fd
+static int spawn_open(task_t* task, struct task_spawn_action* action) {
+	// The action is mapped read-only from userland, and could be changed any time
+	char* path = kmalloc(VFS_PATH_MAX);
+	memcpy(path, action->path, VFS_PATH_MAX);
+	path[VFS_PATH_MAX - 1] = 0;
+
+	int fd = vfs_open(task, path, action->flags);
+	kfree(path);
+	if(fd < 0 || fd == action->fd) {
+		return fd < 0 ? -1 : 0;
+	}
+
+	int r = vfs_dup2(task, fd, action->fd);
+	vfs_close(task, fd);
+	return r;
+}
+
+static int spawn_file_action(task_t* task, struct task_spawn_action* action) {
+	switch(action->type) {
+		case SPAWN_ACTION_OPEN:
+			return spawn_open(task, action);
+		case SPAWN_ACTION_CLOSE:
+			return vfs_close(task, action->fd);
+		case SPAWN_ACTION_DUP2:
+			return vfs_dup2(task, action->fd, action->newfd);
+	}
+
+	sc_errno = EINVAL;
+	return -1;
+}
+
+static int spawn_setup(task_t* child, task_t* task, struct task_spawn_ctx* ctx) {
+	inherit(child, task);
+	child->signal_mask = task->signal_mask;
+
+	if(ctx->flags & POSIX_SPAWN_RESETIDS) {
+		child->euid = child->uid;
+		child->egid = child->gid;
+	}
+
+	if(ctx->flags & POSIX_SPAWN_SETSIGMASK) {
+		child->signal_mask = ctx->sigmask;
+	}
+
+	if(ctx->flags & (POSIX_SPAWN_SETSCHEDULER | POSIX_SPAWN_SETSCHEDPARAM)) {
+		int policy = ctx->flags & POSIX_SPAWN_SETSCHEDULER ?
+			ctx->sched_policy : child->sched_policy;
+
+		if(set_scheduler(task, child, policy, ctx->sched_priority) < 0) {
+			return -1;
+		}
+	}
+
+	if(!ctx->num_actions) {
+		return 0;
+	}
+
+	if(ctx->num_actions > SPAWN_MAX_ACTIONS) {
+		sc_errno = EINVAL;
+		return -1;
+	}
+
+	vm_alloc_t vmem;
+	struct task_spawn_action* actions = vm_map(VM_KERNEL, &vmem, task->vmem,
+		ctx->actions, sizeof(struct task_spawn_action) * ctx->num_actions,
+		VM_MAP_USER_ONLY);
+	if(!actions) {
+		sc_errno = EFAULT;
+		return -1;
+	}
+
+	int r = 0;
+	for(uint32_t i = 0; i < ctx->num_actions && r == 0; i++) {
+		r = spawn_file_action(child, &actions[i]);
+	}
+
+	vm_free(&vmem);
+	return r;
+}
+
+/* Creates a new task running the binary at path directly, without forking
+ * the calling task first. File actions and attributes are applied to the
+ * child in the same way the child would after a fork. POSIX_SPAWN_SETSIGDEF
+ * has no effect since signal handlers are never inherited by new binaries,
+ * and process groups are not supported.
+ */
+int task_spawn(task_t* task, char* path, struct task_spawn_ctx* ctx) {
+	uint32_t argc = 0;
+	uint32_t envc = 0;
+	char** argv = copy_user_strings(task, ctx->argv, &argc);
+	char** env = copy_user_strings(task, ctx->env, &envc);
+	if(!argv || !env) {
+		sc_errno = EFAULT;
+		return -1;
+	}
+
+	task_t* child = task_new(task, 0, path, env, envc, argv, argc);
+	kfree_array(argv, argc);
+	kfree_array(env, envc);
+	if(!child) {
+		return -1;
+	}
+
+	if(spawn_setup(child, task, ctx) < 0) {
+		task_cleanup(child);
+		return -1;
+	}
+
+	scheduler_add(child);
+	return child->pid;
+}
+
 int task_chdir(task_t* task, const char* dir) {
 	if(vfs_access(task, dir, R_OK | X_OK) < 0) {
 		return -1;
@@ -402,23 +932,49 @@ int task_chdir(task_t* task, const char* dir) {
 }
 
 int task_strace(task_t* task, isf_t* state) {
-	task_t* fork = _fork(task, state);
+	task_t* fork = _fork(task, state, 0);
 	if(!fork) {
 		return -1;
 	}
 
 	int pipe[2];
 	if(vfs_pipe(task, pipe) != 0) {
+		task_cleanup(fork);
 		return -1;
 	}
 
 	fork->strace_observer = task;
 	fork->strace_fd = pipe[1];
+	scheduler_add(fork);
 	return pipe[0];
 }
 
+static void load_segment(void* image, size_t size, struct elf_program_header* phead) {
+	if(unlikely(loader_num_segments >= LOADER_MAX_SEGMENTS)) {
+		panic("Too many segments in ELF loader.\n");
+	}
+
+	if(unlikely(phead->offset + phead->filesz > size || phead->filesz > phead->memsz)) {
+		panic("Invalid program header in ELF loader.\n");
+	}
+
+	void* addr = ALIGN_DOWN(phead->vaddr, PAGE_SIZE);
+	size_t offset = phead->vaddr - addr;
+	vm_alloc_t* alloc = &loader_segments[loader_num_segments].alloc;
+
+	if(unlikely(!vm_alloc(VM_KERNEL, alloc, RDIV(offset + phead->memsz, PAGE_SIZE),
+		NULL, VM_RW | VM_ZERO))) {
+		panic("Could not map ELF loader.\n");
+	}
+
+	memcpy(alloc->addr + offset, image + phead->offset, phead->filesz);
+	loader_segments[loader_num_segments].addr = addr;
+	loader_segments[loader_num_segments].writable = phead->flags & ELF_PF_W;
+	loader_num_segments++;
+}
+
 void task_init(void) {
-	int fd = vfs_open(NULL, "/usr/libexec/system/xelix-loader", O_RDONLY);
+	int fd = vfs_open(NULL, LOADER_PATH, O_RDONLY);
 	if(unlikely(fd < 0)) {
 		panic("Could not open ELF loader.\n");
 	}
@@ -429,15 +985,35 @@ void task_init(void) {
 	}
 
 	size_t size = stat.st_size;
-	if(unlikely(!vm_alloc(VM_KERNEL, &loader_alloc, RDIV(size, PAGE_SIZE), NULL, VM_RW))) {
-		panic("Could not map ELF loader.\n");
+	vm_alloc_t image_alloc;
+	void* image = vm_alloc(VM_KERNEL, &image_alloc, RDIV(size, PAGE_SIZE), NULL, VM_RW | VM_FREE);
+	if(unlikely(!image)) {
+		panic("Could not allocate memory for ELF loader.\n");
 	}
 
-	size_t read = vfs_read(NULL, fd, loader_alloc.addr, size);
+	size_t read = vfs_read(NULL, fd, image, size);
+	vfs_close(NULL, fd);
 	if(unlikely(read != size)) {
 		panic("Could not read ELF loader.\n");
+	}
+
+	struct elf_header* header = image;
+	if(unlikely(size < sizeof(struct elf_header) || memcmp(header->ident, "\x7f" "ELF", 4)
+		|| header->type != ELF_TYPE_EXEC
+		|| header->phoff + header->phnum * sizeof(struct elf_program_header) > size)) {
 
+		panic("ELF loader is not a valid ELF executable.\n");
 	}
+
+	struct elf_program_header* pheads = image + header->phoff;
+	for(int i = 0; i < header->phnum; i++) {
+		if(pheads[i].type == ELF_PT_LOAD) {
+			load_segment(image, size, &pheads[i]);
+		}
+	}
+
+	loader_entry = header->entry;
+	vm_free(&image_alloc);
 }
 
 static size_t sfs_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
@@ -455,8 +1031,21 @@ static size_t sfs_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
 	sysfs_printf("%-10s: %d\n", "egid", task->egid);
 	sysfs_printf("%-10s: %s\n", "name", task->name);
 	sysfs_printf("%-10s: %p\n", "entry", task->entry);
-	sysfs_printf("%-10s: %p\n", "sbrk", task->sbrk);
+	sysfs_printf("%-10s: %p\n", "sbrk", task->vmem->sbrk);
 	sysfs_printf("%-10s: %d\n", "state", task->task_state);
+	sysfs_printf("%-10s: %d\n", "nice", task->nice);
+	sysfs_printf("%-10s: %d\n", "policy", task->sched_policy);
+	sysfs_printf("%-10s: %d\n", "rtprio", task->rt_priority);
+	sysfs_printf("%-10s: %u\n", "runtime", scheduler_runtime_ms(task->qentry));
+	sysfs_printf("%-10s: %u\n", "utime", task_acct_ms(task->acct.utime));
+	sysfs_printf("%-10s: %u\n", "stime", task_acct_ms(task->acct.stime));
+	sysfs_printf("%-10s: %u\n", "cutime", task_acct_ms(task->acct.cutime));
+	sysfs_printf("%-10s: %u\n", "cstime", task_acct_ms(task->acct.cstime));
+	sysfs_printf("%-10s: %u\n", "nvcsw", task->acct.nvcsw);
+	sysfs_printf("%-10s: %u\n", "nivcsw", task->acct.nivcsw);
+	sysfs_printf("%-10s: %u\n", "faults", task->acct.faults);
+	sysfs_printf("%-10s: %llu\n", "rchar", task->acct.rchar);
+	sysfs_printf("%-10s: %llu\n", "wchar", task->acct.wchar);
 	sysfs_printf("%-10s: %s\n", "cwd", task->cwd);
 	sysfs_printf("%-10s: %s\n", "tty", task->ctty ? task->ctty->path : "");
 	sysfs_printf("%-10s: %d\n", "argc", task->argc);
@@ -475,16 +1064,16 @@ static size_t sfs_read(struct vfs_callback_ctx* ctx, void* dest, size_t size) {
 
 	sysfs_printf("\nOpen files:\n");
 	for(int i = 0; i < CONFIG_VFS_MAX_OPENFILES; i++) {
-		if(!task->files[i].inode) {
+		if(!task->files->fds[i].inode) {
 			continue;
 		}
 
 		sysfs_printf("%3d %-10s %s\n", i,
-			vfs_flags_verbose(task->files[i].flags), task->files[i].path);
+			vfs_flags_verbose(task->files->fds[i].flags), task->files->fds[i].path);
 	}
 
 	sysfs_printf("\nTask memory:\n");
-	vm_alloc_t* range = task->vmem.ranges;
+	vm_alloc_t* range = task->vmem->ranges;
 	for(; range; range = range->next) {
 		sysfs_printf("%p - %p  ->  %p - %p length %#-6lx\n",
 			range->addr, range->addr + range->size - 1,
@@ -28,8 +28,72 @@
 #define KERNEL_STACK_PAGES 4
 #define KERNEL_STACK_SIZE PAGE_SIZE * KERNEL_STACK_PAGES
 
+// `which` argument of getpriority/setpriority, same values as in newlib
+#define PRIO_PROCESS 0
+#define PRIO_PGRP 1
+#define PRIO_USER 2
+
+// posix_spawn flags, same values as in newlib
+#define POSIX_SPAWN_RESETIDS 0x01
+#define POSIX_SPAWN_SETPGROUP 0x02
+#define POSIX_SPAWN_SETSCHEDPARAM 0x04
+#define POSIX_SPAWN_SETSCHEDULER 0x08
+#define POSIX_SPAWN_SETSIGDEF 0x10
+#define POSIX_SPAWN_SETSIGMASK 0x20
+
+// reboot howto, same value as in newlib sys/reboot.h
+#define RB_AUTOBOOT 0x01234567
+
+// posix_spawn file action types
+#define SPAWN_ACTION_OPEN 1
+#define SPAWN_ACTION_CLOSE 2
+#define SPAWN_ACTION_DUP2 3
+
+// Upper limit for the number of file actions passed to posix_spawn
+#define SPAWN_MAX_ACTIONS 1024
+
+struct sched_param;
+
+// Keep in sync with newlib
+struct task_spawn_action {
+	int type;
+	int fd;
+	int newfd;
+	int flags;
+	char path[VFS_PATH_MAX];
+};
+
+struct task_spawn_ctx {
+	char** argv;
+	char** env;
+	struct task_spawn_action* actions;
+	uint32_t num_actions;
+	uint32_t flags;
+	uint32_t sigmask;
+	int sched_policy;
+	int sched_priority;
+};
+
+/* Open files and signal handlers. These are shared between the threads of
+ * a process, see task_clone.
+ */
+struct task_files {
+	uint32_t refs;
+	vfs_file_t fds[CONFIG_VFS_MAX_OPENFILES];
+};
+
+struct task_signals {
+	uint32_t refs;
+
+	// Signals are 1-indexed, so we need one additional array entry
+	struct sigaction handlers[NSIG + 1];
+};
+
 typedef struct task {
 	uint32_t pid;
+
+	// PID of the initial thread of the process, same as pid for most tasks
+	uint32_t tgid;
 	uint16_t uid;
 	uint16_t gid;
 	uint16_t euid;
@@ -38,15 +102,40 @@ typedef struct task {
 	char name[VFS_NAME_MAX];
 	struct task* parent;
 	struct scheduler_qentry* qentry;
-	struct vm_ctx vmem;
+
+	/* Children of this task, and the links in the children list of the
+	 * parent. See tasks/pid.c.
+	 */
+	struct task* children;
+	struct task* sibling_next;
+	struct task** sibling_pprev;
+
+	// Children that have exited and can be collected using waitpid
+	struct task* zombies;
+	struct task* zombie_next;
+
+	// Ring of all threads of the process
+	struct task* group_next;
+	struct task* group_prev;
+
+	// Next task in the same PID hash bucket
+	struct task* pid_next;
+
+	// Address space, shared with the parent after vfork and between threads
+	struct vm_ctx* vmem;
 	isf_t* state;
 	void* entry;
-	void* sbrk;
-	size_t stack_size;
 
 	// Kernel stack used for interrupts. This will be loaded into the TSS.
 	void* kernel_stack;
 
+	/* FPU/SSE register state as stored by fxsave. Only allocated once the
+	 * task first uses the FPU, see tasks/i386-fpu.c. fpu_cpu is the CPU this
+	 * state was last loaded on.
+	 */
+	void* fpu_state;
+	uint32_t fpu_cpu;
+
 	// Controlling terminal
 	struct term* ctty;
 
@@ -88,7 +177,10 @@ typedef struct task {
 		TASK_STATE_SLEEPING,
 
 		// Task is currently in a syscall
-		TASK_STATE_SYSCALL
+		TASK_STATE_SYSCALL,
+
+		// Task is waiting on a futex
+		TASK_STATE_BLOCKED
 	} task_state;
 
 	// Exit code in a format compatible with the waitpid() stat_loc field
@@ -100,10 +192,8 @@ typedef struct task {
 	uint32_t argc;
 	uint32_t envc;
 
-	vfs_file_t files[CONFIG_VFS_MAX_OPENFILES];
-
-	// Signals are 1-indexed, so we need one additional array entry
-	struct sigaction signal_handlers[NSIG + 1];
+	struct task_files* files;
+	struct task_signals* signals;
 	uint32_t signal_mask;
 
 	struct {
@@ -112,9 +202,8 @@ typedef struct task {
 		 */
 		uint32_t wait_for;
 
-		// Used to pass result pid from wait_finish to task_waitpid
-		int wait_res_pid;
-		int* stat_loc;
+		// Set by wait_notify when a child the task is waiting for has exited
+		bool notified;
 	} wait_context;
 
 	char cwd[VFS_PATH_MAX];
@@ -138,6 +227,54 @@ typedef struct task {
 
 	uint32_t sleep_until;
 
+	// Scheduling priority, SCHED_NICE_MIN to SCHED_NICE_MAX
+	int nice;
+
+	// SCHED_OTHER, SCHED_FIFO or SCHED_RR, and priority for the latter two
+	int sched_policy;
+	int rt_priority;
+
+	// Resource usage, see tasks/acct.c. Times are in TSC cycles.
+	struct {
+		// Time stamp of the last switch between user and system time
+		uint64_t last;
+		uint64_t utime;
+		uint64_t stime;
+
+		// Times of children that have been collected using waitpid
+		uint64_t cutime;
+		uint64_t cstime;
+
+		// Voluntary and involuntary task switches
+		uint32_t nvcsw;
+		uint32_t nivcsw;
+
+		// Page faults from userland, including those that were handled
+		uint32_t faults;
+
+		// Bytes transferred using read and write
+		uint64_t rchar;
+		uint64_t wchar;
+	} acct;
+
+	/* Set on vforked tasks while they are borrowing the address space of
+	 * their parent. vfork_pending is set on the parent during that time.
+	 */
+	struct task* vfork_parent;
+	volatile bool vfork_pending;
+
+	// Base address of the %gs segment, see gdt_set_tls
+	void* tls;
+
+	/* Threads only: Userland address that gets set to 0 and woken up using
+	 * futex_wake once the thread has exited, used for pthread_join.
+	 */
+	void* clear_tid;
+
+	// Wait queue entry while in TASK_STATE_BLOCKED, see tasks/futex.c
+	struct task* futex_next;
+	uintptr_t futex_addr;
+
 	struct task* strace_observer;
 	int strace_fd;
 
@@ -147,9 +284,22 @@ typedef struct task {
 task_t* task_new(task_t* parent, uint32_t pid, char name[VFS_NAME_MAX],
 	char** environ, uint32_t envc, char** argv, uint32_t argc);
 int task_fork(task_t* to_fork, isf_t* state);
+int task_vfork(task_t* to_fork, isf_t* state);
+int task_clone(task_t* task, isf_t* state, void* stack, void* tls, void* clear_tid);
+int task_set_tls(task_t* task, void* tls);
+void task_kill_threads(task_t* task);
 int task_execve(task_t* task, char* path, char** argv, char** env);
+int task_spawn(task_t* task, char* path, struct task_spawn_ctx* ctx);
 int task_exit(task_t* task, int code);
+int task_thread_exit(task_t* task, int code);
 int task_setid(task_t* task, int which, int id);
+int task_getid(task_t* task, int which);
+int task_reboot(task_t* task, int howto);
+int task_getpriority(task_t* task, int which, int who);
+int task_setpriority(task_t* task, int which, int who, int prio);
+int task_setscheduler(task_t* task, int pid, int policy, struct sched_param* param);
+int task_getscheduler(task_t* task, int pid);
+int task_getparam(task_t* task, int pid, struct sched_param* param);
 void task_userland_eol(task_t* t);
 void task_cleanup(task_t* t);
 int task_chdir(task_t* task, const char* dir);
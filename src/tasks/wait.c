@@ -19,75 +19,83 @@
 
 #include <tasks/task.h>
 #include <tasks/wait.h>
+#include <tasks/pid.h>
+#include <tasks/acct.h>
+#include <tasks/scheduler.h>
+#include <int/int.h>
 #include <errno.h>
 #include <time.h>
 
 int task_waitpid(task_t* task, int32_t child_pid, int* stat_loc, int options) {
-	if(child_pid > 0) {
-		task_t* target_task = scheduler_find(child_pid);
-		if(!target_task || target_task->parent != task) {
-			sc_errno = ECHILD;
-			return -1;
-		}
-	} else {
-		// Check if task has any children to wait for.
-		bool have_children = false;
-		for(struct scheduler_qentry* e = task->qentry->next; e->next != task->qentry->next; e = e->next) {
-			if(!e->task) {
-				continue;
+	// Process groups are not supported, so wait for any child instead
+	if(child_pid < 0) {
+		child_pid = 0;
+	}
+
+	while(true) {
+		/* Exited children are added to the zombie list before wait_notify is
+		 * called, so with interrupts disabled, there is no way to miss one
+		 * between the check and switching to TASK_STATE_WAITING.
+		 */
+		bool ints = int_save();
+		task_t* child = task_take_zombie(task, child_pid);
+		if(!child) {
+			if(!task_has_children(task, child_pid)) {
+				int_restore(ints);
+				sc_errno = ECHILD;
+				return -1;
 			}
-			task_t* i = e->task;
-			if(i->parent == task && i->task_state != TASK_STATE_REPLACED &&
-				i->task_state != TASK_STATE_REAPED) {
-				have_children = true;
-				break;
+
+			if(options & WNOHANG) {
+				int_restore(ints);
+				return 0;
 			}
-		}
 
-		if(!have_children) {
-			sc_errno = ECHILD;
-			return -1;
+			task->wait_context.wait_for = child_pid;
+			task->wait_context.notified = false;
+			task->task_state = TASK_STATE_WAITING;
 		}
+		int_restore(ints);
 
-		child_pid = 0;
-	}
+		if(child) {
+			if(stat_loc) {
+				*stat_loc = child->exit_code;
+			}
 
-	task->wait_context.wait_for = child_pid;
-	task->wait_context.stat_loc = stat_loc;
-	task->task_state = TASK_STATE_WAITING;
-	task->interrupt_yield = true;
+			task_acct_reap(task, child);
+			uint32_t pid = child->pid;
+			child->task_state = TASK_STATE_REAPED;
+			return pid;
+		}
 
-	// Will be set in wait_finish below
-	task->wait_context.wait_res_pid = 0;
+		// Wait until wait_notify is called
+		while((volatile int)task->task_state == TASK_STATE_WAITING) {
+			scheduler_yield();
+		}
 
-	// Wait until wait_finish is called
-	while((volatile int)task->task_state == TASK_STATE_WAITING) {
-		scheduler_yield();
+		// Woken up by something else, most likely a signal handler
+		if(!task->wait_context.notified) {
+			sc_errno = EINTR;
+			return -1;
+		}
 	}
-	return (volatile int)task->wait_context.wait_res_pid;
 }
 
-/* Called by the scheduler whenever a task with a parent that is in the
- * TASK_STATE_WAITING state is unlinked.
+/* Called by task_userland_eol after an exited child has been added to the
+ * zombie list of task. Wakes the task up if it is waiting for the child. If
+ * child is NULL, the task is woken up regardless and checks its zombie list.
  */
-void wait_finish(task_t* task, task_t* child) {
-	// Check if this is the child we're waiting for
-	if(task->wait_context.wait_for && task->wait_context.wait_for != child->pid) {
+void wait_notify(task_t* task, task_t* child) {
+	if(task->task_state != TASK_STATE_WAITING) {
 		return;
 	}
 
-	// This is used as return value for waitpid above.
-	task->wait_context.wait_res_pid = child->pid;
-	if(task->wait_context.stat_loc) {
-		*task->wait_context.stat_loc = child->exit_code;
+	if(child && task->wait_context.wait_for && task->wait_context.wait_for != child->pid) {
+		return;
 	}
 
-	child->task_state = TASK_STATE_REAPED;
-
-	/* Usually, the task state is set to running by the SIGCHLD, but if the
-	 * signal is masked, we still need to return from the wait.
-	 */
-	task->task_state = TASK_STATE_RUNNING;
+	task->wait_context.notified = true;
+	scheduler_wake(task);
 }
 
 int task_sleep(task_t* task, struct timeval* tv) {
@@ -20,6 +20,10 @@
 
 #include <tasks/task.h>
 
+// waitpid options, same values as in newlib
+#define WNOHANG 1
+#define WUNTRACED 2
+
 int task_waitpid(task_t* task, int32_t child_pid, int* stat_loc, int options);
-void wait_finish(task_t* task, task_t* child);
+void wait_notify(task_t* task, task_t* child);
 int task_sleep(task_t* task, struct timeval* tv);
@@ -27,6 +27,8 @@ worker_t* worker_new(char* name, void* entry) {
 	worker_t* worker = kmalloc(sizeof(worker_t));
 	worker->entry = entry;
 	worker->stopped = false;
+	worker->sleeping = false;
+	worker->sleep_until = 0;
 	strlcpy(worker->name, name, VFS_NAME_MAX);
 
 	worker->state = vm_alloc(VM_KERNEL, NULL, 1, NULL, VM_RW);
@@ -58,6 +60,14 @@ worker_t* worker_new(char* name, void* entry) {
 	return worker;
 }
 
+// Wait until woken up or the timeout set by worker_prepare_sleep has passed
+void worker_sleep(worker_t* worker) {
+	while(worker_is_sleeping(worker)) {
+		scheduler_yield();
+	}
+	worker->sleeping = false;
+}
+
 int worker_stop(worker_t* worker) {
 	worker->stopped = true;
 	return 0;
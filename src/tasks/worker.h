@@ -21,6 +21,7 @@
 #include <stdint.h>
 #include <fs/vfs.h>
 #include <int/int.h>
+#include <bsp/timer.h>
 
 typedef struct worker {
 	char name[VFS_NAME_MAX];
@@ -28,8 +29,34 @@ typedef struct worker {
 	isf_t* state;
 	void* entry;
 	void* stack;
+
+	/* Set by worker_prepare_sleep. The scheduler won't run the worker until
+	 * worker_wake is called or, if sleep_until is non-zero, that timer tick
+	 * is reached.
+	 */
+	volatile bool sleeping;
+	uint32_t sleep_until;
 } worker_t;
 
+static inline bool worker_is_sleeping(worker_t* worker) {
+	return worker->sleeping && (!worker->sleep_until ||
+		timer_get_tick() < worker->sleep_until);
+}
+
+/* Sleeping is split into two steps so that the condition to sleep on can be
+ * checked and the worker marked as sleeping while holding a lock. A
+ * worker_wake after that is not lost, worker_sleep just returns immediately.
+ */
+static inline void worker_prepare_sleep(worker_t* worker, uint32_t until) {
+	worker->sleep_until = until;
+	worker->sleeping = true;
+}
+
+static inline void worker_wake(worker_t* worker) {
+	worker->sleeping = false;
+}
+
 worker_t* worker_new(char* name, void* entry);
+void worker_sleep(worker_t* worker);
 int worker_stop(worker_t* worker);
 int worker_exit(worker_t* worker);
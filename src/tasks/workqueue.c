@@ -0,0 +1,232 @@
+/* workqueue.c: Deferred work run by a pool of kernel workers
+ * Copyright © 2023 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <tasks/workqueue.h>
+#include <tasks/worker.h>
+#include <tasks/scheduler.h>
+#include <bsp/timer.h>
+#include <int/int.h>
+#include <spinlock.h>
+#include <panic.h>
+#include <string.h>
+
+/* Work that is ready to run in FIFO order, and delayed work sorted by expiry
+ * tick. Interrupt handlers use this to hand off work that is too slow to do
+ * with interrupts disabled, so the lock is always taken with interrupts
+ * disabled.
+ *
+ * Idle kworkers sleep until work gets queued or the first delayed work
+ * expires. Work is never run by two kworkers at the same time. If it gets
+ * queued again while running, it stays on the queue until the first run is
+ * done.
+ */
+static struct work* queue_head;
+static struct work* queue_tail;
+static struct work* delayed;
+static worker_t* workers[WORKQUEUE_WORKERS];
+static spinlock_t lock;
+
+static void wake_one(void) {
+	for(int i = 0; i < WORKQUEUE_WORKERS; i++) {
+		if(workers[i] && workers[i]->sleeping) {
+			worker_wake(workers[i]);
+			scheduler_kick();
+			return;
+		}
+	}
+}
+
+static void append(struct work* work) {
+	work->next = NULL;
+	if(queue_tail) {
+		queue_tail->next = work;
+	} else {
+		queue_head = work;
+	}
+	queue_tail = work;
+}
+
+static void unlink_delayed(struct work* work) {
+	for(struct work** prev = &delayed; *prev; prev = &(*prev)->next) {
+		if(*prev == work) {
+			*prev = work->next;
+			break;
+		}
+	}
+	work->delayed = false;
+}
+
+static void unlink_queued(struct work* work) {
+	struct work* prev = NULL;
+	for(struct work* cur = queue_head; cur; prev = cur, cur = cur->next) {
+		if(cur != work) {
+			continue;
+		}
+
+		if(prev) {
+			prev->next = work->next;
+		} else {
+			queue_head = work->next;
+		}
+
+		if(queue_tail == work) {
+			queue_tail = prev;
+		}
+		break;
+	}
+}
+
+/* Queue work to be run by a kworker as soon as possible. Delayed work that
+ * hasn't expired yet is moved to the end of the queue. Returns false if the
+ * work was already queued.
+ */
+bool queue_work(struct work* work) {
+	bool ints = int_save();
+	spinlock_raw_get(&lock);
+
+	bool queued = !work->pending || work->delayed;
+	if(work->delayed) {
+		unlink_delayed(work);
+	}
+
+	if(queued) {
+		work->pending = true;
+		append(work);
+		wake_one();
+	}
+
+	spinlock_release(&lock);
+	int_restore(ints);
+	return queued;
+}
+
+// Queue work to be run after at least `ms` milliseconds
+bool queue_delayed_work(struct work* work, uint32_t ms) {
+	if(!ms) {
+		return queue_work(work);
+	}
+
+	uint32_t ticks = MAX(1, (uint64_t)ms * timer_get_rate() / 1000);
+	bool ints = int_save();
+	spinlock_raw_get(&lock);
+
+	if(work->pending) {
+		spinlock_release(&lock);
+		int_restore(ints);
+		return false;
+	}
+
+	work->pending = true;
+	work->delayed = true;
+	work->expires = timer_get_tick() + ticks;
+
+	struct work** prev = &delayed;
+	while(*prev && (*prev)->expires <= work->expires) {
+		prev = &(*prev)->next;
+	}
+	work->next = *prev;
+	*prev = work;
+
+	// Sleeping kworkers might be waiting for a later expiry
+	wake_one();
+
+	spinlock_release(&lock);
+	int_restore(ints);
+	return true;
+}
+
+/* Remove work from the queue if it hasn't started running yet. Returns whether
+ * it was queued. If the work is running right now, it is not waited for.
+ */
+bool cancel_work(struct work* work) {
+	bool ints = int_save();
+	spinlock_raw_get(&lock);
+
+	bool queued = work->pending;
+	if(work->delayed) {
+		unlink_delayed(work);
+	} else if(work->pending) {
+		unlink_queued(work);
+	}
+	work->pending = false;
+
+	spinlock_release(&lock);
+	int_restore(ints);
+	return queued;
+}
+
+// Takes the first work that isn't running on another kworker. Needs the lock
+static struct work* take_work(void) {
+	uint32_t now = timer_get_tick();
+	while(delayed && delayed->expires <= now) {
+		struct work* work = delayed;
+		delayed = work->next;
+		work->delayed = false;
+		append(work);
+	}
+
+	for(struct work* work = queue_head; work; work = work->next) {
+		if(work->running) {
+			continue;
+		}
+
+		unlink_queued(work);
+		work->pending = false;
+		work->running = true;
+		return work;
+	}
+	return NULL;
+}
+
+static void __attribute__((fastcall, noreturn)) kworker_entry(worker_t* worker) {
+	while(true) {
+		bool ints = int_save();
+		spinlock_raw_get(&lock);
+
+		struct work* work = take_work();
+		if(!work) {
+			worker_prepare_sleep(worker, delayed ? delayed->expires : 0);
+		}
+
+		spinlock_release(&lock);
+		int_restore(ints);
+
+		if(!work) {
+			worker_sleep(worker);
+			continue;
+		}
+
+		// The work needs to stay allocated until its function has returned
+		work->func(work);
+		work->running = false;
+	}
+}
+
+void workqueue_init(void) {
+	for(int i = 0; i < WORKQUEUE_WORKERS; i++) {
+		char name[VFS_NAME_MAX];
+		snprintf(name, VFS_NAME_MAX, "kworker%d", i);
+
+		workers[i] = worker_new(name, kworker_entry);
+		if(!workers[i]) {
+			panic("workqueue: Could not start %s\n", name);
+		}
+		scheduler_add_worker(workers[i]);
+	}
+}
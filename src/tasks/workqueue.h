@@ -0,0 +1,55 @@
+#pragma once
+
+/* Copyright © 2023 Lukas Martini
+ *
+ * This file is part of Xelix.
+ *
+ * Xelix is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Xelix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Xelix. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Number of kworkers in the pool
+#define WORKQUEUE_WORKERS 2
+
+struct work;
+typedef void (*work_func_t)(struct work* work);
+
+/* A deferred function call. Usually embedded in a driver's state, and set up
+ * once using WORK_INIT or work_init. The same work can be queued again once
+ * it has started running.
+ */
+struct work {
+	work_func_t func;
+	void* data;
+
+	// Internal state, see tasks/workqueue.c
+	struct work* next;
+	uint32_t expires;
+	volatile bool pending;
+	volatile bool delayed;
+	volatile bool running;
+};
+
+#define WORK_INIT(f, d) { .func = (f), .data = (d) }
+
+static inline void work_init(struct work* work, work_func_t func, void* data) {
+	*work = (struct work)WORK_INIT(func, data);
+}
+
+bool queue_work(struct work* work);
+bool queue_delayed_work(struct work* work, uint32_t ms);
+bool cancel_work(struct work* work);
+void workqueue_init(void);
@@ -229,7 +229,7 @@ int term_vfs_ioctl(struct vfs_callback_ctx* ctx, int request, void* _arg) {
 	}
 
 	vm_alloc_t alloc;
-	void* arg = vm_map(VM_KERNEL, &alloc, &ctx->task->vmem, _arg,
+	void* arg = vm_map(VM_KERNEL, &alloc, ctx->task->vmem, _arg,
 		arg_size, VM_MAP_USER_ONLY | VM_RW);
 
 	if(!arg) {